@@ -0,0 +1,136 @@
+#include "flight_recorder.h"
+#include "tokeniser_states.h"
+
+#include <stdlib.h>
+
+static char const * const event_names[] =
+{
+    [event_init] = "init",
+    [event_nul] = "nul",
+    [event_space] = "space",
+    [event_single_quote] = "single_quote",
+    [event_double_quote] = "double_quote",
+    [event_regular_char] = "regular_char",
+    [event_delimiter] = "delimiter"
+};
+#define EVENT_NAME_COUNT (sizeof event_names / sizeof event_names[0])
+
+static char const * event_name_get(unsigned int const event_code)
+{
+    char const * name;
+
+    if (event_code >= EVENT_NAME_COUNT || event_names[event_code] == NULL)
+    {
+        name = "unknown";
+    }
+    else
+    {
+        name = event_names[event_code];
+    }
+
+    return name;
+}
+
+flight_recorder_st * flight_recorder_alloc(size_t const entry_count, FILE * const auto_dump_stream)
+{
+    flight_recorder_st * flight_recorder = malloc(sizeof *flight_recorder);
+    size_t size = 1;
+
+    if (flight_recorder == NULL)
+    {
+        goto done;
+    }
+
+    while (size < entry_count)
+    {
+        size <<= 1;
+    }
+
+    flight_recorder->entries = calloc(size, sizeof *flight_recorder->entries);
+    if (flight_recorder->entries == NULL)
+    {
+        free(flight_recorder);
+        flight_recorder = NULL;
+        goto done;
+    }
+    flight_recorder->mask = size - 1;
+    flight_recorder->count = 0;
+    flight_recorder->auto_dump_stream = auto_dump_stream;
+
+done:
+    return flight_recorder;
+}
+
+void flight_recorder_free(flight_recorder_st * const flight_recorder)
+{
+    if (flight_recorder != NULL)
+    {
+        free(flight_recorder->entries);
+        free(flight_recorder);
+    }
+}
+
+void flight_recorder_dump(flight_recorder_st const * const flight_recorder, FILE * const stream)
+{
+    uint64_t const size = flight_recorder->mask + 1;
+    uint64_t const first = (flight_recorder->count > size) ? flight_recorder->count - size : 0;
+    uint64_t index;
+
+    fprintf(stream, "flight recorder: %llu events, %llu dropped\n",
+            (unsigned long long)(flight_recorder->count - first),
+            (unsigned long long)first);
+
+    for (index = first; index < flight_recorder->count; index++)
+    {
+        flight_recorder_entry_st const * const entry = &flight_recorder->entries[index & flight_recorder->mask];
+        unsigned char const current_char = entry->current_char;
+
+        fprintf(stream, "%10lu %-45s %-13s ",
+                (unsigned long)entry->offset,
+                tokeniser_state_name_get(entry->state_id),
+                event_name_get(entry->event_code));
+        if (current_char >= ' ' && current_char < 0x7f)
+        {
+            fprintf(stream, "'%c'\n", current_char);
+        }
+        else
+        {
+            fprintf(stream, "0x%02x\n", current_char);
+        }
+    }
+}
+
+bool tokeniser_flight_recorder_enable(tokeniser_st * const tokeniser,
+                                      size_t const entry_count,
+                                      FILE * const auto_dump_stream)
+{
+    bool enabled;
+    flight_recorder_st * const flight_recorder = flight_recorder_alloc(entry_count, auto_dump_stream);
+
+    if (flight_recorder == NULL)
+    {
+        enabled = false;
+        goto done;
+    }
+
+    flight_recorder_free(tokeniser->flight_recorder);
+    tokeniser->flight_recorder = flight_recorder;
+    enabled = true;
+
+done:
+    return enabled;
+}
+
+void tokeniser_flight_recorder_disable(tokeniser_st * const tokeniser)
+{
+    flight_recorder_free(tokeniser->flight_recorder);
+    tokeniser->flight_recorder = NULL;
+}
+
+void tokeniser_flight_recorder_dump(tokeniser_st const * const tokeniser, FILE * const stream)
+{
+    if (tokeniser->flight_recorder != NULL)
+    {
+        flight_recorder_dump(tokeniser->flight_recorder, stream);
+    }
+}
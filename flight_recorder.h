@@ -0,0 +1,47 @@
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* A ring buffer of the most recent events dispatched to a
+ * tokeniser FSM. Entries are small and fixed size so recording
+ * costs no more than a few stores.
+ */
+typedef struct flight_recorder_entry_st
+{
+    uint32_t offset; /* The offset of the character in the line (truncated to 32 bits). */
+    uint8_t state_id; /* The state the event was dispatched to. */
+    uint8_t event_code;
+    char current_char;
+    uint8_t unused;
+} flight_recorder_entry_st;
+
+typedef struct flight_recorder_st
+{
+    flight_recorder_entry_st * entries;
+    uint64_t mask; /* The number of entries less 1. The entry count is a power of 2. */
+    uint64_t count; /* The number of entries ever recorded. */
+    FILE * auto_dump_stream; /* If set, dump here when a line doesn't complete cleanly. */
+} flight_recorder_st;
+
+flight_recorder_st * flight_recorder_alloc(size_t const entry_count, FILE * const auto_dump_stream);
+void flight_recorder_free(flight_recorder_st * const flight_recorder);
+void flight_recorder_dump(flight_recorder_st const * const flight_recorder, FILE * const stream);
+
+static inline void flight_recorder_record(flight_recorder_st * const flight_recorder,
+                                          unsigned int const state_id,
+                                          unsigned int const event_code,
+                                          size_t const offset,
+                                          int const current_char)
+{
+    flight_recorder_entry_st * const entry = &flight_recorder->entries[flight_recorder->count & flight_recorder->mask];
+
+    entry->offset = (uint32_t)offset;
+    entry->state_id = (uint8_t)state_id;
+    entry->event_code = (uint8_t)event_code;
+    entry->current_char = (char)current_char;
+    flight_recorder->count++;
+}
+
+#endif /* __FLIGHT_RECORDER_H__ */
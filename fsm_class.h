@@ -40,6 +40,7 @@ typedef struct
     fsm_exit_handler exit_handler;
     fsm_transition_handler transition_handler;
     char const * name;
+    unsigned int id; /* Optional. Identifies the state cheaply, e.g. when tracing. */
 } fsm_state_config;
 
 typedef struct
@@ -74,6 +75,16 @@ void fsm_state_transition(fsm_class * const fsm, fsm_state_config const * const
         .name = #STATE \
     }
 
+/* As DEFINE_STATE, also giving the state an id. */
+#define DEFINE_STATE_WITH_ID(STATE, ID, ENTRY, EXIT, TRANSITION) \
+    fsm_state_config STATE  = { \
+        .entry_handler = ENTRY, \
+        .exit_handler = EXIT, \
+        .transition_handler = TRANSITION, \
+        .name = #STATE, \
+        .id = ID \
+    }
+
 
 /* "inlined" methods of FSM class */
 #define Fsm_constructor(fsm, handlers) do \
@@ -0,0 +1,32 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define HASH_FNV_PRIME UINT64_C(0x100000001b3)
+
+/* FNV-1a. Cheap to compute a character at a time, which suits
+ * hashing tokens as they are built.
+ */
+static inline uint64_t hash_add_char(uint64_t const hash, char const ch)
+{
+    return (hash ^ (unsigned char)ch) * HASH_FNV_PRIME;
+}
+
+static inline uint64_t hash_bytes(void const * const data, size_t const length)
+{
+    unsigned char const * const bytes = data;
+    uint64_t hash = HASH_FNV_OFFSET_BASIS;
+    size_t index;
+
+    for (index = 0; index < length; index++)
+    {
+        hash = hash_add_char(hash, bytes[index]);
+    }
+
+    return hash;
+}
+
+#endif /* __HASH_H__ */
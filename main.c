@@ -1,9 +1,28 @@
+#include "token_index.h"
 #include "tokeniser.h"
+#include "tokeniser_batch.h"
+#include "tokeniser_cache.h"
+#include "tokeniser_decompress.h"
+#include "tokeniser_parallel.h"
+#include "tokeniser_pipeline.h"
+#include "tokeniser_pool.h"
+#include "tokeniser_run.h"
+#include "tokeniser_structural.h"
+#include "token_counts.h"
 #include "tokens.h"
 
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #define UNUSED(arg) (void)(arg)
 
@@ -94,7 +113,11 @@ static void do_tokenise_test(char const * const string)
         case tokeniser_result_error:
             printf("got error\n");
             break;
+        case tokeniser_result_limit_exceeded:
+            printf("got limit exceeded\n");
+            break;
         case tokeniser_result_continue: /* Shouldn't happen. */
+        case tokeniser_result_need_more_input: /* Shouldn't happen without continuation mode. */
             break;
         case tokeniser_result_already_done: /* Shouldn't happen unless we've done something dumb. */
             break;
@@ -104,13 +127,2596 @@ static void do_tokenise_test(char const * const string)
     tokeniser_free(tokeniser);
 }
 
-int main(int const argc, char * const * const argv)
+typedef struct file_context_st
 {
-    UNUSED(argc);
-    UNUSED(argv);
+    size_t line_number;
+    tokens_st * tokens;
+} file_context_st;
 
-    do_tokenise_test("test | > < abc' | \"|\" def 'ghi \"|\" 123\" 456 \"789 \"double quoted\" \'single quoted\' \"double quoted embedded single quote \'\" \'single quoted embedded double quote \"\'");
-    do_tokenise_test("test \"double quotedincomplete");
+static bool file_new_token(char const * const token,
+                           size_t const start_index,
+                           size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+{
+    file_context_st * const file_context = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    return tokens_add_token(file_context->tokens, token);
+}
+
+static bool file_line_done(tokeniser_result_t const result,
+                           size_t const line_start,
+                           size_t const line_end,
+                           void * const user_arg)
+{
+    file_context_st * const file_context = user_arg;
+    size_t const count = tokens_count(file_context->tokens);
+    size_t index;
+
+    UNUSED(line_start);
+    UNUSED(line_end);
+
+    file_context->line_number++;
+    printf("line %zu:%s", file_context->line_number, (result == tokeniser_result_incomplete_token) ? " (incomplete)" : "");
+    for (index = 0; index < count; index++)
+    {
+        printf(" [%s]", tokens_get_token(file_context->tokens, index));
+    }
+    printf("\n");
+
+    tokens_clear(file_context->tokens);
+
+    return true;
+}
+
+static int do_tokenise_file(char const * const filename)
+{
+    int result;
+    FILE * const fp = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    tokeniser_st * tokeniser = NULL;
+    tokeniser_decompress_st * decompress = NULL;
+    tokeniser_source_st file_source;
+    tokeniser_source_st source;
+    file_context_st file_context;
+
+    file_context.line_number = 0;
+    file_context.tokens = NULL;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "unable to open %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    /* Compressed files are decompressed as they are read. */
+    tokeniser_source_file_init(&file_source, fp);
+    decompress = tokeniser_decompress_alloc(&file_source);
+    tokeniser = tokeniser_alloc();
+    file_context.tokens = tokens_alloc();
+    if (decompress == NULL || tokeniser == NULL || file_context.tokens == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    tokeniser_source_decompress_init(&source, decompress);
+    if (tokeniser_run(tokeniser, &source, file_new_token, file_line_done, &file_context) != tokeniser_result_ok)
+    {
+        fprintf(stderr, "failed to tokenise %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    result = EXIT_SUCCESS;
+
+done:
+    tokens_free(file_context.tokens);
+    tokeniser_free(tokeniser);
+    tokeniser_decompress_free(decompress);
+    if (fp != NULL && fp != stdin)
+    {
+        fclose(fp);
+    }
+
+    return result;
+}
+
+typedef struct join_context_st
+{
+    size_t line_number;
+    size_t mismatches;
+    tokens_st * tokens;
+    tokeniser_st * tokeniser; /* Reads each joined line back. */
+    tokens_st * joined_tokens;
+} join_context_st;
+
+static bool tokens_new_token(char const * const token,
+                             size_t const start_index,
+                             size_t const end_index,
+                             char const quote_char,
+                             void * const user_arg)
+{
+    tokens_st * const tokens = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    return tokens_add_token(tokens, token);
+}
+
+static bool join_new_token(char const * const token,
+                           size_t const start_index,
+                           size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+{
+    join_context_st * const join_context = user_arg;
+
+    return tokens_new_token(token, start_index, end_index, quote_char, join_context->tokens);
+}
+
+static bool joined_line_matches(join_context_st * const join_context, char const * const line)
+{
+    /* Check that the joined line is read back as the tokens it was 
+     * made from. 
+     */
+    tokeniser_result_t tokeniser_result;
+    char const * pch = line;
+    bool matches;
+    size_t index;
+
+    tokeniser_init(join_context->tokeniser);
+    tokens_clear(join_context->joined_tokens);
+    do
+    {
+        tokeniser_result = tokeniser_feed(join_context->tokeniser, *pch, tokens_new_token, join_context->joined_tokens);
+    }
+    while (tokeniser_result == tokeniser_result_continue && *pch++ != '\0');
+
+    if (tokeniser_result != tokeniser_result_ok
+        || tokens_count(join_context->joined_tokens) != tokens_count(join_context->tokens))
+    {
+        matches = false;
+        goto done;
+    }
+    for (index = 0; index < tokens_count(join_context->tokens); index++)
+    {
+        if (strcmp(tokens_get_token(join_context->joined_tokens, index), tokens_get_token(join_context->tokens, index)) != 0)
+        {
+            matches = false;
+            goto done;
+        }
+    }
+    matches = true;
+
+done:
+    return matches;
+}
+
+static bool join_line_done(tokeniser_result_t const result,
+                           size_t const line_start,
+                           size_t const line_end,
+                           void * const user_arg)
+{
+    join_context_st * const join_context = user_arg;
+    char * const line = tokens_join_quoted(join_context->tokens);
+
+    UNUSED(result);
+    UNUSED(line_start);
+    UNUSED(line_end);
+
+    join_context->line_number++;
+    if (line == NULL || !joined_line_matches(join_context, line))
+    {
+        fprintf(stderr, "line %zu doesn't join into a line with the same tokens\n", join_context->line_number);
+        join_context->mismatches++;
+    }
+    else
+    {
+        printf("%s\n", line);
+    }
+    free(line);
+    tokens_clear(join_context->tokens);
+
+    return true;
+}
+
+static int do_join_file(char const * const filename)
+{
+    int result;
+    FILE * const fp = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "r");
+    tokeniser_st * tokeniser = NULL;
+    tokeniser_source_st source;
+    join_context_st join_context;
+
+    join_context.line_number = 0;
+    join_context.mismatches = 0;
+    join_context.tokens = tokens_alloc();
+    join_context.tokeniser = tokeniser_alloc();
+    join_context.joined_tokens = tokens_alloc();
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "unable to open %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    tokeniser = tokeniser_alloc();
+    if (tokeniser == NULL || join_context.tokens == NULL || join_context.tokeniser == NULL || join_context.joined_tokens == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    tokeniser_source_file_init(&source, fp);
+    if (tokeniser_run(tokeniser, &source, join_new_token, join_line_done, &join_context) != tokeniser_result_ok)
+    {
+        fprintf(stderr, "failed to tokenise %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    result = (join_context.mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+done:
+    tokens_free(join_context.joined_tokens);
+    tokeniser_free(join_context.tokeniser);
+    tokens_free(join_context.tokens);
+    tokeniser_free(tokeniser);
+    if (fp != NULL && fp != stdin)
+    {
+        fclose(fp);
+    }
+
+    return result;
+}
+
+#define BENCHMARK_PASSES 5
+#define BENCHMARK_BATCH_LINES 4
+#define BENCHMARK_BATCH_TOKENS 256 /* Per line. */
+
+typedef struct benchmark_context_st
+{
+    tokeniser_st * tokeniser;
+    tokeniser_structural_st * structural;
+    tokeniser_batch_st * batch;
+    tokeniser_batch_line_st batch_lines[BENCHMARK_BATCH_LINES];
+    tokeniser_scan_token_st batch_tokens[BENCHMARK_BATCH_LINES][BENCHMARK_BATCH_TOKENS];
+    size_t batch_line_count;
+    char * text; /* Room for the text of any token in the file. */
+    size_t token_count;
+} benchmark_context_st;
+
+typedef void (* benchmark_line_fn)(benchmark_context_st * const context, char const * const line, size_t const length);
+typedef void (* benchmark_flush_fn)(benchmark_context_st * const context);
+
+typedef struct benchmark_engine_st
+{
+    char const * name;
+    benchmark_line_fn tokenise_line;
+    benchmark_flush_fn flush; /* NULL unless the engine holds on to lines. */
+} benchmark_engine_st;
+
+static bool benchmark_new_token(char const * const token,
+                                size_t const start_index,
+                                size_t const end_index,
+                                char const quote_char,
+                                void * const user_arg)
+{
+    benchmark_context_st * const context = user_arg;
+
+    UNUSED(token);
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    context->token_count++;
+
+    return true;
+}
+
+static void benchmark_fsm_line(benchmark_context_st * const context, char const * const line, size_t const length)
+{
+    tokeniser_result_t result = tokeniser_result_continue;
+    size_t index;
+
+    tokeniser_init(context->tokeniser);
+    for (index = 0; index < length && result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(context->tokeniser, line[index], benchmark_new_token, context);
+    }
+    if (result == tokeniser_result_continue)
+    {
+        tokeniser_feed(context->tokeniser, '\0', benchmark_new_token, context);
+    }
+}
+
+static void benchmark_structural_line(benchmark_context_st * const context, char const * const line, size_t const length)
+{
+    size_t count;
+    size_t index;
+
+    tokeniser_structural_index(context->structural, line, length);
+    count = tokeniser_structural_token_count(context->structural);
+    for (index = 0; index < count; index++)
+    {
+        /* Materialise every token, as the FSM does. */
+        if (tokeniser_structural_token_get(context->structural, index) != NULL)
+        {
+            context->token_count++;
+        }
+    }
+}
+
+static void benchmark_batch_flush(benchmark_context_st * const context)
+{
+    size_t line;
+
+    tokeniser_batch_run(context->batch, context->batch_lines, context->batch_line_count);
+    for (line = 0; line < context->batch_line_count; line++)
+    {
+        tokeniser_batch_line_st const * const batch_line = &context->batch_lines[line];
+        size_t const count = (batch_line->token_count < batch_line->token_capacity) ? batch_line->token_count : batch_line->token_capacity;
+        size_t index;
+
+        for (index = 0; index < count; index++)
+        {
+            /* Materialise every token, as the FSM does. */
+            tokeniser_scan_copy(batch_line->text, &batch_line->tokens[index], context->text);
+            context->token_count++;
+        }
+    }
+    context->batch_line_count = 0;
+}
+
+static void benchmark_batch_line(benchmark_context_st * const context, char const * const line, size_t const length)
+{
+    tokeniser_batch_line_st * const batch_line = &context->batch_lines[context->batch_line_count];
+
+    batch_line->text = line;
+    batch_line->length = length;
+    batch_line->tokens = context->batch_tokens[context->batch_line_count];
+    batch_line->token_capacity = BENCHMARK_BATCH_TOKENS;
+    context->batch_line_count++;
+    if (context->batch_line_count == BENCHMARK_BATCH_LINES)
+    {
+        benchmark_batch_flush(context);
+    }
+}
+
+static benchmark_engine_st const benchmark_engines[] =
+{
+    { "fsm", benchmark_fsm_line, NULL },
+    { "structural", benchmark_structural_line, NULL },
+    { "batch", benchmark_batch_line, benchmark_batch_flush }
+};
+
+static char * file_contents_get(char const * const filename, size_t * const length)
+{
+    FILE * const fp = fopen(filename, "rb");
+    char * contents = NULL;
+    long size;
+
+    if (fp == NULL)
+    {
+        goto done;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        goto done;
+    }
+    contents = malloc((size_t)size + 1);
+    if (contents == NULL)
+    {
+        goto done;
+    }
+    if (fread(contents, 1, (size_t)size, fp) != (size_t)size)
+    {
+        free(contents);
+        contents = NULL;
+        goto done;
+    }
+    *length = (size_t)size;
+
+done:
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    return contents;
+}
+
+static double seconds_get(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int do_benchmark_file(char const * const filename)
+{
+    int result;
+    size_t length = 0;
+    char * const contents = file_contents_get(filename, &length);
+    benchmark_context_st * const context = calloc(1, sizeof *context);
+    size_t engine;
+
+    if (contents == NULL)
+    {
+        fprintf(stderr, "unable to read %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    if (context == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    context->tokeniser = tokeniser_alloc();
+    context->structural = tokeniser_structural_alloc();
+    context->batch = tokeniser_batch_alloc();
+    context->text = malloc(length + 1);
+    if (context->tokeniser == NULL || context->structural == NULL || context->batch == NULL || context->text == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    printf("%s: %zu bytes\n", filename, length);
+    for (engine = 0; engine < sizeof benchmark_engines / sizeof benchmark_engines[0]; engine++)
+    {
+        double best_seconds = 0;
+        unsigned int pass;
+
+        for (pass = 0; pass < BENCHMARK_PASSES; pass++)
+        {
+            double const start_seconds = seconds_get();
+            char const * line = contents;
+            char const * const end = contents + length;
+            double seconds;
+
+            context->token_count = 0;
+            while (line < end)
+            {
+                char const * const line_end = memchr(line, '\n', (size_t)(end - line));
+                size_t const line_length = (line_end != NULL) ? (size_t)(line_end - line) : (size_t)(end - line);
+
+                benchmark_engines[engine].tokenise_line(context, line, line_length);
+                line += line_length + 1;
+            }
+            if (benchmark_engines[engine].flush != NULL)
+            {
+                benchmark_engines[engine].flush(context);
+            }
+            seconds = seconds_get() - start_seconds;
+            if (pass == 0 || seconds < best_seconds)
+            {
+                best_seconds = seconds;
+            }
+        }
+
+        printf("  %-12s %10zu tokens %8.3f GB/s\n",
+               benchmark_engines[engine].name,
+               context->token_count,
+               (best_seconds > 0) ? (double)length / best_seconds / 1e9 : 0.0);
+    }
+
+    result = EXIT_SUCCESS;
+
+done:
+    if (context != NULL)
+    {
+        free(context->text);
+        tokeniser_batch_free(context->batch);
+        tokeniser_structural_free(context->structural);
+        tokeniser_free(context->tokeniser);
+        free(context);
+    }
+    free(contents);
+
+    return result;
+}
+
+static bool stream_new_token(char const * const token,
+                             size_t const start_index,
+                             size_t const end_index,
+                             char const quote_char,
+                             void * const user_arg)
+{
+    size_t * const token_count = user_arg;
+
+    UNUSED(token);
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    (*token_count)++;
+
+    return true;
+}
+
+static int do_benchmark_stream(char const * const filename)
+{
+    /* Time tokenising a file as it is read (and decompressed), 
+     * rather than from memory, so that compressed and uncompressed 
+     * copies of a corpus can be compared. 
+     */
+    static char const * const format_names[] = { "unknown", "uncompressed", "gzip", "zstd" };
+    int result;
+    FILE * const fp = fopen(filename, "rb");
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    tokeniser_decompress_st * decompress = NULL;
+    tokeniser_source_st file_source;
+    tokeniser_source_st source;
+    size_t token_count = 0;
+    double start_seconds;
+    double seconds;
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "unable to open %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    tokeniser_source_file_init(&file_source, fp);
+    decompress = tokeniser_decompress_alloc(&file_source);
+    if (tokeniser == NULL || decompress == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    tokeniser_source_decompress_init(&source, decompress);
+    start_seconds = seconds_get();
+    if (tokeniser_run(tokeniser, &source, stream_new_token, NULL, &token_count) != tokeniser_result_ok)
+    {
+        fprintf(stderr, "failed to tokenise %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    seconds = seconds_get() - start_seconds;
+
+    printf("%s: %s, %zu bytes read, %zu bytes tokenised, %zu tokens\n",
+           filename,
+           format_names[tokeniser_decompress_format_get(decompress)],
+           tokeniser_decompress_bytes_in_get(decompress),
+           tokeniser_decompress_bytes_out_get(decompress),
+           token_count);
+    printf("  %8.3f GB/s tokenised %8.3f GB/s read\n",
+           (seconds > 0) ? (double)tokeniser_decompress_bytes_out_get(decompress) / seconds / 1e9 : 0.0,
+           (seconds > 0) ? (double)tokeniser_decompress_bytes_in_get(decompress) / seconds / 1e9 : 0.0);
+
+    result = EXIT_SUCCESS;
+
+done:
+    tokeniser_decompress_free(decompress);
+    tokeniser_free(tokeniser);
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    return result;
+}
+
+#define COUNT_MAX_THREADS 64
+#define COUNT_MIN_CHUNK_SIZE (1024 * 1024) /* Smaller files aren't worth splitting between threads. */
+#define COUNT_ALL_POSITIONS ((size_t)-1)
+
+typedef struct count_options_st
+{
+    size_t top_count;
+    size_t position; /* Only count the token at this index in each line, unless COUNT_ALL_POSITIONS. */
+    size_t sketch_width; /* 0 for exact counts. */
+} count_options_st;
+
+typedef struct count_worker_st
+{
+    char const * text; /* The worker's share of the file, a whole number of lines. */
+    size_t length;
+    tokeniser_st * tokeniser;
+    tokens_st * tokens; /* The tokens of the current line. */
+    token_counts_st * counts;
+    bool failed;
+    pthread_t thread;
+    bool thread_started;
+} count_worker_st;
+
+static char const * file_map(char const * const filename, size_t * const length)
+{
+    /* Returns: The mapped file, or NULL if it couldn't be mapped. An 
+     * empty file is mapped as "". 
+     */
+    int const fd = open(filename, O_RDONLY);
+    char const * contents = NULL;
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        goto done;
+    }
+    *length = (size_t)st.st_size;
+    if (*length == 0)
+    {
+        contents = "";
+        goto done;
+    }
+    contents = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (contents == MAP_FAILED)
+    {
+        contents = NULL;
+        goto done;
+    }
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return contents;
+}
+
+static void file_unmap(char const * const contents, size_t const length)
+{
+    if (contents != NULL && length != 0)
+    {
+        munmap((void *)contents, length);
+    }
+}
+
+typedef struct index_check_st
+{
+    token_index_st const * index;
+    size_t line;
+    size_t token;
+    size_t line_start; /* The offset in the file of the line being replayed. */
+    bool matches;
+} index_check_st;
+
+static bool index_check_token(char const * const token,
+                              size_t const start_index,
+                              size_t const end_index,
+                              char const quote_char,
+                              void * const user_arg)
+{
+    /* Compare a token from the tokeniser with the next one in the 
+     * index. 
+     */
+    index_check_st * const check = user_arg;
+    size_t length;
+    size_t indexed_start;
+    size_t indexed_end;
+    char const * const text = token_index_get_token(check->index, check->line, check->token, &length);
+
+    if (text == NULL
+        || length != strlen(token)
+        || memcmp(text, token, length) != 0
+        || token_index_get_quote_char(check->index, check->line, check->token) != quote_char
+        || !token_index_get_span(check->index, check->line, check->token, &indexed_start, &indexed_end)
+        || indexed_start != check->line_start + start_index
+        || indexed_end != check->line_start + end_index)
+    {
+        check->matches = false;
+    }
+    check->token++;
+
+    return true;
+}
+
+static int do_index_file(char const * const filename)
+{
+    /* Write an index of the file, open it, and check it replays the 
+     * same lines and tokens as feeding the file to the tokeniser a 
+     * character at a time. 
+     */
+    int result;
+    char index_filename[] = "/tmp/tokeniser_index_XXXXXX";
+    int const index_fd = mkstemp(index_filename);
+    token_index_st * index = NULL;
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    size_t length = 0;
+    char const * const contents = file_map(filename, &length);
+    index_check_st check;
+    size_t offset;
+    size_t token_total = 0;
+
+    if (index_fd >= 0)
+    {
+        close(index_fd);
+    }
+    if (contents == NULL)
+    {
+        fprintf(stderr, "unable to map %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    if (index_fd < 0 || tokeniser == NULL || !token_index_write(filename, index_filename))
+    {
+        fprintf(stderr, "failed to index %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    index = token_index_open(index_filename, filename);
+    if (index == NULL)
+    {
+        fprintf(stderr, "failed to open the index of %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    check.index = index;
+    check.line = 0;
+    check.matches = true;
+    offset = 0;
+    while (offset < length && check.matches)
+    {
+        char const * const line_end = memchr(contents + offset, '\n', length - offset);
+        size_t const line_length = (line_end == NULL) ? length - offset : (size_t)(line_end - (contents + offset));
+        tokeniser_result_t line_result = tokeniser_result_continue;
+        size_t line_index;
+
+        tokeniser_init(tokeniser);
+        check.token = 0;
+        check.line_start = offset;
+        for (line_index = 0; line_index <= line_length && line_result == tokeniser_result_continue; line_index++)
+        {
+            char const next_char = (line_index < line_length) ? contents[offset + line_index] : '\0';
+
+            line_result = tokeniser_feed(tokeniser, next_char, index_check_token, &check);
+        }
+        if (token_index_line_result(index, check.line) != line_result
+            || token_index_tokens_count(index, check.line) != check.token)
+        {
+            check.matches = false;
+        }
+        token_total += check.token;
+        check.line++;
+        offset += line_length + 1;
+    }
+
+    if (!check.matches || check.line != token_index_line_count(index))
+    {
+        fprintf(stderr, "%s: the index doesn't match line %zu\n", filename, check.line);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    printf("%s: %zu lines and %zu tokens replayed from the index match\n", filename, check.line, token_total);
+    result = EXIT_SUCCESS;
+
+done:
+    token_index_close(index);
+    if (index_fd >= 0)
+    {
+        unlink(index_filename);
+    }
+    tokeniser_free(tokeniser);
+    file_unmap(contents, length);
+
+    return result;
+}
+
+static bool count_new_token(char const * const token,
+                            size_t const start_index,
+                            size_t const end_index,
+                            char const quote_char,
+                            void * const user_arg)
+{
+    count_worker_st * const worker = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    if (!tokens_add_token(worker->tokens, token))
+    {
+        worker->failed = true;
+    }
+
+    return !worker->failed;
+}
+
+static bool count_line_done(tokeniser_result_t const result,
+                            size_t const line_start,
+                            size_t const line_end,
+                            void * const user_arg)
+{
+    count_worker_st * const worker = user_arg;
+
+    UNUSED(result);
+    UNUSED(line_start);
+    UNUSED(line_end);
+
+    if (!worker->failed && !token_counts_add_tokens(worker->counts, worker->tokens))
+    {
+        worker->failed = true;
+    }
+    tokens_clear(worker->tokens);
+
+    return !worker->failed;
+}
+
+static void * count_thread(void * const arg)
+{
+    count_worker_st * const worker = arg;
+
+    if (tokeniser_feed_buffer(worker->tokeniser, worker->text, worker->length,
+                              count_new_token, count_line_done, worker) != tokeniser_result_continue
+        || tokeniser_feed_end(worker->tokeniser, count_new_token, count_line_done, worker) != tokeniser_result_ok)
+    {
+        worker->failed = true;
+    }
+
+    return NULL;
+}
+
+static size_t count_thread_count_get(size_t const length)
+{
+    long const processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t thread_count = (processors > 0) ? (size_t)processors : 1;
+
+    if (thread_count > COUNT_MAX_THREADS)
+    {
+        thread_count = COUNT_MAX_THREADS;
+    }
+    if (thread_count > length / COUNT_MIN_CHUNK_SIZE + 1)
+    {
+        thread_count = length / COUNT_MIN_CHUNK_SIZE + 1;
+    }
+
+    return thread_count;
+}
+
+static int do_count_file(char const * const filename, count_options_st const * const options)
+{
+    /* Count the tokens of a memory mapped file in one pass. Each 
+     * thread counts a share of the lines with its own counter, and 
+     * the counters are merged at the end. 
+     */
+    int result;
+    size_t length = 0;
+    char const * const contents = file_map(filename, &length);
+    count_worker_st workers[COUNT_MAX_THREADS];
+    size_t const thread_count = count_thread_count_get(length);
+    size_t started_count;
+    size_t chunk_start = 0;
+    token_count_st * top = NULL;
+    size_t top_length;
+    size_t index;
+
+    memset(workers, 0, sizeof workers);
+    if (contents == NULL)
+    {
+        fprintf(stderr, "unable to map %s\n", filename);
+        result = EXIT_FAILURE;
+        goto done;
+    }
+
+    for (index = 0; index < thread_count; index++)
+    {
+        count_worker_st * const worker = &workers[index];
+        token_dictionary_st * dictionary;
+        size_t chunk_end = (index + 1 == thread_count) ? length : length / thread_count * (index + 1);
+
+        if (chunk_end < chunk_start)
+        {
+            chunk_end = chunk_start;
+        }
+
+        /* Give each thread whole lines. */
+        while (chunk_end < length && chunk_end > chunk_start && contents[chunk_end - 1] != '\n')
+        {
+            chunk_end++;
+        }
+        worker->text = contents + chunk_start;
+        worker->length = chunk_end - chunk_start;
+        chunk_start = chunk_end;
+
+        worker->tokeniser = tokeniser_alloc();
+        worker->counts = token_counts_alloc(options->top_count, options->sketch_width);
+        if (worker->tokeniser == NULL || worker->counts == NULL)
+        {
+            result = EXIT_FAILURE;
+            goto done;
+        }
+        dictionary = token_counts_dictionary_get(worker->counts);
+        worker->tokens = (dictionary != NULL) ? tokens_alloc_interned(dictionary) : tokens_alloc();
+        if (worker->tokens == NULL)
+        {
+            result = EXIT_FAILURE;
+            goto done;
+        }
+        if (options->position != COUNT_ALL_POSITIONS)
+        {
+            tokeniser_projection_set(worker->tokeniser, &options->position, 1, false);
+        }
+    }
+
+    for (started_count = 0; started_count < thread_count; started_count++)
+    {
+        if (pthread_create(&workers[started_count].thread, NULL, count_thread, &workers[started_count]) != 0)
+        {
+            /* Count this share on this thread instead. */
+            count_thread(&workers[started_count]);
+        }
+        else
+        {
+            workers[started_count].thread_started = true;
+        }
+    }
+    /* Every thread has to finish before any worker can be freed. */
+    for (index = 0; index < thread_count; index++)
+    {
+        if (workers[index].thread_started)
+        {
+            pthread_join(workers[index].thread, NULL);
+        }
+    }
+    for (index = 0; index < thread_count; index++)
+    {
+        if (workers[index].failed || (index > 0 && !token_counts_merge(workers[0].counts, workers[index].counts)))
+        {
+            fprintf(stderr, "failed to count %s\n", filename);
+            result = EXIT_FAILURE;
+            goto done;
+        }
+    }
+
+    top = malloc((options->top_count + 1) * sizeof *top);
+    if (top == NULL)
+    {
+        result = EXIT_FAILURE;
+        goto done;
+    }
+    top_length = token_counts_top(workers[0].counts, top);
+    printf("%s:%s\n", filename, (options->sketch_width != 0) ? " (approximate)" : "");
+    for (index = 0; index < top_length; index++)
+    {
+        printf("  %12" PRIu64 " %s\n", top[index].count, top[index].token);
+    }
+
+    result = EXIT_SUCCESS;
+
+done:
+    for (index = 0; index < thread_count; index++)
+    {
+        tokens_free(workers[index].tokens);
+        token_counts_free(workers[index].counts);
+        tokeniser_free(workers[index].tokeniser);
+    }
+    free(top);
+    file_unmap(contents, length);
+
+    return result;
+}
+
+/* The checks below print nothing unless something is wrong. */
+static unsigned int checks_failed;
+
+static void check(bool const passed, char const * const what)
+{
+    if (!passed)
+    {
+        printf("check failed: %s\n", what);
+        checks_failed++;
+    }
+}
+
+#define CHECK_DESCRIPTION_SIZE 1024
+
+typedef struct check_context_st
+{
+    tokeniser_st * tokeniser;
+    char description[CHECK_DESCRIPTION_SIZE]; /* What the tokeniser passed on for the line. */
+    size_t length;
+} check_context_st;
+
+static void check_describe(check_context_st * const context, char const * const format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    if (context->length < sizeof context->description)
+    {
+        int const length = vsnprintf(context->description + context->length, sizeof context->description - context->length, format, args);
+
+        if (length > 0)
+        {
+            context->length += (size_t)length;
+        }
+    }
+    va_end(args);
+}
+
+static void check_line(check_context_st * const context, char const * const line, new_token_cb const callback, char const * const expected)
+{
+    /* Feed the line to the tokeniser, and check that the callback 
+     * describes what it passed on as expected. 
+     */
+    tokeniser_result_t result;
+    char const * pch = line;
+
+    context->length = 0;
+    context->description[0] = '\0';
+    tokeniser_init(context->tokeniser);
+    do
+    {
+        result = tokeniser_feed(context->tokeniser, *pch, callback, context);
+    }
+    while (result == tokeniser_result_continue && *pch++ != '\0');
+
+    if (strcmp(context->description, expected) != 0)
+    {
+        printf("check failed: \"%s\" gave %s, not %s\n", line, context->description, expected);
+        checks_failed++;
+    }
+}
+
+static char const * check_result_name(tokeniser_result_t const result)
+{
+    static char const * const names[] =
+    {
+        [tokeniser_result_continue] = "continue",
+        [tokeniser_result_ok] = "ok",
+        [tokeniser_result_already_done] = "already done",
+        [tokeniser_result_incomplete_token] = "incomplete",
+        [tokeniser_result_error] = "error",
+        [tokeniser_result_limit_exceeded] = "limit",
+        [tokeniser_result_need_more_input] = "more"
+    };
+
+    return ((size_t)result < sizeof names / sizeof names[0]) ? names[result] : "?";
+}
+
+static void check_lines(check_context_st * const context, char const * const text, new_token_cb const callback, char const * const expected)
+{
+    /* Feed each '\n' separated line of text to the tokeniser, ending 
+     * it with a NUL, and check that the callback describes what it 
+     * passed on as expected. The result of each line is added to the 
+     * description, along with the offset of any limit exceeded. A 
+     * line that needs more input carries on with the next one. 
+     */
+    tokeniser_result_t result = tokeniser_result_continue;
+    char const * pch = text;
+
+    context->length = 0;
+    context->description[0] = '\0';
+    tokeniser_init(context->tokeniser);
+    do
+    {
+        char const next_char = (*pch == '\n') ? '\0' : *pch;
+
+        if (result == tokeniser_result_continue)
+        {
+            result = tokeniser_feed(context->tokeniser, next_char, callback, context);
+        }
+        if (next_char != '\0')
+        {
+            continue;
+        }
+        if (result != tokeniser_result_need_more_input || *pch == '\0')
+        {
+            check_describe(context, "=%s", check_result_name(result));
+            if (tokeniser_limit_offset_get(context->tokeniser) != TOKENISER_NO_LIMIT_OFFSET)
+            {
+                check_describe(context, "@%zu", tokeniser_limit_offset_get(context->tokeniser));
+            }
+            check_describe(context, ";");
+            tokeniser_init(context->tokeniser);
+        }
+        result = tokeniser_result_continue;
+    }
+    while (*pch++ != '\0');
+
+    if (strcmp(context->description, expected) != 0)
+    {
+        printf("check failed: \"%s\" gave %s, not %s\n", text, context->description, expected);
+        checks_failed++;
+    }
+}
+
+static bool text_new_token(char const * const token,
+                           size_t const start_index,
+                           size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+{
+    /* Quoted tokens are marked with a q. */
+    check_context_st * const context = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+
+    check_describe(context, "%s[%s]", (quote_char != '\0') ? "q" : "", token);
+
+    return true;
+}
+
+static void do_csv_check(void)
+{
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "CSV tokeniser allocated");
+        goto done;
+    }
+
+    tokeniser_csv_set(context.tokeniser, ',');
+    check_lines(&context, "a, b ,c", text_new_token, "[a][ b ][c]=ok;");
+    check_lines(&context, "\"a\"\"b\",\"\"\"\"", text_new_token, "q[a\"b]q[\"]=ok;");
+    /* Delimiters with nothing between them give empty fields. */
+    check_lines(&context, "a,,b\n,\na,b,\n\"\",", text_new_token, "[a][][b]=ok;[][]=ok;[a][b][]=ok;q[][]=ok;");
+    check_lines(&context, "\na", text_new_token, "=ok;[a]=ok;");
+    /* A '\r' ending a line is dropped, but not one inside a line. */
+    check_lines(&context, "a,b\r\n\"c\"\r\nd\re\r", text_new_token, "[a][b]=ok;q[c]=ok;[d\re]=ok;");
+    check_lines(&context, "\"a\"\r\"b\"", text_new_token, "[a\r\"b\"]=ok;");
+    /* Quoted fields carry on over line ends. */
+    check_lines(&context, "\"a\nb\",c\n\"d\n\ne\"", text_new_token, "q[a\nb][c]=ok;q[d\n\ne]=ok;");
+    check_lines(&context, "\"a", text_new_token, "=more;");
+    tokeniser_csv_set(context.tokeniser, '\t');
+    check_lines(&context, "a\tb c\t\"d\te\"\t,f", text_new_token, "[a][b c]q[d\te][,f]=ok;");
+    tokeniser_csv_set(context.tokeniser, '\0');
+    check_lines(&context, "a,b \"c d\"", text_new_token, "[a,b]q[c d]=ok;");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static void do_limits_check(void)
+{
+    tokeniser_limits_st limits = { 0 };
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "limits tokeniser allocated");
+        goto done;
+    }
+
+    limits.max_token_bytes = 3;
+    limits.policy = tokeniser_limit_policy_fail;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "abc 'd e'\nab abcd x", text_new_token, "[abc]q[d e]=ok;[ab]=limit@6;");
+    limits.policy = tokeniser_limit_policy_truncate;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "ab abcd x", text_new_token, "[ab][abc][x]=ok@6;");
+
+    limits.max_token_bytes = 0;
+    limits.max_tokens_per_line = 2;
+    limits.policy = tokeniser_limit_policy_fail;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "a b \na b c", text_new_token, "[a][b]=ok;[a][b]=limit@4;");
+    limits.policy = tokeniser_limit_policy_truncate;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "a b c d", text_new_token, "[a][b]=ok@4;");
+
+    /* The NUL ending a line doesn't count towards its length. */
+    limits.max_tokens_per_line = 0;
+    limits.max_line_bytes = 5;
+    limits.policy = tokeniser_limit_policy_fail;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "ab cd\nab cde", text_new_token, "[ab][cd]=ok;[ab]=limit@5;");
+    limits.policy = tokeniser_limit_policy_truncate;
+    tokeniser_limits_set(context.tokeniser, &limits);
+    check_lines(&context, "ab cd\nab cdef", text_new_token, "[ab][cd]=ok;[ab][cd]=ok@5;");
+
+    tokeniser_limits_set(context.tokeniser, NULL);
+    check_lines(&context, "abcdef a b c", text_new_token, "[abcdef][a][b][c]=ok;");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static bool span_new_token(char const * const token,
+                           size_t const start_index,
+                           size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+
+    UNUSED(quote_char);
+
+    check_describe(context, "[%s %zu-%zu]", token, start_index, end_index);
+
+    return true;
+}
+
+static void do_continuation_check(void)
+{
+    /* Each line is a separate run of tokeniser_feed() calls ending 
+     * in a NUL, and a line that needs more input carries on with 
+     * the next one. 
+     */
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "continuation tokeniser allocated");
+        goto done;
+    }
+
+    tokeniser_continuation_set(context.tokeniser, true);
+    check_lines(&context, "ab\\\ncd e\na \\\n b", text_new_token, "[abcd][e]=ok;[a][b]=ok;");
+    check_lines(&context, "'a b\nc' d\n\"x\n\ny\"", text_new_token, "q[a b\nc][d]=ok;q[x\n\ny]=ok;");
+    check_lines(&context, "ab\\\ncd 'e\nf'", span_new_token, "[abcd 0-6][e\nf 7-12]=ok;");
+    check_lines(&context, "a 'b\n", text_new_token, "[a]=more;");
+    tokeniser_continuation_set(context.tokeniser, false);
+    check_lines(&context, "'a b\nc\\", text_new_token, "[a b]=incomplete;[c\\]=ok;");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static void do_projection_check(void)
+{
+    static size_t const second[] = { 1 };
+    static size_t const first_and_third[] = { 0, 2 };
+    char const * const line = "a b c d";
+    tokeniser_result_t result = tokeniser_result_continue;
+    check_context_st context;
+    size_t index;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "projection tokeniser allocated");
+        goto done;
+    }
+
+    /* The line ends as soon as the highest wanted token does, so 
+     * the open quote after it isn't seen. 
+     */
+    tokeniser_projection_set(context.tokeniser, second, 1, false);
+    check_lines(&context, "a b 'c\na\n'a b' c", text_new_token, "[b]=ok;=ok;[c]=ok;");
+    context.length = 0;
+    tokeniser_init(context.tokeniser);
+    for (index = 0; result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(context.tokeniser, line[index], text_new_token, &context);
+    }
+    check(result == tokeniser_result_ok && index == 4, "projection stops at the end of the highest wanted token");
+
+    /* Wanting the last token means scanning the whole line. A token 
+     * that is both wanted and last is only passed on once. 
+     */
+    tokeniser_projection_set(context.tokeniser, first_and_third, 2, true);
+    check_lines(&context, "a b c d e\nx y z\np q\np\n\na 'b", text_new_token, "[a][c][e]=ok;[x][z]=ok;[p][q]=ok;[p]=ok;=ok;[a][b]=incomplete;");
+    tokeniser_projection_set(context.tokeniser, NULL, 0, true);
+    check_lines(&context, "a b 'c d'\na", span_new_token, "[c d 4-9]=ok;[a 0-1]=ok;");
+
+    tokeniser_projection_set(context.tokeniser, NULL, 0, false);
+    check_lines(&context, "a b c", text_new_token, "[a][b][c]=ok;");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static void do_flight_recorder_check(void)
+{
+    /* A ring of 4 events, dumped automatically for an incomplete 
+     * line and then on request after a clean one. 
+     */
+    static char const incomplete_dump[] =
+        "flight recorder: 4 events, 3 dropped\n"
+        "         2 tokeniser_state_regular_token                 space         ' '\n"
+        "         3 tokeniser_state_no_token                      single_quote  '''\n"
+        "         4 tokeniser_state_single_quoted_token           regular_char  'c'\n"
+        "         5 tokeniser_state_single_quoted_token           nul           0x00\n";
+    static char const clean_dump[] =
+        "flight recorder: 4 events, 8 dropped\n"
+        "         0 tokeniser_state_no_token                      regular_char  'x'\n"
+        "         1 tokeniser_state_regular_token                 space         ' '\n"
+        "         2 tokeniser_state_no_token                      regular_char  'y'\n"
+        "         3 tokeniser_state_regular_token                 nul           0x00\n";
+    char * dump = NULL;
+    size_t dump_size;
+    FILE * const dump_stream = open_memstream(&dump, &dump_size);
+    char * requested_dump = NULL;
+    FILE * requested_stream;
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (dump_stream == NULL || context.tokeniser == NULL || !tokeniser_flight_recorder_enable(context.tokeniser, 3, dump_stream))
+    {
+        check(false, "flight recorder allocated");
+        goto done;
+    }
+
+    check_line(&context, "ab 'c", text_new_token, "[ab][c]");
+    fflush(dump_stream);
+    check(strcmp(dump, incomplete_dump) == 0, "incomplete line dumped the last 4 events");
+
+    /* Lines that end cleanly aren't dumped. */
+    check_line(&context, "x y", text_new_token, "[x][y]");
+    fflush(dump_stream);
+    check(strcmp(dump, incomplete_dump) == 0, "clean line not dumped");
+
+    requested_stream = open_memstream(&requested_dump, &dump_size);
+    if (requested_stream == NULL)
+    {
+        check(false, "flight recorder dump stream opened");
+        goto done;
+    }
+    tokeniser_flight_recorder_dump(context.tokeniser, requested_stream);
+    fclose(requested_stream);
+    check(strcmp(requested_dump, clean_dump) == 0, "events kept across lines");
+
+done:
+    tokeniser_free(context.tokeniser);
+    if (dump_stream != NULL)
+    {
+        fclose(dump_stream);
+    }
+    free(requested_dump);
+    free(dump);
+}
+
+static bool keyword_new_token(char const * const token,
+                              size_t const start_index,
+                              size_t const end_index,
+                              char const quote_char,
+                              void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    check_describe(context, "[%s:%d]", token, tokeniser_token_keyword_get(context->tokeniser));
+
+    return true;
+}
+
+static void do_keyword_check(void)
+{
+    static char const * const keywords[] = { "get", "set", "quit" };
+    tokeniser_keywords_st * const keyword_set = tokeniser_keywords_alloc(keywords, sizeof keywords / sizeof keywords[0]);
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (keyword_set == NULL || context.tokeniser == NULL)
+    {
+        check(false, "keywords allocated");
+        goto done;
+    }
+
+    tokeniser_keywords_set(context.tokeniser, keyword_set);
+    check_line(&context, "get set quit", keyword_new_token, "[get:0][set:1][quit:2]");
+    check_line(&context, "gets ge Get quit2 x", keyword_new_token, "[gets:-1][ge:-1][Get:-1][quit2:-1][x:-1]");
+    /* Keywords are matched on the text passed on, without quotes. */
+    check_line(&context, "'set' \"quit\" s'e't", keyword_new_token, "[set:1][quit:2][set:1]");
+    tokeniser_keywords_set(context.tokeniser, NULL);
+    check_line(&context, "get", keyword_new_token, "[get:-1]");
+
+done:
+    tokeniser_free(context.tokeniser);
+    tokeniser_keywords_free(keyword_set);
+}
+
+static bool number_new_token(char const * const token,
+                             size_t const start_index,
+                             size_t const end_index,
+                             char const quote_char,
+                             void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+    tokeniser_number_st number;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    if (!tokeniser_token_number_get(context->tokeniser, &number))
+    {
+        check_describe(context, "[%s]", token);
+    }
+    else if (number.kind == tokeniser_number_integer)
+    {
+        check_describe(context, "[%s:%" PRId64 "%s]", token, number.integer, number.overflow ? " overflow" : "");
+    }
+    else
+    {
+        check_describe(context, "[%s:%g%s]", token, number.real, number.overflow ? " overflow" : "");
+    }
+
+    return true;
+}
+
+static void do_number_check(void)
+{
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "tokeniser allocated");
+        goto done;
+    }
+
+    tokeniser_numbers_set(context.tokeniser, true);
+    check_line(&context, "42 -7 +3 0 007", number_new_token, "[42:42][-7:-7][+3:3][0:0][007:7]");
+    check_line(&context, "3.5 -.5 5. 1e3 2.5E-2 +1e+2", number_new_token, "[3.5:3.5][-.5:-0.5][5.:5][1e3:1000][2.5E-2:0.025][+1e+2:100]");
+    check_line(&context, "x - . e5 1e 1.2.3 12a 0x10 '42'", number_new_token, "[x][-][.][e5][1e][1.2.3][12a][0x10][42]");
+    check_line(&context, "9223372036854775807 -9223372036854775808", number_new_token, "[9223372036854775807:9223372036854775807][-9223372036854775808:-9223372036854775808]");
+    /* Out of range values are clamped and flagged. */
+    check_line(&context,
+               "9223372036854775808 -9223372036854775809 99999999999999999999",
+               number_new_token,
+               "[9223372036854775808:9223372036854775807 overflow][-9223372036854775809:-9223372036854775808 overflow][99999999999999999999:9223372036854775807 overflow]");
+    check_line(&context,
+               "1e400 -1e400 1e-400 1e99999999999",
+               number_new_token,
+               "[1e400:inf overflow][-1e400:-inf overflow][1e-400:0][1e99999999999:inf overflow]");
+    tokeniser_numbers_set(context.tokeniser, false);
+    check_line(&context, "42", number_new_token, "[42]");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+#define PIPELINE_CHECK_BUFFER_SIZE 16
+#define PIPELINE_CHECK_READ_SIZE 5
+
+typedef struct pipeline_check_source_st
+{
+    char const * text;
+    size_t length;
+    size_t offset;
+} pipeline_check_source_st;
+
+static ssize_t pipeline_check_fill(void * const source_context, char * const buffer, size_t const buffer_size)
+{
+    /* A few characters at a time, so lines span reads. */
+    pipeline_check_source_st * const source = source_context;
+    size_t length = source->length - source->offset;
+
+    if (length > buffer_size)
+    {
+        length = buffer_size;
+    }
+    if (length > PIPELINE_CHECK_READ_SIZE)
+    {
+        length = PIPELINE_CHECK_READ_SIZE;
+    }
+    memcpy(buffer, source->text + source->offset, length);
+    source->offset += length;
+
+    return (ssize_t)length;
+}
+
+static void pipeline_check_continuation_setup(tokeniser_st * const tokeniser, void * const user_arg)
+{
+    UNUSED(user_arg);
+
+    tokeniser_continuation_set(tokeniser, true);
+}
+
+static bool pipeline_check_consume(tokeniser_pipeline_batch_st const * const batch, void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+    size_t line;
+
+    for (line = 0; line < batch->line_count; line++)
+    {
+        tokeniser_pipeline_line_st const * const pipeline_line = &batch->lines[line];
+        size_t index;
+
+        for (index = pipeline_line->first_token; index < pipeline_line->first_token + pipeline_line->token_count; index++)
+        {
+            tokeniser_pipeline_token_st const * const span = &batch->token_spans[index];
+
+            check_describe(context, "[%s %zu-%zu", tokens_get_token(batch->tokens, index), span->start_index, span->end_index);
+            check_describe(context, span->quote_char != '\0' ? " %c]" : "]", span->quote_char);
+        }
+        check_describe(context, "(%d %zu-%zu)", pipeline_line->result, pipeline_line->line_start, pipeline_line->line_end);
+    }
+
+    return true;
+}
+
+static void pipeline_check(char const * const text,
+                           tokeniser_pipeline_setup_cb const setup_callback,
+                           char const * const expected)
+{
+    /* One tokeniser thread and one consumer thread, so the batches 
+     * are consumed in order. 
+     */
+    tokeniser_pipeline_config_st const config = { PIPELINE_CHECK_BUFFER_SIZE, 0, 0, 1, 1 };
+    tokeniser_pipeline_st * const pipeline = tokeniser_pipeline_alloc(&config);
+    pipeline_check_source_st source_context = { text, strlen(text), 0 };
+    tokeniser_source_st const source = { pipeline_check_fill, &source_context };
+    check_context_st context;
+
+    context.length = 0;
+    context.description[0] = '\0';
+    if (pipeline == NULL
+        || tokeniser_pipeline_run(pipeline, &source, setup_callback, pipeline_check_consume, &context) != tokeniser_result_ok)
+    {
+        check(false, "pipeline run");
+    }
+    else if (strcmp(context.description, expected) != 0)
+    {
+        printf("check failed: the pipeline gave %s, not %s\n", context.description, expected);
+        checks_failed++;
+    }
+
+    tokeniser_pipeline_free(pipeline);
+}
+
+static bool key_value_new_token(char const * const token,
+                                size_t const start_index,
+                                size_t const end_index,
+                                char const quote_char,
+                                void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+    tokeniser_key_value_st key_value;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    if (!tokeniser_token_key_value_get(context->tokeniser, &key_value))
+    {
+        check_describe(context, "[%s]", token);
+    }
+    else
+    {
+        check_describe(context, "[%.*s|%.*s]", (int)key_value.key_length, key_value.key, (int)key_value.value_length, key_value.value);
+    }
+
+    return true;
+}
+
+static void do_key_value_check(void)
+{
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "key value tokeniser allocated");
+        goto done;
+    }
+
+    tokeniser_key_values_set(context.tokeniser, true);
+    check_line(&context, "a=b", key_value_new_token, "[a|b]");
+    /* Only an '=' outside quotes splits a token, and only the first. */
+    check_line(&context, "\"a=b\"", key_value_new_token, "[a=b]");
+    check_line(&context, "a=\"b=c\"", key_value_new_token, "[a|b=c]");
+    check_line(&context, "a=b=c x'='y", key_value_new_token, "[a|b=c][x=y]");
+    /* Either half may be empty. */
+    check_line(&context, "=b", key_value_new_token, "[|b]");
+    check_line(&context, "a=", key_value_new_token, "[a|]");
+    check_line(&context, "=", key_value_new_token, "[|]");
+    tokeniser_key_values_set(context.tokeniser, false);
+    check_line(&context, "a=b", key_value_new_token, "[a=b]");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static bool pool_new_token(char const * const token,
+                           size_t const start_index,
+                           size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+{
+    /* Describe the token along with anything the settings add. */
+    check_context_st * const context = user_arg;
+    tokeniser_key_value_st key_value;
+    tokeniser_number_st number;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    check_describe(context, "[%s", token);
+    if (tokeniser_token_key_value_get(context->tokeniser, &key_value))
+    {
+        check_describe(context, " key");
+    }
+    if (tokeniser_token_number_get(context->tokeniser, &number))
+    {
+        check_describe(context, " number");
+    }
+    check_describe(context, ":%d]", tokeniser_token_keyword_get(context->tokeniser));
+
+    return true;
+}
+
+static void do_pool_check(void)
+{
+    /* A tokeniser released with its settings changed should come 
+     * back from the pool behaving like a fresh one. 
+     */
+    static char const * const keywords[] = { "a" };
+    tokeniser_keywords_st * const keyword_set = tokeniser_keywords_alloc(keywords, sizeof keywords / sizeof keywords[0]);
+    tokeniser_pool_stats_st before;
+    tokeniser_pool_stats_st after;
+    check_context_st context;
+    tokeniser_st * used;
+
+    context.tokeniser = NULL;
+    used = tokeniser_pool_acquire();
+    if (keyword_set == NULL || used == NULL)
+    {
+        check(false, "pool tokeniser acquired");
+        goto done;
+    }
+
+    tokeniser_csv_set(used, ',');
+    tokeniser_key_values_set(used, true);
+    tokeniser_numbers_set(used, true);
+    tokeniser_keywords_set(used, keyword_set);
+    tokeniser_pool_release(used);
+
+    tokeniser_pool_stats_get(&before);
+    context.tokeniser = tokeniser_pool_acquire();
+    tokeniser_pool_stats_get(&after);
+    check(context.tokeniser == used && after.allocations == before.allocations, "released tokeniser reused by the pool");
+    if (context.tokeniser == NULL)
+    {
+        goto done;
+    }
+
+    check_line(&context, "a=b 'c d' x,y 12 a", pool_new_token, "[a=b:-1][c d:-1][x,y:-1][12:-1][a:-1]");
+
+done:
+    tokeniser_pool_release(context.tokeniser);
+    tokeniser_pool_drain();
+    tokeniser_pool_stats_get(&after);
+    check(after.idle == 0, "pool drained");
+    tokeniser_keywords_free(keyword_set);
+}
+
+static void do_pipeline_check(void)
+{
+    /* Lines that don't fit in a buffer are passed on as too long, 
+     * and continued lines aren't split between buffers. 
+     */
+    pipeline_check("ab 'cd'\na_line_longer_than_a_buffer x\ny z\nlast",
+                   NULL,
+                   "[ab 0-2][cd 3-7 '](1 0-7)(5 8-37)[y 38-39][z 40-41](1 38-41)[last 42-46](1 42-46)");
+    pipeline_check("ab \\\ncd\n'e\nf' g\nh\n",
+                   pipeline_check_continuation_setup,
+                   "[ab 0-2][cd 5-7](1 0-7)[e\nf 8-13 '][g 14-15](1 8-15)[h 16-17](1 16-17)");
+    pipeline_check("x \\\na_continued_line_longer_than_a_buffer\n'y\nz'\n",
+                   pipeline_check_continuation_setup,
+                   "(5 0-41)[y\nz 42-47 '](1 42-47)");
+}
+
+static bool variable_new_token(char const * const token,
+                               size_t const start_index,
+                               size_t const end_index,
+                               char const quote_char,
+                               void * const user_arg)
+{
+    check_context_st * const context = user_arg;
+
+    check_describe(context, "[%s %zu-%zu", token, start_index, end_index);
+    check_describe(context, quote_char != '\0' ? " %c]" : "]", quote_char);
+
+    return true;
+}
+
+static char const * variable_check_lookup(char const * const name, void * const lookup_arg)
+{
+    char const * value = NULL;
+
+    UNUSED(lookup_arg);
+
+    if (strcmp(name, "HOME") == 0)
+    {
+        value = "/home/me";
+    }
+    else if (strcmp(name, "EMPTY") == 0)
+    {
+        value = "";
+    }
+
+    return value;
+}
+
+static void do_variable_check(void)
+{
+    static size_t const second_token[] = { 1 };
+    check_context_st context;
+
+    context.tokeniser = tokeniser_alloc();
+    if (context.tokeniser == NULL)
+    {
+        check(false, "tokeniser allocated");
+        goto done;
+    }
+
+    tokeniser_variables_set(context.tokeniser, variable_check_lookup, NULL);
+    check_line(&context,
+               "$HOME ${HOME}/x '$HOME' \"$HOME\" $EMPTY$HOME",
+               variable_new_token,
+               "[/home/me 0-5][/home/me/x 6-15][$HOME 16-23 '][/home/me 24-31 \"][/home/me 32-43]");
+    /* Unquoted tokens that expand to nothing are dropped, but quoted 
+     * ones are kept. 
+     */
+    check_line(&context, "a $UNDEF b ${UNDEF} $EMPTY$UNDEF c $UNDEF", variable_new_token, "[a 0-1][b 9-10][c 33-34]");
+    check_line(&context, "\"$UNDEF\" x$UNDEF $UNDEF'' ''", variable_new_token, "[ 0-8 \"][x 9-16][ 17-25][ 26-28 ']");
+    check_line(&context, "$ ${ $1 ${HOME x$ a$$HOME", variable_new_token, "[$ 0-1][${ 2-4][$1 5-7][${HOME 8-14][x$ 15-17][a$/home/me 18-25]");
+    /* Dropped tokens aren't counted, so the selected token is b. */
+    tokeniser_projection_set(context.tokeniser, second_token, 1, false);
+    check_line(&context, "$UNDEF a $EMPTY b c", variable_new_token, "[b 16-17]");
+    tokeniser_projection_set(context.tokeniser, NULL, 0, false);
+    tokeniser_variables_set(context.tokeniser, NULL, NULL);
+    check_line(&context, "$HOME", variable_new_token, "[$HOME 0-5]");
+
+done:
+    tokeniser_free(context.tokeniser);
+}
+
+static void do_cache_check(void)
+{
+    tokeniser_cache_st * const cache = tokeniser_cache_alloc(64 * 1024, 2);
+    char const line[] = "cached 'line of' tokens";
+    tokeniser_cache_entry_st * entry;
+    tokeniser_cache_entry_st * again;
+    tokeniser_cache_stats_st stats;
+
+    if (cache == NULL)
+    {
+        check(false, "cache allocated");
+        goto done;
+    }
+
+    entry = tokeniser_cache_lookup(cache, line, strlen(line));
+    again = tokeniser_cache_lookup(cache, line, strlen(line));
+    check(entry != NULL && entry == again, "cache hit returns the same entry");
+    if (entry != NULL)
+    {
+        tokens_st const * const tokens = tokeniser_cache_entry_tokens(entry);
+
+        check(tokeniser_cache_entry_result(entry) == tokeniser_result_ok
+              && tokens_count(tokens) == 3
+              && strcmp(tokens_get_token(tokens, 1), "line of") == 0,
+              "cached tokens");
+        tokeniser_cache_release(cache, entry);
+    }
+    if (again != NULL)
+    {
+        tokeniser_cache_release(cache, again);
+    }
+    tokeniser_cache_stats_get(cache, &stats);
+    check(stats.hits == 1 && stats.misses == 1 && stats.entry_count == 1, "cache stats");
+
+done:
+    tokeniser_cache_free(cache);
+}
+
+/* The engines are compared by what they pass to new_token_cb. */
+#define PARITY_SEED 2463534242u
+#define PARITY_LARGE_RECORDS 4
+#define PARITY_LARGE_RECORD_SIZE (4 * TOKENISER_PARALLEL_MIN_CHUNK_SIZE + 1000)
+#define PARITY_SHORT_LINES 2000
+#define PARITY_SHORT_LINE_SIZE 40
+
+static uint32_t parity_random(uint32_t * const seed)
+{
+    /* xorshift32, so the checks are the same on every run. */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+
+    return *seed;
+}
+
+static void parity_record_fill(char * const record, size_t const length, uint32_t * const seed, bool const any_byte)
+{
+    /* Mostly token characters, spaces and quotes, so tokens and 
+     * quoted tokens span the chunks. Short lines get any byte at 
+     * all, including NULs and high bytes. 
+     */
+    static char const chars[] = "abcdefgh  \t'\"";
+    size_t index;
+
+    for (index = 0; index < length; index++)
+    {
+        uint32_t const random = parity_random(seed);
+
+        record[index] = any_byte && (random & 3) == 0 ? (char)(random >> 8) : chars[(random >> 8) % (sizeof chars - 1)];
+    }
+}
+
+static bool parity_new_token(char const * const token,
+                             size_t const start_index,
+                             size_t const end_index,
+                             char const quote_char,
+                             void * const user_arg)
+{
+    FILE * const stream = user_arg;
+
+    fprintf(stream, "%zu-%zu %d [%s]\n", start_index, end_index, quote_char, token);
+
+    return true;
+}
+
+static char * parity_fsm_describe(char const * const record, size_t const length)
+{
+    /* What tokeniser_feed makes of the record followed by a NUL. */
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    tokeniser_result_t result = tokeniser_result_continue;
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    size_t index;
+
+    for (index = 0; index < length && result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(tokeniser, record[index], parity_new_token, stream);
+    }
+    if (result == tokeniser_result_continue)
+    {
+        result = tokeniser_feed(tokeniser, '\0', parity_new_token, stream);
+    }
+    fprintf(stream, "result %d\n", result);
+    fclose(stream);
+    tokeniser_free(tokeniser);
+
+    return description;
+}
+
+static char * parity_parallel_describe(char const * const record, size_t const length)
+{
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    tokeniser_result_t const result = tokeniser_parallel_feed(record, length, 4, parity_new_token, stream);
+
+    fprintf(stream, "result %d\n", result);
+    fclose(stream);
+
+    return description;
+}
+
+static char * parity_structural_describe(char const * const record, size_t const length)
+{
+    tokeniser_structural_st * const structural = tokeniser_structural_alloc();
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    tokeniser_result_t const result = tokeniser_structural_index(structural, record, length);
+    size_t const count = tokeniser_structural_token_count(structural);
+    size_t index;
+
+    for (index = 0; index < count; index++)
+    {
+        size_t start_index;
+        size_t end_index;
+
+        tokeniser_structural_token_span(structural, index, &start_index, &end_index);
+        parity_new_token(tokeniser_structural_token_get(structural, index),
+                         start_index,
+                         end_index,
+                         tokeniser_structural_token_quote_char(structural, index),
+                         stream);
+    }
+    fprintf(stream, "result %d\n", result);
+    fclose(stream);
+    tokeniser_structural_free(structural);
+
+    return description;
+}
+
+static void parity_scan_token_describe(char const * const record, tokeniser_scan_token_st const * const token, FILE * const stream)
+{
+    char * const text = malloc(token->text_length + 1);
+
+    if (text == NULL)
+    {
+        fprintf(stream, "out of memory\n");
+        goto done;
+    }
+    if (token->needs_copy)
+    {
+        tokeniser_scan_copy(record, token, text);
+    }
+    else
+    {
+        memcpy(text, token->text, token->text_length);
+        text[token->text_length] = '\0';
+    }
+    parity_new_token(text, token->start_index, token->end_index, token->quote_char, stream);
+
+done:
+    free(text);
+}
+
+static char * parity_scan_describe(char const * const record, size_t const length)
+{
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    tokeniser_result_t result = tokeniser_result_ok;
+    tokeniser_scan_token_st token;
+    size_t offset = 0;
+
+    while (tokeniser_scan_next(record, length, &offset, &token))
+    {
+        parity_scan_token_describe(record, &token, stream);
+        if (token.incomplete)
+        {
+            result = tokeniser_result_incomplete_token;
+        }
+    }
+    fprintf(stream, "result %d\n", result);
+    fclose(stream);
+
+    return description;
+}
+
+static char * parity_batch_describe(tokeniser_batch_st const * const batch, char const * const record, size_t const length)
+{
+    /* The record is run in lockstep with shorter copies of itself, 
+     * so the lines in the batch end at different times. 
+     */
+    tokeniser_batch_line_st lines[TOKENISER_BATCH_MAX_LINES];
+    size_t const line_count = (length < TOKENISER_BATCH_MAX_LINES) ? length + 1 : TOKENISER_BATCH_MAX_LINES;
+    size_t const token_capacity = length / 2 + 1;
+    tokeniser_scan_token_st * const tokens = malloc(line_count * token_capacity * sizeof *tokens);
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    size_t index;
+
+    if (tokens == NULL)
+    {
+        fprintf(stream, "out of memory\n");
+        goto done;
+    }
+
+    for (index = 0; index < line_count; index++)
+    {
+        lines[index].text = record;
+        lines[index].length = length - index;
+        lines[index].tokens = &tokens[index * token_capacity];
+        lines[index].token_capacity = token_capacity;
+    }
+    if (!tokeniser_batch_run(batch, lines, line_count))
+    {
+        fprintf(stream, "batch failed\n");
+        goto done;
+    }
+    for (index = 0; index < lines[0].token_count && index < token_capacity; index++)
+    {
+        parity_scan_token_describe(record, &lines[0].tokens[index], stream);
+    }
+    fprintf(stream, "result %d\n", lines[0].result);
+
+done:
+    fclose(stream);
+    free(tokens);
+
+    return description;
+}
+
+static char * parity_validate_describe(char const * const record, size_t const length)
+{
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    tokeniser_scan_validation_st validation;
+    tokeniser_result_t const result = tokeniser_scan_validate(record, length, &validation);
+
+    fprintf(stream, "%zu tokens, result %d\n", validation.token_count, result);
+    fclose(stream);
+
+    return description;
+}
+
+static bool parity_count_token(char const * const token,
+                               size_t const start_index,
+                               size_t const end_index,
+                               char const quote_char,
+                               void * const user_arg)
+{
+    size_t * const token_count = user_arg;
+
+    UNUSED(token);
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    (*token_count)++;
+
+    return true;
+}
+
+static char * parity_fsm_summarise(char const * const record, size_t const length)
+{
+    /* The token count and result from tokeniser_feed, to compare 
+     * with tokeniser_scan_validate(). 
+     */
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    tokeniser_result_t result = tokeniser_result_continue;
+    char * description = NULL;
+    size_t size;
+    FILE * const stream = open_memstream(&description, &size);
+    size_t token_count = 0;
+    size_t index;
+
+    for (index = 0; index < length && result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(tokeniser, record[index], parity_count_token, &token_count);
+    }
+    if (result == tokeniser_result_continue)
+    {
+        result = tokeniser_feed(tokeniser, '\0', parity_count_token, &token_count);
+    }
+    fprintf(stream, "%zu tokens, result %d\n", token_count, result);
+    fclose(stream);
+    tokeniser_free(tokeniser);
+
+    return description;
+}
+
+static void parity_check(tokeniser_batch_st const * const batch, char const * const record, size_t const length, char const * const what)
+{
+    char * const expected = parity_fsm_describe(record, length);
+    char * const expected_summary = parity_fsm_summarise(record, length);
+    char * const parallel = parity_parallel_describe(record, length);
+    char * const structural = parity_structural_describe(record, length);
+    char * const scan = parity_scan_describe(record, length);
+    char * const validate = parity_validate_describe(record, length);
+    char * const batched = parity_batch_describe(batch, record, length);
+    char description[128];
+
+    snprintf(description, sizeof description, "parallel tokens match tokeniser_feed on %s", what);
+    check(strcmp(parallel, expected) == 0, description);
+    snprintf(description, sizeof description, "structural tokens match tokeniser_feed on %s", what);
+    check(strcmp(structural, expected) == 0, description);
+    snprintf(description, sizeof description, "scanned tokens match tokeniser_feed on %s", what);
+    check(strcmp(scan, expected) == 0, description);
+    snprintf(description, sizeof description, "validation matches tokeniser_feed on %s", what);
+    check(strcmp(validate, expected_summary) == 0, description);
+    snprintf(description, sizeof description, "batched tokens match tokeniser_feed on %s", what);
+    check(strcmp(batched, expected) == 0, description);
+
+    free(batched);
+    free(validate);
+    free(scan);
+    free(structural);
+    free(parallel);
+    free(expected_summary);
+    free(expected);
+}
+
+static void do_parity_check(void)
+{
+    /* Check that the other engines find the same tokens as 
+     * tokeniser_feed in random records. 
+     */
+    char * const record = malloc(PARITY_LARGE_RECORD_SIZE);
+    tokeniser_batch_st * const batch = tokeniser_batch_alloc();
+    uint32_t seed = PARITY_SEED;
+    size_t index;
+
+    if (record == NULL || batch == NULL)
+    {
+        check(false, "parity record allocated");
+        goto done;
+    }
+
+    for (index = 0; index < PARITY_LARGE_RECORDS; index++)
+    {
+        parity_record_fill(record, PARITY_LARGE_RECORD_SIZE, &seed, false);
+        parity_check(batch, record, PARITY_LARGE_RECORD_SIZE, "a large record");
+    }
+
+    for (index = 0; index < PARITY_SHORT_LINES; index++)
+    {
+        size_t const length = parity_random(&seed) % PARITY_SHORT_LINE_SIZE;
+
+        parity_record_fill(record, length, &seed, true);
+        parity_check(batch, record, length, "a short line");
+    }
+
+done:
+    tokeniser_batch_free(batch);
+    free(record);
+}
+
+#define DECOMPRESS_CHECK_LINES 20000
+
+static bool gzip_member_append(char const * const text, size_t const length, unsigned char * const out, size_t * const out_length, size_t const out_size)
+{
+    /* Add 16 to the window bits to write a gzip header. */
+    z_stream zlib;
+    bool appended;
+
+    memset(&zlib, 0, sizeof zlib);
+    if (deflateInit2(&zlib, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        appended = false;
+        goto done;
+    }
+    zlib.next_in = (unsigned char *)text;
+    zlib.avail_in = (uInt)length;
+    zlib.next_out = out + *out_length;
+    zlib.avail_out = (uInt)(out_size - *out_length);
+    appended = (deflate(&zlib, Z_FINISH) == Z_STREAM_END);
+    *out_length = out_size - zlib.avail_out;
+    deflateEnd(&zlib);
+
+done:
+    return appended;
+}
+
+static bool decompress_read_back(unsigned char const * const data,
+                                 size_t const length,
+                                 char const * const expected,
+                                 size_t const expected_length,
+                                 tokeniser_decompress_format_t const expected_format)
+{
+    /* Read the data through a decompressor. Returns false if the 
+     * decompressor reports an error, or doesn't give the expected 
+     * text in the expected format. 
+     */
+    FILE * const fp = fmemopen((void *)data, length, "rb");
+    tokeniser_decompress_st * decompress = NULL;
+    tokeniser_source_st file_source;
+    tokeniser_source_st source;
+    char buffer[4096];
+    size_t offset = 0;
+    bool matches = false;
+    ssize_t bytes_read;
+
+    if (fp == NULL)
+    {
+        goto done;
+    }
+    tokeniser_source_file_init(&file_source, fp);
+    decompress = tokeniser_decompress_alloc(&file_source);
+    if (decompress == NULL)
+    {
+        goto done;
+    }
+    tokeniser_source_decompress_init(&source, decompress);
+
+    matches = true;
+    while ((bytes_read = source.fill(source.context, buffer, sizeof buffer)) > 0)
+    {
+        if ((size_t)bytes_read > expected_length - offset || memcmp(buffer, expected + offset, (size_t)bytes_read) != 0)
+        {
+            matches = false;
+        }
+        offset += (size_t)bytes_read;
+    }
+    matches = matches
+              && bytes_read == 0
+              && offset == expected_length
+              && tokeniser_decompress_format_get(decompress) == expected_format;
+
+done:
+    tokeniser_decompress_free(decompress);
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    return matches;
+}
+
+static void do_decompress_check(void)
+{
+    /* Text too big for one read of compressed input, compressed as 
+     * one gzip member and as two, and truncated. 
+     */
+    size_t const text_size = DECOMPRESS_CHECK_LINES * 32;
+    char * const text = malloc(text_size);
+    size_t const compressed_size = compressBound(text_size) + 1024;
+    unsigned char * const compressed = malloc(compressed_size);
+    uint32_t seed = PARITY_SEED;
+    size_t text_length = 0;
+    size_t compressed_length = 0;
+    size_t line;
+
+    if (text == NULL || compressed == NULL)
+    {
+        check(false, "decompress check allocated");
+        goto done;
+    }
+
+    for (line = 0; line < DECOMPRESS_CHECK_LINES; line++)
+    {
+        text_length += (size_t)snprintf(text + text_length, text_size - text_length, "line %zu '%08x'\n", line, parity_random(&seed));
+    }
+    check(decompress_read_back((unsigned char const *)text, text_length, text, text_length, tokeniser_decompress_format_none),
+          "uncompressed input passed through");
+
+    check(gzip_member_append(text, text_length, compressed, &compressed_length, compressed_size), "gzip compressed");
+    check(compressed_length > TOKENISER_DECOMPRESS_INPUT_SIZE, "gzip input spans reads");
+    check(decompress_read_back(compressed, compressed_length, text, text_length, tokeniser_decompress_format_gzip),
+          "gzip input decompressed");
+    check(!decompress_read_back(compressed, compressed_length - 8, text, text_length, tokeniser_decompress_format_gzip),
+          "truncated gzip input fails");
+    check(!decompress_read_back(compressed, compressed_length / 2, text, text_length, tokeniser_decompress_format_gzip),
+          "gzip input cut in half fails");
+
+    compressed_length = 0;
+    check(gzip_member_append(text, text_length / 3, compressed, &compressed_length, compressed_size)
+          && gzip_member_append(text + text_length / 3, text_length - text_length / 3, compressed, &compressed_length, compressed_size),
+          "gzip members compressed");
+    check(decompress_read_back(compressed, compressed_length, text, text_length, tokeniser_decompress_format_gzip),
+          "gzip members decompressed");
+
+done:
+    free(compressed);
+    free(text);
+}
+
+#define COUNTS_CHECK_TOP 3
+
+static bool counts_add_line(token_counts_st * const counts, char const * const line)
+{
+    /* Count the tokens of a line, in the counter's dictionary if 
+     * it is exact. 
+     */
+    token_dictionary_st * const dictionary = token_counts_dictionary_get(counts);
+    tokens_st * const tokens = (dictionary != NULL) ? tokens_alloc_interned(dictionary) : tokens_alloc();
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    tokeniser_result_t result = tokeniser_result_continue;
+    bool added = false;
+    char const * pch = line;
+
+    if (tokens == NULL || tokeniser == NULL)
+    {
+        goto done;
+    }
+
+    tokeniser_init(tokeniser);
+    do
+    {
+        result = tokeniser_feed(tokeniser, *pch, tokens_new_token, tokens);
+    }
+    while (result == tokeniser_result_continue && *pch++ != '\0');
+    added = (result == tokeniser_result_ok) && token_counts_add_tokens(counts, tokens);
+
+done:
+    tokeniser_free(tokeniser);
+    tokens_free(tokens);
+    return added;
+}
+
+static void counts_check(token_counts_st * const counts, char const * const expected, char const * const what)
+{
+    token_count_st top[COUNTS_CHECK_TOP];
+    size_t const top_length = token_counts_top(counts, top);
+    check_context_st context;
+    size_t index;
+
+    context.tokeniser = NULL;
+    context.length = 0;
+    context.description[0] = '\0';
+    for (index = 0; index < top_length; index++)
+    {
+        check_describe(&context, "[%s:%" PRIu64 "]", top[index].token, top[index].count);
+    }
+    if (strcmp(context.description, expected) != 0)
+    {
+        printf("check failed: %s gave %s, not %s\n", what, context.description, expected);
+        checks_failed++;
+    }
+}
+
+static void do_counts_check(void)
+{
+    /* The same lines counted exactly and with a sketch, on one 
+     * counter and split between two that are then merged. 
+     */
+    static char const * const lines[] =
+    {
+        "a b c d a",
+        "e a b 'a' c b",
+        "b c a f a"
+    };
+    size_t const sketch_widths[] = { 0, 1024 };
+    size_t width_index;
+
+    for (width_index = 0; width_index < sizeof sketch_widths / sizeof sketch_widths[0]; width_index++)
+    {
+        token_counts_st * const counts = token_counts_alloc(COUNTS_CHECK_TOP, sketch_widths[width_index]);
+        token_counts_st * const first = token_counts_alloc(COUNTS_CHECK_TOP, sketch_widths[width_index]);
+        token_counts_st * const second = token_counts_alloc(COUNTS_CHECK_TOP, sketch_widths[width_index]);
+        char const * const what = (sketch_widths[width_index] == 0) ? "exact counts" : "sketch counts";
+        size_t index;
+
+        if (counts == NULL || first == NULL || second == NULL)
+        {
+            check(false, "counters allocated");
+        }
+        else
+        {
+            for (index = 0; index < sizeof lines / sizeof lines[0]; index++)
+            {
+                check(counts_add_line(counts, lines[index]), "tokens counted");
+                check(counts_add_line((index == 0) ? first : second, lines[index]), "tokens counted");
+            }
+            counts_check(counts, "[a:6][b:4][c:3]", what);
+            check(token_counts_merge(first, second), "counts merged");
+            counts_check(first, "[a:6][b:4][c:3]", what);
+            counts_check(second, "[a:4][b:3][c:2]", what);
+        }
+
+        token_counts_free(second);
+        token_counts_free(first);
+        token_counts_free(counts);
+    }
+}
+
+#define JOIN_CHECK_LINES 2000
+#define JOIN_CHECK_TOKENS 6
+#define JOIN_CHECK_TOKEN_SIZE 10
+
+static bool join_check_unrepresentable(char const * const token)
+{
+    /* As documented for tokens_join_quoted(). */
+    return (token[0] == ' ' || (token[0] >= '\t' && token[0] <= '\r') || token[0] == '\'' || token[0] == '\"')
+           && strchr(token, '\'') != NULL
+           && strchr(token, '\"') != NULL;
+}
+
+static bool join_check_line(tokens_st const * const tokens, tokens_st * const read_back, tokeniser_st * const tokeniser)
+{
+    /* Join the tokens, and check that tokenising the line gives 
+     * them back. 
+     */
+    char * const line = tokens_join_quoted(tokens);
+    tokeniser_result_t result = tokeniser_result_continue;
+    bool matches = true;
+    size_t index;
+
+    if (line == NULL)
+    {
+        /* Only allowed if a token can't be written. */
+        matches = false;
+        for (index = 0; index < tokens_count(tokens); index++)
+        {
+            matches |= join_check_unrepresentable(tokens_get_token(tokens, index));
+        }
+        goto done;
+    }
+
+    tokens_clear(read_back);
+    tokeniser_init(tokeniser);
+    for (index = 0; result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(tokeniser, line[index], tokens_new_token, read_back);
+        if (line[index] == '\0')
+        {
+            break;
+        }
+    }
+
+    matches = (result == tokeniser_result_ok && tokens_count(read_back) == tokens_count(tokens));
+    for (index = 0; matches && index < tokens_count(tokens); index++)
+    {
+        matches = (strcmp(tokens_get_token(read_back, index), tokens_get_token(tokens, index)) == 0);
+    }
+    if (!matches)
+    {
+        printf("check failed: the joined line \"%s\" doesn't read back as its tokens\n", line);
+        checks_failed++;
+        matches = true; /* Already reported. */
+    }
+
+done:
+    free(line);
+    return matches;
+}
+
+static void do_join_check(void)
+{
+    /* Random tokens, heavy in spaces, quotes and other characters 
+     * that need care, should survive tokens_join_quoted(). 
+     */
+    static char const chars[] = "ab= $\\\t'\"\xe9";
+    tokens_st * const tokens = tokens_alloc();
+    tokens_st * const read_back = tokens_alloc();
+    tokeniser_st * const tokeniser = tokeniser_alloc();
+    uint32_t seed = PARITY_SEED;
+    size_t line;
+
+    if (tokens == NULL || read_back == NULL || tokeniser == NULL)
+    {
+        check(false, "join check allocated");
+        goto done;
+    }
+
+    for (line = 0; line < JOIN_CHECK_LINES; line++)
+    {
+        size_t const token_count = parity_random(&seed) % (JOIN_CHECK_TOKENS + 1);
+        size_t index;
+
+        tokens_clear(tokens);
+        for (index = 0; index < token_count; index++)
+        {
+            char token[JOIN_CHECK_TOKEN_SIZE + 1];
+            size_t const length = parity_random(&seed) % (JOIN_CHECK_TOKEN_SIZE + 1);
+            size_t char_index;
+
+            for (char_index = 0; char_index < length; char_index++)
+            {
+                token[char_index] = chars[parity_random(&seed) % (sizeof chars - 1)];
+            }
+            token[length] = '\0';
+            tokens_add_token(tokens, token);
+        }
+        check(join_check_line(tokens, read_back, tokeniser), "tokens_join_quoted only fails for tokens that can't be written");
+    }
+
+done:
+    tokeniser_free(tokeniser);
+    tokens_free(read_back);
+    tokens_free(tokens);
+}
+
+int main(int const argc, char * const * const argv)
+{
+    if (argc > 2 && strcmp(argv[1], "-B") == 0)
+    {
+        /* Compare the throughput of the tokeniser engines. */
+        int result = EXIT_SUCCESS;
+        int index;
+
+        for (index = 2; index < argc; index++)
+        {
+            if (do_benchmark_file(argv[index]) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "-T") == 0)
+    {
+        /* Find the most frequent tokens: 
+         * -T <count> [-p <token position>] [-s <sketch width>] <file>... 
+         */
+        int result = EXIT_SUCCESS;
+        count_options_st options;
+        int index = 3;
+
+        options.top_count = strtoul(argv[2], NULL, 0);
+        options.position = COUNT_ALL_POSITIONS;
+        options.sketch_width = 0;
+        while (index + 1 < argc && (strcmp(argv[index], "-p") == 0 || strcmp(argv[index], "-s") == 0))
+        {
+            if (strcmp(argv[index], "-p") == 0)
+            {
+                options.position = strtoul(argv[index + 1], NULL, 0);
+            }
+            else
+            {
+                options.sketch_width = strtoul(argv[index + 1], NULL, 0);
+            }
+            index += 2;
+        }
+
+        for (; index < argc; index++)
+        {
+            if (do_count_file(argv[index], &options) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "-I") == 0)
+    {
+        /* Check that indexing files and replaying the index gives 
+         * what the tokeniser does. 
+         */
+        int result = EXIT_SUCCESS;
+        int index;
+
+        for (index = 2; index < argc; index++)
+        {
+            if (do_index_file(argv[index]) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "-J") == 0)
+    {
+        /* Write each line back with its tokens minimally quoted, 
+         * checking that it reads back as the same tokens. 
+         */
+        int result = EXIT_SUCCESS;
+        int index;
+
+        for (index = 2; index < argc; index++)
+        {
+            if (do_join_file(argv[index]) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "-S") == 0)
+    {
+        /* Time tokenising files as they are read. */
+        int result = EXIT_SUCCESS;
+        int index;
+
+        for (index = 2; index < argc; index++)
+        {
+            if (do_benchmark_stream(argv[index]) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    if (argc > 1)
+    {
+        int result = EXIT_SUCCESS;
+        int index;
+
+        for (index = 1; index < argc; index++)
+        {
+            if (do_tokenise_file(argv[index]) != EXIT_SUCCESS)
+            {
+                result = EXIT_FAILURE;
+            }
+        }
+
+        return result;
+    }
+
+    do_tokenise_test("test | > < abc' | \"|\" def 'ghi \"|\" 123\" 456 \"789 \"double quoted\" \'single quoted\' \"double quoted embedded single quote \'\" \'single quoted embedded double quote \"\'");
+    do_tokenise_test("test \"double quotedincomplete");
+
+    do_keyword_check();
+    do_number_check();
+    do_key_value_check();
+    do_csv_check();
+    do_limits_check();
+    do_flight_recorder_check();
+    do_continuation_check();
+    do_projection_check();
+    do_pool_check();
+    do_pipeline_check();
+    do_variable_check();
+    do_join_check();
+    do_counts_check();
+    do_decompress_check();
+    do_cache_check();
+    do_parity_check();
 
-    return 0;
+    return (checks_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
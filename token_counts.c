@@ -0,0 +1,607 @@
+#include "token_counts.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ID_COUNTS_INITIAL_SIZE 1024
+
+/* One of the tokens with the highest estimates seen so far. */
+typedef struct candidate_st
+{
+    char * token;
+    size_t token_size; /* The allocated size of token. */
+    uint64_t hash;
+    uint64_t count; /* The estimate when last seen. */
+    size_t heap_index;
+} candidate_st;
+
+struct token_counts_st
+{
+    size_t top_count;
+
+    /* Exact counts. */
+    token_dictionary_st * dictionary;
+    uint64_t * id_counts; /* Indexed by token id. */
+    size_t id_count_size;
+
+    /* Approximate counts. */
+    uint64_t * sketch; /* TOKEN_COUNTS_SKETCH_DEPTH rows of sketch_mask + 1 counters. */
+    size_t sketch_mask;
+    candidate_st * candidates;
+    size_t candidate_count;
+    size_t * heap; /* Indexes of candidates, as a min-heap on count. */
+    size_t * slots; /* Open addressed on hash. Index of a candidate plus 1, or 0 if empty. */
+    size_t slot_mask;
+};
+
+static size_t power_of_2_get(size_t const minimum)
+{
+    size_t size = 1;
+
+    while (size < minimum)
+    {
+        size *= 2;
+    }
+
+    return size;
+}
+
+static uint64_t hash_mix(uint64_t hash)
+{
+    /* The FNV-1a hash is spread over both halves, which are used as
+     * two independent hashes for the sketch rows.
+     */
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static uint64_t * sketch_counter_get(token_counts_st const * const counts, uint64_t const hash, unsigned int const row)
+{
+    uint64_t const mixed = hash_mix(hash);
+    uint64_t const low = (uint32_t)mixed;
+    uint64_t const high = (mixed >> 32) | 1;
+
+    return &counts->sketch[row * (counts->sketch_mask + 1) + ((low + row * high) & counts->sketch_mask)];
+}
+
+static uint64_t sketch_add(token_counts_st * const counts, uint64_t const hash)
+{
+    /* Returns: The new estimate. */
+    uint64_t estimate = UINT64_MAX;
+    unsigned int row;
+
+    for (row = 0; row < TOKEN_COUNTS_SKETCH_DEPTH; row++)
+    {
+        uint64_t * const counter = sketch_counter_get(counts, hash, row);
+
+        (*counter)++;
+        if (*counter < estimate)
+        {
+            estimate = *counter;
+        }
+    }
+
+    return estimate;
+}
+
+static uint64_t sketch_estimate(token_counts_st const * const counts, uint64_t const hash)
+{
+    uint64_t estimate = UINT64_MAX;
+    unsigned int row;
+
+    for (row = 0; row < TOKEN_COUNTS_SKETCH_DEPTH; row++)
+    {
+        uint64_t const counter = *sketch_counter_get(counts, hash, row);
+
+        if (counter < estimate)
+        {
+            estimate = counter;
+        }
+    }
+
+    return estimate;
+}
+
+static uint64_t heap_count_get(token_counts_st const * const counts, size_t const heap_index)
+{
+    return counts->candidates[counts->heap[heap_index]].count;
+}
+
+static void heap_swap(token_counts_st * const counts, size_t const first, size_t const second)
+{
+    size_t const candidate = counts->heap[first];
+
+    counts->heap[first] = counts->heap[second];
+    counts->heap[second] = candidate;
+    counts->candidates[counts->heap[first]].heap_index = first;
+    counts->candidates[counts->heap[second]].heap_index = second;
+}
+
+static void heap_sift_up(token_counts_st * const counts, size_t heap_index)
+{
+    while (heap_index > 0 && heap_count_get(counts, (heap_index - 1) / 2) > heap_count_get(counts, heap_index))
+    {
+        heap_swap(counts, heap_index, (heap_index - 1) / 2);
+        heap_index = (heap_index - 1) / 2;
+    }
+}
+
+static void heap_sift_down(token_counts_st * const counts, size_t heap_index)
+{
+    for (;;)
+    {
+        size_t const left = 2 * heap_index + 1;
+        size_t const right = left + 1;
+        size_t smallest = heap_index;
+
+        if (left < counts->candidate_count && heap_count_get(counts, left) < heap_count_get(counts, smallest))
+        {
+            smallest = left;
+        }
+        if (right < counts->candidate_count && heap_count_get(counts, right) < heap_count_get(counts, smallest))
+        {
+            smallest = right;
+        }
+        if (smallest == heap_index)
+        {
+            break;
+        }
+        heap_swap(counts, heap_index, smallest);
+        heap_index = smallest;
+    }
+}
+
+static size_t slot_find(token_counts_st const * const counts, char const * const token, uint64_t const hash)
+{
+    /* Returns: The slot holding token, or the empty slot where it
+     * would go.
+     */
+    size_t slot = hash & counts->slot_mask;
+
+    while (counts->slots[slot] != 0)
+    {
+        candidate_st const * const candidate = &counts->candidates[counts->slots[slot] - 1];
+
+        if (candidate->hash == hash && strcmp(candidate->token, token) == 0)
+        {
+            break;
+        }
+        slot = (slot + 1) & counts->slot_mask;
+    }
+
+    return slot;
+}
+
+static void slot_remove(token_counts_st * const counts, size_t const slot)
+{
+    /* Close the gap by moving back any later entry in the run that
+     * may then be skipped over, so lookups needn't allow for removed
+     * entries.
+     */
+    size_t hole = slot;
+    size_t next = (slot + 1) & counts->slot_mask;
+
+    while (counts->slots[next] != 0)
+    {
+        size_t const home = counts->candidates[counts->slots[next] - 1].hash & counts->slot_mask;
+
+        if (((next - home) & counts->slot_mask) >= ((next - hole) & counts->slot_mask))
+        {
+            counts->slots[hole] = counts->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & counts->slot_mask;
+    }
+    counts->slots[hole] = 0;
+}
+
+static bool candidate_token_set(candidate_st * const candidate, char const * const token)
+{
+    size_t const size = strlen(token) + 1;
+    bool token_set;
+
+    if (candidate->token_size < size)
+    {
+        char * const new_token = realloc(candidate->token, size);
+
+        if (new_token == NULL)
+        {
+            token_set = false;
+            goto done;
+        }
+        candidate->token = new_token;
+        candidate->token_size = size;
+    }
+    memcpy(candidate->token, token, size);
+    token_set = true;
+
+done:
+    return token_set;
+}
+
+static bool candidate_offer(token_counts_st * const counts, char const * const token, uint64_t const hash, uint64_t const estimate)
+{
+    /* Keep token as a candidate if its estimate is among the highest.
+     * Returns false if out of memory.
+     */
+    bool offered;
+    size_t slot;
+    size_t index;
+
+    if (counts->candidate_count == counts->top_count
+        && (counts->top_count == 0 || estimate <= heap_count_get(counts, 0)))
+    {
+        /* Not a candidate, or one whose estimate can't have changed. */
+        offered = true;
+        goto done;
+    }
+
+    slot = slot_find(counts, token, hash);
+    if (counts->slots[slot] != 0)
+    {
+        index = counts->slots[slot] - 1;
+        counts->candidates[index].count = estimate;
+        heap_sift_down(counts, counts->candidates[index].heap_index);
+        offered = true;
+        goto done;
+    }
+
+    if (counts->candidate_count < counts->top_count)
+    {
+        index = counts->candidate_count;
+        if (!candidate_token_set(&counts->candidates[index], token))
+        {
+            offered = false;
+            goto done;
+        }
+        counts->heap[index] = index;
+        counts->candidates[index].heap_index = index;
+        counts->candidate_count++;
+    }
+    else
+    {
+        /* Replace the candidate with the lowest estimate. */
+        candidate_st * const lowest = &counts->candidates[counts->heap[0]];
+
+        index = counts->heap[0];
+        slot_remove(counts, slot_find(counts, lowest->token, lowest->hash));
+        if (!candidate_token_set(lowest, token))
+        {
+            /* The lowest candidate is unchanged, so put it back. */
+            counts->slots[slot_find(counts, lowest->token, lowest->hash)] = index + 1;
+            offered = false;
+            goto done;
+        }
+        slot = slot_find(counts, token, hash);
+    }
+    counts->candidates[index].hash = hash;
+    counts->candidates[index].count = estimate;
+    counts->slots[slot] = index + 1;
+    heap_sift_up(counts, counts->candidates[index].heap_index);
+    heap_sift_down(counts, counts->candidates[index].heap_index);
+    offered = true;
+
+done:
+    return offered;
+}
+
+static void candidates_refresh(token_counts_st * const counts)
+{
+    /* Bring the candidates' estimates up to date with the sketch. */
+    size_t index;
+
+    for (index = 0; index < counts->candidate_count; index++)
+    {
+        counts->candidates[index].count = sketch_estimate(counts, counts->candidates[index].hash);
+    }
+    for (index = counts->candidate_count / 2; index-- > 0;)
+    {
+        heap_sift_down(counts, index);
+    }
+}
+
+static bool id_counts_ensure(token_counts_st * const counts, size_t const id_count)
+{
+    bool ensured;
+
+    if (id_count > counts->id_count_size)
+    {
+        size_t const new_size = power_of_2_get((id_count > ID_COUNTS_INITIAL_SIZE) ? id_count : ID_COUNTS_INITIAL_SIZE);
+        uint64_t * const new_counts = realloc(counts->id_counts, new_size * sizeof *new_counts);
+
+        if (new_counts == NULL)
+        {
+            ensured = false;
+            goto done;
+        }
+        memset(&new_counts[counts->id_count_size], 0, (new_size - counts->id_count_size) * sizeof *new_counts);
+        counts->id_counts = new_counts;
+        counts->id_count_size = new_size;
+    }
+    ensured = true;
+
+done:
+    return ensured;
+}
+
+token_counts_st * token_counts_alloc(size_t const top_count, size_t const sketch_width)
+{
+    token_counts_st * counts = calloc(1, sizeof *counts);
+
+    if (counts == NULL)
+    {
+        goto done;
+    }
+
+    counts->top_count = top_count;
+    if (sketch_width == 0)
+    {
+        counts->dictionary = token_dictionary_alloc();
+        if (counts->dictionary == NULL)
+        {
+            goto error;
+        }
+        goto done;
+    }
+
+    counts->sketch_mask = power_of_2_get(sketch_width) - 1;
+    counts->slot_mask = power_of_2_get(2 * top_count + 1) - 1;
+    counts->sketch = calloc(TOKEN_COUNTS_SKETCH_DEPTH * (counts->sketch_mask + 1), sizeof *counts->sketch);
+    counts->candidates = calloc(top_count + 1, sizeof *counts->candidates);
+    counts->heap = calloc(top_count + 1, sizeof *counts->heap);
+    counts->slots = calloc(counts->slot_mask + 1, sizeof *counts->slots);
+    if (counts->sketch == NULL || counts->candidates == NULL || counts->heap == NULL || counts->slots == NULL)
+    {
+        goto error;
+    }
+
+    goto done;
+
+error:
+    token_counts_free(counts);
+    counts = NULL;
+
+done:
+    return counts;
+}
+
+void token_counts_free(token_counts_st * const counts)
+{
+    size_t index;
+
+    if (counts == NULL)
+    {
+        goto done;
+    }
+
+    token_dictionary_free(counts->dictionary);
+    free(counts->id_counts);
+    if (counts->candidates != NULL)
+    {
+        for (index = 0; index < counts->top_count; index++)
+        {
+            free(counts->candidates[index].token);
+        }
+    }
+    free(counts->candidates);
+    free(counts->heap);
+    free(counts->slots);
+    free(counts->sketch);
+    free(counts);
+
+done:
+    return;
+}
+
+token_dictionary_st * token_counts_dictionary_get(token_counts_st const * const counts)
+{
+    return counts->dictionary;
+}
+
+bool token_counts_add_tokens(token_counts_st * const counts, tokens_st const * const tokens)
+{
+    size_t const token_count = tokens_count(tokens);
+    bool added;
+    size_t index;
+
+    if (counts->dictionary != NULL)
+    {
+        if (!id_counts_ensure(counts, token_dictionary_count(counts->dictionary)))
+        {
+            added = false;
+            goto done;
+        }
+        for (index = 0; index < token_count; index++)
+        {
+            uint32_t const id = tokens_get_token_id(tokens, index);
+
+            if (id == TOKEN_ID_INVALID || id >= counts->id_count_size)
+            {
+                added = false;
+                goto done;
+            }
+            counts->id_counts[id]++;
+        }
+    }
+    else
+    {
+        for (index = 0; index < token_count; index++)
+        {
+            char const * const token = tokens_get_token(tokens, index);
+            uint64_t const hash = hash_bytes(token, strlen(token));
+
+            if (!candidate_offer(counts, token, hash, sketch_add(counts, hash)))
+            {
+                added = false;
+                goto done;
+            }
+        }
+    }
+    added = true;
+
+done:
+    return added;
+}
+
+bool token_counts_merge(token_counts_st * const into, token_counts_st const * const from)
+{
+    bool merged;
+    size_t index;
+
+    if (into->dictionary != NULL)
+    {
+        size_t const id_count = token_dictionary_count(from->dictionary);
+
+        for (index = 0; index < id_count && index < from->id_count_size; index++)
+        {
+            uint32_t id;
+
+            if (from->id_counts[index] == 0)
+            {
+                continue;
+            }
+            id = token_dictionary_intern(into->dictionary, token_dictionary_get(from->dictionary, (uint32_t)index));
+            if (id == TOKEN_ID_INVALID || !id_counts_ensure(into, (size_t)id + 1))
+            {
+                merged = false;
+                goto done;
+            }
+            into->id_counts[id] += from->id_counts[index];
+        }
+    }
+    else
+    {
+        /* The merged sketch holds the counts of both, so each side's
+         * candidates are judged on their combined estimates.
+         */
+        for (index = 0; index < TOKEN_COUNTS_SKETCH_DEPTH * (into->sketch_mask + 1); index++)
+        {
+            into->sketch[index] += from->sketch[index];
+        }
+        candidates_refresh(into);
+        for (index = 0; index < from->candidate_count; index++)
+        {
+            candidate_st const * const candidate = &from->candidates[index];
+
+            if (!candidate_offer(into, candidate->token, candidate->hash, sketch_estimate(into, candidate->hash)))
+            {
+                merged = false;
+                goto done;
+            }
+        }
+    }
+    merged = true;
+
+done:
+    return merged;
+}
+
+static int token_count_compare(void const * const first, void const * const second)
+{
+    /* Most frequent first, then alphabetical so the order is stable. */
+    token_count_st const * const first_count = first;
+    token_count_st const * const second_count = second;
+    int compare;
+
+    if (first_count->count != second_count->count)
+    {
+        compare = (first_count->count > second_count->count) ? -1 : 1;
+    }
+    else
+    {
+        compare = strcmp(first_count->token, second_count->token);
+    }
+
+    return compare;
+}
+
+static void top_sift_down(token_count_st * const top, size_t const top_length, size_t index)
+{
+    /* top is a min-heap on count while the ids are scanned. */
+    for (;;)
+    {
+        size_t const left = 2 * index + 1;
+        size_t const right = left + 1;
+        size_t smallest = index;
+        token_count_st swap;
+
+        if (left < top_length && token_count_compare(&top[left], &top[smallest]) > 0)
+        {
+            smallest = left;
+        }
+        if (right < top_length && token_count_compare(&top[right], &top[smallest]) > 0)
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            break;
+        }
+        swap = top[index];
+        top[index] = top[smallest];
+        top[smallest] = swap;
+        index = smallest;
+    }
+}
+
+size_t token_counts_top(token_counts_st * const counts, token_count_st * const top)
+{
+    size_t top_length = 0;
+    size_t index;
+
+    if (counts->dictionary != NULL)
+    {
+        size_t const id_count = token_dictionary_count(counts->dictionary);
+
+        for (index = 0; index < id_count && index < counts->id_count_size && counts->top_count != 0; index++)
+        {
+            token_count_st count;
+
+            if (counts->id_counts[index] == 0)
+            {
+                continue;
+            }
+            count.token = token_dictionary_get(counts->dictionary, (uint32_t)index);
+            count.count = counts->id_counts[index];
+            if (top_length < counts->top_count)
+            {
+                top[top_length] = count;
+                top_length++;
+                if (top_length == counts->top_count)
+                {
+                    size_t heap_index;
+
+                    for (heap_index = top_length / 2; heap_index-- > 0;)
+                    {
+                        top_sift_down(top, top_length, heap_index);
+                    }
+                }
+            }
+            else if (token_count_compare(&count, &top[0]) < 0)
+            {
+                top[0] = count;
+                top_sift_down(top, top_length, 0);
+            }
+        }
+    }
+    else
+    {
+        candidates_refresh(counts);
+        for (index = 0; index < counts->candidate_count; index++)
+        {
+            top[index].token = counts->candidates[index].token;
+            top[index].count = counts->candidates[index].count;
+        }
+        top_length = counts->candidate_count;
+    }
+
+    qsort(top, top_length, sizeof *top, token_count_compare);
+
+    return top_length;
+}
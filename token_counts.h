@@ -0,0 +1,75 @@
+#ifndef __TOKEN_COUNTS_H__
+#define __TOKEN_COUNTS_H__
+
+#include "token_dictionary.h"
+#include "tokens.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counts how often each token occurs, to find the most frequent.
+ * Exact counts keep a counter for every distinct token, indexed by
+ * its id in a token_dictionary_st. Approximate counts use a fixed
+ * amount of memory however many distinct tokens there are: a
+ * count-min sketch, which may overestimate a count but never
+ * underestimates it, and the tokens with the highest estimates so
+ * far. A counter isn't thread safe, so each thread keeps its own
+ * and they are merged at the end.
+ */
+typedef struct token_counts_st token_counts_st;
+
+/* The number of rows in the sketch, each hashed differently. A
+ * token's estimate is the lowest of its counters.
+ */
+#define TOKEN_COUNTS_SKETCH_DEPTH 4
+
+typedef struct token_count_st
+{
+    char const * token;
+    uint64_t count;
+} token_count_st;
+
+/*
+ * Allocate a counter.
+ * @top_count: The number of most frequent tokens wanted from
+ * token_counts_top().
+ * @sketch_width: The number of counters in each row of the sketch,
+ * rounded up to a power of 2, or 0 for exact counts.
+ * Returns NULL if out of memory.
+ */
+token_counts_st * token_counts_alloc(size_t const top_count, size_t const sketch_width);
+
+void token_counts_free(token_counts_st * const counts);
+
+/*
+ * Returns: The dictionary tokens are to be interned in for exact
+ * counts, or NULL for approximate counts.
+ */
+token_dictionary_st * token_counts_dictionary_get(token_counts_st const * const counts);
+
+/*
+ * Count every token in tokens. For exact counts they must have been
+ * interned in the counter's dictionary (see
+ * tokens_alloc_interned()), so no token is looked up again.
+ * Returns false if out of memory.
+ */
+bool token_counts_add_tokens(token_counts_st * const counts, tokens_st const * const tokens);
+
+/*
+ * Add the counts in from to those in into. Both must have been
+ * allocated with the same top_count and sketch_width.
+ * Returns false if out of memory.
+ */
+bool token_counts_merge(token_counts_st * const into, token_counts_st const * const from);
+
+/*
+ * Get the most frequent tokens, most frequent first. The tokens
+ * remain valid until the counter is next changed or freed.
+ * @top: Room for the top_count tokens.
+ * Returns: The number of tokens in top, which is less than
+ * top_count if fewer distinct tokens have been counted.
+ */
+size_t token_counts_top(token_counts_st * const counts, token_count_st * const top);
+
+#endif /* __TOKEN_COUNTS_H__ */
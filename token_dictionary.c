@@ -0,0 +1,319 @@
+#include "token_dictionary.h"
+#include "hash.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DICTIONARY_INITIAL_SLOTS 64
+#define DICTIONARY_CHUNK_SIZE (64 * 1024)
+
+typedef struct dictionary_slot_st
+{
+    uint32_t id; /* TOKEN_ID_INVALID if the slot is empty. */
+    uint32_t hash_check; /* The upper bits of the hash, to avoid most string compares. */
+} dictionary_slot_st;
+
+/* The strings are packed into large chunks rather than being
+ * allocated individually.
+ */
+typedef struct dictionary_chunk_st dictionary_chunk_st;
+struct dictionary_chunk_st
+{
+    dictionary_chunk_st * next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct token_dictionary_st
+{
+    dictionary_slot_st * slots;
+    size_t slot_count; /* Always a power of 2. */
+
+    char const * * strings; /* Indexed by id. */
+    size_t string_count;
+    size_t string_array_size;
+
+    dictionary_chunk_st * chunks; /* The chunk currently being filled is first. */
+};
+
+static uint32_t hash_check_get(uint64_t const hash)
+{
+    return (uint32_t)(hash >> 32);
+}
+
+static dictionary_slot_st * slot_find(dictionary_slot_st * const slots,
+                                      size_t const slot_count,
+                                      char const * const * const strings,
+                                      char const * const token,
+                                      uint64_t const hash)
+{
+    /* Linear probe from the home slot until either the token or an
+     * empty slot is found. There is always at least one empty slot.
+     */
+    size_t const mask = slot_count - 1;
+    uint32_t const hash_check = hash_check_get(hash);
+    size_t index = hash & mask;
+
+    for (;;)
+    {
+        dictionary_slot_st * const slot = &slots[index];
+
+        if (slot->id == TOKEN_ID_INVALID)
+        {
+            break;
+        }
+        if (slot->hash_check == hash_check && strcmp(strings[slot->id], token) == 0)
+        {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+
+    return &slots[index];
+}
+
+static dictionary_slot_st * slots_alloc(size_t const slot_count)
+{
+    dictionary_slot_st * const slots = malloc(slot_count * sizeof *slots);
+    size_t index;
+
+    if (slots == NULL)
+    {
+        goto done;
+    }
+    for (index = 0; index < slot_count; index++)
+    {
+        slots[index].id = TOKEN_ID_INVALID;
+    }
+
+done:
+    return slots;
+}
+
+static bool dictionary_grow(token_dictionary_st * const dictionary)
+{
+    bool grown;
+    size_t const new_slot_count = dictionary->slot_count * 2;
+    dictionary_slot_st * const new_slots = slots_alloc(new_slot_count);
+    size_t id;
+
+    if (new_slots == NULL)
+    {
+        grown = false;
+        goto done;
+    }
+
+    for (id = 0; id < dictionary->string_count; id++)
+    {
+        char const * const string = dictionary->strings[id];
+        uint64_t const hash = hash_bytes(string, strlen(string));
+        dictionary_slot_st * const slot = slot_find(new_slots, new_slot_count, dictionary->strings, string, hash);
+
+        slot->id = id;
+        slot->hash_check = hash_check_get(hash);
+    }
+
+    free(dictionary->slots);
+    dictionary->slots = new_slots;
+    dictionary->slot_count = new_slot_count;
+    grown = true;
+
+done:
+    return grown;
+}
+
+static char const * string_store(token_dictionary_st * const dictionary, char const * const token, size_t const length)
+{
+    char * string;
+    dictionary_chunk_st * chunk = dictionary->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < length + 1)
+    {
+        size_t const chunk_size = (length + 1 > DICTIONARY_CHUNK_SIZE) ? length + 1 : DICTIONARY_CHUNK_SIZE;
+
+        chunk = malloc(sizeof *chunk + chunk_size);
+        if (chunk == NULL)
+        {
+            string = NULL;
+            goto done;
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = dictionary->chunks;
+        dictionary->chunks = chunk;
+    }
+
+    string = &chunk->data[chunk->used];
+    memcpy(string, token, length + 1);
+    chunk->used += length + 1;
+
+done:
+    return string;
+}
+
+static bool strings_ensure_space(token_dictionary_st * const dictionary)
+{
+    bool has_space;
+    char const * * new_strings;
+    size_t new_size;
+
+    if (dictionary->string_count < dictionary->string_array_size)
+    {
+        has_space = true;
+        goto done;
+    }
+
+    new_size = dictionary->string_array_size * 2;
+    new_strings = realloc(dictionary->strings, new_size * sizeof *new_strings);
+    if (new_strings == NULL)
+    {
+        has_space = false;
+        goto done;
+    }
+    dictionary->strings = new_strings;
+    dictionary->string_array_size = new_size;
+    has_space = true;
+
+done:
+    return has_space;
+}
+
+token_dictionary_st * token_dictionary_alloc(void)
+{
+    token_dictionary_st * dictionary = calloc(1, sizeof *dictionary);
+
+    if (dictionary == NULL)
+    {
+        goto done;
+    }
+
+    dictionary->slot_count = DICTIONARY_INITIAL_SLOTS;
+    dictionary->slots = slots_alloc(dictionary->slot_count);
+    dictionary->string_array_size = DICTIONARY_INITIAL_SLOTS / 2;
+    dictionary->strings = malloc(dictionary->string_array_size * sizeof *dictionary->strings);
+    if (dictionary->slots == NULL || dictionary->strings == NULL)
+    {
+        token_dictionary_free(dictionary);
+        dictionary = NULL;
+        goto done;
+    }
+
+done:
+    return dictionary;
+}
+
+void token_dictionary_free(token_dictionary_st * const dictionary)
+{
+    dictionary_chunk_st * chunk;
+
+    if (dictionary == NULL)
+    {
+        goto done;
+    }
+
+    chunk = dictionary->chunks;
+    while (chunk != NULL)
+    {
+        dictionary_chunk_st * const next = chunk->next;
+
+        free(chunk);
+        chunk = next;
+    }
+    free(dictionary->strings);
+    free(dictionary->slots);
+    free(dictionary);
+
+done:
+    return;
+}
+
+uint32_t token_dictionary_intern(token_dictionary_st * const dictionary, char const * const token)
+{
+    uint32_t id;
+    size_t const length = strlen(token);
+    uint64_t const hash = hash_bytes(token, length);
+    dictionary_slot_st * slot;
+    char const * string;
+
+    slot = slot_find(dictionary->slots, dictionary->slot_count, dictionary->strings, token, hash);
+    if (slot->id != TOKEN_ID_INVALID)
+    {
+        id = slot->id;
+        goto done;
+    }
+
+    /* A new token. Keep the table no more than half full so probe
+     * sequences stay short.
+     */
+    if (dictionary->string_count >= TOKEN_ID_INVALID - 1 || !strings_ensure_space(dictionary))
+    {
+        id = TOKEN_ID_INVALID;
+        goto done;
+    }
+    if ((dictionary->string_count + 1) * 2 > dictionary->slot_count)
+    {
+        if (!dictionary_grow(dictionary))
+        {
+            id = TOKEN_ID_INVALID;
+            goto done;
+        }
+        slot = slot_find(dictionary->slots, dictionary->slot_count, dictionary->strings, token, hash);
+    }
+
+    string = string_store(dictionary, token, length);
+    if (string == NULL)
+    {
+        id = TOKEN_ID_INVALID;
+        goto done;
+    }
+
+    id = dictionary->string_count;
+    dictionary->strings[id] = string;
+    dictionary->string_count++;
+    slot->id = id;
+    slot->hash_check = hash_check_get(hash);
+
+done:
+    return id;
+}
+
+uint32_t token_dictionary_find(token_dictionary_st const * const dictionary, char const * const token)
+{
+    uint64_t const hash = hash_bytes(token, strlen(token));
+
+    return slot_find(dictionary->slots, dictionary->slot_count, dictionary->strings, token, hash)->id;
+}
+
+char const * token_dictionary_get(token_dictionary_st const * const dictionary, uint32_t const id)
+{
+    char const * string;
+
+    if (dictionary == NULL || id >= dictionary->string_count)
+    {
+        string = NULL;
+        goto done;
+    }
+
+    string = dictionary->strings[id];
+
+done:
+    return string;
+}
+
+size_t token_dictionary_count(token_dictionary_st const * const dictionary)
+{
+    size_t count;
+
+    if (dictionary == NULL)
+    {
+        count = 0;
+    }
+    else
+    {
+        count = dictionary->string_count;
+    }
+
+    return count;
+}
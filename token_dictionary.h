@@ -0,0 +1,53 @@
+#ifndef __TOKEN_DICTIONARY_H__
+#define __TOKEN_DICTIONARY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A dictionary that stores each distinct token string once and
+ * identifies it by a 32 bit id. Ids are allocated sequentially
+ * from 0, so they can be used to index arrays.
+ */
+typedef struct token_dictionary_st token_dictionary_st;
+
+#define TOKEN_ID_INVALID UINT32_MAX
+
+/*
+ * Create an empty dictionary.
+ * Returns: A new dictionary, or NULL if out of memory.
+ */
+token_dictionary_st * token_dictionary_alloc(void);
+
+/*
+ * Free the dictionary, and all the strings stored in it.
+ */
+void token_dictionary_free(token_dictionary_st * const dictionary);
+
+/*
+ * Look up token, adding it to the dictionary if not already
+ * present.
+ * Returns: The id of the token, or TOKEN_ID_INVALID if out of
+ * memory.
+ */
+uint32_t token_dictionary_intern(token_dictionary_st * const dictionary, char const * const token);
+
+/*
+ * Look up token without adding it.
+ * Returns: The id of the token, or TOKEN_ID_INVALID if it isn't
+ * in the dictionary.
+ */
+uint32_t token_dictionary_find(token_dictionary_st const * const dictionary, char const * const token);
+
+/*
+ * Returns: The string with the given id, or NULL if the id is
+ * invalid. The string remains valid until the dictionary is
+ * freed.
+ */
+char const * token_dictionary_get(token_dictionary_st const * const dictionary, uint32_t const id);
+
+/*
+ * Returns: The number of distinct tokens in the dictionary.
+ */
+size_t token_dictionary_count(token_dictionary_st const * const dictionary);
+
+#endif /* __TOKEN_DICTIONARY_H__ */
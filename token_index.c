@@ -0,0 +1,558 @@
+#include "token_index.h"
+#include "tokeniser_run.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define UNUSED(arg) (void)(arg)
+
+typedef struct mapped_file_st
+{
+    char const * data;
+    size_t size;
+} mapped_file_st;
+
+struct token_index_st
+{
+    mapped_file_st index_file;
+    mapped_file_st source_file;
+    token_index_header_st const * header;
+    token_index_token_st const * tokens;
+    token_index_line_st const * lines;
+    char const * arena;
+};
+
+typedef struct index_writer_st
+{
+    char const * source; /* The mapped source file. */
+    FILE * tokens_fp; /* The index file. Tokens are written directly to it. */
+    FILE * lines_fp; /* Temporary files holding the lines and arena until the */
+    FILE * arena_fp; /* number of tokens is known. */
+    uint64_t token_count;
+    uint64_t line_count;
+    uint64_t line_first_token;
+    uint64_t arena_size;
+    bool failed;
+} index_writer_st;
+
+static bool mapped_file_open(mapped_file_st * const mapped_file, char const * const filename)
+{
+    bool opened;
+    struct stat st;
+    int const fd = open(filename, O_RDONLY);
+
+    mapped_file->data = NULL;
+    mapped_file->size = 0;
+
+    if (fd < 0)
+    {
+        opened = false;
+        goto done;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        opened = false;
+        goto done;
+    }
+
+    mapped_file->size = st.st_size;
+    if (mapped_file->size > 0)
+    {
+        void * const data = mmap(NULL, mapped_file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+        {
+            opened = false;
+            goto done;
+        }
+        mapped_file->data = data;
+    }
+    opened = true;
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return opened;
+}
+
+static void mapped_file_close(mapped_file_st * const mapped_file)
+{
+    if (mapped_file->data != NULL)
+    {
+        munmap((void *)mapped_file->data, mapped_file->size);
+        mapped_file->data = NULL;
+    }
+}
+
+static uint64_t quote_flags_get(char const quote_char)
+{
+    uint64_t quote;
+
+    if (quote_char == '\'')
+    {
+        quote = TOKEN_INDEX_QUOTE_SINGLE;
+    }
+    else if (quote_char == '\"')
+    {
+        quote = TOKEN_INDEX_QUOTE_DOUBLE;
+    }
+    else
+    {
+        quote = TOKEN_INDEX_QUOTE_NONE;
+    }
+
+    return quote << TOKEN_INDEX_QUOTE_SHIFT;
+}
+
+static bool index_new_token(char const * const token,
+                            size_t const start_index,
+                            size_t const end_index,
+                            char const quote_char,
+                            void * const user_arg)
+{
+    index_writer_st * const writer = user_arg;
+    char const * const text = (token != NULL) ? token : "";
+    size_t const text_length = strlen(text);
+    size_t const length = end_index - start_index;
+    char const * const raw = &writer->source[start_index];
+    token_index_token_st entry;
+
+    if (length > UINT32_MAX || text_length > UINT32_MAX)
+    {
+        writer->failed = true;
+        goto done;
+    }
+
+    entry.start = start_index;
+    entry.length = length;
+    entry.text_length = text_length;
+
+    /* The text of most tokens is either the token itself, or the
+     * token less its opening quote.
+     */
+    if (text_length <= length && memcmp(raw, text, text_length) == 0)
+    {
+        entry.text = start_index;
+    }
+    else if (text_length < length && memcmp(raw + 1, text, text_length) == 0)
+    {
+        entry.text = start_index + 1;
+    }
+    else
+    {
+        entry.text = writer->arena_size | TOKEN_INDEX_TEXT_IN_ARENA;
+        if (fwrite(text, 1, text_length, writer->arena_fp) != text_length)
+        {
+            writer->failed = true;
+            goto done;
+        }
+        writer->arena_size += text_length;
+    }
+    entry.text |= quote_flags_get(quote_char);
+
+    if (fwrite(&entry, sizeof entry, 1, writer->tokens_fp) != 1)
+    {
+        writer->failed = true;
+        goto done;
+    }
+    writer->token_count++;
+
+done:
+    return !writer->failed;
+}
+
+static bool index_line_done(tokeniser_result_t const result,
+                            size_t const line_start,
+                            size_t const line_end,
+                            void * const user_arg)
+{
+    index_writer_st * const writer = user_arg;
+    token_index_line_st entry;
+
+    UNUSED(line_start);
+    UNUSED(line_end);
+
+    if (writer->failed)
+    {
+        goto done;
+    }
+    if (writer->token_count - writer->line_first_token > UINT32_MAX)
+    {
+        writer->failed = true;
+        goto done;
+    }
+
+    entry.first_token = writer->line_first_token;
+    entry.token_count = writer->token_count - writer->line_first_token;
+    entry.result = result;
+    if (fwrite(&entry, sizeof entry, 1, writer->lines_fp) != 1)
+    {
+        writer->failed = true;
+        goto done;
+    }
+    writer->line_count++;
+    writer->line_first_token = writer->token_count;
+
+done:
+    return !writer->failed;
+}
+
+static bool file_append(FILE * const dest, FILE * const src)
+{
+    bool appended;
+    char buffer[64 * 1024];
+    size_t bytes_read;
+
+    rewind(src);
+    while ((bytes_read = fread(buffer, 1, sizeof buffer, src)) > 0)
+    {
+        if (fwrite(buffer, 1, bytes_read, dest) != bytes_read)
+        {
+            appended = false;
+            goto done;
+        }
+    }
+    appended = !ferror(src);
+
+done:
+    return appended;
+}
+
+bool token_index_write(char const * const source_filename, char const * const index_filename)
+{
+    bool written;
+    mapped_file_st source_file;
+    tokeniser_st * tokeniser = NULL;
+    index_writer_st writer;
+    token_index_header_st header;
+
+    memset(&writer, 0, sizeof writer);
+
+    if (!mapped_file_open(&source_file, source_filename))
+    {
+        written = false;
+        goto done;
+    }
+    if (source_file.data != NULL)
+    {
+        madvise((void *)source_file.data, source_file.size, MADV_SEQUENTIAL);
+    }
+    writer.source = source_file.data;
+
+    tokeniser = tokeniser_alloc();
+    writer.tokens_fp = fopen(index_filename, "wb");
+    writer.lines_fp = tmpfile();
+    writer.arena_fp = tmpfile();
+    if (tokeniser == NULL || writer.tokens_fp == NULL || writer.lines_fp == NULL || writer.arena_fp == NULL)
+    {
+        written = false;
+        goto done;
+    }
+
+    /* Leave room for the header, which is written last. */
+    memset(&header, 0, sizeof header);
+    if (fwrite(&header, sizeof header, 1, writer.tokens_fp) != 1)
+    {
+        written = false;
+        goto done;
+    }
+
+    if (tokeniser_feed_buffer(tokeniser, source_file.data, source_file.size, index_new_token, index_line_done, &writer) != tokeniser_result_continue
+        || tokeniser_feed_end(tokeniser, index_new_token, index_line_done, &writer) != tokeniser_result_ok
+        || writer.failed)
+    {
+        written = false;
+        goto done;
+    }
+
+    memcpy(header.magic, TOKEN_INDEX_MAGIC, sizeof header.magic);
+    header.version = TOKEN_INDEX_VERSION;
+    header.header_size = sizeof header;
+    header.source_size = source_file.size;
+    header.token_count = writer.token_count;
+    header.line_count = writer.line_count;
+    header.tokens_offset = sizeof header;
+    header.lines_offset = header.tokens_offset + writer.token_count * sizeof(token_index_token_st);
+    header.arena_offset = header.lines_offset + writer.line_count * sizeof(token_index_line_st);
+    header.arena_size = writer.arena_size;
+
+    if (!file_append(writer.tokens_fp, writer.lines_fp)
+        || !file_append(writer.tokens_fp, writer.arena_fp)
+        || fseek(writer.tokens_fp, 0, SEEK_SET) != 0
+        || fwrite(&header, sizeof header, 1, writer.tokens_fp) != 1)
+    {
+        written = false;
+        goto done;
+    }
+
+    written = true;
+
+done:
+    if (writer.arena_fp != NULL)
+    {
+        fclose(writer.arena_fp);
+    }
+    if (writer.lines_fp != NULL)
+    {
+        fclose(writer.lines_fp);
+    }
+    if (writer.tokens_fp != NULL && fclose(writer.tokens_fp) != 0)
+    {
+        written = false;
+    }
+    if (!written && writer.tokens_fp != NULL)
+    {
+        unlink(index_filename);
+    }
+    tokeniser_free(tokeniser);
+    mapped_file_close(&source_file);
+
+    return written;
+}
+
+static bool index_header_valid(token_index_header_st const * const header, size_t const index_size, size_t const source_size)
+{
+    bool valid;
+
+    if (index_size < sizeof *header
+        || memcmp(header->magic, TOKEN_INDEX_MAGIC, sizeof header->magic) != 0
+        || header->version != TOKEN_INDEX_VERSION
+        || header->header_size != sizeof *header
+        || header->source_size != source_size)
+    {
+        valid = false;
+        goto done;
+    }
+
+    /* Check the tables lie where they should. The entries in them 
+     * are only checked as they are read, so opening a large index 
+     * doesn't have to touch all of it. 
+     */
+    if (header->tokens_offset != sizeof *header
+        || header->token_count > (index_size - header->tokens_offset) / sizeof(token_index_token_st)
+        || header->lines_offset != header->tokens_offset + header->token_count * sizeof(token_index_token_st)
+        || header->line_count > (index_size - header->lines_offset) / sizeof(token_index_line_st)
+        || header->arena_offset != header->lines_offset + header->line_count * sizeof(token_index_line_st)
+        || header->arena_size != index_size - header->arena_offset)
+    {
+        valid = false;
+        goto done;
+    }
+
+    valid = true;
+
+done:
+    return valid;
+}
+
+token_index_st * token_index_open(char const * const index_filename, char const * const source_filename)
+{
+    token_index_st * index = calloc(1, sizeof *index);
+
+    if (index == NULL)
+    {
+        goto done;
+    }
+
+    if (!mapped_file_open(&index->index_file, index_filename)
+        || !mapped_file_open(&index->source_file, source_filename))
+    {
+        token_index_close(index);
+        index = NULL;
+        goto done;
+    }
+
+    index->header = (token_index_header_st const *)index->index_file.data;
+    if (!index_header_valid(index->header, index->index_file.size, index->source_file.size))
+    {
+        token_index_close(index);
+        index = NULL;
+        goto done;
+    }
+
+    index->tokens = (token_index_token_st const *)(index->index_file.data + index->header->tokens_offset);
+    index->lines = (token_index_line_st const *)(index->index_file.data + index->header->lines_offset);
+    index->arena = index->index_file.data + index->header->arena_offset;
+
+done:
+    return index;
+}
+
+void token_index_close(token_index_st * const index)
+{
+    if (index != NULL)
+    {
+        mapped_file_close(&index->source_file);
+        mapped_file_close(&index->index_file);
+        free(index);
+    }
+}
+
+size_t token_index_line_count(token_index_st const * const index)
+{
+    size_t count;
+
+    if (index == NULL)
+    {
+        count = 0;
+    }
+    else
+    {
+        count = index->header->line_count;
+    }
+
+    return count;
+}
+
+tokeniser_result_t token_index_line_result(token_index_st const * const index, size_t const line)
+{
+    tokeniser_result_t result;
+
+    if (index == NULL || line >= index->header->line_count)
+    {
+        result = tokeniser_result_error;
+    }
+    else
+    {
+        result = (tokeniser_result_t)index->lines[line].result;
+    }
+
+    return result;
+}
+
+size_t token_index_tokens_count(token_index_st const * const index, size_t const line)
+{
+    size_t count;
+
+    if (index == NULL || line >= index->header->line_count)
+    {
+        count = 0;
+    }
+    else
+    {
+        count = index->lines[line].token_count;
+    }
+
+    return count;
+}
+
+static token_index_token_st const * token_entry_get(token_index_st const * const index, size_t const line, size_t const token)
+{
+    /* A corrupt line entry mustn't reach outside the token table. */
+    token_index_token_st const * entry;
+
+    if (index == NULL
+        || line >= index->header->line_count
+        || token >= index->lines[line].token_count
+        || index->lines[line].first_token >= index->header->token_count
+        || token >= index->header->token_count - index->lines[line].first_token)
+    {
+        entry = NULL;
+        goto done;
+    }
+
+    entry = &index->tokens[index->lines[line].first_token + token];
+
+done:
+    return entry;
+}
+
+char const * token_index_get_token(token_index_st const * const index,
+                                   size_t const line,
+                                   size_t const token,
+                                   size_t * const length)
+{
+    char const * text;
+    token_index_token_st const * const entry = token_entry_get(index, line, token);
+    uint64_t offset;
+    uint64_t text_size;
+
+    if (entry == NULL)
+    {
+        text = NULL;
+        goto done;
+    }
+
+    /* The text has to lie within the arena or source file. */
+    offset = entry->text & TOKEN_INDEX_TEXT_OFFSET_MASK;
+    text_size = ((entry->text & TOKEN_INDEX_TEXT_IN_ARENA) != 0) ? index->header->arena_size : index->source_file.size;
+    if (offset > text_size || entry->text_length > text_size - offset)
+    {
+        text = NULL;
+        goto done;
+    }
+
+    if ((entry->text & TOKEN_INDEX_TEXT_IN_ARENA) != 0)
+    {
+        text = index->arena + offset;
+    }
+    else
+    {
+        text = index->source_file.data + offset;
+    }
+    *length = entry->text_length;
+
+done:
+    return text;
+}
+
+char token_index_get_quote_char(token_index_st const * const index, size_t const line, size_t const token)
+{
+    char quote_char;
+    token_index_token_st const * const entry = token_entry_get(index, line, token);
+
+    if (entry == NULL)
+    {
+        quote_char = '\0';
+        goto done;
+    }
+
+    switch ((entry->text & TOKEN_INDEX_QUOTE_MASK) >> TOKEN_INDEX_QUOTE_SHIFT)
+    {
+        case TOKEN_INDEX_QUOTE_SINGLE:
+            quote_char = '\'';
+            break;
+        case TOKEN_INDEX_QUOTE_DOUBLE:
+            quote_char = '\"';
+            break;
+        default:
+            quote_char = '\0';
+            break;
+    }
+
+done:
+    return quote_char;
+}
+
+bool token_index_get_span(token_index_st const * const index,
+                          size_t const line,
+                          size_t const token,
+                          size_t * const start_index,
+                          size_t * const end_index)
+{
+    bool found;
+    token_index_token_st const * const entry = token_entry_get(index, line, token);
+
+    if (entry == NULL
+        || entry->start > index->source_file.size
+        || entry->length > index->source_file.size - entry->start)
+    {
+        found = false;
+        goto done;
+    }
+
+    *start_index = entry->start;
+    *end_index = entry->start + entry->length;
+    found = true;
+
+done:
+    return found;
+}
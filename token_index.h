@@ -0,0 +1,120 @@
+#ifndef __TOKEN_INDEX_H__
+#define __TOKEN_INDEX_H__
+
+#include "tokeniser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A token index records where every token of every line of a
+ * source file lies, so the file can be replayed many times
+ * without tokenising it again. The index is laid out so that it
+ * can be memory mapped and used directly:
+ *
+ *   token_index_header_st
+ *   token_index_token_st[token_count]
+ *   token_index_line_st[line_count]
+ *   arena[arena_size]
+ *
+ * Token text is read from the source file wherever it appears
+ * there unmodified. Only tokens that had quotes stripped from the
+ * middle of them have their text stored in the arena.
+ * All values are in host byte order.
+ */
+
+#define TOKEN_INDEX_MAGIC "TOKIDX\0\0"
+#define TOKEN_INDEX_VERSION 1
+
+typedef struct token_index_header_st
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t source_size; /* The size of the source file the index was built from. */
+    uint64_t token_count;
+    uint64_t line_count;
+    uint64_t tokens_offset;
+    uint64_t lines_offset;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+} token_index_header_st;
+
+/* Flags packed into the top bits of token_index_token_st.text. */
+#define TOKEN_INDEX_TEXT_IN_ARENA (UINT64_C(1) << 63)
+#define TOKEN_INDEX_QUOTE_SHIFT 61
+#define TOKEN_INDEX_QUOTE_MASK (UINT64_C(3) << TOKEN_INDEX_QUOTE_SHIFT)
+#define TOKEN_INDEX_QUOTE_NONE 0
+#define TOKEN_INDEX_QUOTE_SINGLE 1
+#define TOKEN_INDEX_QUOTE_DOUBLE 2
+#define TOKEN_INDEX_TEXT_OFFSET_MASK ((UINT64_C(1) << TOKEN_INDEX_QUOTE_SHIFT) - 1)
+
+typedef struct token_index_token_st
+{
+    uint64_t start; /* The offset of the token in the source file. */
+    uint64_t text; /* The offset of the token text in the source file or arena, plus flags. */
+    uint32_t length; /* The length of the token in the source file, including any quotes. */
+    uint32_t text_length; /* The length of the token text. */
+} token_index_token_st;
+
+typedef struct token_index_line_st
+{
+    uint64_t first_token; /* Index into the token table. */
+    uint32_t token_count;
+    uint32_t result; /* The tokeniser_result_t for the line. */
+} token_index_line_st;
+
+typedef struct token_index_st token_index_st;
+
+/*
+ * Tokenise source_filename and write its index to
+ * index_filename.
+ * Returns: true if the index was written.
+ */
+bool token_index_write(char const * const source_filename, char const * const index_filename);
+
+/*
+ * Map an index and the source file it was built from. Only the
+ * header is checked here, so opening takes the same time whatever
+ * the size of the index. The accessors check each entry they read.
+ * Returns: The index, or NULL if either file couldn't be mapped,
+ * they don't match, or the header is corrupt.
+ */
+token_index_st * token_index_open(char const * const index_filename, char const * const source_filename);
+
+void token_index_close(token_index_st * const index);
+
+size_t token_index_line_count(token_index_st const * const index);
+
+tokeniser_result_t token_index_line_result(token_index_st const * const index, size_t const line);
+
+size_t token_index_tokens_count(token_index_st const * const index, size_t const line);
+
+/*
+ * Returns: The text of a token, which is NOT NUL terminated, or
+ * NULL if line or token is out of range or the entry is corrupt.
+ * The length of the text is written to length.
+ */
+char const * token_index_get_token(token_index_st const * const index,
+                                   size_t const line,
+                                   size_t const token,
+                                   size_t * const length);
+
+/*
+ * Returns: The quote character passed to new_token_cb when the
+ * token was found ('\0' if the token wasn't quoted).
+ */
+char token_index_get_quote_char(token_index_st const * const index, size_t const line, size_t const token);
+
+/*
+ * Get the start and end offsets of a token in the source file,
+ * as passed to new_token_cb.
+ * Returns: false if line or token is out of range or the entry is
+ * corrupt.
+ */
+bool token_index_get_span(token_index_st const * const index,
+                          size_t const line,
+                          size_t const token,
+                          size_t * const start_index,
+                          size_t * const end_index);
+
+#endif /* __TOKEN_INDEX_H__ */
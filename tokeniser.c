@@ -1,57 +1,205 @@
 #include "tokeniser_states.h"
+#include "hash.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
 
-void str_extend(char * * const str, char const new_char)
-{
-    char * existing_str = *str;
-    char new_str[2];
+#define CURRENT_TOKEN_INITIAL_SIZE 32
 
-    new_str[0] = new_char;
-    new_str[1] = '\0';
+bool current_token_append(tokeniser_st * const tokeniser, char const new_char)
+{
+    /* The buffer grows geometrically, so the cost of appending is
+     * constant no matter how long the token gets.
+     */
+    bool appended;
 
-    if (existing_str == NULL)
+    if (tokeniser->current_token_length + 1 >= tokeniser->current_token_size)
     {
-        existing_str = malloc(2);
-        if (existing_str == NULL)
+        size_t const new_size = (tokeniser->current_token_size == 0) ? CURRENT_TOKEN_INITIAL_SIZE : tokeniser->current_token_size * 2;
+        char * const new_token = realloc(tokeniser->current_token, new_size);
+
+        if (new_token == NULL)
         {
+            appended = false;
             goto done;
         }
-        existing_str[0] = '\0';
+        tokeniser->current_token = new_token;
+        tokeniser->current_token_size = new_size;
     }
-    else
+
+    tokeniser->current_token[tokeniser->current_token_length] = new_char;
+    tokeniser->current_token_length++;
+    if (tokeniser->keywords != NULL)
     {
-        /* Allow space for the NUL terminator and the new char. */
-        existing_str = realloc(existing_str, strlen(existing_str) + 2);
-        if (existing_str == NULL)
+        tokeniser->current_token_hash = hash_add_char(tokeniser->current_token_hash, new_char);
+    }
+    if (tokeniser->numbers)
+    {
+        tokeniser_number_scan_char(&tokeniser->current_token_number, new_char);
+    }
+    tokeniser->current_token[tokeniser->current_token_length] = '\0';
+    appended = true;
+
+done:
+    return appended;
+}
+
+bool current_token_append_run(tokeniser_st * const tokeniser, char const * const chars, size_t const length)
+{
+    /* As current_token_append() for each character, but growing the 
+     * buffer at most once. 
+     */
+    bool appended;
+    size_t index;
+
+    if (tokeniser->current_token_length + length >= tokeniser->current_token_size)
+    {
+        size_t new_size = (tokeniser->current_token_size == 0) ? CURRENT_TOKEN_INITIAL_SIZE : tokeniser->current_token_size;
+        char * new_token;
+
+        while (tokeniser->current_token_length + length >= new_size)
         {
+            new_size *= 2;
+        }
+        new_token = realloc(tokeniser->current_token, new_size);
+        if (new_token == NULL)
+        {
+            appended = false;
             goto done;
         }
+        tokeniser->current_token = new_token;
+        tokeniser->current_token_size = new_size;
+    }
+
+    memcpy(&tokeniser->current_token[tokeniser->current_token_length], chars, length);
+    tokeniser->current_token_length += length;
+    tokeniser->current_token[tokeniser->current_token_length] = '\0';
+    for (index = 0; index < length && (tokeniser->keywords != NULL || tokeniser->numbers); index++)
+    {
+        if (tokeniser->keywords != NULL)
+        {
+            tokeniser->current_token_hash = hash_add_char(tokeniser->current_token_hash, chars[index]);
+        }
+        if (tokeniser->numbers)
+        {
+            tokeniser_number_scan_char(&tokeniser->current_token_number, chars[index]);
+        }
+    }
+    appended = true;
+
+done:
+    return appended;
+}
+
+char const * current_token_get(tokeniser_st const * const tokeniser)
+{
+    return (tokeniser->current_token != NULL) ? tokeniser->current_token : "";
+}
+
+void current_token_clear(tokeniser_st * const tokeniser)
+{
+    /* Keep the buffer for the next token. */
+    tokeniser->current_token_length = 0;
+    tokeniser->current_token_hash = HASH_FNV_OFFSET_BASIS;
+    tokeniser_number_scan_init(&tokeniser->current_token_number);
+    tokeniser->current_token_quoted = false;
+    tokeniser->current_token_has_text = false;
+    tokeniser->current_token_separator = NO_SEPARATOR;
+    if (tokeniser->current_token != NULL)
+    {
+        tokeniser->current_token[0] = '\0';
+    }
+}
+
+void current_token_drop_last(tokeniser_st * const tokeniser)
+{
+    /* FNV-1a and the number scan can't be undone a character at a 
+     * time, so start them again. This only happens when a line is 
+     * continued. 
+     */
+    if (tokeniser->current_token_length == 0)
+    {
+        goto done;
+    }
+
+    tokeniser->current_token_length--;
+    tokeniser->current_token[tokeniser->current_token_length] = '\0';
+    tokeniser->current_token_hash = hash_bytes(tokeniser->current_token, tokeniser->current_token_length);
+    if (tokeniser->current_token_separator != NO_SEPARATOR
+        && tokeniser->current_token_separator >= tokeniser->current_token_length)
+    {
+        tokeniser->current_token_separator = NO_SEPARATOR;
     }
+    if (tokeniser->numbers && !tokeniser->current_token_quoted)
+    {
+        size_t index;
 
-    strcat(existing_str, new_str);
+        tokeniser_number_scan_init(&tokeniser->current_token_number);
+        for (index = 0; index < tokeniser->current_token_length; index++)
+        {
+            tokeniser_number_scan_char(&tokeniser->current_token_number, tokeniser->current_token[index]);
+        }
+    }
 
 done:
-    *str = existing_str;
+    return;
+}
+
+void current_token_quoted_set(tokeniser_st * const tokeniser)
+{
+    tokeniser->current_token_quoted = true;
+    tokeniser_number_scan_invalidate(&tokeniser->current_token_number);
+}
+
+void current_token_swap_last(tokeniser_st * const tokeniser)
+{
+    /* Exchange the current token with the last deferred token, 
+     * buffers and all, so neither is copied. 
+     */
+    char * const token = tokeniser->current_token;
+    size_t const length = tokeniser->current_token_length;
+    size_t const size = tokeniser->current_token_size;
+    uint64_t const hash = tokeniser->current_token_hash;
+    tokeniser_number_scan_st const number = tokeniser->current_token_number;
+    size_t const separator = tokeniser->current_token_separator;
+
+    tokeniser->current_token = tokeniser->last_token;
+    tokeniser->current_token_length = tokeniser->last_token_length;
+    tokeniser->current_token_size = tokeniser->last_token_size;
+    tokeniser->current_token_hash = tokeniser->last_token_hash;
+    tokeniser->current_token_number = tokeniser->last_token_number;
+    tokeniser->current_token_separator = tokeniser->last_token_separator;
+    tokeniser->last_token = token;
+    tokeniser->last_token_length = length;
+    tokeniser->last_token_size = size;
+    tokeniser->last_token_hash = hash;
+    tokeniser->last_token_number = number;
+    tokeniser->last_token_separator = separator;
 }
 
 void current_token_free(tokeniser_st * const tokeniser)
 {
     free(tokeniser->current_token);
     tokeniser->current_token = NULL;
+    tokeniser->current_token_length = 0;
+    tokeniser->current_token_size = 0;
 }
 
-void current_token_init(tokeniser_st * const tokeniser, char const first_char)
+void current_token_init(tokeniser_st * const tokeniser)
 {
-    current_token_free(tokeniser);
+    current_token_clear(tokeniser);
     tokeniser->token_start = tokeniser->char_count;
-    if (first_char != '\0')
+}
+
+void tokeniser_limit_hit(tokeniser_st * const tokeniser)
+{
+    if (tokeniser->limit_offset == TOKENISER_NO_LIMIT_OFFSET)
     {
-        str_extend(&tokeniser->current_token, first_char);
+        tokeniser->limit_offset = tokeniser->char_count;
     }
 }
 
@@ -68,6 +216,8 @@ void tokeniser_free(tokeniser_st * const tokeniser)
     }
 
     current_token_free(tokeniser);
+    free(tokeniser->last_token);
+    flight_recorder_free(tokeniser->flight_recorder);
 
     free(tokeniser);
 
@@ -77,17 +227,28 @@ done:
 
 void tokeniser_init(tokeniser_st * const tokeniser)
 {
-    current_token_free(tokeniser);
+    current_token_clear(tokeniser);
+    tokeniser->current_token_discarded = false;
     tokeniser->user_callback = NULL;
     tokeniser->user_arg = NULL;
     tokeniser->char_count = 0;
+    tokeniser->token_count = 0;
+    tokeniser->limit_offset = TOKENISER_NO_LIMIT_OFFSET;
+    tokeniser->previous_char = '\0';
+    tokeniser->last_append_offset = (size_t)-1;
+    tokeniser->projection_next = 0;
+    tokeniser->projection_done = false;
+    tokeniser->token_deferred = false;
+    tokeniser->last_token_pending = false;
+    tokeniser->variable_state = variable_none;
+    tokeniser->line_csv_delimiter = tokeniser->csv_delimiter;
 
     tokeniser_init_fsm(tokeniser);
 }
 
 tokeniser_st * tokeniser_alloc(void)
 {
-    tokeniser_st * tokeniser = malloc(sizeof *tokeniser);
+    tokeniser_st * tokeniser = calloc(1, sizeof *tokeniser);
 
     if (tokeniser == NULL)
     {
@@ -95,12 +256,88 @@ tokeniser_st * tokeniser_alloc(void)
     }
 
     tokeniser->current_token = NULL;
+    tokeniser->flight_recorder = NULL;
     tokeniser_init(tokeniser);
+    tokeniser_stream_init(tokeniser);
 
 done:
     return tokeniser;
 }
 
+/* A tokeniser as tokeniser_alloc() leaves it, built once and copied 
+ * by tokeniser_reset(). 
+ */
+static tokeniser_st reset_template;
+static pthread_once_t reset_template_once = PTHREAD_ONCE_INIT;
+
+static void reset_template_build(void)
+{
+    tokeniser_init(&reset_template);
+    tokeniser_stream_init(&reset_template);
+}
+
+void tokeniser_reset(tokeniser_st * const tokeniser)
+{
+    /* Copy the template rather than running the init transitions 
+     * again. The copy mustn't take the token buffers, and the FSM 
+     * has to use this tokeniser's event handlers, not the 
+     * template's. 
+     */
+    char * const current_token = tokeniser->current_token;
+    size_t const current_token_size = tokeniser->current_token_size;
+    char * const last_token = tokeniser->last_token;
+    size_t const last_token_size = tokeniser->last_token_size;
+
+    pthread_once(&reset_template_once, reset_template_build);
+
+    /* The cache only holds values while there is a lookup, as 
+     * setting the variables empties it. 
+     */
+    if (tokeniser->variable_lookup != NULL)
+    {
+        tokeniser_variables_set(tokeniser, NULL, NULL);
+    }
+    flight_recorder_free(tokeniser->flight_recorder);
+    memcpy(tokeniser, &reset_template, offsetof(tokeniser_st, variable_cache));
+    tokeniser->fsm.current_state.event_handlers = &tokeniser->event_handlers;
+
+    tokeniser->current_token = current_token;
+    tokeniser->current_token_size = current_token_size;
+    if (current_token != NULL)
+    {
+        current_token[0] = '\0';
+    }
+    tokeniser->last_token = last_token;
+    tokeniser->last_token_size = last_token_size;
+}
+
+static event_code_t tokeniser_csv_event_from_char_get(char const ch, char const delimiter)
+{
+    /* In the CSV dialect spaces and '\'' are ordinary characters, 
+     * and '"' is the only quote. 
+     */
+    event_code_t event_code;
+
+    if (ch == '\0')
+    {
+        event_code = event_nul;
+    }
+    else if (ch == delimiter)
+    {
+        event_code = event_delimiter;
+    }
+    else if (ch == '\"')
+    {
+        event_code = event_double_quote;
+    }
+    else
+    {
+        event_code = event_regular_char;
+    }
+
+    return event_code;
+}
+
 static event_code_t tokeniser_event_from_char_get(char const ch)
 {
     event_code_t event_code;
@@ -152,15 +389,185 @@ tokeniser_result_t tokeniser_feed(tokeniser_st * const tokeniser,
     tokeniser->result = tokeniser_result_continue;
 
     /* Construct the event. */
-    tokeniser_event.code = tokeniser_event_from_char_get(next_char);
+    if (tokeniser->line_csv_delimiter != '\0')
+    {
+        tokeniser_event.code = tokeniser_csv_event_from_char_get(next_char, tokeniser->line_csv_delimiter);
+    }
+    else
+    {
+        tokeniser_event.code = tokeniser_event_from_char_get(next_char);
+    }
     tokeniser_event.current_char = next_char; 
 
-    tokeniser_dispatch(tokeniser, &tokeniser_event);
+    if (next_char != '\0'
+        && tokeniser->limits.max_line_bytes != 0
+        && tokeniser->char_count == tokeniser->limits.max_line_bytes)
+    {
+        tokeniser_line_limit_exceeded(tokeniser);
+    }
+    else if (tokeniser->variable_lookup == NULL
+             || tokeniser->line_csv_delimiter != '\0'
+             || !tokeniser_variable_feed(tokeniser, (char)next_char))
+    {
+        tokeniser_dispatch(tokeniser, &tokeniser_event);
+    }
+    if (tokeniser->projecting)
+    {
+        tokeniser_projection_update(tokeniser);
+    }
 
+    tokeniser->previous_char = (char)next_char;
     tokeniser->char_count++; /* Update the number of characters processed. */
 
     result = tokeniser->result;
 
+    if (tokeniser->flight_recorder != NULL
+        && tokeniser->flight_recorder->auto_dump_stream != NULL
+        && (result == tokeniser_result_incomplete_token || result == tokeniser_result_error))
+    {
+        flight_recorder_dump(tokeniser->flight_recorder, tokeniser->flight_recorder->auto_dump_stream);
+    }
+
 done:
     return result;
 }
+
+void tokeniser_limits_set(tokeniser_st * const tokeniser, tokeniser_limits_st const * const limits)
+{
+    if (limits == NULL)
+    {
+        memset(&tokeniser->limits, 0, sizeof tokeniser->limits);
+    }
+    else
+    {
+        tokeniser->limits = *limits;
+    }
+}
+
+size_t tokeniser_limit_offset_get(tokeniser_st const * const tokeniser)
+{
+    return tokeniser->limit_offset;
+}
+
+void tokeniser_continuation_set(tokeniser_st * const tokeniser, bool const enabled)
+{
+    tokeniser->continuation = enabled;
+}
+
+void tokeniser_csv_set(tokeniser_st * const tokeniser, char const delimiter)
+{
+    /* Takes effect from the next tokeniser_init(). */
+    tokeniser->csv_delimiter = delimiter;
+    tokeniser->continuation = (delimiter != '\0');
+}
+
+void tokeniser_projection_set(tokeniser_st * const tokeniser,
+                              size_t const * const indices,
+                              size_t const index_count,
+                              bool const last)
+{
+    tokeniser->projecting = (indices != NULL || last);
+    tokeniser->projection = indices;
+    tokeniser->projection_count = (indices != NULL) ? index_count : 0;
+    tokeniser->projection_last = last;
+}
+
+void tokeniser_keywords_set(tokeniser_st * const tokeniser, tokeniser_keywords_st const * const keywords)
+{
+    tokeniser->keywords = keywords;
+    tokeniser->current_token_hash = hash_bytes(current_token_get(tokeniser), tokeniser->current_token_length);
+}
+
+int tokeniser_token_keyword_get(tokeniser_st const * const tokeniser)
+{
+    int keyword;
+
+    if (tokeniser->keywords == NULL)
+    {
+        keyword = TOKENISER_KEYWORD_NONE;
+        goto done;
+    }
+
+    keyword = tokeniser_keywords_match(tokeniser->keywords,
+                                       tokeniser->current_token_hash,
+                                       current_token_get(tokeniser),
+                                       tokeniser->current_token_length);
+
+done:
+    return keyword;
+}
+
+void tokeniser_numbers_set(tokeniser_st * const tokeniser, bool const enabled)
+{
+    /* Only tokens started from now on are parsed. */
+    tokeniser->numbers = enabled;
+    tokeniser_number_scan_invalidate(&tokeniser->current_token_number);
+}
+
+bool tokeniser_token_number_get(tokeniser_st const * const tokeniser, tokeniser_number_st * const number)
+{
+    bool is_number;
+
+    if (!tokeniser->numbers)
+    {
+        number->kind = tokeniser_number_none;
+        is_number = false;
+        goto done;
+    }
+
+    is_number = tokeniser_number_scan_finish(&tokeniser->current_token_number, current_token_get(tokeniser), number);
+
+done:
+    return is_number;
+}
+
+void tokeniser_key_values_set(tokeniser_st * const tokeniser, bool const enabled)
+{
+    /* Only tokens started from now on are split. */
+    tokeniser->key_values = enabled;
+}
+
+bool tokeniser_token_key_value_get(tokeniser_st const * const tokeniser, tokeniser_key_value_st * const key_value)
+{
+    /* The '=' was found as the token was built, so neither half is 
+     * searched for or copied. 
+     */
+    char const * const token = current_token_get(tokeniser);
+    size_t const separator = tokeniser->current_token_separator;
+    bool is_key_value;
+
+    if (!tokeniser->key_values || separator == NO_SEPARATOR)
+    {
+        key_value->key = token;
+        key_value->key_length = tokeniser->current_token_length;
+        key_value->value = NULL;
+        key_value->value_length = 0;
+        is_key_value = false;
+        goto done;
+    }
+
+    key_value->key = token;
+    key_value->key_length = separator;
+    key_value->value = token + separator + 1;
+    key_value->value_length = tokeniser->current_token_length - separator - 1;
+    is_key_value = true;
+
+done:
+    return is_key_value;
+}
+
+void tokeniser_variables_set(tokeniser_st * const tokeniser,
+                             tokeniser_variable_lookup_cb const lookup,
+                             void * const lookup_arg)
+{
+    /* The cached values may not be valid for the new lookup. */
+    size_t index;
+
+    tokeniser->variable_lookup = lookup;
+    tokeniser->variable_lookup_arg = lookup_arg;
+    tokeniser->variable_state = variable_none;
+    for (index = 0; index < VARIABLE_CACHE_SIZE; index++)
+    {
+        tokeniser->variable_cache[index].valid = false;
+    }
+}
@@ -1,8 +1,16 @@
 #ifndef __TOKENISER_H__
 #define __TOKENISER_H__
 
+#include "tokeniser_keywords.h"
+#include "tokeniser_number.h"
+
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef enum tokeniser_result_t
 {
@@ -10,9 +18,48 @@ typedef enum tokeniser_result_t
     tokeniser_result_ok, /* A complete line has been scanned up to EOF or the line ending ('\n'). */
     tokeniser_result_already_done, /* The tokeniser was called after the tokeniser has completed tokenising a line. */
     tokeniser_result_incomplete_token, /* EOF or EOL was hit before the current (quoted) token was completed. */
-    tokeniser_result_error /* Some other error. */
+    tokeniser_result_error, /* Some other error. */
+    tokeniser_result_limit_exceeded, /* The line exceeded one of the tokeniser limits. */
+    tokeniser_result_need_more_input /* Continuation mode only. The line ended inside quotes or after a trailing '\\'. */
 } tokeniser_result_t;
 
+typedef enum tokeniser_limit_policy_t
+{
+    tokeniser_limit_policy_fail, /* Abandon the line with tokeniser_result_limit_exceeded. */
+    tokeniser_limit_policy_truncate /* Drop whatever is over the limit and carry on. */
+} tokeniser_limit_policy_t;
+
+/* Limits on the input the tokeniser will accept. 0 means no
+ * limit. When truncating, excess token characters and excess
+ * tokens are dropped, and a line that is too long ends at the
+ * limit. The NUL ending a line doesn't count towards
+ * max_line_bytes.
+ */
+typedef struct tokeniser_limits_st
+{
+    size_t max_token_bytes;
+    size_t max_tokens_per_line;
+    size_t max_line_bytes;
+    tokeniser_limit_policy_t policy;
+} tokeniser_limits_st;
+
+#define TOKENISER_NO_LIMIT_OFFSET ((size_t)-1)
+
+/* The two halves of a key=value token. The spans point into the 
+ * token passed to the new_token_cb, so are only valid during the 
+ * call. The value is NUL terminated, but the key isn't. 
+ */
+typedef struct tokeniser_key_value_st
+{
+    char const * key;
+    size_t key_length;
+    char const * value;
+    size_t value_length;
+} tokeniser_key_value_st;
+
+/* Variable names longer than this aren't expanded. */
+#define TOKENISER_VARIABLE_NAME_MAX 63
+
 
 typedef struct tokeniser_st tokeniser_st;
 typedef int (* getc_cb)(void * const user_context);
@@ -33,6 +80,16 @@ tokeniser_st * tokeniser_alloc(void);
  */
 void tokeniser_init(tokeniser_st * const tokeniser);
 
+/*  
+ * Return the tokeniser to the state tokeniser_alloc() leaves it in: 
+ * ready for a new line, with every setting back to its default and 
+ * any flight recorder freed. The memory for tokens is kept. This 
+ * copies a prebuilt tokeniser, so it is cheaper than 
+ * tokeniser_init(), and costs the same however the tokeniser was 
+ * used. 
+ */
+void tokeniser_reset(tokeniser_st * const tokeniser);
+
 /*  
  * Frees the tokeniser. 
 */ 
@@ -54,5 +111,175 @@ tokeniser_result_t tokeniser_feed(tokeniser_st * const tokeniser,
                                   new_token_cb const user_callback, 
                                   void * const user_arg);
 
+/*  
+ * Set the limits applied to each line. Pass NULL to remove all 
+ * limits. 
+*/ 
+void tokeniser_limits_set(tokeniser_st * const tokeniser, tokeniser_limits_st const * const limits);
+
+/*  
+ * Return value: The offset in the current line of the character 
+ * at which a limit was first exceeded, or 
+ * TOKENISER_NO_LIMIT_OFFSET if no limit has been exceeded. 
+*/ 
+size_t tokeniser_limit_offset_get(tokeniser_st const * const tokeniser);
+
+/*  
+ * Enable or disable continuation mode. In continuation mode, a 
+ * line that ends inside quotes, or with a '\\' outside them, 
+ * gives tokeniser_result_need_more_input rather than ending the 
+ * line. The partial token is kept, and feeding the next line 
+ * carries on from where the tokeniser stopped. Inside quotes the 
+ * line break becomes a '\n' in the token. A trailing '\\' is 
+ * dropped and the next line joined on directly. Offsets count 
+ * the NUL that ended each line as one character. 
+*/ 
+void tokeniser_continuation_set(tokeniser_st * const tokeniser, bool const enabled);
+
+/*  
+ * Select the CSV/TSV dialect, or the default whitespace dialect. 
+ * In the CSV dialect tokens are the fields between delimiters: 
+ * consecutive delimiters give empty fields, spaces are part of a 
+ * field, and only '"' quotes. Inside a quoted field, "" is an 
+ * escaped '"' and delimiters and line breaks are part of the 
+ * field. A '\r' ending a line is dropped, and a blank line has 
+ * no fields. Quoted fields are passed on with quote_char '"'. 
+ * Takes effect from the next call to tokeniser_init(). 
+ * @delimiter: The field delimiter, such as ',' or '\t', or '\0' 
+ * for the whitespace dialect. Selecting the CSV dialect enables 
+ * continuation mode, so a quoted field can span lines, and 
+ * selecting the whitespace dialect disables it. 
+*/ 
+void tokeniser_csv_set(tokeniser_st * const tokeniser, char const delimiter);
+
+/*  
+ * Only pass on selected tokens of each line, like cut -f. Other 
+ * tokens are scanned but not copied. Once the highest wanted 
+ * token is complete the line ends with tokeniser_result_ok, 
+ * without the rest of it being scanned, and 
+ * tokeniser_feed_buffer() skips straight to the next '\n'. 
+ * @indices: The indices (from 0) of the tokens wanted, in 
+ * ascending order. Must stay valid while set. Pass NULL, with 
+ * last false, to pass on every token again. 
+ * @index_count: The number of indices. 
+ * @last: The last token of each line is wanted too. As any token 
+ * might turn out to be the last, the tokens that aren't wanted 
+ * are copied too (though not passed on), and the whole line is 
+ * scanned. 
+*/ 
+void tokeniser_projection_set(tokeniser_st * const tokeniser, 
+                              size_t const * const indices, 
+                              size_t const index_count, 
+                              bool const last);
+
+/*  
+ * Recognise keywords as tokens are found. The hash of each token 
+ * is built as its characters are added, so finding whether it is 
+ * a keyword needs no second pass over it. Pass NULL to stop 
+ * recognising keywords. 
+ * @keywords: Must stay valid while set. It may be shared by any 
+ * number of tokenisers. 
+*/ 
+void tokeniser_keywords_set(tokeniser_st * const tokeniser, tokeniser_keywords_st const * const keywords);
+
+/*  
+ * Only valid during a call to a new_token_cb. 
+ * Return value: The id of the keyword matching the token passed to 
+ * the new_token_cb, or TOKENISER_KEYWORD_NONE if it isn't a 
+ * keyword or no keywords are set. 
+*/ 
+int tokeniser_token_keyword_get(tokeniser_st const * const tokeniser);
+
+/*  
+ * Enable or disable parsing numeric tokens as they are built. Only 
+ * unquoted tokens are parsed. 
+*/ 
+void tokeniser_numbers_set(tokeniser_st * const tokeniser, bool const enabled);
+
+/*  
+ * Only valid during a call to a new_token_cb, when numbers are 
+ * being parsed. 
+ * @number: Set to the value of the token passed to the 
+ * new_token_cb. Its kind is tokeniser_number_none if it isn't a 
+ * number. 
+ * Return value: true if the token is a number. 
+*/ 
+bool tokeniser_token_number_get(tokeniser_st const * const tokeniser, tokeniser_number_st * const number);
+
+/*  
+ * Enable or disable splitting key=value tokens as they are built. 
+ * A token is split at its first '=' outside quotes, so name="a b" 
+ * has the key name and the value a b, while "a=b" and x'='y aren't 
+ * split. An '=' from an expanded variable doesn't split a token 
+ * either. Only applies to the whitespace dialect. 
+*/ 
+void tokeniser_key_values_set(tokeniser_st * const tokeniser, bool const enabled);
+
+/*  
+ * Only valid during a call to a new_token_cb, when key=value tokens 
+ * are being split. 
+ * @key_value: Set to the key and value of the token passed to the 
+ * new_token_cb. 
+ * Return value: true if the token has an '=' to split it at. 
+*/ 
+bool tokeniser_token_key_value_get(tokeniser_st const * const tokeniser, tokeniser_key_value_st * const key_value);
+
+/*  
+ * Looks up a variable being expanded. 
+ * @name: The NUL terminated variable name. 
+ * Return value: The value, or NULL if the variable isn't defined. 
+ * Values are cached, so must stay valid and unchanged until the 
+ * variables are next set. 
+*/ 
+typedef char const * (* tokeniser_variable_lookup_cb)(char const * const name, void * const lookup_arg);
+
+/*  
+ * Expand $NAME and ${NAME} as tokens are built, the way a shell 
+ * does: in unquoted text and inside '"', but not inside '\''. The 
+ * value replaces the reference in the token, and an undefined 
+ * variable expands to nothing. As in a shell, an unquoted token 
+ * made up only of references that expand to nothing is dropped 
+ * (and not counted), while "$UNDEFINED" is an empty token. A '$' 
+ * that isn't followed by a name or a '{', and a ${ that isn't 
+ * closed by a '}' after the name, are kept as they are. The 
+ * token's start and end indexes still refer to the characters fed, 
+ * not the expanded text. Only applies to the whitespace dialect. 
+ * Pass a NULL lookup to stop expanding. 
+ * @lookup: Called with each name not already in the tokeniser's 
+ * small cache of recent lookups. 
+ * @lookup_arg: Passed to lookup. 
+*/ 
+void tokeniser_variables_set(tokeniser_st * const tokeniser, 
+                             tokeniser_variable_lookup_cb const lookup, 
+                             void * const lookup_arg);
+
+/*  
+ * Start recording the events dispatched to the tokeniser FSM in a 
+ * ring buffer. Recording continues across lines until 
+ * tokeniser_flight_recorder_disable() is called. 
+ * @entry_count: The number of events to keep (rounded up to a 
+ * power of 2). 
+ * @auto_dump_stream: If not NULL, the recorded events are dumped 
+ * here whenever a line ends with tokeniser_result_incomplete_token 
+ * or tokeniser_result_error. 
+ * Return value: false if the buffer couldn't be allocated. 
+*/ 
+bool tokeniser_flight_recorder_enable(tokeniser_st * const tokeniser, 
+                                      size_t const entry_count, 
+                                      FILE * const auto_dump_stream);
+
+/*  
+ * Stop recording events and free the recorded events. 
+*/ 
+void tokeniser_flight_recorder_disable(tokeniser_st * const tokeniser);
+
+/*  
+ * Write the recorded events, oldest first, to stream. 
+*/ 
+void tokeniser_flight_recorder_dump(tokeniser_st const * const tokeniser, FILE * const stream);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* __TOKENISER_H__ */
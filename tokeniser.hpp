@@ -0,0 +1,257 @@
+#ifndef __TOKENISER_HPP__
+#define __TOKENISER_HPP__
+
+#include "tokeniser.h"
+#include "tokeniser_scan.h"
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/* Header-only C++20 wrappers for the tokeniser. */
+namespace tokeniser
+{
+
+struct token
+{
+    std::string_view text; /* Quotes stripped. */
+    std::size_t start; /* As passed to new_token_cb. */
+    std::size_t end; /* As passed to new_token_cb. */
+    char quote; /* '\0' unless the token was quoted. */
+    bool incomplete; /* The record ended inside quotes. */
+};
+
+/* Owns a tokeniser_st. */
+class handle
+{
+public:
+    handle()
+        : tokeniser_(tokeniser_alloc())
+    {
+        if (tokeniser_ == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~handle()
+    {
+        tokeniser_free(tokeniser_);
+    }
+
+    handle(handle const &) = delete;
+    handle & operator=(handle const &) = delete;
+
+    handle(handle && other) noexcept
+        : tokeniser_(std::exchange(other.tokeniser_, nullptr))
+    {
+    }
+
+    handle & operator=(handle && other) noexcept
+    {
+        std::swap(tokeniser_, other.tokeniser_);
+        return *this;
+    }
+
+    tokeniser_st * get() const noexcept
+    {
+        return tokeniser_;
+    }
+
+    /* Tokenise a line, calling callback(token const &) for each
+     * token. The text of the token is only valid during the call.
+     */
+    template <typename Callback>
+    tokeniser_result_t feed(std::string_view const line, Callback && callback)
+    {
+        tokeniser_result_t result = tokeniser_result_continue;
+
+        tokeniser_init(tokeniser_);
+        for (std::size_t index = 0; index < line.size() && result == tokeniser_result_continue; index++)
+        {
+            result = tokeniser_feed(tokeniser_, line[index], &handle::trampoline<Callback>, &callback);
+        }
+        if (result == tokeniser_result_continue)
+        {
+            result = tokeniser_feed(tokeniser_, '\0', &handle::trampoline<Callback>, &callback);
+        }
+
+        return result;
+    }
+
+private:
+    template <typename Callback>
+    static bool trampoline(char const * const text,
+                           std::size_t const start_index,
+                           std::size_t const end_index,
+                           char const quote_char,
+                           void * const user_arg)
+    {
+        (*static_cast<std::remove_reference_t<Callback> *>(user_arg))(token{ text, start_index, end_index, quote_char, false });
+        return true;
+    }
+
+    tokeniser_st * tokeniser_;
+};
+
+/* A lazy forward range over the tokens of a record. Tokens are
+ * found as the range is iterated. Their text refers to the record
+ * unless quotes had to be stripped from within them, in which
+ * case it refers to a copy held by the iterator, valid until the
+ * iterator is next changed.
+ */
+class view : public std::ranges::view_interface<view>
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = token;
+        using difference_type = std::ptrdiff_t;
+        using pointer = token const *;
+        using reference = token const &;
+
+        iterator() = default;
+
+        iterator(std::string_view const record, bool const at_end)
+            : record_(record)
+            , offset_(at_end ? record.size() : 0)
+            , at_end_(at_end)
+        {
+            if (!at_end_)
+            {
+                next();
+            }
+        }
+
+        iterator(iterator const & other)
+            : record_(other.record_)
+            , offset_(other.offset_)
+            , at_end_(other.at_end_)
+            , current_(other.current_)
+            , stripped_(other.stripped_)
+        {
+            rebind(other);
+        }
+
+        iterator & operator=(iterator const & other)
+        {
+            if (this != &other)
+            {
+                record_ = other.record_;
+                offset_ = other.offset_;
+                at_end_ = other.at_end_;
+                current_ = other.current_;
+                stripped_ = other.stripped_;
+                rebind(other);
+            }
+            return *this;
+        }
+
+        reference operator*() const noexcept
+        {
+            return current_;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &current_;
+        }
+
+        iterator & operator++()
+        {
+            next();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator previous = *this;
+            next();
+            return previous;
+        }
+
+        friend bool operator==(iterator const & left, iterator const & right) noexcept
+        {
+            return left.at_end_ == right.at_end_ && (left.at_end_ || left.current_.start == right.current_.start);
+        }
+
+    private:
+        void next()
+        {
+            tokeniser_scan_token_st scanned;
+
+            if (!tokeniser_scan_next(record_.data(), record_.size(), &offset_, &scanned))
+            {
+                at_end_ = true;
+                return;
+            }
+
+            if (scanned.needs_copy)
+            {
+                /* Only tokens with quotes inside them are copied. */
+                stripped_.resize(scanned.text_length);
+                tokeniser_scan_copy(record_.data(), &scanned, stripped_.data());
+                current_.text = stripped_;
+            }
+            else
+            {
+                current_.text = std::string_view(scanned.text, scanned.text_length);
+            }
+            current_.start = scanned.start_index;
+            current_.end = scanned.end_index;
+            current_.quote = scanned.quote_char;
+            current_.incomplete = scanned.incomplete;
+        }
+
+        void rebind(iterator const & other)
+        {
+            /* The text of a stripped token must refer to this
+             * iterator's copy rather than the other's.
+             */
+            if (!other.current_.text.empty() && other.current_.text.data() == other.stripped_.data())
+            {
+                current_.text = stripped_;
+            }
+        }
+
+        std::string_view record_;
+        std::size_t offset_ = 0;
+        bool at_end_ = true;
+        token current_ {};
+        std::string stripped_;
+    };
+
+    view() = default;
+
+    explicit view(std::string_view const record)
+        : record_(record)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(record_, false);
+    }
+
+    iterator end() const
+    {
+        return iterator(record_, true);
+    }
+
+private:
+    std::string_view record_;
+};
+
+} /* namespace tokeniser */
+
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<tokeniser::view> = true;
+
+#endif /* __TOKENISER_HPP__ */
@@ -7,6 +7,17 @@ MKDIR=mkdir
 
 # -----Begin user-editable area-----
 
+# zstd input is decompressed if libzstd is found by pkg-config.
+# Build with ZSTD=0 to leave it out, or ZSTD=1 to require it.
+# Rebuild after changing this.
+ifndef ZSTD
+ZSTD:=$(shell pkg-config --exists libzstd 2>/dev/null && echo 1)
+endif
+ifeq "$(ZSTD)" "1"
+ZSTD_INC=-DHAVE_ZSTD $(shell pkg-config --cflags libzstd 2>/dev/null)
+ZSTD_LIB=$(or $(shell pkg-config --libs libzstd 2>/dev/null),-lzstd)
+endif
+
 # -----End user-editable area-----
 
 # If no configuration is specified, "Debug" will be used
@@ -20,29 +31,55 @@ endif
 ifeq "$(CFG)" "Debug"
 OUTDIR=Debug
 OUTFILE=$(OUTDIR)/tokeniser
-CFG_INC=
-CFG_LIB=
+CFG_INC=$(ZSTD_INC)
+CFG_LIB=-lpthread -lz $(ZSTD_LIB)
 CFG_OBJ=
-COMMON_OBJ=$(OUTDIR)/fsm_class.o $(OUTDIR)/main.o \
-	$(OUTDIR)/tokeniser.o $(OUTDIR)/tokeniser_states.o \
+COMMON_OBJ=$(OUTDIR)/flight_recorder.o $(OUTDIR)/fsm_class.o \
+	$(OUTDIR)/main.o $(OUTDIR)/tokeniser.o \
+	$(OUTDIR)/tokeniser_batch.o $(OUTDIR)/tokeniser_cache.o \
+	$(OUTDIR)/tokeniser_decompress.o $(OUTDIR)/tokeniser_keywords.o \
+	$(OUTDIR)/tokeniser_number.o $(OUTDIR)/tokeniser_parallel.o \
+	$(OUTDIR)/tokeniser_pipeline.o $(OUTDIR)/tokeniser_pool.o \
+	$(OUTDIR)/tokeniser_run.o $(OUTDIR)/tokeniser_scan.o \
+	$(OUTDIR)/tokeniser_states.o $(OUTDIR)/tokeniser_structural.o \
+	$(OUTDIR)/tokeniser_table.o $(OUTDIR)/token_counts.o \
+	$(OUTDIR)/token_dictionary.o $(OUTDIR)/token_index.o \
 	$(OUTDIR)/tokens.o 
 OBJ=$(COMMON_OBJ) $(CFG_OBJ)
-ALL_OBJ=$(OUTDIR)/fsm_class.o $(OUTDIR)/main.o $(OUTDIR)/tokeniser.o \
-	$(OUTDIR)/tokeniser_states.o $(OUTDIR)/tokens.o 
+ALL_OBJ=$(OUTDIR)/flight_recorder.o $(OUTDIR)/fsm_class.o $(OUTDIR)/main.o \
+	$(OUTDIR)/tokeniser.o $(OUTDIR)/tokeniser_batch.o \
+	$(OUTDIR)/tokeniser_cache.o $(OUTDIR)/tokeniser_decompress.o \
+	$(OUTDIR)/tokeniser_keywords.o $(OUTDIR)/tokeniser_number.o \
+	$(OUTDIR)/tokeniser_parallel.o $(OUTDIR)/tokeniser_pipeline.o \
+	$(OUTDIR)/tokeniser_pool.o $(OUTDIR)/tokeniser_run.o \
+	$(OUTDIR)/tokeniser_scan.o $(OUTDIR)/tokeniser_states.o \
+	$(OUTDIR)/tokeniser_structural.o $(OUTDIR)/tokeniser_table.o \
+	$(OUTDIR)/token_counts.o $(OUTDIR)/token_dictionary.o \
+	$(OUTDIR)/token_index.o $(OUTDIR)/tokens.o 
 
 COMPILE=gcc -c   -g -Wall -Wextra -o "$(OUTDIR)/$(*F).o" $(CFG_INC) $<
-LINK=gcc  -g -o "$(OUTFILE)" $(ALL_OBJ)
+LINK=gcc  -g -o "$(OUTFILE)" $(ALL_OBJ) $(CFG_LIB)
+CHECK_OUTFILE=$(OUTDIR)/tokeniser_coro_check
+CHECK_LINK=g++ -std=c++20 -g -Wall -Wextra -o "$(CHECK_OUTFILE)" $(CFG_INC) tokeniser_coro_check.cpp $(filter-out $(OUTDIR)/main.o,$(ALL_OBJ)) $(CFG_LIB)
 
 # Pattern rules
 $(OUTDIR)/%.o : %.c
 	$(COMPILE)
 
 # Build rules
-all: $(OUTFILE)
+all: $(OUTFILE) $(CHECK_OUTFILE)
 
 $(OUTFILE): $(OUTDIR)  $(OBJ)
 	$(LINK)
 
+$(CHECK_OUTFILE): $(OUTDIR)  $(OBJ) tokeniser_coro_check.cpp tokeniser_coro.hpp tokeniser.hpp
+	$(CHECK_LINK)
+
+# Run the checks
+check: all
+	"$(OUTFILE)"
+	"$(CHECK_OUTFILE)"
+
 $(OUTDIR):
 	$(MKDIR) -p "$(OUTDIR)"
 
@@ -52,6 +89,7 @@ rebuild: cleanall all
 # Clean this project
 clean:
 	$(RM) -f $(OUTFILE)
+	$(RM) -f $(CHECK_OUTFILE)
 	$(RM) -f $(OBJ)
 
 # Clean this project and all dependencies
@@ -64,29 +102,55 @@ endif
 ifeq "$(CFG)" "Release"
 OUTDIR=Release
 OUTFILE=$(OUTDIR)/tokeniser
-CFG_INC=
-CFG_LIB=
+CFG_INC=$(ZSTD_INC)
+CFG_LIB=-lpthread -lz $(ZSTD_LIB)
 CFG_OBJ=
-COMMON_OBJ=$(OUTDIR)/fsm_class.o $(OUTDIR)/main.o \
-	$(OUTDIR)/tokeniser.o $(OUTDIR)/tokeniser_states.o \
+COMMON_OBJ=$(OUTDIR)/flight_recorder.o $(OUTDIR)/fsm_class.o \
+	$(OUTDIR)/main.o $(OUTDIR)/tokeniser.o \
+	$(OUTDIR)/tokeniser_batch.o $(OUTDIR)/tokeniser_cache.o \
+	$(OUTDIR)/tokeniser_decompress.o $(OUTDIR)/tokeniser_keywords.o \
+	$(OUTDIR)/tokeniser_number.o $(OUTDIR)/tokeniser_parallel.o \
+	$(OUTDIR)/tokeniser_pipeline.o $(OUTDIR)/tokeniser_pool.o \
+	$(OUTDIR)/tokeniser_run.o $(OUTDIR)/tokeniser_scan.o \
+	$(OUTDIR)/tokeniser_states.o $(OUTDIR)/tokeniser_structural.o \
+	$(OUTDIR)/tokeniser_table.o $(OUTDIR)/token_counts.o \
+	$(OUTDIR)/token_dictionary.o $(OUTDIR)/token_index.o \
 	$(OUTDIR)/tokens.o 
 OBJ=$(COMMON_OBJ) $(CFG_OBJ)
-ALL_OBJ=$(OUTDIR)/fsm_class.o $(OUTDIR)/main.o $(OUTDIR)/tokeniser.o \
-	$(OUTDIR)/tokeniser_states.o $(OUTDIR)/tokens.o 
+ALL_OBJ=$(OUTDIR)/flight_recorder.o $(OUTDIR)/fsm_class.o $(OUTDIR)/main.o \
+	$(OUTDIR)/tokeniser.o $(OUTDIR)/tokeniser_batch.o \
+	$(OUTDIR)/tokeniser_cache.o $(OUTDIR)/tokeniser_decompress.o \
+	$(OUTDIR)/tokeniser_keywords.o $(OUTDIR)/tokeniser_number.o \
+	$(OUTDIR)/tokeniser_parallel.o $(OUTDIR)/tokeniser_pipeline.o \
+	$(OUTDIR)/tokeniser_pool.o $(OUTDIR)/tokeniser_run.o \
+	$(OUTDIR)/tokeniser_scan.o $(OUTDIR)/tokeniser_states.o \
+	$(OUTDIR)/tokeniser_structural.o $(OUTDIR)/tokeniser_table.o \
+	$(OUTDIR)/token_counts.o $(OUTDIR)/token_dictionary.o \
+	$(OUTDIR)/token_index.o $(OUTDIR)/tokens.o 
 
 COMPILE=gcc -c   -Wall -Wextra -o "$(OUTDIR)/$(*F).o" $(CFG_INC) $<
-LINK=gcc  -o "$(OUTFILE)" $(ALL_OBJ)
+LINK=gcc  -o "$(OUTFILE)" $(ALL_OBJ) $(CFG_LIB)
+CHECK_OUTFILE=$(OUTDIR)/tokeniser_coro_check
+CHECK_LINK=g++ -std=c++20 -Wall -Wextra -o "$(CHECK_OUTFILE)" $(CFG_INC) tokeniser_coro_check.cpp $(filter-out $(OUTDIR)/main.o,$(ALL_OBJ)) $(CFG_LIB)
 
 # Pattern rules
 $(OUTDIR)/%.o : %.c
 	$(COMPILE)
 
 # Build rules
-all: $(OUTFILE)
+all: $(OUTFILE) $(CHECK_OUTFILE)
 
 $(OUTFILE): $(OUTDIR)  $(OBJ)
 	$(LINK)
 
+$(CHECK_OUTFILE): $(OUTDIR)  $(OBJ) tokeniser_coro_check.cpp tokeniser_coro.hpp tokeniser.hpp
+	$(CHECK_LINK)
+
+# Run the checks
+check: all
+	"$(OUTFILE)"
+	"$(CHECK_OUTFILE)"
+
 $(OUTDIR):
 	$(MKDIR) -p "$(OUTDIR)"
 
@@ -96,6 +160,7 @@ rebuild: cleanall all
 # Clean this project
 clean:
 	$(RM) -f $(OUTFILE)
+	$(RM) -f $(CHECK_OUTFILE)
 	$(RM) -f $(OBJ)
 
 # Clean this project and all dependencies
@@ -0,0 +1,200 @@
+#include "tokeniser_batch.h"
+#include "tokeniser_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ENTRY_INDEX(state, char_class) ((state) * table_class_count + (char_class))
+
+/* What each action does to a line's token, as values to mix in
+ * arithmetically rather than cases to branch on.
+ */
+typedef struct batch_action_effect_st
+{
+    uint8_t starts; /* A token starts here. */
+    uint8_t skips_quote; /* The token's text starts after this character. */
+    uint8_t keeps_length; /* The text so far is still part of the token. */
+    uint8_t adds_length; /* This character is part of the token's text. */
+    uint8_t ends; /* The token is complete. */
+    uint8_t end_offset; /* The end index is this many characters after this one. */
+    uint8_t quote_mask; /* Masks this character to give the quote character. */
+    uint8_t incomplete; /* The line ended inside quotes. */
+} batch_action_effect_st;
+
+static batch_action_effect_st const batch_action_effects[] =
+{
+    [table_action_none] =            { 0, 0, 1, 0, 0, 0, 0x00, 0 },
+    [table_action_start] =           { 1, 0, 0, 1, 0, 0, 0x00, 0 },
+    [table_action_start_quoted] =    { 1, 1, 0, 0, 0, 0, 0x00, 0 },
+    [table_action_append] =          { 0, 0, 1, 1, 0, 0, 0x00, 0 },
+    [table_action_end] =             { 0, 0, 1, 0, 1, 0, 0x00, 0 },
+    [table_action_end_quoted] =      { 0, 0, 1, 0, 1, 1, 0xff, 0 },
+    [table_action_end_line] =        { 0, 0, 1, 0, 0, 0, 0x00, 0 },
+    [table_action_end_line_token] =  { 0, 0, 1, 0, 1, 0, 0x00, 0 },
+    [table_action_incomplete] =      { 0, 0, 1, 0, 1, 0, 0x00, 1 }
+};
+
+struct tokeniser_batch_st
+{
+    uint8_t char_classes[256]; /* table_class_t, for the locale in use when the batch was allocated. */
+    uint8_t next_states[table_state_count * table_class_count]; /* The FSM, flattened. */
+    uint8_t actions[table_state_count * table_class_count];
+    uint8_t quote_in_token[table_state_count * table_class_count]; /* A quote within a regular token. */
+};
+
+typedef struct batch_lane_st
+{
+    uint8_t state; /* table_state_t */
+    uint8_t skips_quote;
+    uint8_t needs_copy;
+    uint8_t incomplete;
+    size_t token_count;
+    size_t start_index;
+    size_t text_length;
+    tokeniser_scan_token_st overflow_token; /* Written instead of the line's tokens once they are full. */
+} batch_lane_st;
+
+tokeniser_batch_st * tokeniser_batch_alloc(void)
+{
+    tokeniser_batch_st * const batch = calloc(1, sizeof *batch);
+    unsigned int state;
+    unsigned int char_class;
+    unsigned int ch;
+
+    if (batch == NULL)
+    {
+        goto done;
+    }
+
+    for (ch = 0; ch < sizeof batch->char_classes; ch++)
+    {
+        batch->char_classes[ch] = (uint8_t)tokeniser_table_class_get((char)ch);
+    }
+    for (state = 0; state < table_state_count; state++)
+    {
+        for (char_class = 0; char_class < table_class_count; char_class++)
+        {
+            table_entry_st const entry = tokeniser_table[state][char_class];
+
+            batch->next_states[ENTRY_INDEX(state, char_class)] = entry.next_state;
+            batch->actions[ENTRY_INDEX(state, char_class)] = entry.action;
+            batch->quote_in_token[ENTRY_INDEX(state, char_class)] =
+                (entry.action == table_action_none && tokeniser_table_state_in_token((table_state_t)state));
+        }
+    }
+
+done:
+    return batch;
+}
+
+void tokeniser_batch_free(tokeniser_batch_st * const batch)
+{
+    free(batch);
+}
+
+static inline void lane_step(tokeniser_batch_st const * const batch,
+                             batch_lane_st * const lane,
+                             tokeniser_batch_line_st const * const line,
+                             size_t const index)
+{
+    /* Advance one line by one character. The current token is
+     * written out whether or not it is complete, and only counted
+     * if it is, so nothing here depends on the input but the table
+     * lookups.
+     */
+    char const ch = (index < line->length) ? line->text[index] : '\0';
+    unsigned int const entry_index = ENTRY_INDEX(lane->state, batch->char_classes[(unsigned char)ch]);
+    batch_action_effect_st const * const effect = &batch_action_effects[batch->actions[entry_index]];
+    size_t const starts_mask = (size_t)0 - effect->starts;
+    tokeniser_scan_token_st * const token = (lane->token_count < line->token_capacity)
+                                            ? &line->tokens[lane->token_count]
+                                            : &lane->overflow_token;
+
+    lane->start_index = (lane->start_index & ~starts_mask) | (index & starts_mask);
+    lane->skips_quote = (uint8_t)((lane->skips_quote & ~effect->starts) | effect->skips_quote);
+    lane->text_length = lane->text_length * effect->keeps_length + effect->adds_length;
+    lane->needs_copy = (uint8_t)((lane->needs_copy & effect->keeps_length) | batch->quote_in_token[entry_index]);
+    lane->incomplete |= effect->incomplete;
+
+    token->start_index = lane->start_index;
+    token->end_index = index + effect->end_offset;
+    token->quote_char = (char)(ch & effect->quote_mask);
+    token->incomplete = effect->incomplete;
+    token->needs_copy = lane->needs_copy;
+    token->text = line->text + lane->start_index + lane->skips_quote;
+    token->text_length = lane->text_length;
+
+    lane->token_count += effect->ends;
+    lane->state = batch->next_states[entry_index];
+}
+
+bool tokeniser_batch_run(tokeniser_batch_st const * const batch,
+                         tokeniser_batch_line_st * const lines,
+                         size_t const line_count)
+{
+    batch_lane_st lanes[TOKENISER_BATCH_MAX_LINES];
+    size_t max_length = 0;
+    size_t index;
+    size_t line;
+    bool ran;
+
+    if (line_count > TOKENISER_BATCH_MAX_LINES)
+    {
+        ran = false;
+        goto done;
+    }
+
+    for (line = 0; line < line_count; line++)
+    {
+        lanes[line].state = table_state_no_token;
+        lanes[line].skips_quote = 0;
+        lanes[line].needs_copy = 0;
+        lanes[line].incomplete = 0;
+        lanes[line].token_count = 0;
+        lanes[line].start_index = 0;
+        lanes[line].text_length = 0;
+        if (lines[line].length > max_length)
+        {
+            max_length = lines[line].length;
+        }
+    }
+
+    /* The '\0' after the longest line ends every line. A line with
+     * a NUL in it may end sooner, and then just stays done.
+     */
+    for (index = 0; index <= max_length; index++)
+    {
+        unsigned int done_count = 0;
+
+        for (line = 0; line < line_count; line++)
+        {
+            lane_step(batch, &lanes[line], &lines[line], index);
+            done_count += (lanes[line].state == table_state_done);
+        }
+        if (done_count == line_count)
+        {
+            break;
+        }
+    }
+
+    for (line = 0; line < line_count; line++)
+    {
+        lines[line].token_count = lanes[line].token_count;
+        if (lanes[line].token_count > lines[line].token_capacity)
+        {
+            lines[line].result = tokeniser_result_limit_exceeded;
+        }
+        else if (lanes[line].incomplete)
+        {
+            lines[line].result = tokeniser_result_incomplete_token;
+        }
+        else
+        {
+            lines[line].result = tokeniser_result_ok;
+        }
+    }
+    ran = true;
+
+done:
+    return ran;
+}
@@ -0,0 +1,59 @@
+#ifndef __TOKENISER_BATCH_H__
+#define __TOKENISER_BATCH_H__
+
+#include "tokeniser.h"
+#include "tokeniser_scan.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tokenises several independent short lines together in one
+ * thread. Each line has its own compact state in the table FSM
+ * (tokeniser_table.h), and all of them are advanced a character
+ * at a time in lockstep. The transitions are table lookups with
+ * no data dependent branches, so the lines' work overlaps rather
+ * than each stalling on mispredicted branches. The tokens,
+ * offsets, quote characters and results are the same as feeding
+ * each line to tokeniser_feed() followed by a '\0'.
+ */
+typedef struct tokeniser_batch_st tokeniser_batch_st;
+
+#define TOKENISER_BATCH_MAX_LINES 16
+
+typedef struct tokeniser_batch_line_st
+{
+    char const * text; /* The line. It needn't be NUL terminated. If it holds a NUL, the line ends there. */
+    size_t length;
+    tokeniser_scan_token_st * tokens; /* Where to put the tokens. Use tokeniser_scan_copy() to get their text. */
+    size_t token_capacity; /* The number of tokens there is room for. */
+
+    /* Set by tokeniser_batch_run(). */
+    size_t token_count; /* The number of tokens in the line, which may be more than token_capacity. */
+    tokeniser_result_t result; /* tokeniser_result_ok, tokeniser_result_incomplete_token, or
+                                * tokeniser_result_limit_exceeded if the tokens didn't fit. */
+} tokeniser_batch_line_st;
+
+tokeniser_batch_st * tokeniser_batch_alloc(void);
+
+void tokeniser_batch_free(tokeniser_batch_st * const batch);
+
+/*
+ * Tokenise a batch of lines.
+ * @lines: The lines, with their token arrays.
+ * @line_count: The number of lines, at most
+ * TOKENISER_BATCH_MAX_LINES.
+ * Return value: false if there are too many lines.
+ */
+bool tokeniser_batch_run(tokeniser_batch_st const * const batch,
+                         tokeniser_batch_line_st * const lines,
+                         size_t const line_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_BATCH_H__ */
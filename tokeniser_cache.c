@@ -0,0 +1,432 @@
+#include "tokeniser_cache.h"
+#include "tokeniser_pool.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNUSED(arg) (void)(arg)
+
+#define CACHE_DEFAULT_SHARDS 16
+#define CACHE_INITIAL_BUCKETS 64
+
+struct tokeniser_cache_entry_st
+{
+    tokeniser_cache_entry_st * bucket_next;
+    tokeniser_cache_entry_st * lru_prev; /* Towards the most recently used entry. */
+    tokeniser_cache_entry_st * lru_next; /* Towards the least recently used entry. */
+    uint64_t hash;
+    unsigned int reference_count; /* Includes the reference held by the cache. */
+    size_t memory_used;
+    tokens_st * tokens;
+    tokeniser_result_t result;
+    size_t length;
+    char line[];
+};
+
+typedef struct cache_shard_st cache_shard_st;
+struct cache_shard_st
+{
+    pthread_mutex_t lock;
+    tokeniser_cache_entry_st * * buckets;
+    size_t bucket_count; /* Always a power of 2. */
+    tokeniser_cache_entry_st * lru_head; /* The most recently used entry. */
+    tokeniser_cache_entry_st * lru_tail; /* The least recently used entry. */
+    size_t entry_count;
+    size_t memory_used;
+    size_t memory_budget;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+struct tokeniser_cache_st
+{
+    unsigned int shard_count;
+    cache_shard_st shards[];
+};
+
+static bool cache_new_token(char const * const token,
+                            size_t const start_index,
+                            size_t const end_index,
+                            char const quote_char,
+                            void * const user_arg)
+{
+    tokens_st * const tokens = user_arg;
+
+    UNUSED(start_index);
+    UNUSED(end_index);
+    UNUSED(quote_char);
+
+    return tokens_add_token(tokens, (token != NULL) ? token : "");
+}
+
+static tokeniser_cache_entry_st * entry_create(char const * const line, size_t const length, uint64_t const hash)
+{
+    tokeniser_cache_entry_st * entry = malloc(sizeof *entry + length);
+    tokeniser_st * tokeniser = NULL;
+    tokeniser_result_t result;
+    size_t index;
+
+    if (entry == NULL)
+    {
+        goto done;
+    }
+
+    entry->hash = hash;
+    entry->reference_count = 1;
+    entry->length = length;
+    memcpy(entry->line, line, length);
+
+    /* Lines are tokenised without holding a shard lock, so use the 
+     * calling thread's tokenisers rather than allocating one per miss. 
+     */
+    entry->tokens = tokens_alloc();
+    tokeniser = tokeniser_pool_acquire();
+    if (entry->tokens == NULL || tokeniser == NULL)
+    {
+        tokens_free(entry->tokens);
+        free(entry);
+        entry = NULL;
+        goto done;
+    }
+
+    result = tokeniser_result_continue;
+    for (index = 0; index < length && result == tokeniser_result_continue; index++)
+    {
+        result = tokeniser_feed(tokeniser, line[index], cache_new_token, entry->tokens);
+    }
+    if (result == tokeniser_result_continue)
+    {
+        result = tokeniser_feed(tokeniser, '\0', cache_new_token, entry->tokens);
+    }
+    entry->result = result;
+    entry->memory_used = sizeof *entry + length + tokens_memory_used(entry->tokens);
+
+done:
+    tokeniser_pool_release(tokeniser);
+
+    return entry;
+}
+
+static void entry_free(tokeniser_cache_entry_st * const entry)
+{
+    tokens_free(entry->tokens);
+    free(entry);
+}
+
+static void lru_unlink(cache_shard_st * const shard, tokeniser_cache_entry_st * const entry)
+{
+    if (entry->lru_prev != NULL)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        shard->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_head(cache_shard_st * const shard, tokeniser_cache_entry_st * const entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head != NULL)
+    {
+        shard->lru_head->lru_prev = entry;
+    }
+    else
+    {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+static tokeniser_cache_entry_st * * bucket_get(cache_shard_st * const shard, uint64_t const hash)
+{
+    /* The low bits of the hash select the shard, so use the high
+     * bits to select the bucket.
+     */
+    return &shard->buckets[(hash >> 32) & (shard->bucket_count - 1)];
+}
+
+static tokeniser_cache_entry_st * shard_find(cache_shard_st * const shard,
+                                             char const * const line,
+                                             size_t const length,
+                                             uint64_t const hash)
+{
+    tokeniser_cache_entry_st * entry;
+
+    for (entry = *bucket_get(shard, hash); entry != NULL; entry = entry->bucket_next)
+    {
+        if (entry->hash == hash && entry->length == length && memcmp(entry->line, line, length) == 0)
+        {
+            break;
+        }
+    }
+
+    return entry;
+}
+
+static void shard_grow(cache_shard_st * const shard)
+{
+    size_t const new_bucket_count = shard->bucket_count * 2;
+    tokeniser_cache_entry_st * * const new_buckets = calloc(new_bucket_count, sizeof *new_buckets);
+    tokeniser_cache_entry_st * * const old_buckets = shard->buckets;
+    size_t const old_bucket_count = shard->bucket_count;
+    size_t index;
+
+    if (new_buckets == NULL)
+    {
+        /* Carry on with longer chains. */
+        goto done;
+    }
+
+    shard->buckets = new_buckets;
+    shard->bucket_count = new_bucket_count;
+    for (index = 0; index < old_bucket_count; index++)
+    {
+        tokeniser_cache_entry_st * entry = old_buckets[index];
+
+        while (entry != NULL)
+        {
+            tokeniser_cache_entry_st * const next = entry->bucket_next;
+            tokeniser_cache_entry_st * * const bucket = bucket_get(shard, entry->hash);
+
+            entry->bucket_next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(old_buckets);
+
+done:
+    return;
+}
+
+static void shard_remove(cache_shard_st * const shard, tokeniser_cache_entry_st * const entry)
+{
+    tokeniser_cache_entry_st * * link = bucket_get(shard, entry->hash);
+
+    while (*link != entry)
+    {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    lru_unlink(shard, entry);
+
+    shard->entry_count--;
+    shard->memory_used -= entry->memory_used;
+
+    /* Drop the reference held by the cache. Anyone still using the
+     * entry frees it when they release it.
+     */
+    entry->reference_count--;
+    if (entry->reference_count == 0)
+    {
+        entry_free(entry);
+    }
+}
+
+static void shard_insert(cache_shard_st * const shard, tokeniser_cache_entry_st * const entry)
+{
+    tokeniser_cache_entry_st * * bucket;
+
+    /* Evict least recently used entries until the new one fits. */
+    while (shard->lru_tail != NULL && shard->memory_used + entry->memory_used > shard->memory_budget)
+    {
+        shard_remove(shard, shard->lru_tail);
+        shard->evictions++;
+    }
+
+    if (shard->entry_count >= shard->bucket_count)
+    {
+        shard_grow(shard);
+    }
+
+    bucket = bucket_get(shard, entry->hash);
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    lru_push_head(shard, entry);
+    entry->reference_count++;
+    shard->entry_count++;
+    shard->memory_used += entry->memory_used;
+}
+
+tokeniser_cache_st * tokeniser_cache_alloc(size_t const memory_budget, unsigned int const shard_count)
+{
+    unsigned int const shards = (shard_count == 0) ? CACHE_DEFAULT_SHARDS : shard_count;
+    tokeniser_cache_st * cache = calloc(1, sizeof *cache + shards * sizeof cache->shards[0]);
+    unsigned int index;
+
+    if (cache == NULL)
+    {
+        goto done;
+    }
+
+    for (index = 0; index < shards; index++)
+    {
+        cache_shard_st * const shard = &cache->shards[index];
+
+        shard->bucket_count = CACHE_INITIAL_BUCKETS;
+        shard->buckets = calloc(shard->bucket_count, sizeof *shard->buckets);
+        if (shard->buckets == NULL)
+        {
+            tokeniser_cache_free(cache);
+            cache = NULL;
+            goto done;
+        }
+        shard->memory_budget = memory_budget / shards;
+        pthread_mutex_init(&shard->lock, NULL);
+        cache->shard_count++;
+    }
+
+done:
+    return cache;
+}
+
+void tokeniser_cache_free(tokeniser_cache_st * const cache)
+{
+    unsigned int index;
+
+    if (cache == NULL)
+    {
+        goto done;
+    }
+
+    for (index = 0; index < cache->shard_count; index++)
+    {
+        cache_shard_st * const shard = &cache->shards[index];
+
+        while (shard->lru_head != NULL)
+        {
+            shard_remove(shard, shard->lru_head);
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+
+done:
+    return;
+}
+
+tokeniser_cache_entry_st * tokeniser_cache_lookup(tokeniser_cache_st * const cache,
+                                                  char const * const line,
+                                                  size_t const length)
+{
+    uint64_t const hash = hash_bytes(line, length);
+    cache_shard_st * const shard = &cache->shards[hash % cache->shard_count];
+    tokeniser_cache_entry_st * entry;
+    tokeniser_cache_entry_st * existing_entry;
+
+    pthread_mutex_lock(&shard->lock);
+    entry = shard_find(shard, line, length, hash);
+    if (entry != NULL)
+    {
+        lru_unlink(shard, entry);
+        lru_push_head(shard, entry);
+        entry->reference_count++;
+        shard->hits++;
+    }
+    else
+    {
+        shard->misses++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (entry != NULL)
+    {
+        goto done;
+    }
+
+    /* Tokenise without holding the lock. */
+    entry = entry_create(line, length, hash);
+    if (entry == NULL)
+    {
+        goto done;
+    }
+    if (entry->memory_used > shard->memory_budget)
+    {
+        /* Too big to cache. The caller gets the only reference. */
+        goto done;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    existing_entry = shard_find(shard, line, length, hash);
+    if (existing_entry != NULL)
+    {
+        /* Another thread got there first. */
+        existing_entry->reference_count++;
+    }
+    else
+    {
+        shard_insert(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (existing_entry != NULL)
+    {
+        entry_free(entry);
+        entry = existing_entry;
+    }
+
+done:
+    return entry;
+}
+
+tokens_st const * tokeniser_cache_entry_tokens(tokeniser_cache_entry_st const * const entry)
+{
+    return entry->tokens;
+}
+
+tokeniser_result_t tokeniser_cache_entry_result(tokeniser_cache_entry_st const * const entry)
+{
+    return entry->result;
+}
+
+void tokeniser_cache_release(tokeniser_cache_st * const cache, tokeniser_cache_entry_st * const entry)
+{
+    cache_shard_st * const shard = &cache->shards[entry->hash % cache->shard_count];
+    bool free_entry;
+
+    pthread_mutex_lock(&shard->lock);
+    entry->reference_count--;
+    free_entry = entry->reference_count == 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (free_entry)
+    {
+        entry_free(entry);
+    }
+}
+
+void tokeniser_cache_stats_get(tokeniser_cache_st * const cache, tokeniser_cache_stats_st * const stats)
+{
+    unsigned int index;
+
+    memset(stats, 0, sizeof *stats);
+
+    for (index = 0; index < cache->shard_count; index++)
+    {
+        cache_shard_st * const shard = &cache->shards[index];
+
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->entry_count += shard->entry_count;
+        stats->memory_used += shard->memory_used;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
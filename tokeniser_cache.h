@@ -0,0 +1,71 @@
+#ifndef __TOKENISER_CACHE_H__
+#define __TOKENISER_CACHE_H__
+
+#include "tokeniser.h"
+#include "tokens.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A cache of tokenised lines, keyed by the content of the line.
+ * The cache is split into shards, each with its own lock and LRU
+ * list, so it can be shared by many threads. Entries are
+ * reference counted, so an entry handed out by the cache stays
+ * valid until it is released, even if it is evicted meanwhile.
+ */
+typedef struct tokeniser_cache_st tokeniser_cache_st;
+typedef struct tokeniser_cache_entry_st tokeniser_cache_entry_st;
+
+typedef struct tokeniser_cache_stats_st
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entry_count;
+    size_t memory_used;
+} tokeniser_cache_stats_st;
+
+/*
+ * Create a cache.
+ * @memory_budget: The maximum number of bytes the cached lines
+ * and their tokens may use.
+ * @shard_count: The number of independently locked shards. 0
+ * selects a default.
+ * Returns: A new cache, or NULL if out of memory.
+ */
+tokeniser_cache_st * tokeniser_cache_alloc(size_t const memory_budget, unsigned int const shard_count);
+
+/*
+ * Free the cache. All entries must have been released.
+ */
+void tokeniser_cache_free(tokeniser_cache_st * const cache);
+
+/*
+ * Get the tokens for a line, tokenising it and adding it to the
+ * cache if it isn't already there.
+ * @line: The line to tokenise. It needn't be NUL terminated.
+ * @length: The number of characters in the line.
+ * Returns: The cache entry, which must be passed to
+ * tokeniser_cache_release() once finished with, or NULL if out
+ * of memory.
+ */
+tokeniser_cache_entry_st * tokeniser_cache_lookup(tokeniser_cache_st * const cache,
+                                                  char const * const line,
+                                                  size_t const length);
+
+/*
+ * Returns: The tokens for the line. They are shared, so must not
+ * be modified.
+ */
+tokens_st const * tokeniser_cache_entry_tokens(tokeniser_cache_entry_st const * const entry);
+
+/*
+ * Returns: The result of tokenising the line.
+ */
+tokeniser_result_t tokeniser_cache_entry_result(tokeniser_cache_entry_st const * const entry);
+
+void tokeniser_cache_release(tokeniser_cache_st * const cache, tokeniser_cache_entry_st * const entry);
+
+void tokeniser_cache_stats_get(tokeniser_cache_st * const cache, tokeniser_cache_stats_st * const stats);
+
+#endif /* __TOKENISER_CACHE_H__ */
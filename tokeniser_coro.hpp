@@ -0,0 +1,276 @@
+#ifndef __TOKENISER_CORO_HPP__
+#define __TOKENISER_CORO_HPP__
+
+#include "tokeniser.hpp"
+#include "tokeniser_run.h"
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* C++20 coroutines that tokenise a stream of '\n' terminated
+ * lines read from an asynchronous byte source. The tokeniser is
+ * suspended along with the coroutine whenever the source has no
+ * data, and carries on where it left off when the source
+ * resumes it, so nothing is scanned twice. Each stream needs
+ * only its read buffer, a tokeniser and room for its longest
+ * token.
+ */
+namespace tokeniser
+{
+
+/* A source whose read(std::span<char>) can be co_awaited for the
+ * number of bytes read: 0 at the end of the stream, or negative
+ * on error.
+ */
+template <typename Source>
+concept async_byte_source = requires(Source & source, std::span<char> buffer)
+{
+    { source.read(buffer).await_ready() } -> std::convertible_to<bool>;
+    { source.read(buffer).await_resume() } -> std::convertible_to<std::ptrdiff_t>;
+};
+
+struct stream_item
+{
+    enum class kind
+    {
+        token,
+        line_end
+    };
+
+    kind what;
+    std::string_view text; /* Tokens only. Valid until the stream is next resumed. */
+    std::size_t start; /* The offset in the stream of the token or line. */
+    std::size_t end; /* The offset in the stream of the token end or line ending. */
+    char quote; /* Tokens only. */
+    tokeniser_result_t result; /* Line ends only. tokeniser_result_error if the source failed. */
+};
+
+/* An asynchronous generator of stream_items. Another coroutine
+ * gets each item with co_await next(), which gives nullptr once
+ * the stream is finished.
+ */
+class token_stream
+{
+public:
+    struct promise_type
+    {
+        stream_item const * current = nullptr;
+        std::coroutine_handle<> consumer;
+        std::exception_ptr exception;
+
+        struct transfer_to_consumer
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> const generator) noexcept
+            {
+                return generator.promise().consumer;
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        token_stream get_return_object() noexcept
+        {
+            return token_stream(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        transfer_to_consumer final_suspend() noexcept
+        {
+            return {};
+        }
+
+        transfer_to_consumer yield_value(stream_item const & item) noexcept
+        {
+            current = &item;
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+            current = nullptr;
+        }
+
+        void unhandled_exception() noexcept
+        {
+            exception = std::current_exception();
+            current = nullptr;
+        }
+    };
+
+    token_stream(token_stream const &) = delete;
+    token_stream & operator=(token_stream const &) = delete;
+
+    token_stream(token_stream && other) noexcept
+        : generator_(std::exchange(other.generator_, nullptr))
+    {
+    }
+
+    token_stream & operator=(token_stream && other) noexcept
+    {
+        std::swap(generator_, other.generator_);
+        return *this;
+    }
+
+    ~token_stream()
+    {
+        if (generator_)
+        {
+            generator_.destroy();
+        }
+    }
+
+    auto next() noexcept
+    {
+        struct next_awaiter
+        {
+            std::coroutine_handle<promise_type> generator;
+
+            bool await_ready() noexcept
+            {
+                return generator.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> const consumer) noexcept
+            {
+                generator.promise().consumer = consumer;
+                return generator;
+            }
+
+            stream_item const * await_resume()
+            {
+                if (generator.promise().exception)
+                {
+                    std::rethrow_exception(generator.promise().exception);
+                }
+                return generator.done() ? nullptr : generator.promise().current;
+            }
+        };
+
+        return next_awaiter{ generator_ };
+    }
+
+private:
+    explicit token_stream(std::coroutine_handle<promise_type> const generator) noexcept
+        : generator_(generator)
+    {
+    }
+
+    std::coroutine_handle<promise_type> generator_;
+};
+
+namespace detail
+{
+
+/* What the tokeniser callbacks found in the last byte fed to it. */
+struct stream_state
+{
+    std::string token_text; /* Reused, so it only grows to the longest token. */
+    stream_item token {};
+    stream_item line_end {};
+    bool have_token = false;
+    bool have_line_end = false;
+};
+
+inline bool stream_new_token(char const * const token,
+                             std::size_t const start_index,
+                             std::size_t const end_index,
+                             char const quote_char,
+                             void * const user_arg)
+{
+    stream_state & state = *static_cast<stream_state *>(user_arg);
+
+    state.token_text.assign(token);
+    state.token = stream_item{ stream_item::kind::token, state.token_text, start_index, end_index, quote_char, tokeniser_result_continue };
+    state.have_token = true;
+
+    return true;
+}
+
+inline bool stream_line_done(tokeniser_result_t const result,
+                             std::size_t const line_start,
+                             std::size_t const line_end,
+                             void * const user_arg)
+{
+    stream_state & state = *static_cast<stream_state *>(user_arg);
+
+    state.line_end = stream_item{ stream_item::kind::line_end, {}, line_start, line_end, '\0', result };
+    state.have_line_end = true;
+
+    return true;
+}
+
+} /* namespace detail */
+
+/*
+ * Tokenise the lines read from source, yielding each token as
+ * soon as it is complete and the end of each line. source must
+ * outlive the stream.
+ */
+template <async_byte_source Source>
+token_stream tokenise_stream(Source & source, std::size_t const buffer_size = 4096)
+{
+    handle tokeniser;
+    std::vector<char> buffer(buffer_size);
+    detail::stream_state state;
+    std::ptrdiff_t length;
+
+    while ((length = co_await source.read(std::span<char>(buffer))) > 0)
+    {
+        for (std::ptrdiff_t index = 0; index < length; index++)
+        {
+            /* One byte at a time, so each token can be handed on
+             * before the tokeniser moves past it.
+             */
+            tokeniser_feed_buffer(tokeniser.get(), &buffer[index], 1, detail::stream_new_token, detail::stream_line_done, &state);
+            if (state.have_token)
+            {
+                state.have_token = false;
+                co_yield state.token;
+            }
+            if (state.have_line_end)
+            {
+                state.have_line_end = false;
+                co_yield state.line_end;
+            }
+        }
+    }
+
+    tokeniser_feed_end(tokeniser.get(), detail::stream_new_token, detail::stream_line_done, &state);
+    if (state.have_token)
+    {
+        state.have_token = false;
+        co_yield state.token;
+    }
+    if (state.have_line_end)
+    {
+        state.have_line_end = false;
+        co_yield state.line_end;
+    }
+
+    if (length < 0)
+    {
+        state.line_end = stream_item{ stream_item::kind::line_end, {}, 0, 0, '\0', tokeniser_result_error };
+        co_yield state.line_end;
+    }
+}
+
+} /* namespace tokeniser */
+
+#endif /* __TOKENISER_CORO_HPP__ */
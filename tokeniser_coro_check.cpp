@@ -0,0 +1,543 @@
+#include "tokeniser_coro.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Checks that tokenise_stream() reading from a socket passes on
+ * the same tokens and line ends as feeding each line to
+ * tokeniser_feed(). The other end of the socket is written a few
+ * bytes at a time, and the stream is read through a buffer
+ * smaller than some tokens, so tokens and lines span reads and
+ * the stream has to wait for data.
+ *
+ * Then checks that many streams can be served at once from one
+ * thread, each by its own socket and coroutine, with a poll loop
+ * resuming whichever are readable. Each stream is much longer than
+ * the memory it is allowed, so none of them can be buffering more
+ * than the line it is in.
+ */
+
+namespace
+{
+
+constexpr std::size_t stream_buffer_size = 7;
+constexpr std::size_t max_write_size = 5;
+constexpr std::size_t many_stream_count = 1024;
+constexpr std::size_t many_max_write_size = 61;
+constexpr std::size_t many_stream_repeats = 40; /* The copies of stream_text each of the many streams carries. */
+constexpr std::size_t max_stream_memory = 4096; /* The heap each of the many streams may use. */
+
+char const stream_text[] =
+    "plain tokens on a line\n"
+    "'single quoted' \"double quoted\" mixed'quotes'here\n"
+    "\n"
+    "   leading and trailing spaces   \n"
+    "a_token_much_longer_than_the_stream_buffer another\n"
+    "\"an incomplete quote\n"
+    "the last line has no newline";
+
+/* A non-blocking socket whose reads suspend the awaiting
+ * coroutine until the socket is readable.
+ */
+class socket_source
+{
+public:
+    explicit socket_source(int const fd) noexcept
+        : fd_(fd)
+    {
+    }
+
+    auto read(std::span<char> const buffer) noexcept
+    {
+        struct read_awaiter
+        {
+            socket_source & source;
+            std::span<char> buffer;
+            std::ptrdiff_t length;
+
+            bool await_ready() noexcept
+            {
+                length = ::read(source.fd_, buffer.data(), buffer.size());
+                return length >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            }
+
+            void await_suspend(std::coroutine_handle<> const reader) noexcept
+            {
+                source.reader_ = reader;
+            }
+
+            std::ptrdiff_t await_resume() noexcept
+            {
+                if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    /* Resumed once the socket became readable. */
+                    length = ::read(source.fd_, buffer.data(), buffer.size());
+                }
+                return length;
+            }
+        };
+
+        return read_awaiter{ *this, buffer, 0 };
+    }
+
+    int fd() const noexcept
+    {
+        return fd_;
+    }
+
+    bool waiting() const noexcept
+    {
+        return static_cast<bool>(reader_);
+    }
+
+    /* Resume the reader waiting on the socket, once it is readable. */
+    void resume()
+    {
+        std::exchange(reader_, nullptr).resume();
+    }
+
+    /* Wait for the socket and resume the reader waiting on it.
+     * Returns: false if nothing was waiting.
+     */
+    bool resume_reader()
+    {
+        struct pollfd poll_fd = { fd_, POLLIN, 0 };
+
+        if (!reader_)
+        {
+            return false;
+        }
+        while (::poll(&poll_fd, 1, -1) < 0 && errno == EINTR)
+        {
+        }
+        resume();
+
+        return true;
+    }
+
+private:
+    int fd_;
+    std::coroutine_handle<> reader_;
+};
+
+/* A coroutine that starts straight away, for the consumer. */
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+void describe_token(std::string & description, std::string_view const text, std::size_t const start, std::size_t const end, char const quote)
+{
+    char buffer[64];
+
+    std::snprintf(buffer, sizeof buffer, "token %zu-%zu %d [", start, end, quote);
+    description += buffer;
+    description += text;
+    description += "]\n";
+}
+
+void describe_line_end(std::string & description, tokeniser_result_t const result, std::size_t const start, std::size_t const end)
+{
+    char buffer[64];
+
+    std::snprintf(buffer, sizeof buffer, "line %d %zu-%zu\n", result, start, end);
+    description += buffer;
+}
+
+struct feed_line_context
+{
+    std::string * description;
+    std::size_t line_start;
+};
+
+bool feed_new_token(char const * const token,
+                    std::size_t const start_index,
+                    std::size_t const end_index,
+                    char const quote_char,
+                    void * const user_arg)
+{
+    feed_line_context * const context = static_cast<feed_line_context *>(user_arg);
+
+    describe_token(*context->description, token, context->line_start + start_index, context->line_start + end_index, quote_char);
+
+    return true;
+}
+
+std::string feed_describe(std::string_view const text)
+{
+    /* What tokeniser_feed() makes of each line on its own. */
+    tokeniser::handle tokeniser;
+    std::string description;
+    std::size_t line_start = 0;
+
+    while (line_start < text.size())
+    {
+        std::size_t const newline = text.find('\n', line_start);
+        std::size_t const line_end = (newline == std::string_view::npos) ? text.size() : newline;
+        feed_line_context context = { &description, line_start };
+        tokeniser_result_t result = tokeniser_result_continue;
+
+        tokeniser_init(tokeniser.get());
+        for (std::size_t index = line_start; index < line_end && result == tokeniser_result_continue; index++)
+        {
+            result = tokeniser_feed(tokeniser.get(), text[index], feed_new_token, &context);
+        }
+        if (result == tokeniser_result_continue)
+        {
+            result = tokeniser_feed(tokeniser.get(), '\0', feed_new_token, &context);
+        }
+        describe_line_end(description, result, line_start, line_end);
+        line_start = line_end + 1;
+    }
+
+    return description;
+}
+
+task stream_describe(tokeniser::token_stream & stream, std::string & description, bool & finished)
+{
+    while (tokeniser::stream_item const * const item = co_await stream.next())
+    {
+        if (item->what == tokeniser::stream_item::kind::token)
+        {
+            describe_token(description, item->text, item->start, item->end, item->quote);
+        }
+        else
+        {
+            describe_line_end(description, item->result, item->start, item->end);
+        }
+    }
+    finished = true;
+}
+
+void socket_write(int const fd, std::string_view const text)
+{
+    std::size_t offset = 0;
+    std::size_t write_size = 1;
+
+    while (offset < text.size())
+    {
+        std::size_t const length = std::min(write_size, text.size() - offset);
+        ssize_t const written = ::write(fd, text.data() + offset, length);
+
+        if (written < 0)
+        {
+            break;
+        }
+        offset += static_cast<std::size_t>(written);
+        write_size = write_size % max_write_size + 1;
+        std::this_thread::yield();
+    }
+    ::close(fd);
+}
+
+/* How far one of the many streams has matched what it should
+ * give. The description isn't kept, so the check itself uses
+ * constant memory per stream.
+ */
+struct stream_progress
+{
+    std::size_t matched = 0;
+    bool mismatched = false;
+    bool finished = false;
+};
+
+task stream_compare(tokeniser::token_stream & stream, std::string_view const expected, stream_progress & progress)
+{
+    std::string piece;
+
+    while (tokeniser::stream_item const * const item = co_await stream.next())
+    {
+        piece.clear();
+        if (item->what == tokeniser::stream_item::kind::token)
+        {
+            describe_token(piece, item->text, item->start, item->end, item->quote);
+        }
+        else
+        {
+            describe_line_end(piece, item->result, item->start, item->end);
+        }
+        if (expected.substr(progress.matched, piece.size()) != piece)
+        {
+            progress.mismatched = true;
+        }
+        progress.matched += piece.size();
+    }
+    progress.finished = true;
+}
+
+struct many_stream
+{
+    many_stream(int const fd, std::string_view const expected)
+        : source(fd),
+          stream(tokeniser::tokenise_stream(source, stream_buffer_size))
+    {
+        stream_compare(stream, expected, progress);
+    }
+
+    socket_source source;
+    tokeniser::token_stream stream;
+    stream_progress progress;
+};
+
+void socket_write_many(std::vector<int> const & fds, std::string_view const text)
+{
+    /* A few bytes to each socket in turn, closing each once all of 
+     * the text is written. 
+     */
+    std::vector<std::size_t> offsets(fds.size(), 0);
+    bool writing = true;
+
+    while (writing)
+    {
+        writing = false;
+        for (std::size_t index = 0; index < fds.size(); index++)
+        {
+            std::size_t const offset = offsets[index];
+            std::size_t const length = std::min((offset + index) % many_max_write_size + 1, text.size() - offset);
+            ssize_t written;
+
+            if (offset == text.size())
+            {
+                continue;
+            }
+            written = ::write(fds[index], text.data() + offset, length);
+            offsets[index] = (written < 0) ? text.size() : offset + static_cast<std::size_t>(written);
+            if (offsets[index] == text.size())
+            {
+                ::close(fds[index]);
+            }
+            writing = true;
+        }
+        std::this_thread::yield();
+    }
+}
+
+std::size_t heap_in_use()
+{
+    return mallinfo2().uordblks;
+}
+
+bool fd_limit_raise(std::size_t const fd_count)
+{
+    struct rlimit limit;
+
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    {
+        return false;
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < fd_count)
+    {
+        limit.rlim_cur = (limit.rlim_max == RLIM_INFINITY) ? fd_count : std::min<rlim_t>(limit.rlim_max, fd_count);
+        if (::setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < fd_count)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool many_streams_check()
+{
+    std::string text;
+    std::string expected;
+    std::vector<int> read_fds;
+    std::vector<int> write_fds;
+    std::vector<std::unique_ptr<many_stream>> streams;
+    std::vector<struct pollfd> poll_fds;
+    std::vector<many_stream *> polled;
+    std::size_t heap_start;
+    std::size_t heap_peak;
+    bool passed = true;
+
+    for (std::size_t repeat = 0; repeat < many_stream_repeats; repeat++)
+    {
+        text += stream_text;
+        text += '\n';
+    }
+    expected = feed_describe(text);
+
+    if (!fd_limit_raise(2 * many_stream_count + 16))
+    {
+        std::printf("check failed: unable to open %zu sockets\n", 2 * many_stream_count);
+        return false;
+    }
+    for (std::size_t index = 0; index < many_stream_count; index++)
+    {
+        int fds[2];
+
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            std::perror("socketpair");
+            passed = false;
+            break;
+        }
+        ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        read_fds.push_back(fds[0]);
+        write_fds.push_back(fds[1]);
+    }
+    if (!passed)
+    {
+        for (std::size_t index = 0; index < read_fds.size(); index++)
+        {
+            ::close(read_fds[index]);
+            ::close(write_fds[index]);
+        }
+        return false;
+    }
+
+    streams.reserve(many_stream_count);
+    poll_fds.reserve(many_stream_count);
+    polled.reserve(many_stream_count);
+    heap_start = heap_in_use();
+    heap_peak = heap_start;
+
+    for (int const fd : read_fds)
+    {
+        streams.push_back(std::make_unique<many_stream>(fd, expected));
+    }
+
+    {
+        std::thread writer(socket_write_many, std::cref(write_fds), std::string_view(text));
+
+        for (;;)
+        {
+            poll_fds.clear();
+            polled.clear();
+            for (std::unique_ptr<many_stream> const & stream : streams)
+            {
+                if (stream->source.waiting())
+                {
+                    poll_fds.push_back({ stream->source.fd(), POLLIN, 0 });
+                    polled.push_back(stream.get());
+                }
+            }
+            if (poll_fds.empty())
+            {
+                break;
+            }
+            while (::poll(poll_fds.data(), poll_fds.size(), -1) < 0 && errno == EINTR)
+            {
+            }
+            for (std::size_t index = 0; index < poll_fds.size(); index++)
+            {
+                if (poll_fds[index].revents != 0)
+                {
+                    polled[index]->source.resume();
+                }
+            }
+            heap_peak = std::max(heap_peak, heap_in_use());
+        }
+        writer.join();
+    }
+
+    for (std::size_t index = 0; index < streams.size(); index++)
+    {
+        stream_progress const & progress = streams[index]->progress;
+
+        if (!progress.finished || progress.mismatched || progress.matched != expected.size())
+        {
+            std::printf("check failed: stream %zu of %zu didn't give what tokeniser_feed() does\n", index, many_stream_count);
+            passed = false;
+            break;
+        }
+    }
+    if ((heap_peak - heap_start) / many_stream_count > max_stream_memory)
+    {
+        std::printf("check failed: %zu streams used %zu bytes each, more than %zu\n",
+                    many_stream_count,
+                    (heap_peak - heap_start) / many_stream_count,
+                    max_stream_memory);
+        passed = false;
+    }
+
+    streams.clear();
+    for (int const fd : read_fds)
+    {
+        ::close(fd);
+    }
+
+    return passed;
+}
+
+} /* namespace */
+
+int main()
+{
+    std::string_view const text(stream_text, sizeof stream_text - 1);
+    std::string const expected = feed_describe(text);
+    std::string description;
+    bool finished = false;
+    int fds[2];
+
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        std::perror("socketpair");
+        return EXIT_FAILURE;
+    }
+    ::fcntl(fds[0], F_SETFL, ::fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    {
+        socket_source source(fds[0]);
+        tokeniser::token_stream stream = tokeniser::tokenise_stream(source, stream_buffer_size);
+        std::thread writer(socket_write, fds[1], text);
+
+        stream_describe(stream, description, finished);
+        while (!finished && source.resume_reader())
+        {
+        }
+        writer.join();
+    }
+    ::close(fds[0]);
+
+    if (!finished || description != expected)
+    {
+        std::printf("check failed: the coroutine stream gave\n%s\nnot\n%s\n", description.c_str(), expected.c_str());
+        return EXIT_FAILURE;
+    }
+
+    return many_streams_check() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
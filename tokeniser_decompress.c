@@ -0,0 +1,361 @@
+#include "tokeniser_decompress.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/* Enough of the input to recognise the format by. */
+#define MAGIC_SIZE 4
+
+/* Add 32 to the window bits to accept a gzip header. */
+#define ZLIB_GZIP_WINDOW_BITS (15 + 32)
+
+struct tokeniser_decompress_st
+{
+    tokeniser_source_st const * input;
+    tokeniser_decompress_format_t format;
+    unsigned char * in; /* Input read but not yet decompressed. */
+    size_t in_length;
+    size_t in_offset;
+    bool input_ended;
+    bool stream_ended; /* The last compressed stream read was complete. */
+    z_stream zlib;
+    bool zlib_ready;
+#if defined(HAVE_ZSTD)
+    ZSTD_DStream * zstd;
+#endif
+    size_t bytes_in;
+    size_t bytes_out;
+};
+
+static bool input_read(tokeniser_decompress_st * const decompress)
+{
+    /* Read more input after whatever is still waiting. Returns false
+     * if the input failed.
+     */
+    bool read_ok;
+    ssize_t bytes_read;
+
+    if (decompress->in_offset == decompress->in_length)
+    {
+        decompress->in_offset = 0;
+        decompress->in_length = 0;
+    }
+    else if (decompress->in_offset != 0)
+    {
+        memmove(decompress->in, decompress->in + decompress->in_offset, decompress->in_length - decompress->in_offset);
+        decompress->in_length -= decompress->in_offset;
+        decompress->in_offset = 0;
+    }
+
+    bytes_read = decompress->input->fill(decompress->input->context,
+                                         (char *)decompress->in + decompress->in_length,
+                                         TOKENISER_DECOMPRESS_INPUT_SIZE - decompress->in_length);
+    if (bytes_read < 0)
+    {
+        read_ok = false;
+        goto done;
+    }
+    if (bytes_read == 0)
+    {
+        decompress->input_ended = true;
+    }
+    decompress->in_length += (size_t)bytes_read;
+    decompress->bytes_in += (size_t)bytes_read;
+    read_ok = true;
+
+done:
+    return read_ok;
+}
+
+static bool format_detect(tokeniser_decompress_st * const decompress)
+{
+    /* Returns false if the input failed, or the decoder couldn't be
+     * set up.
+     */
+    bool detected;
+
+    while (decompress->in_length < MAGIC_SIZE && !decompress->input_ended)
+    {
+        if (!input_read(decompress))
+        {
+            detected = false;
+            goto done;
+        }
+    }
+
+    if (decompress->in_length >= 2 && decompress->in[0] == 0x1f && decompress->in[1] == 0x8b)
+    {
+        decompress->format = tokeniser_decompress_format_gzip;
+        if (inflateInit2(&decompress->zlib, ZLIB_GZIP_WINDOW_BITS) != Z_OK)
+        {
+            detected = false;
+            goto done;
+        }
+        decompress->zlib_ready = true;
+    }
+    else if (decompress->in_length >= 4
+             && decompress->in[0] == 0x28 && decompress->in[1] == 0xb5
+             && decompress->in[2] == 0x2f && decompress->in[3] == 0xfd)
+    {
+        decompress->format = tokeniser_decompress_format_zstd;
+#if defined(HAVE_ZSTD)
+        decompress->zstd = ZSTD_createDStream();
+        if (decompress->zstd == NULL)
+        {
+            detected = false;
+            goto done;
+        }
+#else
+        detected = false;
+        goto done;
+#endif
+    }
+    else
+    {
+        decompress->format = tokeniser_decompress_format_none;
+    }
+    detected = true;
+
+done:
+    return detected;
+}
+
+static ssize_t none_fill(tokeniser_decompress_st * const decompress, char * const buffer, size_t const buffer_size)
+{
+    /* Hand over what was read while detecting the format, then read
+     * straight into the caller's buffer.
+     */
+    ssize_t length;
+
+    if (decompress->in_offset < decompress->in_length)
+    {
+        length = (ssize_t)(decompress->in_length - decompress->in_offset);
+        if ((size_t)length > buffer_size)
+        {
+            length = (ssize_t)buffer_size;
+        }
+        memcpy(buffer, decompress->in + decompress->in_offset, (size_t)length);
+        decompress->in_offset += (size_t)length;
+        goto done;
+    }
+
+    length = decompress->input->fill(decompress->input->context, buffer, buffer_size);
+    if (length > 0)
+    {
+        decompress->bytes_in += (size_t)length;
+    }
+
+done:
+    return length;
+}
+
+static ssize_t gzip_fill(tokeniser_decompress_st * const decompress, char * const buffer, size_t const buffer_size)
+{
+    z_stream * const zlib = &decompress->zlib;
+    ssize_t length;
+
+    zlib->next_out = (Bytef *)buffer;
+    zlib->avail_out = (uInt)buffer_size;
+    while (zlib->avail_out == buffer_size)
+    {
+        int status;
+
+        if (decompress->in_offset == decompress->in_length)
+        {
+            if (decompress->input_ended)
+            {
+                /* The input ended part way through a stream. */
+                length = decompress->stream_ended ? 0 : -1;
+                goto done;
+            }
+            if (!input_read(decompress))
+            {
+                length = -1;
+                goto done;
+            }
+            continue;
+        }
+
+        zlib->next_in = decompress->in + decompress->in_offset;
+        zlib->avail_in = (uInt)(decompress->in_length - decompress->in_offset);
+        status = inflate(zlib, Z_NO_FLUSH);
+        decompress->in_offset = decompress->in_length - zlib->avail_in;
+        if (status == Z_STREAM_END)
+        {
+            /* Another member may follow. */
+            decompress->stream_ended = true;
+            if (inflateReset(zlib) != Z_OK)
+            {
+                length = -1;
+                goto done;
+            }
+        }
+        else if (status == Z_OK || status == Z_BUF_ERROR)
+        {
+            decompress->stream_ended = false;
+        }
+        else
+        {
+            length = -1;
+            goto done;
+        }
+    }
+    length = (ssize_t)(buffer_size - zlib->avail_out);
+
+done:
+    return length;
+}
+
+#if defined(HAVE_ZSTD)
+static ssize_t zstd_fill(tokeniser_decompress_st * const decompress, char * const buffer, size_t const buffer_size)
+{
+    ZSTD_outBuffer out = { buffer, buffer_size, 0 };
+    ssize_t length;
+
+    while (out.pos == 0)
+    {
+        ZSTD_inBuffer in;
+        size_t status;
+
+        if (decompress->in_offset == decompress->in_length)
+        {
+            if (decompress->input_ended)
+            {
+                length = decompress->stream_ended ? 0 : -1;
+                goto done;
+            }
+            if (!input_read(decompress))
+            {
+                length = -1;
+                goto done;
+            }
+            continue;
+        }
+
+        in.src = decompress->in;
+        in.size = decompress->in_length;
+        in.pos = decompress->in_offset;
+        status = ZSTD_decompressStream(decompress->zstd, &out, &in);
+        decompress->in_offset = in.pos;
+        if (ZSTD_isError(status))
+        {
+            length = -1;
+            goto done;
+        }
+        /* 0 once a frame is complete. Another frame may follow. */
+        decompress->stream_ended = (status == 0);
+    }
+    length = (ssize_t)out.pos;
+
+done:
+    return length;
+}
+#endif
+
+static ssize_t decompress_fill(void * const source_context, char * const buffer, size_t const buffer_size)
+{
+    tokeniser_decompress_st * const decompress = source_context;
+    ssize_t length;
+
+    if (decompress->format == tokeniser_decompress_format_unknown && !format_detect(decompress))
+    {
+        length = -1;
+        goto done;
+    }
+
+    switch (decompress->format)
+    {
+        case tokeniser_decompress_format_gzip:
+            length = gzip_fill(decompress, buffer, buffer_size);
+            break;
+#if defined(HAVE_ZSTD)
+        case tokeniser_decompress_format_zstd:
+            length = zstd_fill(decompress, buffer, buffer_size);
+            break;
+#endif
+        case tokeniser_decompress_format_none:
+            length = none_fill(decompress, buffer, buffer_size);
+            break;
+        default:
+            length = -1;
+            break;
+    }
+    if (length > 0)
+    {
+        decompress->bytes_out += (size_t)length;
+    }
+
+done:
+    return length;
+}
+
+tokeniser_decompress_st * tokeniser_decompress_alloc(tokeniser_source_st const * const input)
+{
+    tokeniser_decompress_st * decompress = calloc(1, sizeof *decompress);
+
+    if (decompress == NULL)
+    {
+        goto done;
+    }
+
+    decompress->in = malloc(TOKENISER_DECOMPRESS_INPUT_SIZE);
+    if (decompress->in == NULL)
+    {
+        free(decompress);
+        decompress = NULL;
+        goto done;
+    }
+    decompress->input = input;
+    decompress->format = tokeniser_decompress_format_unknown;
+
+done:
+    return decompress;
+}
+
+void tokeniser_decompress_free(tokeniser_decompress_st * const decompress)
+{
+    if (decompress == NULL)
+    {
+        goto done;
+    }
+
+    if (decompress->zlib_ready)
+    {
+        inflateEnd(&decompress->zlib);
+    }
+#if defined(HAVE_ZSTD)
+    ZSTD_freeDStream(decompress->zstd);
+#endif
+    free(decompress->in);
+    free(decompress);
+
+done:
+    return;
+}
+
+void tokeniser_source_decompress_init(tokeniser_source_st * const source, tokeniser_decompress_st * const decompress)
+{
+    source->fill = decompress_fill;
+    source->context = decompress;
+}
+
+tokeniser_decompress_format_t tokeniser_decompress_format_get(tokeniser_decompress_st const * const decompress)
+{
+    return decompress->format;
+}
+
+size_t tokeniser_decompress_bytes_in_get(tokeniser_decompress_st const * const decompress)
+{
+    return decompress->bytes_in;
+}
+
+size_t tokeniser_decompress_bytes_out_get(tokeniser_decompress_st const * const decompress)
+{
+    return decompress->bytes_out;
+}
@@ -0,0 +1,67 @@
+#ifndef __TOKENISER_DECOMPRESS_H__
+#define __TOKENISER_DECOMPRESS_H__
+
+#include "tokeniser_run.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A source that decompresses another source as it is read, so
+ * compressed input can be tokenised without first being
+ * decompressed to disk or into memory. The format is found from
+ * the first bytes of the input: gzip (including several
+ * concatenated members), zstd when built with HAVE_ZSTD (which
+ * tokeniser.mak defines, and links -lzstd for, when pkg-config
+ * finds libzstd), or anything else, which is passed through
+ * unchanged. tokeniser_run() calls the fill callback on its reader
+ * thread, so decompression overlaps with tokenising.
+ */
+typedef struct tokeniser_decompress_st tokeniser_decompress_st;
+
+/* The size of the buffer compressed input is read into. */
+#define TOKENISER_DECOMPRESS_INPUT_SIZE (64 * 1024)
+
+typedef enum tokeniser_decompress_format_t
+{
+    tokeniser_decompress_format_unknown, /* Nothing has been read yet. */
+    tokeniser_decompress_format_none,
+    tokeniser_decompress_format_gzip,
+    tokeniser_decompress_format_zstd
+} tokeniser_decompress_format_t;
+
+/*
+ * Allocate a decompressor reading from input.
+ * @input: Must stay valid while the decompressor is used.
+ * Returns NULL if out of memory.
+ */
+tokeniser_decompress_st * tokeniser_decompress_alloc(tokeniser_source_st const * const input);
+
+void tokeniser_decompress_free(tokeniser_decompress_st * const decompress);
+
+/*
+ * Initialise a source that reads the decompressed input. The fill
+ * callback returns -1 if the input is corrupt or truncated, or is
+ * zstd compressed and zstd support isn't built in.
+ */
+void tokeniser_source_decompress_init(tokeniser_source_st * const source, tokeniser_decompress_st * const decompress);
+
+tokeniser_decompress_format_t tokeniser_decompress_format_get(tokeniser_decompress_st const * const decompress);
+
+/*
+ * Return value: The number of bytes read from the input so far.
+ */
+size_t tokeniser_decompress_bytes_in_get(tokeniser_decompress_st const * const decompress);
+
+/*
+ * Return value: The number of decompressed bytes supplied so far.
+ */
+size_t tokeniser_decompress_bytes_out_get(tokeniser_decompress_st const * const decompress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_DECOMPRESS_H__ */
@@ -0,0 +1,197 @@
+#include "tokeniser_keywords.h"
+#include "hash.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYWORDS_MIN_SLOTS 8
+#define KEYWORDS_SEED_ATTEMPTS 256
+#define KEYWORDS_MAX_SLOT_FACTOR 64 /* Give up if a hash needs more than this many slots per keyword. */
+#define KEYWORDS_SEED_MULTIPLIER UINT64_C(0x9e3779b97f4a7c15)
+
+typedef struct keyword_st
+{
+    char const * text;
+    size_t length;
+} keyword_st;
+
+struct tokeniser_keywords_st
+{
+    uint64_t seed;
+    size_t slot_mask; /* The slot count, a power of 2, less one. */
+    int * slots; /* The id of the keyword in each slot, or TOKENISER_KEYWORD_NONE. */
+
+    keyword_st * keywords; /* Indexed by id. */
+    size_t keyword_count;
+    char * text; /* The keywords, NUL separated. */
+};
+
+static size_t slot_index_get(uint64_t const seed, size_t const slot_mask, uint64_t const hash)
+{
+    /* Mix in the seed and take the high bits of the product, which
+     * depend on all the bits of the hash.
+     */
+    return (size_t)(((hash ^ seed) * KEYWORDS_SEED_MULTIPLIER) >> 32) & slot_mask;
+}
+
+static bool seed_try(tokeniser_keywords_st * const keywords, uint64_t const * const hashes, uint64_t const seed)
+{
+    /* Returns true if no two keywords share a slot with this seed. */
+    bool perfect = true;
+    size_t index;
+
+    for (index = 0; index <= keywords->slot_mask; index++)
+    {
+        keywords->slots[index] = TOKENISER_KEYWORD_NONE;
+    }
+    for (index = 0; index < keywords->keyword_count; index++)
+    {
+        size_t const slot = slot_index_get(seed, keywords->slot_mask, hashes[index]);
+
+        if (keywords->slots[slot] != TOKENISER_KEYWORD_NONE)
+        {
+            perfect = false;
+            goto done;
+        }
+        keywords->slots[slot] = (int)index;
+    }
+    keywords->seed = seed;
+
+done:
+    return perfect;
+}
+
+static bool perfect_hash_build(tokeniser_keywords_st * const keywords, uint64_t const * const hashes)
+{
+    /* Start with at least twice as many slots as keywords, so a
+     * seed that spreads them out is found within a few attempts,
+     * and double the slots until one is. Duplicate keywords (or a
+     * 64 bit hash collision) can never be separated, so give up
+     * eventually.
+     */
+    bool built = false;
+    size_t slot_count = KEYWORDS_MIN_SLOTS;
+
+    while (slot_count < keywords->keyword_count * 2)
+    {
+        slot_count *= 2;
+    }
+
+    while (!built && slot_count <= keywords->keyword_count * KEYWORDS_MAX_SLOT_FACTOR + KEYWORDS_MIN_SLOTS)
+    {
+        int * const new_slots = realloc(keywords->slots, slot_count * sizeof *new_slots);
+        uint64_t seed;
+
+        if (new_slots == NULL)
+        {
+            goto done;
+        }
+        keywords->slots = new_slots;
+        keywords->slot_mask = slot_count - 1;
+
+        for (seed = 0; seed < KEYWORDS_SEED_ATTEMPTS && !built; seed++)
+        {
+            built = seed_try(keywords, hashes, seed);
+        }
+        slot_count *= 2;
+    }
+
+done:
+    return built;
+}
+
+tokeniser_keywords_st * tokeniser_keywords_alloc(char const * const * const keywords, size_t const keyword_count)
+{
+    tokeniser_keywords_st * set = calloc(1, sizeof *set);
+    uint64_t * hashes = NULL;
+    size_t text_size = 0;
+    size_t text_used = 0;
+    size_t index;
+
+    if (set == NULL)
+    {
+        goto done;
+    }
+
+    for (index = 0; index < keyword_count; index++)
+    {
+        text_size += strlen(keywords[index]) + 1;
+    }
+    set->keyword_count = keyword_count;
+    set->keywords = malloc((keyword_count + 1) * sizeof *set->keywords);
+    set->text = malloc(text_size + 1);
+    hashes = malloc((keyword_count + 1) * sizeof *hashes);
+    if (set->keywords == NULL || set->text == NULL || hashes == NULL)
+    {
+        goto error;
+    }
+
+    for (index = 0; index < keyword_count; index++)
+    {
+        size_t const length = strlen(keywords[index]);
+        char * const text = &set->text[text_used];
+
+        memcpy(text, keywords[index], length + 1);
+        text_used += length + 1;
+        set->keywords[index].text = text;
+        set->keywords[index].length = length;
+        hashes[index] = hash_bytes(text, length);
+    }
+
+    if (!perfect_hash_build(set, hashes))
+    {
+        goto error;
+    }
+    goto done;
+
+error:
+    tokeniser_keywords_free(set);
+    set = NULL;
+
+done:
+    free(hashes);
+    return set;
+}
+
+void tokeniser_keywords_free(tokeniser_keywords_st * const keywords)
+{
+    if (keywords == NULL)
+    {
+        goto done;
+    }
+
+    free(keywords->slots);
+    free(keywords->keywords);
+    free(keywords->text);
+    free(keywords);
+
+done:
+    return;
+}
+
+int tokeniser_keywords_match(tokeniser_keywords_st const * const keywords,
+                             uint64_t const hash,
+                             char const * const token,
+                             size_t const length)
+{
+    /* Any token can land in a slot, so the slot's keyword must be
+     * compared with it.
+     */
+    int const id = keywords->slots[slot_index_get(keywords->seed, keywords->slot_mask, hash)];
+    int match = TOKENISER_KEYWORD_NONE;
+
+    if (id != TOKENISER_KEYWORD_NONE
+        && keywords->keywords[id].length == length
+        && memcmp(keywords->keywords[id].text, token, length) == 0)
+    {
+        match = id;
+    }
+
+    return match;
+}
+
+int tokeniser_keywords_find(tokeniser_keywords_st const * const keywords, char const * const token, size_t const length)
+{
+    return tokeniser_keywords_match(keywords, hash_bytes(token, length), token, length);
+}
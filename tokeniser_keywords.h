@@ -0,0 +1,54 @@
+#ifndef __TOKENISER_KEYWORDS_H__
+#define __TOKENISER_KEYWORDS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A fixed set of keywords, such as the commands and flags of a
+ * dialect, looked up through a perfect hash built when the set is
+ * created. A lookup takes the FNV-1a hash of the token (see
+ * hash.h), which the tokeniser builds as the token is built, so
+ * recognising a keyword costs one slot lookup and one compare.
+ */
+typedef struct tokeniser_keywords_st tokeniser_keywords_st;
+
+#define TOKENISER_KEYWORD_NONE (-1)
+
+/*
+ * Build the perfect hash for a set of keywords. The keywords are
+ * copied.
+ * @keywords: The keywords. The id of each keyword is its index in
+ * this array.
+ * @keyword_count: The number of keywords.
+ * Returns: The keyword set, or NULL if out of memory or a keyword
+ * appears more than once.
+ */
+tokeniser_keywords_st * tokeniser_keywords_alloc(char const * const * const keywords, size_t const keyword_count);
+
+void tokeniser_keywords_free(tokeniser_keywords_st * const keywords);
+
+/*
+ * Look up a token whose hash has already been computed.
+ * @hash: hash_bytes(token, length).
+ * Returns: The id of the keyword, or TOKENISER_KEYWORD_NONE.
+ */
+int tokeniser_keywords_match(tokeniser_keywords_st const * const keywords,
+                             uint64_t const hash,
+                             char const * const token,
+                             size_t const length);
+
+/*
+ * Look up a token.
+ * Returns: The id of the keyword, or TOKENISER_KEYWORD_NONE.
+ */
+int tokeniser_keywords_find(tokeniser_keywords_st const * const keywords, char const * const token, size_t const length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_KEYWORDS_H__ */
@@ -0,0 +1,256 @@
+#include "tokeniser_number.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define NUMBER_EXPONENT_LIMIT 100000 /* Far beyond any double, so clamping here doesn't change the result. */
+#define NUMBER_EXACT_MANTISSA_MAX (UINT64_C(1) << 53)
+#define NUMBER_EXACT_POWER_MAX 22
+
+typedef enum number_scan_state_t
+{
+    number_scan_start,
+    number_scan_sign,
+    number_scan_integer,
+    number_scan_leading_point, /* A '.' with no digits before it. */
+    number_scan_fraction,
+    number_scan_exponent_start,
+    number_scan_exponent_sign,
+    number_scan_exponent,
+    number_scan_invalid
+} number_scan_state_t;
+
+/* Every power of 10 that a double holds exactly. */
+static double const powers_of_10[NUMBER_EXACT_POWER_MAX + 1] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_digit(char const ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static void mantissa_digit_add(tokeniser_number_scan_st * const scan, char const ch, bool const fraction)
+{
+    /* Once the mantissa is full, later integer digits only scale it,
+     * and later fraction digits are dropped. The value is then only
+     * approximate, so finishing falls back to strtod().
+     */
+    unsigned int const digit = (unsigned int)(ch - '0');
+
+    if (!scan->truncated && scan->mantissa <= (UINT64_MAX - digit) / 10)
+    {
+        scan->mantissa = scan->mantissa * 10 + digit;
+        if (fraction)
+        {
+            scan->decimal_exponent--;
+        }
+    }
+    else
+    {
+        scan->truncated = true;
+        if (!fraction)
+        {
+            scan->decimal_exponent++;
+        }
+    }
+}
+
+void tokeniser_number_scan_init(tokeniser_number_scan_st * const scan)
+{
+    scan->state = number_scan_start;
+    scan->negative = false;
+    scan->exponent_negative = false;
+    scan->truncated = false;
+    scan->mantissa = 0;
+    scan->decimal_exponent = 0;
+    scan->exponent = 0;
+}
+
+void tokeniser_number_scan_invalidate(tokeniser_number_scan_st * const scan)
+{
+    scan->state = number_scan_invalid;
+}
+
+void tokeniser_number_scan_char(tokeniser_number_scan_st * const scan, char const ch)
+{
+    number_scan_state_t next_state = number_scan_invalid;
+
+    switch ((number_scan_state_t)scan->state)
+    {
+        case number_scan_start:
+            if (ch == '+' || ch == '-')
+            {
+                scan->negative = (ch == '-');
+                next_state = number_scan_sign;
+                break;
+            }
+            /* Fall through. */
+        case number_scan_sign:
+            if (is_digit(ch))
+            {
+                mantissa_digit_add(scan, ch, false);
+                next_state = number_scan_integer;
+            }
+            else if (ch == '.')
+            {
+                next_state = number_scan_leading_point;
+            }
+            break;
+        case number_scan_integer:
+            if (is_digit(ch))
+            {
+                mantissa_digit_add(scan, ch, false);
+                next_state = number_scan_integer;
+            }
+            else if (ch == '.')
+            {
+                next_state = number_scan_fraction;
+            }
+            else if (ch == 'e' || ch == 'E')
+            {
+                next_state = number_scan_exponent_start;
+            }
+            break;
+        case number_scan_leading_point:
+            if (is_digit(ch))
+            {
+                mantissa_digit_add(scan, ch, true);
+                next_state = number_scan_fraction;
+            }
+            break;
+        case number_scan_fraction:
+            if (is_digit(ch))
+            {
+                mantissa_digit_add(scan, ch, true);
+                next_state = number_scan_fraction;
+            }
+            else if (ch == 'e' || ch == 'E')
+            {
+                next_state = number_scan_exponent_start;
+            }
+            break;
+        case number_scan_exponent_start:
+            if (ch == '+' || ch == '-')
+            {
+                scan->exponent_negative = (ch == '-');
+                next_state = number_scan_exponent_sign;
+                break;
+            }
+            /* Fall through. */
+        case number_scan_exponent_sign:
+        case number_scan_exponent:
+            if (is_digit(ch))
+            {
+                if (scan->exponent < NUMBER_EXPONENT_LIMIT)
+                {
+                    scan->exponent = scan->exponent * 10 + (ch - '0');
+                }
+                next_state = number_scan_exponent;
+            }
+            break;
+        case number_scan_invalid:
+            break;
+    }
+
+    scan->state = next_state;
+}
+
+static void integer_finish(tokeniser_number_scan_st const * const scan, tokeniser_number_st * const number)
+{
+    uint64_t const limit = scan->negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+
+    number->kind = tokeniser_number_integer;
+    number->overflow = (scan->truncated || scan->mantissa > limit);
+    if (number->overflow)
+    {
+        number->integer = scan->negative ? INT64_MIN : INT64_MAX;
+    }
+    else if (scan->negative)
+    {
+        /* Negate in unsigned arithmetic, so INT64_MIN doesn't overflow. */
+        number->integer = (int64_t)(0 - scan->mantissa);
+    }
+    else
+    {
+        number->integer = (int64_t)scan->mantissa;
+    }
+}
+
+static void real_finish(tokeniser_number_scan_st const * const scan,
+                        char const * const text,
+                        tokeniser_number_st * const number)
+{
+    /* A mantissa and power of 10 that are both exactly representable
+     * give a correctly rounded result from a single multiply or
+     * divide. Anything else is left to strtod().
+     */
+    int32_t const exponent = scan->decimal_exponent + (scan->exponent_negative ? -scan->exponent : scan->exponent);
+
+    number->kind = tokeniser_number_real;
+    number->overflow = false;
+    if (!scan->truncated
+        && scan->mantissa <= NUMBER_EXACT_MANTISSA_MAX
+        && exponent >= -NUMBER_EXACT_POWER_MAX
+        && exponent <= NUMBER_EXACT_POWER_MAX)
+    {
+        double value = (double)scan->mantissa;
+
+        if (exponent < 0)
+        {
+            value /= powers_of_10[-exponent];
+        }
+        else
+        {
+            value *= powers_of_10[exponent];
+        }
+        number->real = scan->negative ? -value : value;
+    }
+    else
+    {
+        errno = 0;
+        number->real = strtod(text, NULL);
+        number->overflow = (errno == ERANGE && isinf(number->real));
+    }
+}
+
+bool tokeniser_number_scan_finish(tokeniser_number_scan_st const * const scan,
+                                  char const * const text,
+                                  tokeniser_number_st * const number)
+{
+    bool is_number = true;
+
+    switch ((number_scan_state_t)scan->state)
+    {
+        case number_scan_integer:
+            integer_finish(scan, number);
+            break;
+        case number_scan_fraction:
+        case number_scan_exponent:
+            real_finish(scan, text, number);
+            break;
+        default:
+            number->kind = tokeniser_number_none;
+            is_number = false;
+            break;
+    }
+
+    return is_number;
+}
+
+bool tokeniser_number_parse(char const * const text, tokeniser_number_st * const number)
+{
+    tokeniser_number_scan_st scan;
+    char const * ch;
+
+    tokeniser_number_scan_init(&scan);
+    for (ch = text; *ch != '\0'; ch++)
+    {
+        tokeniser_number_scan_char(&scan, *ch);
+    }
+
+    return tokeniser_number_scan_finish(&scan, text, number);
+}
@@ -0,0 +1,75 @@
+#ifndef __TOKENISER_NUMBER_H__
+#define __TOKENISER_NUMBER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum tokeniser_number_kind_t
+{
+    tokeniser_number_none, /* The token isn't a number. */
+    tokeniser_number_integer, /* [+-]digits */
+    tokeniser_number_real /* [+-]digits.digits[eE][+-]digits, with either set of digits optional but not both. */
+} tokeniser_number_kind_t;
+
+typedef struct tokeniser_number_st
+{
+    tokeniser_number_kind_t kind;
+    bool overflow; /* The value is out of range, and has been clamped as strtoll() and strtod() do. */
+    int64_t integer; /* Valid for tokeniser_number_integer. */
+    double real; /* Valid for tokeniser_number_real. */
+} tokeniser_number_st;
+
+/* The state of a number being scanned a character at a time, as
+ * a token is built. Numbers are always in the C locale's format.
+ */
+typedef struct tokeniser_number_scan_st
+{
+    uint8_t state; /* number_scan_state_t in tokeniser_number.c */
+    bool negative;
+    bool exponent_negative;
+    bool truncated; /* There were too many digits to hold exactly in mantissa. */
+    uint64_t mantissa; /* The leading digits. */
+    int32_t decimal_exponent; /* The power of 10 to scale mantissa by, before exponent is applied. */
+    int32_t exponent; /* The value after the 'e', clamped well beyond the range of a double. */
+} tokeniser_number_scan_st;
+
+void tokeniser_number_scan_init(tokeniser_number_scan_st * const scan);
+
+/*
+ * Add the next character of the token to the scan.
+ */
+void tokeniser_number_scan_char(tokeniser_number_scan_st * const scan, char const ch);
+
+/*
+ * The token can't be a number, whatever follows.
+ */
+void tokeniser_number_scan_invalidate(tokeniser_number_scan_st * const scan);
+
+/*
+ * Get the value of the scanned token.
+ * @text: The NUL terminated text that was scanned. It is only
+ * read back for the rare reals that can't be converted exactly
+ * from the scan alone.
+ * Returns: false if the token isn't a number.
+ */
+bool tokeniser_number_scan_finish(tokeniser_number_scan_st const * const scan,
+                                  char const * const text,
+                                  tokeniser_number_st * const number);
+
+/*
+ * Parse a NUL terminated token, as the tokeniser does while
+ * scanning.
+ * Returns: false if the token isn't a number.
+ */
+bool tokeniser_number_parse(char const * const text, tokeniser_number_st * const number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_NUMBER_H__ */
@@ -0,0 +1,539 @@
+#include "tokeniser_parallel.h"
+#include "tokeniser_table.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PIECES_INITIAL_SIZE 64
+#define TEXT_INITIAL_SIZE 4096
+
+/* The part of a token found within one chunk. */
+typedef struct token_piece_st
+{
+    size_t start_index; /* Not set if the token is continued. */
+    size_t end_index; /* Not set if the token is open. */
+    size_t text_offset; /* Of the NUL terminated text in the chunk's text buffer. */
+    size_t text_length;
+    char quote_char;
+    bool continued; /* The token started in an earlier chunk. */
+    bool open; /* The token carries on into the next chunk. */
+} token_piece_st;
+
+typedef struct chunk_st
+{
+    char const * buffer; /* The whole record. */
+    size_t start;
+    size_t end;
+
+    /* Found by the speculative pass. */
+    uint8_t end_states[table_state_count]; /* The state at the end of the chunk for each possible start state. */
+
+    /* Found by the tokenising pass once the start state is known. */
+    table_state_t start_state;
+    token_piece_st * pieces;
+    size_t piece_count;
+    size_t piece_array_size;
+    char * text;
+    size_t text_length;
+    size_t text_size;
+    tokeniser_result_t result; /* continue unless the record ended within the chunk. */
+} chunk_st;
+
+typedef struct stitch_st
+{
+    char * text; /* The text of a token that spans chunks. */
+    size_t text_length;
+    size_t text_size;
+    size_t start_index;
+} stitch_st;
+
+static bool text_append(char * * const text,
+                        size_t * const text_length,
+                        size_t * const text_size,
+                        char const * const new_text,
+                        size_t const new_text_length)
+{
+    bool appended;
+
+    if (*text_length + new_text_length >= *text_size)
+    {
+        size_t new_size = (*text_size == 0) ? TEXT_INITIAL_SIZE : *text_size;
+        char * new_buffer;
+
+        while (*text_length + new_text_length >= new_size)
+        {
+            new_size *= 2;
+        }
+        new_buffer = realloc(*text, new_size);
+        if (new_buffer == NULL)
+        {
+            appended = false;
+            goto done;
+        }
+        *text = new_buffer;
+        *text_size = new_size;
+    }
+
+    if (new_text_length != 0)
+    {
+        memcpy(*text + *text_length, new_text, new_text_length);
+    }
+    *text_length += new_text_length;
+    (*text)[*text_length] = '\0';
+    appended = true;
+
+done:
+    return appended;
+}
+
+static void lanes_merge(uint8_t * const lane_states, unsigned int * const lane_of, unsigned int * const lane_count)
+{
+    /* Lanes that have reached the same state follow the same path
+     * from now on, so only one of them need be kept.
+     */
+    unsigned int lane;
+    unsigned int other_lane;
+    unsigned int start_state;
+
+    for (lane = 0; lane < *lane_count; lane++)
+    {
+        other_lane = lane + 1;
+        while (other_lane < *lane_count)
+        {
+            unsigned int const last_lane = *lane_count - 1;
+
+            if (lane_states[other_lane] != lane_states[lane])
+            {
+                other_lane++;
+                continue;
+            }
+            /* Merge other_lane into lane and move the last lane into its place. */
+            for (start_state = 0; start_state < table_state_count; start_state++)
+            {
+                if (lane_of[start_state] == other_lane)
+                {
+                    lane_of[start_state] = lane;
+                }
+                else if (lane_of[start_state] == last_lane)
+                {
+                    lane_of[start_state] = other_lane;
+                }
+            }
+            lane_states[other_lane] = lane_states[last_lane];
+            (*lane_count)--;
+        }
+    }
+}
+
+static void chunk_speculate(chunk_st * const chunk)
+{
+    /* Scan the chunk from every possible start state at once,
+     * recording where each one ends up. There's no token building,
+     * just state changes.
+     */
+    uint8_t lane_states[table_state_count];
+    unsigned int lane_of[table_state_count]; /* The lane followed by each start state. */
+    unsigned int lane_count = table_state_count;
+    unsigned int lane;
+    size_t index;
+
+    for (lane = 0; lane < table_state_count; lane++)
+    {
+        lane_states[lane] = (uint8_t)lane;
+        lane_of[lane] = lane;
+    }
+
+    for (index = chunk->start; index < chunk->end && lane_count > 1; index++)
+    {
+        table_class_t const char_class = tokeniser_table_class_get(chunk->buffer[index]);
+
+        for (lane = 0; lane < lane_count; lane++)
+        {
+            lane_states[lane] = tokeniser_table[lane_states[lane]][char_class].next_state;
+        }
+        lanes_merge(lane_states, lane_of, &lane_count);
+    }
+
+    if (lane_count == 1)
+    {
+        uint8_t state = lane_states[0];
+
+        for (; index < chunk->end && state != table_state_done; index++)
+        {
+            state = tokeniser_table[state][tokeniser_table_class_get(chunk->buffer[index])].next_state;
+        }
+        lane_states[0] = state;
+    }
+
+    for (lane = 0; lane < table_state_count; lane++)
+    {
+        chunk->end_states[lane] = lane_states[lane_of[lane]];
+    }
+}
+
+static token_piece_st * chunk_piece_new(chunk_st * const chunk, size_t const start_index, bool const continued)
+{
+    token_piece_st * piece = NULL;
+
+    if (chunk->piece_count == chunk->piece_array_size)
+    {
+        size_t const new_size = (chunk->piece_array_size == 0) ? PIECES_INITIAL_SIZE : chunk->piece_array_size * 2;
+        token_piece_st * const new_pieces = realloc(chunk->pieces, new_size * sizeof *new_pieces);
+
+        if (new_pieces == NULL)
+        {
+            goto done;
+        }
+        chunk->pieces = new_pieces;
+        chunk->piece_array_size = new_size;
+    }
+
+    piece = &chunk->pieces[chunk->piece_count];
+    chunk->piece_count++;
+    piece->start_index = start_index;
+    piece->end_index = 0;
+    piece->text_offset = chunk->text_length;
+    piece->text_length = 0;
+    piece->quote_char = '\0';
+    piece->continued = continued;
+    piece->open = true;
+
+done:
+    return piece;
+}
+
+static bool chunk_piece_end(chunk_st * const chunk, size_t const end_index, char const quote_char)
+{
+    token_piece_st * const piece = &chunk->pieces[chunk->piece_count - 1];
+
+    piece->end_index = end_index;
+    piece->quote_char = quote_char;
+    piece->open = false;
+
+    /* Skip past the NUL terminator so the next piece has its own. */
+    return text_append(&chunk->text, &chunk->text_length, &chunk->text_size, "", 1);
+}
+
+static bool chunk_chars_append(chunk_st * const chunk, size_t const index, size_t const length)
+{
+    token_piece_st * const piece = &chunk->pieces[chunk->piece_count - 1];
+
+    piece->text_length += length;
+    return text_append(&chunk->text, &chunk->text_length, &chunk->text_size, &chunk->buffer[index], length);
+}
+
+static size_t chunk_append_run_end(chunk_st const * const chunk, table_state_t const state, size_t index)
+{
+    /* Find the end of the run of characters from index that are
+     * appended to the current token without leaving state.
+     */
+    while (index < chunk->end)
+    {
+        table_entry_st const entry = tokeniser_table[state][tokeniser_table_class_get(chunk->buffer[index])];
+
+        if (entry.action != table_action_append || entry.next_state != state)
+        {
+            break;
+        }
+        index++;
+    }
+
+    return index;
+}
+
+static void chunk_tokenise(chunk_st * const chunk)
+{
+    /* Scan the chunk from its true start state, recording the
+     * pieces of the tokens in it.
+     */
+    table_state_t state = chunk->start_state;
+    bool ok = true;
+    size_t index;
+    size_t run_end;
+
+    chunk->result = tokeniser_result_continue;
+
+    if (tokeniser_table_state_in_token(state))
+    {
+        ok = chunk_piece_new(chunk, 0, true) != NULL;
+    }
+
+    for (index = chunk->start; index < chunk->end && state != table_state_done && ok; index++)
+    {
+        char const ch = chunk->buffer[index];
+        table_entry_st const entry = tokeniser_table[state][tokeniser_table_class_get(ch)];
+
+        switch ((table_action_t)entry.action)
+        {
+            case table_action_none:
+                break;
+            case table_action_start:
+                run_end = chunk_append_run_end(chunk, entry.next_state, index + 1);
+                ok = chunk_piece_new(chunk, index, false) != NULL && chunk_chars_append(chunk, index, run_end - index);
+                index = run_end - 1;
+                break;
+            case table_action_start_quoted:
+                ok = chunk_piece_new(chunk, index, false) != NULL;
+                break;
+            case table_action_append:
+                run_end = chunk_append_run_end(chunk, entry.next_state, index + 1);
+                ok = chunk_chars_append(chunk, index, run_end - index);
+                index = run_end - 1;
+                break;
+            case table_action_end:
+                ok = chunk_piece_end(chunk, index, '\0');
+                break;
+            case table_action_end_quoted:
+                ok = chunk_piece_end(chunk, index + 1, ch);
+                break;
+            case table_action_end_line:
+                chunk->result = tokeniser_result_ok;
+                break;
+            case table_action_end_line_token:
+                ok = chunk_piece_end(chunk, index, '\0');
+                chunk->result = tokeniser_result_ok;
+                break;
+            case table_action_incomplete:
+                ok = chunk_piece_end(chunk, index, '\0');
+                chunk->result = tokeniser_result_incomplete_token;
+                break;
+        }
+        state = entry.next_state;
+    }
+
+    if (!ok)
+    {
+        chunk->result = tokeniser_result_error;
+    }
+}
+
+static void * chunk_speculate_thread(void * const arg)
+{
+    chunk_speculate(arg);
+    return NULL;
+}
+
+static void * chunk_tokenise_thread(void * const arg)
+{
+    chunk_tokenise(arg);
+    return NULL;
+}
+
+static void chunks_run(chunk_st * const chunks, size_t const chunk_count, void * (* const thread_function)(void *))
+{
+    /* Run thread_function on each chunk. The first chunk is done by
+     * the calling thread, as is any chunk a thread can't be started
+     * for.
+     */
+    pthread_t * const threads = calloc(chunk_count, sizeof *threads);
+    bool * const started = calloc(chunk_count, sizeof *started);
+    size_t index;
+
+    for (index = 1; index < chunk_count; index++)
+    {
+        if (threads != NULL && started != NULL)
+        {
+            started[index] = pthread_create(&threads[index], NULL, thread_function, &chunks[index]) == 0;
+        }
+    }
+
+    thread_function(&chunks[0]);
+
+    for (index = 1; index < chunk_count; index++)
+    {
+        if (started != NULL && started[index])
+        {
+            pthread_join(threads[index], NULL);
+        }
+        else
+        {
+            thread_function(&chunks[index]);
+        }
+    }
+
+    free(threads);
+    free(started);
+}
+
+static bool stitch_token(stitch_st * const stitch,
+                         chunk_st const * const chunk,
+                         token_piece_st const * const piece,
+                         new_token_cb const user_callback,
+                         void * const user_arg)
+{
+    char const * const text = chunk->text + piece->text_offset;
+    bool ok = true;
+
+    if (!piece->continued)
+    {
+        stitch->start_index = piece->start_index;
+        stitch->text_length = 0;
+    }
+
+    if (piece->continued || piece->open)
+    {
+        /* Part of a token that spans chunks. */
+        ok = text_append(&stitch->text, &stitch->text_length, &stitch->text_size, text, piece->text_length);
+        if (!ok || piece->open)
+        {
+            goto done;
+        }
+        if (user_callback != NULL)
+        {
+            user_callback(stitch->text, stitch->start_index, piece->end_index, piece->quote_char, user_arg);
+        }
+    }
+    else if (user_callback != NULL)
+    {
+        user_callback(text, piece->start_index, piece->end_index, piece->quote_char, user_arg);
+    }
+
+done:
+    return ok;
+}
+
+static tokeniser_result_t chunks_stitch(chunk_st const * const chunks,
+                                        size_t const chunk_count,
+                                        size_t const length,
+                                        new_token_cb const user_callback,
+                                        void * const user_arg)
+{
+    /* Pass the tokens to the user in order, joining any that span
+     * chunks.
+     */
+    stitch_st stitch = { NULL, 0, 0, 0 };
+    tokeniser_result_t result = tokeniser_result_continue;
+    table_state_t end_state;
+    size_t chunk_index;
+    size_t piece_index;
+
+    for (chunk_index = 0; chunk_index < chunk_count && result == tokeniser_result_continue; chunk_index++)
+    {
+        chunk_st const * const chunk = &chunks[chunk_index];
+
+        for (piece_index = 0; piece_index < chunk->piece_count; piece_index++)
+        {
+            if (!stitch_token(&stitch, chunk, &chunk->pieces[piece_index], user_callback, user_arg))
+            {
+                result = tokeniser_result_error;
+                goto done;
+            }
+        }
+        result = chunk->result;
+    }
+    if (result != tokeniser_result_continue)
+    {
+        goto done;
+    }
+
+    /* The end of the record acts as a NUL. */
+    end_state = chunks[chunk_count - 1].end_states[chunks[chunk_count - 1].start_state];
+    switch ((table_action_t)tokeniser_table[end_state][table_class_nul].action)
+    {
+        case table_action_end_line_token:
+            result = tokeniser_result_ok;
+            break;
+        case table_action_incomplete:
+            result = tokeniser_result_incomplete_token;
+            break;
+        default:
+            result = tokeniser_result_ok;
+            goto done;
+    }
+    if (stitch.text == NULL && !text_append(&stitch.text, &stitch.text_length, &stitch.text_size, "", 0))
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+    if (user_callback != NULL)
+    {
+        user_callback(stitch.text, stitch.start_index, length, '\0', user_arg);
+    }
+
+done:
+    free(stitch.text);
+
+    return result;
+}
+
+tokeniser_result_t tokeniser_parallel_feed(char const * const buffer,
+                                           size_t const length,
+                                           unsigned int const thread_count,
+                                           new_token_cb const user_callback,
+                                           void * const user_arg)
+{
+    tokeniser_result_t result;
+    chunk_st * chunks = NULL;
+    size_t chunk_count;
+    size_t chunk_size;
+    size_t index;
+
+    chunk_count = thread_count;
+    if (chunk_count == 0)
+    {
+        long const processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+        chunk_count = (processors > 0) ? (size_t)processors : 1;
+    }
+    if (chunk_count > length / TOKENISER_PARALLEL_MIN_CHUNK_SIZE)
+    {
+        chunk_count = length / TOKENISER_PARALLEL_MIN_CHUNK_SIZE;
+    }
+    if (chunk_count == 0)
+    {
+        chunk_count = 1;
+    }
+    chunk_size = length / chunk_count;
+
+    chunks = calloc(chunk_count, sizeof *chunks);
+    if (chunks == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+    for (index = 0; index < chunk_count; index++)
+    {
+        chunks[index].buffer = buffer;
+        chunks[index].start = index * chunk_size;
+        chunks[index].end = (index == chunk_count - 1) ? length : (index + 1) * chunk_size;
+    }
+
+    chunks_run(chunks, chunk_count, chunk_speculate_thread);
+
+    /* Each chunk starts in the state the chunk before it ended in. */
+    chunks[0].start_state = table_state_no_token;
+    for (index = 1; index < chunk_count; index++)
+    {
+        chunks[index].start_state = chunks[index - 1].end_states[chunks[index - 1].start_state];
+    }
+
+    chunks_run(chunks, chunk_count, chunk_tokenise_thread);
+
+    for (index = 0; index < chunk_count; index++)
+    {
+        if (chunks[index].result == tokeniser_result_error)
+        {
+            result = tokeniser_result_error;
+            goto done;
+        }
+    }
+
+    result = chunks_stitch(chunks, chunk_count, length, user_callback, user_arg);
+
+done:
+    if (chunks != NULL)
+    {
+        for (index = 0; index < chunk_count; index++)
+        {
+            free(chunks[index].pieces);
+            free(chunks[index].text);
+        }
+        free(chunks);
+    }
+
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef __TOKENISER_PARALLEL_H__
+#define __TOKENISER_PARALLEL_H__
+
+#include "tokeniser.h"
+
+#include <stddef.h>
+
+/* Buffers are split into chunks of at least this many bytes, so
+ * small records aren't worth more than one thread.
+ */
+#define TOKENISER_PARALLEL_MIN_CHUNK_SIZE (64 * 1024)
+
+/*
+ * Tokenise a single record using several threads. The record is
+ * split into chunks, and each chunk is scanned speculatively from
+ * every state the tokeniser could be in at its start (outside a
+ * token, in a token, or inside either kind of quote). Once the
+ * true starting state of each chunk is known from the chunk
+ * before it, the tokens are found and passed to user_callback in
+ * order.
+ * The tokens, their offsets and the result are the same as
+ * feeding each character of buffer to a new tokeniser with
+ * tokeniser_feed() followed by a '\0'. Limits and flight
+ * recording don't apply.
+ * @buffer: The record. It needn't be NUL terminated.
+ * @length: The number of characters in the record.
+ * @thread_count: The maximum number of threads to use. 0 selects
+ * the number of online processors.
+ * Return value: tokeniser_result_ok, tokeniser_result_incomplete_token,
+ * or tokeniser_result_error if out of memory.
+ */
+tokeniser_result_t tokeniser_parallel_feed(char const * const buffer,
+                                           size_t const length,
+                                           unsigned int const thread_count,
+                                           new_token_cb const user_callback,
+                                           void * const user_arg);
+
+#endif /* __TOKENISER_PARALLEL_H__ */
@@ -0,0 +1,954 @@
+#include "tokeniser_pipeline.h"
+#include "tokeniser_private.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LINES_INITIAL_SIZE 64
+#define TOKEN_SPANS_INITIAL_SIZE 256
+
+/* A stage waiting on a queue yields this many times before it
+ * starts sleeping between looks.
+ */
+#define WAIT_SPINS 64
+#define WAIT_SLEEP_NS 20000
+
+#define CACHE_LINE_SIZE 64
+
+/* A bounded multi-producer, multi-consumer queue of pointers.
+ * Each cell carries a sequence number saying whether it is ready
+ * to be written or read at the current positions, so producers
+ * and consumers only contend on the positions, never on a lock.
+ * The capacity is never less than the number of items that can
+ * be queued, so a push always succeeds.
+ */
+typedef struct ring_cell_st
+{
+    atomic_size_t sequence;
+    void * item;
+} ring_cell_st;
+
+typedef struct ring_st
+{
+    ring_cell_st * cells;
+    size_t mask;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t push_position;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t pop_position;
+} ring_st;
+
+typedef struct pipeline_buffer_st
+{
+    char * data;
+    size_t length;
+    size_t stream_offset; /* Of the first character in data. */
+    uint64_t sequence;
+    bool line_too_long; /* data is unused, and length is that of a single line that didn't fit in a buffer. */
+} pipeline_buffer_st;
+
+typedef struct pipeline_batch_st
+{
+    tokeniser_pipeline_batch_st batch; /* What the consumer is given. */
+    tokens_st * tokens;
+    tokeniser_pipeline_token_st * token_spans;
+    size_t token_span_array_size;
+    tokeniser_pipeline_line_st * lines;
+    size_t line_array_size;
+} pipeline_batch_st;
+
+typedef struct pipeline_worker_st
+{
+    tokeniser_pipeline_st * pipeline;
+    tokeniser_st * tokeniser; /* Only for tokeniser threads. */
+    pthread_t thread;
+} pipeline_worker_st;
+
+typedef struct pipeline_stats_st
+{
+    atomic_uint_fast64_t buffers_read;
+    atomic_uint_fast64_t batches_consumed;
+    atomic_uint_fast64_t reader_stalls;
+    atomic_uint_fast64_t tokeniser_input_stalls;
+    atomic_uint_fast64_t tokeniser_output_stalls;
+    atomic_uint_fast64_t consumer_stalls;
+} pipeline_stats_st;
+
+struct tokeniser_pipeline_st
+{
+    size_t buffer_size;
+    size_t buffer_count;
+    size_t batch_count;
+    unsigned int tokeniser_threads;
+    unsigned int consumer_threads;
+
+    pipeline_buffer_st * buffers;
+    char * buffer_data;
+    pipeline_batch_st * batches;
+    pipeline_worker_st * workers; /* The tokeniser threads followed by the consumer threads. */
+    tokeniser_st * line_tokeniser; /* Finds the ends of continued lines for the reader. */
+
+    ring_st free_buffers;
+    ring_st full_buffers;
+    ring_st free_batches;
+    ring_st full_batches;
+
+    /* Set for each run. */
+    tokeniser_source_st const * source;
+    tokeniser_pipeline_consume_cb consume_callback;
+    void * user_arg;
+    bool continued_lines; /* The tokenisers are in continuation mode, so the reader uses line_tokeniser. */
+    atomic_bool reading_done;
+    atomic_bool tokenising_done;
+    atomic_uint tokenisers_running;
+    atomic_bool stop; /* Set to make every stage give up as soon as it can. */
+    atomic_bool failed;
+
+    pipeline_stats_st stats;
+};
+
+typedef struct pipeline_tokenise_st
+{
+    pipeline_batch_st * batch;
+    size_t stream_offset; /* Of the buffer being tokenised. */
+    size_t line_first_token;
+    bool failed;
+} pipeline_tokenise_st;
+
+static bool ring_alloc(ring_st * const ring, size_t const item_count)
+{
+    size_t capacity = 1;
+    bool allocated;
+
+    while (capacity < item_count)
+    {
+        capacity *= 2;
+    }
+    ring->cells = calloc(capacity, sizeof *ring->cells);
+    if (ring->cells == NULL)
+    {
+        allocated = false;
+        goto done;
+    }
+    ring->mask = capacity - 1;
+    allocated = true;
+
+done:
+    return allocated;
+}
+
+static void ring_reset(ring_st * const ring)
+{
+    /* Only while no other thread is using the ring. */
+    size_t index;
+
+    for (index = 0; index <= ring->mask; index++)
+    {
+        atomic_init(&ring->cells[index].sequence, index);
+        ring->cells[index].item = NULL;
+    }
+    atomic_init(&ring->push_position, 0);
+    atomic_init(&ring->pop_position, 0);
+}
+
+static void ring_push(ring_st * const ring, void * const item)
+{
+    size_t position = atomic_load_explicit(&ring->push_position, memory_order_relaxed);
+    ring_cell_st * cell;
+
+    for (;;)
+    {
+        size_t sequence;
+
+        cell = &ring->cells[position & ring->mask];
+        sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        if (sequence == position)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->push_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else
+        {
+            /* Another producer got the cell first. As the ring
+             * can't fill up, it can't be waiting for a consumer.
+             */
+            position = atomic_load_explicit(&ring->push_position, memory_order_relaxed);
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+}
+
+static void * ring_pop(ring_st * const ring)
+{
+    size_t position = atomic_load_explicit(&ring->pop_position, memory_order_relaxed);
+    ring_cell_st * cell;
+    void * item;
+
+    for (;;)
+    {
+        size_t sequence;
+
+        cell = &ring->cells[position & ring->mask];
+        sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        if (sequence == position + 1)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->pop_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if ((intptr_t)(sequence - (position + 1)) < 0)
+        {
+            /* Empty. */
+            item = NULL;
+            goto done;
+        }
+        else
+        {
+            position = atomic_load_explicit(&ring->pop_position, memory_order_relaxed);
+        }
+    }
+
+    item = cell->item;
+    atomic_store_explicit(&cell->sequence, position + ring->mask + 1, memory_order_release);
+
+done:
+    return item;
+}
+
+static size_t ring_depth(ring_st const * const ring)
+{
+    size_t const pop_position = atomic_load_explicit(&ring->pop_position, memory_order_relaxed);
+    size_t const push_position = atomic_load_explicit(&ring->push_position, memory_order_relaxed);
+
+    return (push_position > pop_position) ? push_position - pop_position : 0;
+}
+
+static void * pipeline_wait(tokeniser_pipeline_st * const pipeline,
+                            ring_st * const ring,
+                            atomic_bool * const finished,
+                            atomic_uint_fast64_t * const stalls)
+{
+    /* Wait for an item from ring. Returns NULL if the pipeline is
+     * stopped, or once finished is set and the ring is empty.
+     */
+    void * item = ring_pop(ring);
+    unsigned int spins = 0;
+
+    if (item != NULL)
+    {
+        goto done;
+    }
+
+    atomic_fetch_add_explicit(stalls, 1, memory_order_relaxed);
+    for (;;)
+    {
+        if (atomic_load_explicit(&pipeline->stop, memory_order_acquire))
+        {
+            break;
+        }
+        if (finished != NULL && atomic_load_explicit(finished, memory_order_acquire))
+        {
+            /* Anything pushed before finished was set is visible now. */
+            item = ring_pop(ring);
+            break;
+        }
+
+        if (spins < WAIT_SPINS)
+        {
+            sched_yield();
+            spins++;
+        }
+        else
+        {
+            struct timespec const delay = { 0, WAIT_SLEEP_NS };
+
+            nanosleep(&delay, NULL);
+        }
+
+        item = ring_pop(ring);
+        if (item != NULL)
+        {
+            break;
+        }
+    }
+
+done:
+    return item;
+}
+
+static void pipeline_fail(tokeniser_pipeline_st * const pipeline)
+{
+    atomic_store_explicit(&pipeline->failed, true, memory_order_relaxed);
+    atomic_store_explicit(&pipeline->stop, true, memory_order_release);
+}
+
+static size_t pipeline_lines_length(tokeniser_pipeline_st * const pipeline,
+                                    char const * const data,
+                                    size_t const scanned,
+                                    size_t const length,
+                                    size_t const stream_offset)
+{
+    /* Find the length of the complete lines at the start of data,
+     * which starts at stream_offset. The first scanned characters
+     * have been looked at before.
+     */
+    size_t lines_length;
+
+    if (pipeline->continued_lines)
+    {
+        /* Only the tokeniser knows whether a '\n' ends the line. */
+        tokeniser_st * const tokeniser = pipeline->line_tokeniser;
+
+        tokeniser_feed_buffer(tokeniser, data + scanned, length - scanned, NULL, NULL, NULL);
+        lines_length = (tokeniser->line_start > stream_offset) ? tokeniser->line_start - stream_offset : 0;
+    }
+    else
+    {
+        lines_length = length;
+        while (lines_length > 0 && data[lines_length - 1] != '\n')
+        {
+            lines_length--;
+        }
+    }
+
+    return lines_length;
+}
+
+static size_t pipeline_line_end_find(tokeniser_pipeline_st * const pipeline,
+                                     char const * const data,
+                                     size_t const length,
+                                     size_t const line_start)
+{
+    /* Find the length of data up to and including the line ending
+     * of the line that started at line_start, or 0 if it doesn't
+     * end in data.
+     */
+    size_t line_length = 0;
+    size_t from = 0;
+
+    while (line_length == 0 && from < length)
+    {
+        char const * const newline = memchr(data + from, '\n', length - from);
+        size_t const to = (newline == NULL) ? length : (size_t)(newline - data) + 1;
+
+        if (pipeline->continued_lines)
+        {
+            tokeniser_feed_buffer(pipeline->line_tokeniser, data + from, to - from, NULL, NULL, NULL);
+            if (newline != NULL && pipeline->line_tokeniser->line_start > line_start)
+            {
+                line_length = to;
+            }
+        }
+        else if (newline != NULL)
+        {
+            line_length = to;
+        }
+        from = to;
+    }
+
+    return line_length;
+}
+
+static void pipeline_buffer_push(tokeniser_pipeline_st * const pipeline,
+                                 pipeline_buffer_st * const buffer,
+                                 size_t const length,
+                                 size_t const stream_offset,
+                                 uint64_t const sequence,
+                                 bool const line_too_long)
+{
+    buffer->length = length;
+    buffer->stream_offset = stream_offset;
+    buffer->sequence = sequence;
+    buffer->line_too_long = line_too_long;
+    ring_push(&pipeline->full_buffers, buffer);
+    atomic_fetch_add_explicit(&pipeline->stats.buffers_read, 1, memory_order_relaxed);
+}
+
+static void * pipeline_reader_thread(void * const arg)
+{
+    /* Fill buffers until the source is exhausted. Each buffer is
+     * passed on once it holds a complete line, cut just after the
+     * last one, and the rest is carried over to the start of the
+     * next buffer. A line that fills a whole buffer is skipped, and
+     * passed on as too long once its end is found.
+     */
+    tokeniser_pipeline_st * const pipeline = arg;
+    pipeline_buffer_st * buffer;
+    size_t length = 0;
+    size_t stream_offset = 0; /* Of the first character in buffer. */
+    uint64_t sequence = 0;
+    bool skipping = false;
+    size_t skipped_line_start = 0;
+
+    buffer = pipeline_wait(pipeline, &pipeline->free_buffers, NULL, &pipeline->stats.reader_stalls);
+    while (buffer != NULL)
+    {
+        ssize_t const bytes_read = pipeline->source->fill(pipeline->source->context,
+                                                          buffer->data + length,
+                                                          pipeline->buffer_size - length);
+        pipeline_buffer_st * next_buffer;
+        size_t scanned;
+        size_t cut;
+
+        if (bytes_read < 0)
+        {
+            pipeline_fail(pipeline);
+            break;
+        }
+        if (bytes_read == 0)
+        {
+            if (skipping)
+            {
+                /* The stream ends the line that was too long. */
+                pipeline_buffer_push(pipeline, buffer, stream_offset + length - skipped_line_start, skipped_line_start, sequence, true);
+            }
+            else if (length != 0)
+            {
+                /* The last line isn't terminated. */
+                pipeline_buffer_push(pipeline, buffer, length, stream_offset, sequence, false);
+            }
+            break;
+        }
+
+        scanned = length;
+        length += (size_t)bytes_read;
+        if (skipping)
+        {
+            size_t const line_length = pipeline_line_end_find(pipeline, buffer->data, length, skipped_line_start);
+
+            if (line_length == 0)
+            {
+                /* Still in the line that was too long. */
+                stream_offset += length;
+                length = 0;
+                continue;
+            }
+
+            next_buffer = pipeline_wait(pipeline, &pipeline->free_buffers, NULL, &pipeline->stats.reader_stalls);
+            if (next_buffer == NULL)
+            {
+                break;
+            }
+            pipeline_buffer_push(pipeline,
+                                 next_buffer,
+                                 stream_offset + line_length - 1 - skipped_line_start,
+                                 skipped_line_start,
+                                 sequence,
+                                 true);
+            sequence++;
+            skipping = false;
+
+            /* Carry on with what follows the line. */
+            memmove(buffer->data, buffer->data + line_length, length - line_length);
+            length -= line_length;
+            stream_offset += line_length;
+            scanned = 0;
+        }
+        cut = pipeline_lines_length(pipeline, buffer->data, scanned, length, stream_offset);
+        if (cut == 0)
+        {
+            if (length == pipeline->buffer_size)
+            {
+                /* The line doesn't fit in a buffer. */
+                skipping = true;
+                skipped_line_start = stream_offset;
+                stream_offset += length;
+                length = 0;
+            }
+            /* Else no complete line yet. */
+            continue;
+        }
+
+        next_buffer = pipeline_wait(pipeline, &pipeline->free_buffers, NULL, &pipeline->stats.reader_stalls);
+        if (next_buffer != NULL)
+        {
+            memcpy(next_buffer->data, buffer->data + cut, length - cut);
+        }
+
+        pipeline_buffer_push(pipeline, buffer, cut, stream_offset, sequence, false);
+
+        buffer = next_buffer;
+        length -= cut;
+        stream_offset += cut;
+        sequence++;
+    }
+
+    atomic_store_explicit(&pipeline->reading_done, true, memory_order_release);
+
+    return NULL;
+}
+
+static bool pipeline_token_callback(char const * const token,
+                                    size_t const start_index,
+                                    size_t const end_index,
+                                    char const quote_char,
+                                    void * const user_arg)
+{
+    pipeline_tokenise_st * const tokenise = user_arg;
+    pipeline_batch_st * const batch = tokenise->batch;
+    size_t const token_count = tokens_count(batch->tokens);
+    tokeniser_pipeline_token_st * span;
+
+    if (tokenise->failed)
+    {
+        goto done;
+    }
+
+    if (token_count == batch->token_span_array_size)
+    {
+        size_t const new_size = (batch->token_span_array_size == 0) ? TOKEN_SPANS_INITIAL_SIZE : 2 * batch->token_span_array_size;
+        tokeniser_pipeline_token_st * const new_spans = realloc(batch->token_spans, new_size * sizeof *new_spans);
+
+        if (new_spans == NULL)
+        {
+            tokenise->failed = true;
+            goto done;
+        }
+        batch->token_spans = new_spans;
+        batch->token_span_array_size = new_size;
+    }
+    if (!tokens_add_token(batch->tokens, token))
+    {
+        tokenise->failed = true;
+        goto done;
+    }
+
+    span = &batch->token_spans[token_count];
+    span->start_index = tokenise->stream_offset + start_index;
+    span->end_index = tokenise->stream_offset + end_index;
+    span->quote_char = quote_char;
+
+done:
+    return !tokenise->failed;
+}
+
+static bool pipeline_line_callback(tokeniser_result_t const result,
+                                   size_t const line_start,
+                                   size_t const line_end,
+                                   void * const user_arg)
+{
+    pipeline_tokenise_st * const tokenise = user_arg;
+    pipeline_batch_st * const batch = tokenise->batch;
+    size_t const token_count = tokens_count(batch->tokens);
+    tokeniser_pipeline_line_st * line;
+
+    if (tokenise->failed)
+    {
+        goto done;
+    }
+
+    if (batch->batch.line_count == batch->line_array_size)
+    {
+        size_t const new_size = (batch->line_array_size == 0) ? LINES_INITIAL_SIZE : 2 * batch->line_array_size;
+        tokeniser_pipeline_line_st * const new_lines = realloc(batch->lines, new_size * sizeof *new_lines);
+
+        if (new_lines == NULL)
+        {
+            tokenise->failed = true;
+            goto done;
+        }
+        batch->lines = new_lines;
+        batch->line_array_size = new_size;
+    }
+
+    line = &batch->lines[batch->batch.line_count];
+    line->first_token = tokenise->line_first_token;
+    line->token_count = token_count - tokenise->line_first_token;
+    line->result = result;
+    line->line_start = tokenise->stream_offset + line_start;
+    line->line_end = tokenise->stream_offset + line_end;
+    batch->batch.line_count++;
+    tokenise->line_first_token = token_count;
+
+done:
+    return !tokenise->failed;
+}
+
+static void * pipeline_tokeniser_thread(void * const arg)
+{
+    pipeline_worker_st * const worker = arg;
+    tokeniser_pipeline_st * const pipeline = worker->pipeline;
+    tokeniser_st * const tokeniser = worker->tokeniser;
+
+    tokeniser_init(tokeniser);
+    tokeniser_stream_init(tokeniser);
+
+    for (;;)
+    {
+        pipeline_buffer_st * const buffer = pipeline_wait(pipeline,
+                                                          &pipeline->full_buffers,
+                                                          &pipeline->reading_done,
+                                                          &pipeline->stats.tokeniser_input_stalls);
+        pipeline_tokenise_st tokenise;
+        tokeniser_result_t result;
+
+        if (buffer == NULL)
+        {
+            break;
+        }
+
+        tokenise.batch = pipeline_wait(pipeline, &pipeline->free_batches, NULL, &pipeline->stats.tokeniser_output_stalls);
+        if (tokenise.batch == NULL)
+        {
+            break;
+        }
+        tokenise.stream_offset = buffer->stream_offset;
+        tokenise.line_first_token = 0;
+        tokenise.failed = false;
+        tokens_clear(tokenise.batch->tokens);
+        tokenise.batch->batch.sequence = buffer->sequence;
+        tokenise.batch->batch.line_count = 0;
+
+        if (buffer->line_too_long)
+        {
+            result = pipeline_line_callback(tokeniser_result_limit_exceeded, 0, buffer->length, &tokenise)
+                     ? tokeniser_result_ok
+                     : tokeniser_result_error;
+        }
+        else
+        {
+            /* Lines don't span buffers, so each one is a stream of its own. */
+            result = tokeniser_feed_buffer(tokeniser, buffer->data, buffer->length,
+                                           pipeline_token_callback, pipeline_line_callback, &tokenise);
+            if (result == tokeniser_result_continue)
+            {
+                result = tokeniser_feed_end(tokeniser, pipeline_token_callback, pipeline_line_callback, &tokenise);
+            }
+        }
+        ring_push(&pipeline->free_buffers, buffer);
+
+        if (result != tokeniser_result_ok)
+        {
+            pipeline_fail(pipeline);
+            break;
+        }
+
+        tokenise.batch->batch.token_spans = tokenise.batch->token_spans;
+        tokenise.batch->batch.lines = tokenise.batch->lines;
+        ring_push(&pipeline->full_batches, tokenise.batch);
+    }
+
+    if (atomic_fetch_sub_explicit(&pipeline->tokenisers_running, 1, memory_order_acq_rel) == 1)
+    {
+        atomic_store_explicit(&pipeline->tokenising_done, true, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static void * pipeline_consumer_thread(void * const arg)
+{
+    pipeline_worker_st * const worker = arg;
+    tokeniser_pipeline_st * const pipeline = worker->pipeline;
+
+    for (;;)
+    {
+        pipeline_batch_st * const batch = pipeline_wait(pipeline,
+                                                        &pipeline->full_batches,
+                                                        &pipeline->tokenising_done,
+                                                        &pipeline->stats.consumer_stalls);
+        bool keep_going;
+
+        if (batch == NULL)
+        {
+            break;
+        }
+
+        keep_going = pipeline->consume_callback(&batch->batch, pipeline->user_arg);
+        ring_push(&pipeline->free_batches, batch);
+        atomic_fetch_add_explicit(&pipeline->stats.batches_consumed, 1, memory_order_relaxed);
+        if (!keep_going)
+        {
+            pipeline_fail(pipeline);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+tokeniser_pipeline_st * tokeniser_pipeline_alloc(tokeniser_pipeline_config_st const * const config)
+{
+    tokeniser_pipeline_st * pipeline;
+    size_t worker_count;
+    size_t index;
+
+    pipeline = calloc(1, sizeof *pipeline);
+    if (pipeline == NULL)
+    {
+        goto done;
+    }
+
+    if (config != NULL)
+    {
+        pipeline->buffer_size = config->buffer_size;
+        pipeline->buffer_count = config->buffer_count;
+        pipeline->batch_count = config->batch_count;
+        pipeline->tokeniser_threads = config->tokeniser_threads;
+        pipeline->consumer_threads = config->consumer_threads;
+    }
+    if (pipeline->buffer_size == 0)
+    {
+        pipeline->buffer_size = TOKENISER_RUN_BUFFER_SIZE;
+    }
+    if (pipeline->tokeniser_threads == 0)
+    {
+        pipeline->tokeniser_threads = 1;
+    }
+    if (pipeline->consumer_threads == 0)
+    {
+        pipeline->consumer_threads = 1;
+    }
+    if (pipeline->buffer_count == 0)
+    {
+        pipeline->buffer_count = 2 * (size_t)pipeline->tokeniser_threads;
+    }
+    if (pipeline->buffer_count < 2)
+    {
+        /* The reader holds on to one buffer while it waits for the
+         * next.
+         */
+        pipeline->buffer_count = 2;
+    }
+    if (pipeline->batch_count == 0)
+    {
+        pipeline->batch_count = 2 * (size_t)pipeline->consumer_threads;
+    }
+
+    worker_count = (size_t)pipeline->tokeniser_threads + pipeline->consumer_threads;
+    pipeline->buffers = calloc(pipeline->buffer_count, sizeof *pipeline->buffers);
+    pipeline->buffer_data = malloc(pipeline->buffer_count * pipeline->buffer_size);
+    pipeline->batches = calloc(pipeline->batch_count, sizeof *pipeline->batches);
+    pipeline->workers = calloc(worker_count, sizeof *pipeline->workers);
+    if (pipeline->buffers == NULL
+        || pipeline->buffer_data == NULL
+        || pipeline->batches == NULL
+        || pipeline->workers == NULL
+        || !ring_alloc(&pipeline->free_buffers, pipeline->buffer_count)
+        || !ring_alloc(&pipeline->full_buffers, pipeline->buffer_count)
+        || !ring_alloc(&pipeline->free_batches, pipeline->batch_count)
+        || !ring_alloc(&pipeline->full_batches, pipeline->batch_count))
+    {
+        goto error;
+    }
+
+    for (index = 0; index < pipeline->buffer_count; index++)
+    {
+        pipeline->buffers[index].data = pipeline->buffer_data + index * pipeline->buffer_size;
+    }
+    for (index = 0; index < pipeline->batch_count; index++)
+    {
+        pipeline->batches[index].tokens = tokens_alloc();
+        if (pipeline->batches[index].tokens == NULL)
+        {
+            goto error;
+        }
+        pipeline->batches[index].batch.tokens = pipeline->batches[index].tokens;
+    }
+    for (index = 0; index < worker_count; index++)
+    {
+        pipeline->workers[index].pipeline = pipeline;
+    }
+    for (index = 0; index < pipeline->tokeniser_threads; index++)
+    {
+        pipeline->workers[index].tokeniser = tokeniser_alloc();
+        if (pipeline->workers[index].tokeniser == NULL)
+        {
+            goto error;
+        }
+    }
+    pipeline->line_tokeniser = tokeniser_alloc();
+    if (pipeline->line_tokeniser == NULL)
+    {
+        goto error;
+    }
+
+    goto done;
+
+error:
+    tokeniser_pipeline_free(pipeline);
+    pipeline = NULL;
+
+done:
+    return pipeline;
+}
+
+void tokeniser_pipeline_free(tokeniser_pipeline_st * const pipeline)
+{
+    size_t index;
+
+    if (pipeline == NULL)
+    {
+        goto done;
+    }
+
+    if (pipeline->workers != NULL)
+    {
+        for (index = 0; index < pipeline->tokeniser_threads; index++)
+        {
+            tokeniser_free(pipeline->workers[index].tokeniser);
+        }
+        free(pipeline->workers);
+    }
+    if (pipeline->batches != NULL)
+    {
+        for (index = 0; index < pipeline->batch_count; index++)
+        {
+            tokens_free(pipeline->batches[index].tokens);
+            free(pipeline->batches[index].token_spans);
+            free(pipeline->batches[index].lines);
+        }
+        free(pipeline->batches);
+    }
+    free(pipeline->free_buffers.cells);
+    free(pipeline->full_buffers.cells);
+    free(pipeline->free_batches.cells);
+    free(pipeline->full_batches.cells);
+    free(pipeline->buffer_data);
+    free(pipeline->buffers);
+    tokeniser_free(pipeline->line_tokeniser);
+    free(pipeline);
+
+done:
+    return;
+}
+
+static void pipeline_reset(tokeniser_pipeline_st * const pipeline)
+{
+    /* Put every buffer and batch back in the free queues, wherever
+     * a stopped run left them.
+     */
+    size_t index;
+
+    ring_reset(&pipeline->free_buffers);
+    ring_reset(&pipeline->full_buffers);
+    ring_reset(&pipeline->free_batches);
+    ring_reset(&pipeline->full_batches);
+    for (index = 0; index < pipeline->buffer_count; index++)
+    {
+        ring_push(&pipeline->free_buffers, &pipeline->buffers[index]);
+    }
+    for (index = 0; index < pipeline->batch_count; index++)
+    {
+        ring_push(&pipeline->free_batches, &pipeline->batches[index]);
+    }
+
+    atomic_init(&pipeline->reading_done, false);
+    atomic_init(&pipeline->tokenising_done, false);
+    atomic_init(&pipeline->tokenisers_running, pipeline->tokeniser_threads);
+    atomic_init(&pipeline->stop, false);
+    atomic_init(&pipeline->failed, false);
+
+    atomic_init(&pipeline->stats.buffers_read, 0);
+    atomic_init(&pipeline->stats.batches_consumed, 0);
+    atomic_init(&pipeline->stats.reader_stalls, 0);
+    atomic_init(&pipeline->stats.tokeniser_input_stalls, 0);
+    atomic_init(&pipeline->stats.tokeniser_output_stalls, 0);
+    atomic_init(&pipeline->stats.consumer_stalls, 0);
+}
+
+tokeniser_result_t tokeniser_pipeline_run(tokeniser_pipeline_st * const pipeline,
+                                          tokeniser_source_st const * const source,
+                                          tokeniser_pipeline_setup_cb const setup_callback,
+                                          tokeniser_pipeline_consume_cb const consume_callback,
+                                          void * const user_arg)
+{
+    tokeniser_result_t result;
+    pthread_t reader_thread;
+    bool reader_started;
+    size_t worker_count;
+    size_t started_count;
+    size_t index;
+
+    if (pipeline == NULL || source == NULL || source->fill == NULL || consume_callback == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+
+    worker_count = (size_t)pipeline->tokeniser_threads + pipeline->consumer_threads;
+    pipeline_reset(pipeline);
+    pipeline->source = source;
+    pipeline->consume_callback = consume_callback;
+    pipeline->user_arg = user_arg;
+
+    for (index = 0; index < pipeline->tokeniser_threads; index++)
+    {
+        if (setup_callback != NULL)
+        {
+            setup_callback(pipeline->workers[index].tokeniser, user_arg);
+        }
+    }
+    tokeniser_init(pipeline->line_tokeniser);
+    if (setup_callback != NULL)
+    {
+        setup_callback(pipeline->line_tokeniser, user_arg);
+    }
+    tokeniser_stream_init(pipeline->line_tokeniser);
+    pipeline->continued_lines = pipeline->line_tokeniser->continuation;
+
+    for (started_count = 0; started_count < worker_count; started_count++)
+    {
+        pipeline_worker_st * const worker = &pipeline->workers[started_count];
+        void * (* const thread_function)(void *) = (started_count < pipeline->tokeniser_threads)
+                                                   ? pipeline_tokeniser_thread
+                                                   : pipeline_consumer_thread;
+
+        if (pthread_create(&worker->thread, NULL, thread_function, worker) != 0)
+        {
+            pipeline_fail(pipeline);
+            break;
+        }
+    }
+    reader_started = (started_count == worker_count
+                      && pthread_create(&reader_thread, NULL, pipeline_reader_thread, pipeline) == 0);
+    if (!reader_started)
+    {
+        pipeline_fail(pipeline);
+    }
+
+    if (reader_started)
+    {
+        pthread_join(reader_thread, NULL);
+    }
+    for (index = 0; index < started_count; index++)
+    {
+        pthread_join(pipeline->workers[index].thread, NULL);
+    }
+
+    result = atomic_load(&pipeline->failed) ? tokeniser_result_error : tokeniser_result_ok;
+
+done:
+    return result;
+}
+
+void tokeniser_pipeline_stats_get(tokeniser_pipeline_st const * const pipeline,
+                                  tokeniser_pipeline_stats_st * const stats)
+{
+    if (pipeline == NULL || stats == NULL)
+    {
+        goto done;
+    }
+
+    stats->buffers_queued = ring_depth(&pipeline->full_buffers);
+    stats->batches_queued = ring_depth(&pipeline->full_batches);
+    stats->buffers_read = atomic_load_explicit(&pipeline->stats.buffers_read, memory_order_relaxed);
+    stats->batches_consumed = atomic_load_explicit(&pipeline->stats.batches_consumed, memory_order_relaxed);
+    stats->reader_stalls = atomic_load_explicit(&pipeline->stats.reader_stalls, memory_order_relaxed);
+    stats->tokeniser_input_stalls = atomic_load_explicit(&pipeline->stats.tokeniser_input_stalls, memory_order_relaxed);
+    stats->tokeniser_output_stalls = atomic_load_explicit(&pipeline->stats.tokeniser_output_stalls, memory_order_relaxed);
+    stats->consumer_stalls = atomic_load_explicit(&pipeline->stats.consumer_stalls, memory_order_relaxed);
+
+done:
+    return;
+}
@@ -0,0 +1,132 @@
+#ifndef __TOKENISER_PIPELINE_H__
+#define __TOKENISER_PIPELINE_H__
+
+#include "tokeniser.h"
+#include "tokeniser_run.h"
+#include "tokens.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Tokenises a stream in three stages, each on its own threads: a
+ * reader fills large buffers from the source, tokeniser threads
+ * turn each buffer into a batch of tokens, and consumer threads
+ * are handed the batches. The stages are joined by bounded
+ * lock-free queues. Buffers and batches come from fixed pools
+ * and are recycled, so a stage that gets ahead of the next one
+ * waits for something to be handed back rather than queueing
+ * more work, and once the batches have grown to fit the stream
+ * nothing more is allocated.
+ * The reader cuts each buffer after its last complete line, so
+ * lines don't span buffers and each buffer can be tokenised
+ * independently. When the tokenisers are set up for continuation
+ * mode (see tokeniser_continuation_set()), the reader tokenises
+ * the stream too, to find where continued lines really end. A
+ * line longer than a buffer isn't tokenised: it is passed on with
+ * no tokens and tokeniser_result_limit_exceeded.
+ */
+typedef struct tokeniser_pipeline_st tokeniser_pipeline_st;
+
+typedef struct tokeniser_pipeline_config_st
+{
+    size_t buffer_size; /* The size of each read buffer. 0 selects TOKENISER_RUN_BUFFER_SIZE. */
+    size_t buffer_count; /* The number of read buffers. 0 selects two for each tokeniser thread. */
+    size_t batch_count; /* The number of batches. 0 selects two for each consumer thread. */
+    unsigned int tokeniser_threads; /* 0 selects 1. */
+    unsigned int consumer_threads; /* 0 selects 1. */
+} tokeniser_pipeline_config_st;
+
+typedef struct tokeniser_pipeline_line_st
+{
+    size_t first_token; /* The index in the batch's tokens of the line's first token. */
+    size_t token_count;
+    tokeniser_result_t result; /* As passed to line_done_cb. */
+    size_t line_start; /* The offset in the stream of the first character of the line. */
+    size_t line_end; /* The offset in the stream of the line ending (or the end of the stream). */
+} tokeniser_pipeline_line_st;
+
+typedef struct tokeniser_pipeline_token_st
+{
+    size_t start_index; /* The offset in the stream of the start of the token. */
+    size_t end_index; /* The offset in the stream of the end of the token. */
+    char quote_char; /* As passed to new_token_cb. */
+} tokeniser_pipeline_token_st;
+
+typedef struct tokeniser_pipeline_batch_st
+{
+    uint64_t sequence; /* Batches are numbered from 0 in stream order, but may be consumed out of order. */
+    tokens_st const * tokens; /* The tokens of all the lines in the batch. */
+    tokeniser_pipeline_token_st const * token_spans; /* Where each of tokens was found, in the same order. */
+    tokeniser_pipeline_line_st const * lines;
+    size_t line_count;
+} tokeniser_pipeline_batch_st;
+
+/* The counters since tokeniser_pipeline_run() was called. The
+ * queue depths are a snapshot, and may be slightly out of date
+ * while the pipeline is running.
+ */
+typedef struct tokeniser_pipeline_stats_st
+{
+    size_t buffers_queued; /* Filled buffers waiting for a tokeniser thread. */
+    size_t batches_queued; /* Batches waiting for a consumer thread. */
+    uint64_t buffers_read;
+    uint64_t batches_consumed;
+    uint64_t reader_stalls; /* Times the reader waited for a free buffer. */
+    uint64_t tokeniser_input_stalls; /* Times a tokeniser thread waited for a filled buffer. */
+    uint64_t tokeniser_output_stalls; /* Times a tokeniser thread waited for a free batch. */
+    uint64_t consumer_stalls; /* Times a consumer thread waited for a batch. */
+} tokeniser_pipeline_stats_st;
+
+/* Called on each tokeniser thread's tokeniser before the
+ * pipeline starts, to set options such as the CSV dialect or
+ * limits.
+ */
+typedef void (* tokeniser_pipeline_setup_cb)(tokeniser_st * const tokeniser, void * const user_arg);
+
+/* Called on a consumer thread with each batch. The batch is only
+ * valid until the callback returns.
+ * Return false to stop the pipeline.
+ */
+typedef bool (* tokeniser_pipeline_consume_cb)(tokeniser_pipeline_batch_st const * const batch, void * const user_arg);
+
+/*
+ * Allocate a pipeline, its buffers, batches and tokenisers.
+ * @config: Optional, NULL selects the defaults.
+ * Returns NULL if out of memory.
+ */
+tokeniser_pipeline_st * tokeniser_pipeline_alloc(tokeniser_pipeline_config_st const * const config);
+
+void tokeniser_pipeline_free(tokeniser_pipeline_st * const pipeline);
+
+/*
+ * Tokenise all lines supplied by source, returning once every
+ * batch has been consumed. The pipeline may be run again with
+ * another source.
+ * @setup_callback: Optional.
+ * Return value: tokeniser_result_ok once the whole source has
+ * been tokenised, else tokeniser_result_error if the source
+ * failed, a thread couldn't be started, the tokens couldn't be
+ * stored or consume_callback asked to stop.
+ */
+tokeniser_result_t tokeniser_pipeline_run(tokeniser_pipeline_st * const pipeline,
+                                          tokeniser_source_st const * const source,
+                                          tokeniser_pipeline_setup_cb const setup_callback,
+                                          tokeniser_pipeline_consume_cb const consume_callback,
+                                          void * const user_arg);
+
+/*
+ * Get the pipeline's counters. May be called while it is running.
+ */
+void tokeniser_pipeline_stats_get(tokeniser_pipeline_st const * const pipeline,
+                                  tokeniser_pipeline_stats_st * const stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_PIPELINE_H__ */
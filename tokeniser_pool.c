@@ -0,0 +1,117 @@
+#include "tokeniser_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef struct tokeniser_pool_st
+{
+    tokeniser_st * idle[TOKENISER_POOL_SIZE];
+    size_t idle_count;
+    bool exit_registered; /* The pool is freed when its thread exits. */
+    tokeniser_pool_stats_st stats;
+} tokeniser_pool_st;
+
+static _Thread_local tokeniser_pool_st pool;
+
+static pthread_key_t pool_exit_key;
+static pthread_once_t pool_exit_once = PTHREAD_ONCE_INIT;
+static bool pool_exit_key_ok;
+
+static void pool_exit(void * const arg)
+{
+    /* The thread that owns the pool is exiting. */
+    tokeniser_pool_st * const thread_pool = arg;
+
+    while (thread_pool->idle_count > 0)
+    {
+        thread_pool->idle_count--;
+        tokeniser_free(thread_pool->idle[thread_pool->idle_count]);
+    }
+}
+
+static void pool_exit_key_create(void)
+{
+    pool_exit_key_ok = (pthread_key_create(&pool_exit_key, pool_exit) == 0);
+}
+
+static void pool_exit_register(void)
+{
+    /* A thread's pool can only hold tokenisers once registered, so 
+     * they aren't leaked when it exits. Returns with 
+     * pool.exit_registered false if registering failed. 
+     */
+    pthread_once(&pool_exit_once, pool_exit_key_create);
+    if (pool_exit_key_ok && pthread_setspecific(pool_exit_key, &pool) == 0)
+    {
+        pool.exit_registered = true;
+    }
+}
+
+tokeniser_st * tokeniser_pool_acquire(void)
+{
+    tokeniser_st * tokeniser;
+
+    if (pool.idle_count > 0)
+    {
+        pool.idle_count--;
+        tokeniser = pool.idle[pool.idle_count];
+    }
+    else
+    {
+        tokeniser = tokeniser_alloc();
+        if (tokeniser == NULL)
+        {
+            goto done;
+        }
+        pool.stats.allocations++;
+    }
+
+    pool.stats.acquires++;
+    pool.stats.in_use++;
+    if (pool.stats.in_use > pool.stats.in_use_peak)
+    {
+        pool.stats.in_use_peak = pool.stats.in_use;
+    }
+
+done:
+    return tokeniser;
+}
+
+void tokeniser_pool_release(tokeniser_st * const tokeniser)
+{
+    if (tokeniser == NULL)
+    {
+        goto done;
+    }
+
+    pool.stats.in_use--;
+    if (!pool.exit_registered)
+    {
+        pool_exit_register();
+    }
+    if (pool.idle_count == TOKENISER_POOL_SIZE || !pool.exit_registered)
+    {
+        tokeniser_free(tokeniser);
+        pool.stats.frees++;
+        goto done;
+    }
+
+    tokeniser_reset(tokeniser);
+    pool.idle[pool.idle_count] = tokeniser;
+    pool.idle_count++;
+
+done:
+    return;
+}
+
+void tokeniser_pool_stats_get(tokeniser_pool_stats_st * const stats)
+{
+    *stats = pool.stats;
+    stats->idle = pool.idle_count;
+}
+
+void tokeniser_pool_drain(void)
+{
+    pool_exit(&pool);
+}
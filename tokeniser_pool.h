@@ -0,0 +1,57 @@
+#ifndef __TOKENISER_POOL_H__
+#define __TOKENISER_POOL_H__
+
+#include "tokeniser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A per thread pool of tokenisers, for code that needs a fresh
+ * tokeniser for each short piece of work, such as a server handling
+ * a line per request. Acquiring a tokeniser from the pool takes no
+ * lock and, once the pool has warmed up, no allocation. Released
+ * tokenisers are put back with tokeniser_reset(), so the next user
+ * gets one with default settings and the token memory already
+ * grown. Each thread's pool is freed when the thread exits, except
+ * for the main thread, which should call tokeniser_pool_drain().
+ */
+
+/* The most idle tokenisers each thread keeps. Any more released are
+ * freed.
+ */
+#define TOKENISER_POOL_SIZE 16
+
+typedef struct tokeniser_pool_stats_st
+{
+    size_t idle; /* Tokenisers waiting in the pool. */
+    size_t in_use; /* Tokenisers acquired and not yet released. */
+    size_t in_use_peak; /* The most in use at once. */
+    uint64_t acquires;
+    uint64_t allocations; /* Acquires that found the pool empty. */
+    uint64_t frees; /* Releases that found the pool full. */
+} tokeniser_pool_stats_st;
+
+/*
+ * Get a tokeniser ready for a new line, with default settings.
+ * Returns: The tokeniser, which must be passed to
+ * tokeniser_pool_release() by the same thread once finished with,
+ * or NULL if out of memory.
+ */
+tokeniser_st * tokeniser_pool_acquire(void);
+
+/*
+ * Return a tokeniser to the calling thread's pool.
+ */
+void tokeniser_pool_release(tokeniser_st * const tokeniser);
+
+/*
+ * Get the statistics of the calling thread's pool.
+ */
+void tokeniser_pool_stats_get(tokeniser_pool_stats_st * const stats);
+
+/*
+ * Free the idle tokenisers in the calling thread's pool.
+ */
+void tokeniser_pool_drain(void);
+
+#endif /* __TOKENISER_POOL_H__ */
@@ -2,7 +2,12 @@
 #define __TOKENISER_PRIVATE_H__
 
 #include "tokeniser.h"
+#include "tokeniser_run.h"
 #include "fsm_class.h"
+#include "tokeniser_keywords.h"
+#include "tokeniser_number.h"
+
+#include <stdint.h>
 
 #define UNUSED(arg) (void)(arg)
 
@@ -18,9 +23,33 @@ typedef enum event_code_t
     event_space,
     event_single_quote,
     event_double_quote,
-    event_regular_char
+    event_regular_char,
+    event_delimiter /* CSV dialect only. */
 } event_code_t;
 
+/* current_token_separator when a token has no unquoted '='. */
+#define NO_SEPARATOR ((size_t)-1)
+
+/* The size of the cache of variable values. A power of 2. */
+#define VARIABLE_CACHE_SIZE 16
+
+typedef enum variable_state_t
+{
+    variable_none, /* Not in a variable reference. */
+    variable_dollar, /* Just after a '$'. */
+    variable_name, /* In the name of a $NAME reference. */
+    variable_braced_name /* In the name of a ${NAME} reference. */
+} variable_state_t;
+
+typedef struct variable_cache_entry_st
+{
+    bool valid;
+    uint64_t hash;
+    size_t name_length;
+    char name[TOKENISER_VARIABLE_NAME_MAX + 1];
+    char const * value;
+} variable_cache_entry_st;
+
 struct fsm_event_handlers_st
 {
     fsm_event_handler init;
@@ -29,6 +58,7 @@ struct fsm_event_handlers_st
     fsm_event_handler single_quote;
     fsm_event_handler double_quote;
     fsm_event_handler regular_char;
+    fsm_event_handler delimiter;
 };
 
 struct tokeniser_st
@@ -39,10 +69,75 @@ struct tokeniser_st
     new_token_cb user_callback;
     void * user_arg;
     char * current_token;
+    size_t current_token_length;
+    size_t current_token_size; /* The allocated size of current_token. */
+    uint64_t current_token_hash; /* The FNV-1a hash of current_token. Only kept up to date if there are keywords. */
+    tokeniser_number_scan_st current_token_number; /* Only kept up to date if numbers are being parsed. */
+    bool current_token_quoted; /* The token is, or contains, quoted text, so isn't a number. */
+    bool current_token_has_text; /* A character or a non-empty variable was offered to the token, even if it was discarded. */
+    size_t current_token_separator; /* The offset of the first unquoted '='. Only kept up to date if splitting key=value tokens. */
+    bool current_token_discarded; /* The token is over the token limit, so isn't being kept. */
     size_t char_count;
     size_t token_start; /* The position where we started reading a token. */
     tokeniser_result_t result;
     char expected_close_quote;
+    size_t token_count; /* The number of tokens started on this line. */
+
+    bool continuation; /* Lines ending inside quotes or after a '\\' carry on with the next line. */
+    char csv_delimiter; /* '\0' unless the CSV dialect is selected. */
+    char line_csv_delimiter; /* csv_delimiter as it was at tokeniser_init(), for the line being tokenised. */
+    char previous_char; /* The character fed before the current one. */
+    size_t last_append_offset; /* The offset of the character last added to a token. */
+
+    tokeniser_keywords_st const * keywords; /* NULL unless keywords are to be recognised. */
+    bool numbers; /* Parse numeric tokens as they are built. */
+    bool key_values; /* Split key=value tokens as they are built. */
+
+    /* Variable expansion state. See tokeniser_variables_set(). */
+    tokeniser_variable_lookup_cb variable_lookup; /* NULL unless variables are to be expanded. */
+    void * variable_lookup_arg;
+    variable_state_t variable_state;
+    size_t variable_name_length;
+
+    /* Projection state. See tokeniser_projection_set(). */
+    bool projecting;
+    size_t const * projection; /* The sorted indices of the tokens wanted. */
+    size_t projection_count;
+    bool projection_last; /* The last token of each line is wanted too. */
+    size_t projection_next; /* The index in projection of the next token wanted. */
+    bool projection_done; /* No more tokens on this line are wanted. */
+    bool token_deferred; /* The current token is only wanted if it turns out to be the last. */
+    char * last_token; /* The most recent deferred token, swapped out of current_token. */
+    size_t last_token_length;
+    size_t last_token_size;
+    uint64_t last_token_hash;
+    tokeniser_number_scan_st last_token_number;
+    size_t last_token_separator;
+    size_t last_token_start;
+    size_t last_token_end;
+    char last_token_quote_char;
+    bool last_token_pending;
+
+    tokeniser_limits_st limits;
+    size_t limit_offset; /* Where a limit was first exceeded on this line. */
+
+    /* Multi-line stream state used by tokeniser_feed_buffer(). */
+    new_token_cb stream_token_callback;
+    line_done_cb stream_line_callback;
+    void * stream_user_arg;
+    size_t stream_offset; /* The offset in the stream of the next character. */
+    size_t line_start; /* The offset in the stream of the start of the current line. */
+    bool line_started; /* Characters of the current line have been fed to the FSM. */
+    bool line_complete; /* The FSM has finished the current line. Discard characters up to the next '\n'. */
+
+    struct flight_recorder_st * flight_recorder; /* NULL unless recording is enabled. */
+
+    /* Last, as they are most of the size, so tokeniser_reset() can 
+     * copy everything before them and leave them alone. The name is 
+     * only read while in a variable reference. 
+     */
+    variable_cache_entry_st variable_cache[VARIABLE_CACHE_SIZE];
+    char variable_name[TOKENISER_VARIABLE_NAME_MAX + 1];
 };
 
 typedef struct tokeniser_event_st
@@ -62,9 +157,17 @@ typedef struct tokeniser_event_st
 #define TOKENISER_TO_FSM(tokeniser) (&tokeniser->fsm)
 #define FSM_TO_TOKENISER(fsm) container_of(fsm, tokeniser_st, fsm)
 
-void str_extend(char * * const str, char const new_char);
+bool current_token_append(tokeniser_st * const tokeniser, char const new_char);
+bool current_token_append_run(tokeniser_st * const tokeniser, char const * const chars, size_t const length);
+char const * current_token_get(tokeniser_st const * const tokeniser);
+void current_token_clear(tokeniser_st * const tokeniser);
+void current_token_drop_last(tokeniser_st * const tokeniser);
+void current_token_swap_last(tokeniser_st * const tokeniser);
+void current_token_quoted_set(tokeniser_st * const tokeniser);
 void current_token_free(tokeniser_st * const tokeniser);
-void current_token_init(tokeniser_st * const tokeniser, char const first_char);
+void current_token_init(tokeniser_st * const tokeniser);
+void tokeniser_limit_hit(tokeniser_st * const tokeniser);
 void tokeniser_result_set(tokeniser_st * const tokeniser, tokeniser_result_t const result);
+void tokeniser_stream_init(tokeniser_st * const tokeniser);
 
 #endif /* __TOKENISER_PRIVATE_H__ */
@@ -0,0 +1,496 @@
+#include "tokeniser_run.h"
+#include "tokeniser_private.h"
+#include "tokeniser_states.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct run_buffer_st
+{
+    char * data;
+    ssize_t length; /* The result of the fill callback. */
+    bool full; /* Set by the reader, cleared once the buffer has been tokenised. */
+} run_buffer_st;
+
+typedef struct run_reader_st
+{
+    tokeniser_source_st const * source;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    run_buffer_st buffers[2];
+    bool stop; /* Set when the tokeniser no longer wants any more data. */
+} run_reader_st;
+
+static ssize_t fd_fill(void * const source_context, char * const buffer, size_t const buffer_size)
+{
+    int const fd = (int)(intptr_t)source_context;
+    ssize_t bytes_read;
+
+    do
+    {
+        bytes_read = read(fd, buffer, buffer_size);
+    }
+    while (bytes_read < 0 && errno == EINTR);
+
+    return bytes_read;
+}
+
+static ssize_t file_fill(void * const source_context, char * const buffer, size_t const buffer_size)
+{
+    FILE * const fp = source_context;
+    ssize_t bytes_read;
+
+    bytes_read = fread(buffer, 1, buffer_size, fp);
+    if (bytes_read == 0 && ferror(fp))
+    {
+        bytes_read = -1;
+    }
+
+    return bytes_read;
+}
+
+static ssize_t getc_fill(void * const source_context, char * const buffer, size_t const buffer_size)
+{
+    tokeniser_getc_source_st * const getc_source = source_context;
+    size_t length = 0;
+
+    while (length < buffer_size)
+    {
+        int const ch = getc_source->getc(getc_source->user_context);
+
+        if (ch < 0)
+        {
+            break;
+        }
+        buffer[length] = (char)ch;
+        length++;
+        if (ch == '\n')
+        {
+            break;
+        }
+    }
+
+    return (ssize_t)length;
+}
+
+void tokeniser_source_fd_init(tokeniser_source_st * const source, int const fd)
+{
+    source->fill = fd_fill;
+    source->context = (void *)(intptr_t)fd;
+}
+
+void tokeniser_source_file_init(tokeniser_source_st * const source, FILE * const fp)
+{
+    source->fill = file_fill;
+    source->context = fp;
+}
+
+void tokeniser_source_getc_init(tokeniser_source_st * const source, tokeniser_getc_source_st * const getc_source)
+{
+    source->fill = getc_fill;
+    source->context = getc_source;
+}
+
+void tokeniser_stream_init(tokeniser_st * const tokeniser)
+{
+    tokeniser->stream_token_callback = NULL;
+    tokeniser->stream_line_callback = NULL;
+    tokeniser->stream_user_arg = NULL;
+    tokeniser->stream_offset = 0;
+    tokeniser->line_start = 0;
+    tokeniser->line_started = false;
+    tokeniser->line_complete = false;
+}
+
+static bool stream_token_callback(char const * const token,
+                                  size_t const start_index,
+                                  size_t const end_index,
+                                  char const quote_char,
+                                  void * const user_arg)
+{
+    /* Convert the line relative indexes from the FSM into stream
+     * offsets before passing the token on to the user.
+     */
+    tokeniser_st * const tokeniser = user_arg;
+    bool result;
+
+    if (tokeniser->stream_token_callback == NULL)
+    {
+        result = true;
+        goto done;
+    }
+
+    result = tokeniser->stream_token_callback(token,
+                                              tokeniser->line_start + start_index,
+                                              tokeniser->line_start + end_index,
+                                              quote_char,
+                                              tokeniser->stream_user_arg);
+
+done:
+    return result;
+}
+
+static bool stream_line_done(tokeniser_st * const tokeniser, tokeniser_result_t const result, size_t const line_end)
+{
+    bool keep_going;
+
+    tokeniser->line_complete = true;
+    if (tokeniser->stream_line_callback == NULL)
+    {
+        keep_going = true;
+        goto done;
+    }
+
+    keep_going = tokeniser->stream_line_callback(result,
+                                                 tokeniser->line_start,
+                                                 line_end,
+                                                 tokeniser->stream_user_arg);
+
+done:
+    return keep_going;
+}
+
+static void stream_next_line(tokeniser_st * const tokeniser)
+{
+    /* Called with stream_offset referring to the character after
+     * the line ending.
+     */
+    tokeniser_init(tokeniser);
+    tokeniser->line_start = tokeniser->stream_offset;
+    tokeniser->line_started = false;
+    tokeniser->line_complete = false;
+}
+
+tokeniser_result_t tokeniser_feed_buffer(tokeniser_st * const tokeniser,
+                                         char const * const buffer,
+                                         size_t const length,
+                                         new_token_cb const token_callback,
+                                         line_done_cb const line_callback,
+                                         void * const user_arg)
+{
+    tokeniser_result_t result;
+    size_t index;
+    size_t run;
+
+    if (tokeniser == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+
+    tokeniser->stream_token_callback = token_callback;
+    tokeniser->stream_line_callback = line_callback;
+    tokeniser->stream_user_arg = user_arg;
+
+    index = 0;
+    while (index < length)
+    {
+        char const next_char = buffer[index];
+
+        if (tokeniser->line_complete)
+        {
+            /* Nothing more of interest on this line. Skip straight to
+             * the line ending.
+             */
+            char const * const line_end = memchr(&buffer[index], '\n', length - index);
+            size_t const skip = (line_end == NULL) ? length - index : (size_t)(line_end - &buffer[index]);
+
+            tokeniser->stream_offset += skip;
+            index += skip;
+            if (line_end == NULL)
+            {
+                break;
+            }
+        }
+        else if (next_char == '\n')
+        {
+            tokeniser_result_t const line_result = tokeniser_feed(tokeniser, '\0', stream_token_callback, tokeniser);
+
+            if (line_result == tokeniser_result_need_more_input)
+            {
+                /* The line carries on after the '\n'. */
+                index++;
+                tokeniser->stream_offset++;
+                continue;
+            }
+            if (!stream_line_done(tokeniser, line_result, tokeniser->stream_offset))
+            {
+                result = tokeniser_result_error;
+                goto done;
+            }
+        }
+        else if ((run = tokeniser_run_feed(tokeniser, &buffer[index], length - index)) != 0)
+        {
+            /* A run of characters the FSM would just add to the token
+             * or skip.
+             */
+            tokeniser->line_started = true;
+            index += run;
+            tokeniser->stream_offset += run;
+            continue;
+        }
+        else
+        {
+            tokeniser_result_t const char_result = tokeniser_feed(tokeniser, next_char, stream_token_callback, tokeniser);
+
+            tokeniser->line_started = true;
+            if (char_result != tokeniser_result_continue
+                && !stream_line_done(tokeniser, char_result, tokeniser->stream_offset))
+            {
+                result = tokeniser_result_error;
+                goto done;
+            }
+            index++;
+            tokeniser->stream_offset++;
+            continue;
+        }
+
+        /* At a line ending. */
+        index++;
+        tokeniser->stream_offset++;
+        stream_next_line(tokeniser);
+    }
+
+    result = tokeniser_result_continue;
+
+done:
+    return result;
+}
+
+tokeniser_result_t tokeniser_feed_end(tokeniser_st * const tokeniser,
+                                      new_token_cb const token_callback,
+                                      line_done_cb const line_callback,
+                                      void * const user_arg)
+{
+    tokeniser_result_t result;
+
+    if (tokeniser == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+
+    tokeniser->stream_token_callback = token_callback;
+    tokeniser->stream_line_callback = line_callback;
+    tokeniser->stream_user_arg = user_arg;
+
+    result = tokeniser_result_ok;
+    if (tokeniser->line_started && !tokeniser->line_complete)
+    {
+        bool const continuation = tokeniser->continuation;
+        tokeniser_result_t line_result;
+
+        /* There's no more input to carry on with, so the line ends
+         * here regardless.
+         */
+        tokeniser->continuation = false;
+        line_result = tokeniser_feed(tokeniser, '\0', stream_token_callback, tokeniser);
+        tokeniser->continuation = continuation;
+
+        if (!stream_line_done(tokeniser, line_result, tokeniser->stream_offset))
+        {
+            result = tokeniser_result_error;
+        }
+    }
+
+    tokeniser_init(tokeniser);
+    tokeniser_stream_init(tokeniser);
+
+done:
+    return result;
+}
+
+static void * run_reader_thread(void * const arg)
+{
+    /* Keep reading blocks into whichever buffer the tokeniser isn't
+     * working on until the source is exhausted.
+     */
+    run_reader_st * const reader = arg;
+    unsigned int index = 0;
+    ssize_t length;
+
+    do
+    {
+        run_buffer_st * const buffer = &reader->buffers[index];
+        bool stop;
+
+        pthread_mutex_lock(&reader->lock);
+        while (buffer->full && !reader->stop)
+        {
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        }
+        stop = reader->stop;
+        pthread_mutex_unlock(&reader->lock);
+        if (stop)
+        {
+            break;
+        }
+
+        length = reader->source->fill(reader->source->context, buffer->data, TOKENISER_RUN_BUFFER_SIZE);
+
+        pthread_mutex_lock(&reader->lock);
+        buffer->length = length;
+        buffer->full = true;
+        pthread_cond_signal(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+
+        index ^= 1;
+    }
+    while (length > 0);
+
+    return NULL;
+}
+
+static tokeniser_result_t run_threaded(tokeniser_st * const tokeniser,
+                                       run_reader_st * const reader,
+                                       new_token_cb const token_callback,
+                                       line_done_cb const line_callback,
+                                       void * const user_arg)
+{
+    tokeniser_result_t result;
+    unsigned int index = 0;
+
+    for (;;)
+    {
+        run_buffer_st * const buffer = &reader->buffers[index];
+        ssize_t length;
+
+        pthread_mutex_lock(&reader->lock);
+        while (!buffer->full)
+        {
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        }
+        length = buffer->length;
+        pthread_mutex_unlock(&reader->lock);
+
+        if (length < 0)
+        {
+            result = tokeniser_result_error;
+            break;
+        }
+        if (length == 0)
+        {
+            result = tokeniser_result_ok;
+            break;
+        }
+
+        result = tokeniser_feed_buffer(tokeniser, buffer->data, length, token_callback, line_callback, user_arg);
+        if (result != tokeniser_result_continue)
+        {
+            break;
+        }
+
+        pthread_mutex_lock(&reader->lock);
+        buffer->full = false;
+        pthread_cond_signal(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+
+        index ^= 1;
+    }
+
+    /* Release the reader if it is waiting for a free buffer. */
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_signal(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+
+    return result;
+}
+
+static tokeniser_result_t run_unthreaded(tokeniser_st * const tokeniser,
+                                         tokeniser_source_st const * const source,
+                                         char * const data,
+                                         new_token_cb const token_callback,
+                                         line_done_cb const line_callback,
+                                         void * const user_arg)
+{
+    tokeniser_result_t result;
+
+    for (;;)
+    {
+        ssize_t const length = source->fill(source->context, data, TOKENISER_RUN_BUFFER_SIZE);
+
+        if (length < 0)
+        {
+            result = tokeniser_result_error;
+            break;
+        }
+        if (length == 0)
+        {
+            result = tokeniser_result_ok;
+            break;
+        }
+
+        result = tokeniser_feed_buffer(tokeniser, data, length, token_callback, line_callback, user_arg);
+        if (result != tokeniser_result_continue)
+        {
+            break;
+        }
+    }
+
+    return result;
+}
+
+tokeniser_result_t tokeniser_run(tokeniser_st * const tokeniser,
+                                 tokeniser_source_st const * const source,
+                                 new_token_cb const token_callback,
+                                 line_done_cb const line_callback,
+                                 void * const user_arg)
+{
+    tokeniser_result_t result;
+    run_reader_st reader;
+    pthread_t reader_thread;
+    char * data;
+
+    if (tokeniser == NULL || source == NULL || source->fill == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+
+    data = malloc(2 * TOKENISER_RUN_BUFFER_SIZE);
+    if (data == NULL)
+    {
+        result = tokeniser_result_error;
+        goto done;
+    }
+
+    tokeniser_init(tokeniser);
+    tokeniser_stream_init(tokeniser);
+
+    reader.source = source;
+    reader.stop = false;
+    reader.buffers[0].data = data;
+    reader.buffers[0].full = false;
+    reader.buffers[1].data = data + TOKENISER_RUN_BUFFER_SIZE;
+    reader.buffers[1].full = false;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.cond, NULL);
+
+    if (pthread_create(&reader_thread, NULL, run_reader_thread, &reader) == 0)
+    {
+        result = run_threaded(tokeniser, &reader, token_callback, line_callback, user_arg);
+        pthread_join(reader_thread, NULL);
+    }
+    else
+    {
+        /* No reader thread available, so read and tokenise in turn. */
+        result = run_unthreaded(tokeniser, source, data, token_callback, line_callback, user_arg);
+    }
+
+    pthread_cond_destroy(&reader.cond);
+    pthread_mutex_destroy(&reader.lock);
+    free(data);
+
+    if (result == tokeniser_result_ok)
+    {
+        result = tokeniser_feed_end(tokeniser, token_callback, line_callback, user_arg);
+    }
+
+done:
+    return result;
+}
@@ -0,0 +1,126 @@
+#ifndef __TOKENISER_RUN_H__
+#define __TOKENISER_RUN_H__
+
+#include "tokeniser.h"
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The size of each of the two buffers tokeniser_run() reads
+ * into.
+ */
+#define TOKENISER_RUN_BUFFER_SIZE (256 * 1024)
+
+/* Read up to buffer_size bytes into buffer.
+ * Returns: The number of bytes read, 0 at the end of the input,
+ * or -1 on error.
+ */
+typedef ssize_t (* tokeniser_fill_cb)(void * const source_context, char * const buffer, size_t const buffer_size);
+
+typedef struct tokeniser_source_st
+{
+    tokeniser_fill_cb fill;
+    void * context; /* Passed to fill. */
+} tokeniser_source_st;
+
+/* Called at the end of each line of a multi-line stream.
+ * @result: The tokeniser result for the line (ok,
+ * incomplete_token or error).
+ * @line_start: The offset in the stream of the first character
+ * of the line.
+ * @line_end: The offset in the stream of the line ending (or
+ * the end of the stream).
+ * Return false to stop tokenising the stream.
+ */
+typedef bool (* line_done_cb)(tokeniser_result_t const result,
+                              size_t const line_start,
+                              size_t const line_end,
+                              void * const user_arg);
+
+/* A character at a time source, for input that only has a getc_cb.
+ * It must stay valid while the source initialised from it is used.
+ */
+typedef struct tokeniser_getc_source_st
+{
+    getc_cb getc;
+    void * user_context; /* Passed to getc. */
+} tokeniser_getc_source_st;
+
+/*
+ * Initialise a source that reads from a file descriptor. The
+ * descriptor isn't closed by the tokeniser.
+ */
+void tokeniser_source_fd_init(tokeniser_source_st * const source, int const fd);
+
+/*
+ * Initialise a source that reads from a stdio stream. The
+ * stream isn't closed by the tokeniser.
+ */
+void tokeniser_source_file_init(tokeniser_source_st * const source, FILE * const fp);
+
+/*
+ * Initialise a source that fills its buffer by calling getc, which
+ * returns a negative value (such as EOF) at the end of the input.
+ * Each fill stops after a '\n', so lines are passed on as they
+ * arrive from interactive input.
+ */
+void tokeniser_source_getc_init(tokeniser_source_st * const source, tokeniser_getc_source_st * const getc_source);
+
+/*
+ * Feed a buffer holding part of a multi-line stream into the
+ * tokeniser. Lines are terminated by '\n'. The start and end
+ * indexes passed to token_callback are offsets from the start
+ * of the stream rather than the start of the line.
+ * tokeniser_feed_buffer() may be called repeatedly with
+ * consecutive parts of the stream, and lines may span calls.
+ * Call tokeniser_feed_end() once the stream is exhausted.
+ * @line_callback: Optional, called as each line is completed.
+ * Return value: tokeniser_result_continue, or
+ * tokeniser_result_error if line_callback asked to stop.
+ */
+tokeniser_result_t tokeniser_feed_buffer(tokeniser_st * const tokeniser,
+                                         char const * const buffer,
+                                         size_t const length,
+                                         new_token_cb const token_callback,
+                                         line_done_cb const line_callback,
+                                         void * const user_arg);
+
+/*
+ * Complete the last line of the stream if it wasn't terminated
+ * by '\n', and prepare the tokeniser for a new stream.
+ * Return value: tokeniser_result_ok, or tokeniser_result_error
+ * if line_callback asked to stop.
+ */
+tokeniser_result_t tokeniser_feed_end(tokeniser_st * const tokeniser,
+                                      new_token_cb const token_callback,
+                                      line_done_cb const line_callback,
+                                      void * const user_arg);
+
+/*
+ * Tokenise all lines supplied by source. Reads are made in
+ * large blocks into two buffers, and where possible the next
+ * block is read on a separate thread while the current one is
+ * being tokenised. If line_callback stops early, tokeniser_run()
+ * still waits for the read in progress to return, so a source
+ * that can block indefinitely (such as a pipe or socket with
+ * nothing to read) should be made to return, e.g. by shutting
+ * the socket down or closing the other end of the pipe.
+ * Return value: tokeniser_result_ok once the whole source has
+ * been tokenised, else tokeniser_result_error if the source
+ * failed or line_callback asked to stop.
+ */
+tokeniser_result_t tokeniser_run(tokeniser_st * const tokeniser,
+                                 tokeniser_source_st const * const source,
+                                 new_token_cb const token_callback,
+                                 line_done_cb const line_callback,
+                                 void * const user_arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_RUN_H__ */
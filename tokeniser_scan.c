@@ -0,0 +1,204 @@
+#include "tokeniser_scan.h"
+#include "tokeniser_table.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static size_t close_quote_find(char const * const buffer, size_t const length, size_t const offset, char const quote)
+{
+    /* Inside quotes only the closing quote and NUL matter, whatever
+     * the locale, so whole runs can be compared at once.
+     * Returns: The offset of the first of them, or length if there
+     * isn't one.
+     */
+    size_t index = offset;
+
+#if defined(__SSE2__)
+    __m128i const quotes = _mm_set1_epi8(quote);
+
+    for (; index + 16 <= length; index += 16)
+    {
+        __m128i const chars = _mm_loadu_si128((__m128i const *)(buffer + index));
+        unsigned int const matches = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chars, quotes),
+                                                                                  _mm_cmpeq_epi8(chars, _mm_setzero_si128())));
+
+        if (matches != 0)
+        {
+            index += (size_t)__builtin_ctz(matches);
+            goto done;
+        }
+    }
+#endif
+
+    for (; index < length; index++)
+    {
+        if (buffer[index] == quote || buffer[index] == '\0')
+        {
+            break;
+        }
+    }
+
+#if defined(__SSE2__)
+done:
+#endif
+    return index;
+}
+
+bool tokeniser_scan_next(char const * const buffer,
+                         size_t const length,
+                         size_t * const offset,
+                         tokeniser_scan_token_st * const token)
+{
+    table_state_t state = table_state_no_token;
+    bool found = false;
+    bool finished = false;
+    size_t index;
+
+    token->quote_char = '\0';
+    token->incomplete = false;
+    token->needs_copy = false;
+    token->text_length = 0;
+
+    for (index = *offset; !finished; index++)
+    {
+        char const ch = (index < length) ? buffer[index] : '\0';
+        table_entry_st const entry = tokeniser_table[state][tokeniser_table_class_get(ch)];
+
+        switch ((table_action_t)entry.action)
+        {
+            case table_action_none:
+                if (tokeniser_table_state_in_token(state))
+                {
+                    /* A quote within a regular token. */
+                    token->needs_copy = true;
+                }
+                break;
+            case table_action_start:
+                token->start_index = index;
+                token->text_length = 1;
+                break;
+            case table_action_start_quoted:
+                token->start_index = index;
+                break;
+            case table_action_append:
+                token->text_length++;
+                break;
+            case table_action_end:
+            case table_action_end_line_token:
+                token->end_index = index;
+                found = true;
+                finished = true;
+                break;
+            case table_action_end_quoted:
+                token->end_index = index + 1;
+                token->quote_char = ch;
+                found = true;
+                finished = true;
+                break;
+            case table_action_end_line:
+                finished = true;
+                break;
+            case table_action_incomplete:
+                token->end_index = index;
+                token->incomplete = true;
+                found = true;
+                finished = true;
+                break;
+        }
+        state = entry.next_state;
+    }
+
+    /* Carry on from the character that ended the token, unless it
+     * was the closing quote, which is part of the token. A space is
+     * ignored next time, and the end of the record ends it again.
+     */
+    *offset = (token->quote_char != '\0') ? index : index - 1;
+
+    if (found)
+    {
+        char const * const text = buffer + token->start_index;
+
+        token->text = (text[0] == '\'' || text[0] == '\"') ? text + 1 : text;
+    }
+
+    return found;
+}
+
+void tokeniser_scan_copy(char const * const buffer, tokeniser_scan_token_st const * const token, char * const text)
+{
+    if (token->needs_copy)
+    {
+        tokeniser_table_quotes_strip(buffer + token->start_index, token->end_index - token->start_index, text);
+    }
+    else
+    {
+        memcpy(text, token->text, token->text_length);
+        text[token->text_length] = '\0';
+    }
+}
+
+tokeniser_result_t tokeniser_scan_validate(char const * const buffer,
+                                           size_t const length,
+                                           tokeniser_scan_validation_st * const validation)
+{
+    table_state_t state = table_state_no_token;
+    tokeniser_result_t result = tokeniser_result_ok;
+    size_t open_quote_offset = TOKENISER_SCAN_NO_OFFSET;
+    size_t token_count = 0;
+    size_t index;
+
+    for (index = 0; ; index++)
+    {
+        char ch;
+        table_entry_st entry;
+
+        if (state == table_state_single_quoted_token || state == table_state_single_quoted_regular_token)
+        {
+            index = close_quote_find(buffer, length, index, '\'');
+        }
+        else if (state == table_state_double_quoted_token || state == table_state_double_quoted_regular_token)
+        {
+            index = close_quote_find(buffer, length, index, '\"');
+        }
+
+        ch = (index < length) ? buffer[index] : '\0';
+        entry = tokeniser_table[state][tokeniser_table_class_get(ch)];
+        switch ((table_action_t)entry.action)
+        {
+            case table_action_start:
+                token_count++;
+                break;
+            case table_action_start_quoted:
+                token_count++;
+                open_quote_offset = index;
+                break;
+            case table_action_none:
+                if (state == table_state_regular_token)
+                {
+                    /* A quote within a regular token. */
+                    open_quote_offset = index;
+                }
+                break;
+            case table_action_incomplete:
+                result = tokeniser_result_incomplete_token;
+                goto done;
+            case table_action_end_line:
+            case table_action_end_line_token:
+                open_quote_offset = TOKENISER_SCAN_NO_OFFSET;
+                goto done;
+            case table_action_append:
+            case table_action_end:
+            case table_action_end_quoted:
+                break;
+        }
+        state = entry.next_state;
+    }
+
+done:
+    validation->token_count = token_count;
+    validation->open_quote_offset = open_quote_offset;
+    return result;
+}
@@ -0,0 +1,83 @@
+#ifndef __TOKENISER_SCAN_H__
+#define __TOKENISER_SCAN_H__
+
+#include "tokeniser.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A stateless way to pull tokens from a record held in memory,
+ * one at a time. Between tokens the tokeniser is always in the
+ * same state, so all that needs to be kept from one call to the
+ * next is the offset to carry on from. The tokens, offsets and
+ * quote characters are the same as feeding the record to
+ * tokeniser_feed() followed by a '\0'.
+ */
+
+typedef struct tokeniser_scan_token_st
+{
+    size_t start_index; /* As passed to new_token_cb. */
+    size_t end_index; /* As passed to new_token_cb. */
+    char quote_char; /* As passed to new_token_cb. */
+    bool incomplete; /* The record ended inside quotes (tokeniser_result_incomplete_token). */
+    bool needs_copy; /* Quotes must be stripped from within the token, so use tokeniser_scan_copy(). */
+    char const * text; /* Unless needs_copy, the token text within the record. It isn't NUL terminated. */
+    size_t text_length; /* The length of the token text, once any quotes are stripped. */
+} tokeniser_scan_token_st;
+
+#define TOKENISER_SCAN_NO_OFFSET ((size_t)-1)
+
+typedef struct tokeniser_scan_validation_st
+{
+    size_t token_count; /* The number of tokens, including any incomplete one. */
+    size_t open_quote_offset; /* The offset of the unterminated opening quote, or TOKENISER_SCAN_NO_OFFSET. */
+} tokeniser_scan_validation_st;
+
+/*
+ * Find the next token in a record.
+ * @buffer: The record. It needn't be NUL terminated. If it holds
+ * a NUL, the record ends there.
+ * @length: The number of characters in the record.
+ * @offset: Where to carry on from, which is 0 for the first
+ * token. It is updated ready for the next call.
+ * Return value: true if a token was found, false at the end of
+ * the record.
+ */
+bool tokeniser_scan_next(char const * const buffer,
+                         size_t const length,
+                         size_t * const offset,
+                         tokeniser_scan_token_st * const token);
+
+/*
+ * Copy the text of a token found by tokeniser_scan_next(),
+ * stripping any quotes.
+ * @text: Where to copy the text. There must be room for
+ * token->text_length characters plus a NUL.
+ */
+void tokeniser_scan_copy(char const * const buffer, tokeniser_scan_token_st const * const token, char * const text);
+
+/*
+ * Check that a record is well formed and count its tokens,
+ * without copying any token or allocating any memory. The text
+ * inside quotes is skipped 16 characters at a time where SIMD is
+ * available.
+ * @buffer: The record. It needn't be NUL terminated. If it holds
+ * a NUL, the record ends there.
+ * @length: The number of characters in the record.
+ * Return value: tokeniser_result_ok, or
+ * tokeniser_result_incomplete_token if the record ends inside
+ * quotes.
+ */
+tokeniser_result_t tokeniser_scan_validate(char const * const buffer,
+                                           size_t const length,
+                                           tokeniser_scan_validation_st * const validation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TOKENISER_SCAN_H__ */
@@ -1,19 +1,13 @@
 #include "tokeniser_states.h"
+#include "hash.h"
 
 #include <ctype.h>
-#include <stdio.h>
+#include <string.h>
 
-//#define TOKENISER_STATE_DEBUG
-
-#if defined(TOKENISER_STATE_DEBUG)
-#define STATE_PRINTF(fmt, ...) do {printf(fmt, ##__VA_ARGS__);} while(0)
-#else
-#define STATE_PRINTF(fmt, ...) do {} while(0)
+#if defined(__SSE2__)
+#include <emmintrin.h>
 #endif
 
-static void tokeniser_state_entry(fsm_class * const fsm);
-static void tokeniser_state_exit(fsm_class * const fsm);
-
 static void tokeniser_state_init_transition(fsm_event_handlers_st * const event_handlers);
 static void tokeniser_state_no_token_transition(fsm_event_handlers_st * const event_handlers);
 static void tokeniser_state_done_transition(fsm_event_handlers_st * const event_handlers);
@@ -22,56 +16,99 @@ static void tokeniser_state_single_quoted_token_transition(fsm_event_handlers_st
 static void tokeniser_state_double_quoted_token_transition(fsm_event_handlers_st * const event_handlers);
 static void tokeniser_state_single_quoted_regular_token_transition(fsm_event_handlers_st * const event_handlers);
 static void tokeniser_state_double_quoted_regular_token_transition(fsm_event_handlers_st * const event_handlers);
+static void tokeniser_state_csv_field_start_transition(fsm_event_handlers_st * const event_handlers);
+static void tokeniser_state_csv_unquoted_field_transition(fsm_event_handlers_st * const event_handlers);
+static void tokeniser_state_csv_quoted_field_transition(fsm_event_handlers_st * const event_handlers);
+static void tokeniser_state_csv_quoted_field_quote_transition(fsm_event_handlers_st * const event_handlers);
 
-static const DEFINE_STATE(tokeniser_state_init, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_init_transition);
-static const DEFINE_STATE(tokeniser_state_no_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_no_token_transition);
-static const DEFINE_STATE(tokeniser_state_done, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_done_transition);
-static const DEFINE_STATE(tokeniser_state_regular_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_regular_token_transition);
-static const DEFINE_STATE(tokeniser_state_single_quoted_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_single_quoted_token_transition);
-static const DEFINE_STATE(tokeniser_state_double_quoted_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_double_quoted_token_transition);
-static const DEFINE_STATE(tokeniser_state_single_quoted_regular_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_single_quoted_regular_token_transition);
-static const DEFINE_STATE(tokeniser_state_double_quoted_regular_token, tokeniser_state_entry, tokeniser_state_exit, tokeniser_state_double_quoted_regular_token_transition);
+/* The ids recorded by the flight recorder. */
+typedef enum tokeniser_state_id_t
+{
+    tokeniser_state_id_init,
+    tokeniser_state_id_no_token,
+    tokeniser_state_id_done,
+    tokeniser_state_id_regular_token,
+    tokeniser_state_id_single_quoted_token,
+    tokeniser_state_id_double_quoted_token,
+    tokeniser_state_id_single_quoted_regular_token,
+    tokeniser_state_id_double_quoted_regular_token,
+    tokeniser_state_id_csv_field_start,
+    tokeniser_state_id_csv_unquoted_field,
+    tokeniser_state_id_csv_quoted_field,
+    tokeniser_state_id_csv_quoted_field_quote,
+    tokeniser_state_id_count
+} tokeniser_state_id_t;
+
+static const DEFINE_STATE_WITH_ID(tokeniser_state_init, tokeniser_state_id_init, NULL, NULL, tokeniser_state_init_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_no_token, tokeniser_state_id_no_token, NULL, NULL, tokeniser_state_no_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_done, tokeniser_state_id_done, NULL, NULL, tokeniser_state_done_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_regular_token, tokeniser_state_id_regular_token, NULL, NULL, tokeniser_state_regular_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_single_quoted_token, tokeniser_state_id_single_quoted_token, NULL, NULL, tokeniser_state_single_quoted_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_double_quoted_token, tokeniser_state_id_double_quoted_token, NULL, NULL, tokeniser_state_double_quoted_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_single_quoted_regular_token, tokeniser_state_id_single_quoted_regular_token, NULL, NULL, tokeniser_state_single_quoted_regular_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_double_quoted_regular_token, tokeniser_state_id_double_quoted_regular_token, NULL, NULL, tokeniser_state_double_quoted_regular_token_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_csv_field_start, tokeniser_state_id_csv_field_start, NULL, NULL, tokeniser_state_csv_field_start_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_csv_unquoted_field, tokeniser_state_id_csv_unquoted_field, NULL, NULL, tokeniser_state_csv_unquoted_field_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_csv_quoted_field, tokeniser_state_id_csv_quoted_field, NULL, NULL, tokeniser_state_csv_quoted_field_transition);
+static const DEFINE_STATE_WITH_ID(tokeniser_state_csv_quoted_field_quote, tokeniser_state_id_csv_quoted_field_quote, NULL, NULL, tokeniser_state_csv_quoted_field_quote_transition);
+
+/* Indexed by the state ids. */
+static fsm_state_config const * const tokeniser_states[tokeniser_state_id_count] =
+{
+    [tokeniser_state_id_init] = &tokeniser_state_init,
+    [tokeniser_state_id_no_token] = &tokeniser_state_no_token,
+    [tokeniser_state_id_done] = &tokeniser_state_done,
+    [tokeniser_state_id_regular_token] = &tokeniser_state_regular_token,
+    [tokeniser_state_id_single_quoted_token] = &tokeniser_state_single_quoted_token,
+    [tokeniser_state_id_double_quoted_token] = &tokeniser_state_double_quoted_token,
+    [tokeniser_state_id_single_quoted_regular_token] = &tokeniser_state_single_quoted_regular_token,
+    [tokeniser_state_id_double_quoted_regular_token] = &tokeniser_state_double_quoted_regular_token,
+    [tokeniser_state_id_csv_field_start] = &tokeniser_state_csv_field_start,
+    [tokeniser_state_id_csv_unquoted_field] = &tokeniser_state_csv_unquoted_field,
+    [tokeniser_state_id_csv_quoted_field] = &tokeniser_state_csv_quoted_field,
+    [tokeniser_state_id_csv_quoted_field_quote] = &tokeniser_state_csv_quoted_field_quote
+};
 
 static void default_init_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 }
 
 static void default_nul_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 }
 
 static void default_space_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 }
 
 static void default_single_quote_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 }
 
 static void default_double_quote_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 }
 
 static void default_regular_char_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
 {
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
+}
+
+static void default_delimiter_event_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    UNUSED(fsm);
+    UNUSED(event_fsm);
 }
 
 static void default_event_handlers_set(fsm_event_handlers_st * const event_handlers)
@@ -82,37 +119,290 @@ static void default_event_handlers_set(fsm_event_handlers_st * const event_handl
     event_handlers->single_quote = default_single_quote_event_handler;
     event_handlers->double_quote = default_double_quote_event_handler;
     event_handlers->regular_char = default_regular_char_event_handler;
+    event_handlers->delimiter = default_delimiter_event_handler;
+}
+
+static void last_token_defer(tokeniser_st * const tokeniser, size_t const end_index, char const quote_char)
+{
+    /* Hold on to a token that is only wanted if it turns out to be 
+     * the last on the line. 
+     */
+    current_token_swap_last(tokeniser);
+    tokeniser->last_token_start = tokeniser->token_start;
+    tokeniser->last_token_end = end_index;
+    tokeniser->last_token_quote_char = quote_char;
+    tokeniser->last_token_pending = true;
+}
+
+static void projection_token_end(tokeniser_st * const tokeniser)
+{
+    /* Once the highest wanted token is complete, nothing else on the 
+     * line is of interest (unless the last token is wanted). 
+     */
+    if (!tokeniser->projection_last
+        && tokeniser->projection_count != 0
+        && tokeniser->token_count - 1 >= tokeniser->projection[tokeniser->projection_count - 1])
+    {
+        tokeniser->projection_done = true;
+    }
 }
 
 static void got_token(tokeniser_st * const tokeniser, size_t const end_index, char const quote_char)
 {
     /* Called when a complete token has just been created. 
-     * Notify the user if they are interested, and free the token 
-     * just created. 
+     * Notify the user if they are interested, and clear the token 
+     * just created. Tokens over the token count limit, and tokens 
+     * outside the projection, aren't passed on. 
      */
-    if (tokeniser->user_callback != NULL)
+    if (tokeniser->token_deferred && !tokeniser->current_token_discarded)
     {
-        tokeniser->user_callback(tokeniser->current_token,
+        last_token_defer(tokeniser, end_index, quote_char);
+    }
+    else if (tokeniser->user_callback != NULL && !tokeniser->current_token_discarded)
+    {
+        tokeniser->last_token_pending = false; /* A later token has been passed on. */
+        tokeniser->user_callback(current_token_get(tokeniser),
                                  tokeniser->token_start,
                                  end_index,
                                  quote_char,
                                  tokeniser->user_arg);
     }
-    current_token_free(tokeniser);
+    current_token_clear(tokeniser);
+
+    if (tokeniser->projecting)
+    {
+        projection_token_end(tokeniser);
+    }
 }
 
-static void tokeniser_state_entry(fsm_class * const fsm)
+static void regular_token_end(tokeniser_st * const tokeniser)
 {
-    UNUSED(fsm);
+    /* An unquoted token made up only of references to undefined or 
+     * empty variables is dropped, as a shell drops it, rather than 
+     * passed on as an empty token. It isn't counted either. 
+     */
+    if (tokeniser->variable_lookup != NULL
+        && !tokeniser->current_token_has_text
+        && !tokeniser->current_token_quoted)
+    {
+        current_token_clear(tokeniser);
+        tokeniser->token_count--;
+    }
+    else
+    {
+        got_token(tokeniser,
+                  tokeniser->char_count,
+                  '\0');
+    }
+}
 
-    STATE_PRINTF("enter %s\n", Fsm_current_state_name(fsm));
+static void last_token_deliver(tokeniser_st * const tokeniser)
+{
+    /* The line has ended, so the deferred token was the last one. */
+    current_token_swap_last(tokeniser);
+    tokeniser->token_start = tokeniser->last_token_start;
+    tokeniser->current_token_discarded = false;
+    tokeniser->token_deferred = false;
+    tokeniser->last_token_pending = false;
+    got_token(tokeniser, tokeniser->last_token_end, tokeniser->last_token_quote_char);
 }
 
-static void tokeniser_state_exit(fsm_class * const fsm)
+static void tokeniser_abandon_line(fsm_class * const fsm, tokeniser_result_t const result)
 {
-    UNUSED(fsm);
+    /* Give up on the rest of the line. Any partial token is 
+     * dropped. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+
+    if (fsm->current_state.config == &tokeniser_state_done)
+    {
+        goto done;
+    }
+
+    current_token_clear(tokeniser);
+    tokeniser_result_set(tokeniser, result);
+    fsm_state_transition(fsm, &tokeniser_state_done);
+
+done:
+    return;
+}
+
+static bool tokeniser_limit_exceeded(fsm_class * const fsm)
+{
+    /* Returns true if the tokeniser should carry on with the line. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    bool carry_on;
+
+    tokeniser_limit_hit(tokeniser);
+    if (tokeniser->limits.policy == tokeniser_limit_policy_truncate)
+    {
+        carry_on = true;
+    }
+    else
+    {
+        tokeniser_abandon_line(fsm, tokeniser_result_limit_exceeded);
+        carry_on = false;
+    }
+
+    return carry_on;
+}
+
+static bool token_char_append(fsm_class * const fsm, int const new_char)
+{
+    /* Add a character to the current token, subject to the token 
+     * size limit. Returns false if the line has been abandoned. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    bool carry_on;
+
+    tokeniser->current_token_has_text = true;
+    if (tokeniser->current_token_discarded)
+    {
+        carry_on = true;
+        goto done;
+    }
+    if (tokeniser->limits.max_token_bytes != 0
+        && tokeniser->current_token_length >= tokeniser->limits.max_token_bytes)
+    {
+        carry_on = tokeniser_limit_exceeded(fsm);
+        goto done;
+    }
+    if (!current_token_append(tokeniser, (char)new_char))
+    {
+        tokeniser_abandon_line(fsm, tokeniser_result_error);
+        carry_on = false;
+        goto done;
+    }
+    tokeniser->last_append_offset = tokeniser->char_count;
+    carry_on = true;
+
+done:
+    return carry_on;
+}
+
+static bool projection_token_wanted(tokeniser_st * const tokeniser)
+{
+    /* Called as each token starts. Tokens that aren't wanted are 
+     * deferred if the last token is wanted, as any of them might be 
+     * last. 
+     */
+    size_t const index = tokeniser->token_count - 1;
+    bool wanted;
+
+    while (tokeniser->projection_next < tokeniser->projection_count
+           && tokeniser->projection[tokeniser->projection_next] < index)
+    {
+        tokeniser->projection_next++;
+    }
+    wanted = (tokeniser->projection_next < tokeniser->projection_count
+              && tokeniser->projection[tokeniser->projection_next] == index);
+    tokeniser->token_deferred = (!wanted && tokeniser->projection_last);
+
+    return wanted || tokeniser->token_deferred;
+}
+
+static bool token_begin(fsm_class * const fsm)
+{
+    /* Count the token just started, subject to the token count 
+     * limit, and decide whether it is kept. Returns false if the 
+     * line has been abandoned. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    bool carry_on;
+
+    tokeniser->current_token_discarded = false;
+    tokeniser->token_count++;
+
+    if (tokeniser->limits.max_tokens_per_line != 0
+        && tokeniser->token_count > tokeniser->limits.max_tokens_per_line)
+    {
+        carry_on = tokeniser_limit_exceeded(fsm);
+        tokeniser->current_token_discarded = true;
+        goto done;
+    }
+    if (tokeniser->projecting && !projection_token_wanted(tokeniser))
+    {
+        tokeniser->current_token_discarded = true;
+    }
+    carry_on = true;
+
+done:
+    return carry_on;
+}
+
+static void separator_check(tokeniser_st * const tokeniser, int const new_char, size_t const offset)
+{
+    /* A character from outside quotes was just offered to the token 
+     * at offset. The first of them that is an '=' splits a key=value 
+     * token, as long as it wasn't dropped by the token size limit. 
+     */
+    if (new_char == '='
+        && tokeniser->key_values
+        && tokeniser->current_token_separator == NO_SEPARATOR
+        && tokeniser->current_token_length > offset)
+    {
+        tokeniser->current_token_separator = offset;
+    }
+}
+
+static bool token_start(fsm_class * const fsm, int const first_char)
+{
+    /* Start a new token. first_char is '\0' if the token starts 
+     * with a quote, which isn't part of the token. Returns false if 
+     * the line has been abandoned. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    bool carry_on;
+
+    current_token_init(tokeniser);
+    if (first_char == '\0')
+    {
+        current_token_quoted_set(tokeniser);
+    }
+    carry_on = token_begin(fsm);
+    if (carry_on && first_char != '\0')
+    {
+        carry_on = token_char_append(fsm, first_char);
+    }
+
+    return carry_on;
+}
+
+static void tokeniser_quote_continuation(fsm_class * const fsm)
+{
+    /* The line ended inside quotes in continuation mode. The line 
+     * break becomes part of the token, which carries on with the 
+     * next line. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
 
-    STATE_PRINTF("leave %s\n", Fsm_current_state_name(fsm));
+    if (token_char_append(fsm, '\n'))
+    {
+        tokeniser_result_set(tokeniser, tokeniser_result_need_more_input);
+    }
+}
+
+static void tokeniser_backslash_continuation(fsm_class * const fsm)
+{
+    /* The line ended with a '\\' in continuation mode. Drop the 
+     * '\\' and join the next line onto this one. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    size_t const backslash_offset = tokeniser->char_count - 1;
+
+    if (tokeniser->last_append_offset == backslash_offset)
+    {
+        current_token_drop_last(tokeniser);
+    }
+    if (tokeniser->token_start == backslash_offset)
+    {
+        /* The '\\' was the whole token, so no token has started. */
+        current_token_clear(tokeniser);
+        tokeniser->token_count--;
+        fsm_state_transition(fsm, &tokeniser_state_no_token);
+    }
+    tokeniser_result_set(tokeniser, tokeniser_result_need_more_input);
 }
 
 static void tokeniser_state_init_init_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -120,15 +410,21 @@ static void tokeniser_state_init_init_handler(fsm_class * const fsm, fsm_event c
     /* Initial state. Transition to the first 
      * working state when processing the 'init' event.
      */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm);
 
-    STATE_PRINTF("%s\n", __FUNCTION__);
-    fsm_state_transition(fsm, &tokeniser_state_no_token);
+    if (tokeniser->line_csv_delimiter != '\0')
+    {
+        fsm_state_transition(fsm, &tokeniser_state_csv_field_start);
+    }
+    else
+    {
+        fsm_state_transition(fsm, &tokeniser_state_no_token);
+    }
 }
 
 static void tokeniser_state_init_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
     default_event_handlers_set(event_handlers);
 
     event_handlers->init = tokeniser_state_init_init_handler;
@@ -141,13 +437,11 @@ static void tokeniser_state_done_handler(fsm_class * const fsm, fsm_event const
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
     tokeniser->result = tokeniser_result_already_done;
 }
 
 static void tokeniser_state_done_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_done_handler;
@@ -155,6 +449,7 @@ static void tokeniser_state_done_transition(fsm_event_handlers_st * const event_
     event_handlers->single_quote = tokeniser_state_done_handler;
     event_handlers->double_quote = tokeniser_state_done_handler;
     event_handlers->regular_char = tokeniser_state_done_handler;
+    event_handlers->delimiter = tokeniser_state_done_handler;
 }
 
 static void tokeniser_state_quoted_token_nul_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -166,13 +461,19 @@ static void tokeniser_state_quoted_token_nul_handler(fsm_class * const fsm, fsm_
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
-    got_token(tokeniser,
-              tokeniser->char_count,
-              '\0');
-    tokeniser_result_set(tokeniser, tokeniser_result_incomplete_token);
-    fsm_state_transition(fsm, &tokeniser_state_done);
+    if (tokeniser->continuation)
+    {
+        tokeniser_quote_continuation(fsm);
+    }
+    else
+    {
+        got_token(tokeniser,
+                  tokeniser->char_count,
+                  '\0');
+        tokeniser_result_set(tokeniser, tokeniser_result_incomplete_token);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
 }
 
 static void tokeniser_state_quoted_token_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -184,7 +485,6 @@ static void tokeniser_state_quoted_token_quote_handler(fsm_class * const fsm, fs
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     got_token(tokeniser,
               tokeniser->char_count + 1, /* Include the closing quote in the end index. */
@@ -199,17 +499,13 @@ static void tokeniser_state_quoted_token_other_handler(fsm_class * const fsm, fs
      * If the line ends before the closing quote is received, set 
      * the result to incomplete token. 
      */
-    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
-    str_extend(&tokeniser->current_token, event->current_char);
+    token_char_append(fsm, event->current_char);
 }
 
 static void tokeniser_state_single_quoted_token_transition(fsm_event_handlers_st * const event_handlers)
 {    
-    STATE_PRINTF("%s\n", __FUNCTION__);
-
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_quoted_token_nul_handler;
@@ -221,7 +517,6 @@ static void tokeniser_state_single_quoted_token_transition(fsm_event_handlers_st
 
 static void tokeniser_state_double_quoted_token_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_quoted_token_nul_handler;
@@ -243,13 +538,19 @@ static void tokeniser_state_quoted_regular_token_nul_handler(fsm_class * const f
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
 
-    STATE_PRINTF("%s\n", __FUNCTION__);
-    /* No more input. */
-    got_token(tokeniser,
-              tokeniser->char_count,
-              '\0');
-    tokeniser_result_set(tokeniser, tokeniser_result_incomplete_token);
-    fsm_state_transition(fsm, &tokeniser_state_done);
+    if (tokeniser->continuation)
+    {
+        tokeniser_quote_continuation(fsm);
+    }
+    else
+    {
+        /* No more input. */
+        got_token(tokeniser,
+                  tokeniser->char_count,
+                  '\0');
+        tokeniser_result_set(tokeniser, tokeniser_result_incomplete_token);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
 }
 
 static void tokeniser_state_quoted_regular_token_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -262,7 +563,6 @@ static void tokeniser_state_quoted_regular_token_quote_handler(fsm_class * const
      * token. 
      */
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     /* Received the matching close quote character. */
     fsm_state_transition(fsm, &tokeniser_state_regular_token);
@@ -277,18 +577,14 @@ static void tokeniser_state_quoted_regular_token_other_handler(fsm_class * const
      * the closing quote is received, set the result to incomplete 
      * token. 
      */
-    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     /* Add the new char into the current token. */
-    str_extend(&tokeniser->current_token, event->current_char);
+    token_char_append(fsm, event->current_char);
 }
 
 static void tokeniser_state_single_quoted_regular_token_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
-
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_quoted_regular_token_nul_handler;
@@ -300,8 +596,6 @@ static void tokeniser_state_single_quoted_regular_token_transition(fsm_event_han
 
 static void tokeniser_state_double_quoted_regular_token_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
-
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_quoted_regular_token_nul_handler;
@@ -322,13 +616,17 @@ static void tokeniser_state_regular_token_nul_handler(fsm_class * const fsm, fsm
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
-    got_token(tokeniser,
-              tokeniser->char_count,
-              '\0');
-    tokeniser_result_set(tokeniser, tokeniser_result_ok);
-    fsm_state_transition(fsm, &tokeniser_state_done);
+    if (tokeniser->continuation && tokeniser->previous_char == '\\')
+    {
+        tokeniser_backslash_continuation(fsm);
+    }
+    else
+    {
+        regular_token_end(tokeniser);
+        tokeniser_result_set(tokeniser, tokeniser_result_ok);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
 }
 
 static void tokeniser_state_regular_token_single_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -342,9 +640,9 @@ static void tokeniser_state_regular_token_single_quote_handler(fsm_class * const
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     tokeniser->expected_close_quote = event->current_char;
+    current_token_quoted_set(tokeniser);
     fsm_state_transition(fsm, &tokeniser_state_single_quoted_regular_token);
 }
 
@@ -359,9 +657,9 @@ static void tokeniser_state_regular_token_double_quote_handler(fsm_class * const
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     tokeniser->expected_close_quote = event->current_char;
+    current_token_quoted_set(tokeniser);
     fsm_state_transition(fsm, &tokeniser_state_double_quoted_regular_token);
 }
 
@@ -376,12 +674,8 @@ static void tokeniser_state_regular_token_space_handler(fsm_class * const fsm, f
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
-    got_token(tokeniser,
-              tokeniser->char_count,
-              '\0');
-    current_token_free(tokeniser);
+    regular_token_end(tokeniser);
     fsm_state_transition(fsm, &tokeniser_state_no_token);
 }
 
@@ -396,15 +690,14 @@ static void tokeniser_state_regular_token_regular_char_handler(fsm_class * const
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
+    size_t const offset = tokeniser->current_token_length;
 
-    str_extend(&tokeniser->current_token, event->current_char);
+    token_char_append(fsm, event->current_char);
+    separator_check(tokeniser, event->current_char, offset);
 }
 
 static void tokeniser_state_regular_token_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
-
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_regular_token_nul_handler;
@@ -423,7 +716,6 @@ static void tokeniser_state_no_token_nul_handler(fsm_class * const fsm, fsm_even
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     UNUSED(event_fsm); 
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     tokeniser_result_set(tokeniser, tokeniser_result_ok);
     fsm_state_transition(fsm, &tokeniser_state_done);
@@ -438,7 +730,6 @@ static void tokeniser_state_no_token_space_handler(fsm_class * const fsm, fsm_ev
      */
     UNUSED(fsm);
     UNUSED(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
 }
 
@@ -451,11 +742,12 @@ static void tokeniser_state_no_token_single_quote_handler(fsm_class * const fsm,
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     tokeniser->expected_close_quote = event->current_char;
-    current_token_init(tokeniser, '\0');
-    fsm_state_transition(fsm, &tokeniser_state_single_quoted_token);
+    if (token_start(fsm, '\0'))
+    {
+        fsm_state_transition(fsm, &tokeniser_state_single_quoted_token);
+    }
 }
 
 static void tokeniser_state_no_token_double_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -467,11 +759,12 @@ static void tokeniser_state_no_token_double_quote_handler(fsm_class * const fsm,
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
     tokeniser->expected_close_quote = event->current_char;
-    current_token_init(tokeniser, '\0');
-    fsm_state_transition(fsm, &tokeniser_state_double_quoted_token);
+    if (token_start(fsm, '\0'))
+    {
+        fsm_state_transition(fsm, &tokeniser_state_double_quoted_token);
+    }
 }
 
 static void tokeniser_state_no_token_regular_char_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
@@ -483,16 +776,16 @@ static void tokeniser_state_no_token_regular_char_handler(fsm_class * const fsm,
      */
     tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
     tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
-    STATE_PRINTF("%s\n", __FUNCTION__);
 
-    current_token_init(tokeniser, (char)event->current_char);
-    fsm_state_transition(fsm, &tokeniser_state_regular_token);
+    if (token_start(fsm, event->current_char))
+    {
+        separator_check(tokeniser, event->current_char, 0);
+        fsm_state_transition(fsm, &tokeniser_state_regular_token);
+    }
 }
 
 static void tokeniser_state_no_token_transition(fsm_event_handlers_st * const event_handlers)
 {
-    STATE_PRINTF("%s\n", __FUNCTION__);
-
     default_event_handlers_set(event_handlers);
 
     event_handlers->nul = tokeniser_state_no_token_nul_handler;
@@ -502,12 +795,739 @@ static void tokeniser_state_no_token_transition(fsm_event_handlers_st * const ev
     event_handlers->regular_char = tokeniser_state_no_token_regular_char_handler;
 }
 
+static void tokeniser_csv_record_end(fsm_class * const fsm, char const quote_char)
+{
+    /* The end of a record, in an unquoted field or just after a 
+     * quoted one. A '\r' before the line ending is part of the line 
+     * ending, not the field. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    size_t end_index = tokeniser->char_count;
+
+    if (tokeniser->previous_char == '\r' && tokeniser->last_append_offset == tokeniser->char_count - 1)
+    {
+        current_token_drop_last(tokeniser);
+        end_index--;
+    }
+    if (end_index == 0)
+    {
+        /* A blank line has no fields. */
+        current_token_clear(tokeniser);
+        tokeniser->token_count = 0;
+    }
+    else
+    {
+        got_token(tokeniser, end_index, quote_char);
+    }
+    tokeniser_result_set(tokeniser, tokeniser_result_ok);
+    fsm_state_transition(fsm, &tokeniser_state_done);
+}
+
+static void tokeniser_state_csv_field_start_nul_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* At the start of a field, which is where each record starts 
+     * and where each delimiter leaves off. A delimiter or the end of 
+     * the record ends an empty field. A '\"' starts a quoted field, 
+     * and anything else an unquoted one. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    if (tokeniser->char_count == 0)
+    {
+        /* A blank line has no fields. */
+        tokeniser_result_set(tokeniser, tokeniser_result_ok);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
+    else if (token_start(fsm, '\0'))
+    {
+        got_token(tokeniser, tokeniser->char_count, '\0');
+        tokeniser_result_set(tokeniser, tokeniser_result_ok);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
+}
+
+static void tokeniser_state_csv_field_start_delimiter_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* At the start of a field, which is where each record starts 
+     * and where each delimiter leaves off. A delimiter or the end of 
+     * the record ends an empty field. A '\"' starts a quoted field, 
+     * and anything else an unquoted one. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    if (token_start(fsm, '\0'))
+    {
+        got_token(tokeniser, tokeniser->char_count, '\0');
+    }
+}
+
+static void tokeniser_state_csv_field_start_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* At the start of a field, which is where each record starts 
+     * and where each delimiter leaves off. A delimiter or the end of 
+     * the record ends an empty field. A '\"' starts a quoted field, 
+     * and anything else an unquoted one. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    tokeniser->expected_close_quote = event->current_char;
+    if (token_start(fsm, '\0'))
+    {
+        fsm_state_transition(fsm, &tokeniser_state_csv_quoted_field);
+    }
+}
+
+static void tokeniser_state_csv_field_start_regular_char_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* At the start of a field, which is where each record starts 
+     * and where each delimiter leaves off. A delimiter or the end of 
+     * the record ends an empty field. A '\"' starts a quoted field, 
+     * and anything else an unquoted one. 
+     */
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    if (token_start(fsm, event->current_char))
+    {
+        fsm_state_transition(fsm, &tokeniser_state_csv_unquoted_field);
+    }
+}
+
+static void tokeniser_state_csv_field_start_transition(fsm_event_handlers_st * const event_handlers)
+{
+    default_event_handlers_set(event_handlers);
+
+    event_handlers->nul = tokeniser_state_csv_field_start_nul_handler;
+    event_handlers->delimiter = tokeniser_state_csv_field_start_delimiter_handler;
+    event_handlers->double_quote = tokeniser_state_csv_field_start_quote_handler;
+    event_handlers->regular_char = tokeniser_state_csv_field_start_regular_char_handler;
+}
+
+static void tokeniser_state_csv_unquoted_field_nul_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In an unquoted field, which runs to the next delimiter or the 
+     * end of the record. A '\"' within it is an ordinary character. 
+     */
+    UNUSED(event_fsm);
+
+    tokeniser_csv_record_end(fsm, '\0');
+}
+
+static void tokeniser_state_csv_unquoted_field_delimiter_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In an unquoted field, which runs to the next delimiter or the 
+     * end of the record. A '\"' within it is an ordinary character. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    got_token(tokeniser, tokeniser->char_count, '\0');
+    fsm_state_transition(fsm, &tokeniser_state_csv_field_start);
+}
+
+static void tokeniser_state_csv_unquoted_field_other_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In an unquoted field, which runs to the next delimiter or the 
+     * end of the record. A '\"' within it is an ordinary character. 
+     */
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    token_char_append(fsm, event->current_char);
+}
+
+static void tokeniser_state_csv_unquoted_field_transition(fsm_event_handlers_st * const event_handlers)
+{
+    default_event_handlers_set(event_handlers);
+
+    event_handlers->nul = tokeniser_state_csv_unquoted_field_nul_handler;
+    event_handlers->delimiter = tokeniser_state_csv_unquoted_field_delimiter_handler;
+    event_handlers->double_quote = tokeniser_state_csv_unquoted_field_other_handler;
+    event_handlers->regular_char = tokeniser_state_csv_unquoted_field_other_handler;
+}
+
+static void tokeniser_state_csv_quoted_field_nul_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In a quoted field. Everything up to the next '\"' is part of 
+     * the field, including delimiters and line breaks. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    if (tokeniser->continuation)
+    {
+        tokeniser_quote_continuation(fsm);
+    }
+    else
+    {
+        got_token(tokeniser, tokeniser->char_count, '\0');
+        tokeniser_result_set(tokeniser, tokeniser_result_incomplete_token);
+        fsm_state_transition(fsm, &tokeniser_state_done);
+    }
+}
+
+static void tokeniser_state_csv_quoted_field_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In a quoted field. Everything up to the next '\"' is part of 
+     * the field, including delimiters and line breaks. 
+     */
+    UNUSED(event_fsm);
+
+    fsm_state_transition(fsm, &tokeniser_state_csv_quoted_field_quote);
+}
+
+static void tokeniser_state_csv_quoted_field_other_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* In a quoted field. Everything up to the next '\"' is part of 
+     * the field, including delimiters and line breaks. 
+     */
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    token_char_append(fsm, event->current_char);
+}
+
+static void tokeniser_state_csv_quoted_field_transition(fsm_event_handlers_st * const event_handlers)
+{
+    default_event_handlers_set(event_handlers);
+
+    event_handlers->nul = tokeniser_state_csv_quoted_field_nul_handler;
+    event_handlers->delimiter = tokeniser_state_csv_quoted_field_other_handler;
+    event_handlers->double_quote = tokeniser_state_csv_quoted_field_quote_handler;
+    event_handlers->regular_char = tokeniser_state_csv_quoted_field_other_handler;
+}
+
+static void tokeniser_state_csv_quoted_field_quote_nul_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* Just after a '\"' in a quoted field. Another '\"' makes the 
+     * pair an escaped '\"'. Otherwise the field's quotes have closed. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    tokeniser_csv_record_end(fsm, tokeniser->expected_close_quote);
+}
+
+static void tokeniser_state_csv_quoted_field_quote_delimiter_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* Just after a '\"' in a quoted field. Another '\"' makes the 
+     * pair an escaped '\"'. Otherwise the field's quotes have closed. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    UNUSED(event_fsm);
+
+    got_token(tokeniser, tokeniser->char_count, tokeniser->expected_close_quote);
+    fsm_state_transition(fsm, &tokeniser_state_csv_field_start);
+}
+
+static void tokeniser_state_csv_quoted_field_quote_quote_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* Just after a '\"' in a quoted field. Another '\"' makes the 
+     * pair an escaped '\"'. Otherwise the field's quotes have closed. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    /* The state is only held past the closing quote for a '\r', 
+     * which wasn't a line ending after all, so this '\"' is just 
+     * more text after the field. 
+     */
+    if (token_char_append(fsm, event->current_char))
+    {
+        if (tokeniser->previous_char == '\r')
+        {
+            fsm_state_transition(fsm, &tokeniser_state_csv_unquoted_field);
+        }
+        else
+        {
+            fsm_state_transition(fsm, &tokeniser_state_csv_quoted_field);
+        }
+    }
+}
+
+static void tokeniser_state_csv_quoted_field_quote_regular_char_handler(fsm_class * const fsm, fsm_event const * const event_fsm)
+{
+    /* Just after a '\"' in a quoted field. Another '\"' makes the 
+     * pair an escaped '\"'. Otherwise the field's quotes have closed. 
+     * Text after the closing quote isn't valid CSV, but is kept as 
+     * part of the field rather than lost. 
+     */
+    tokeniser_event_st * const event = FSM_EVENT_TO_TOKENISER_EVENT(event_fsm);
+
+    /* A '\r' may be the start of a CRLF line ending, which 
+     * tokeniser_csv_record_end() drops. 
+     */
+    if (token_char_append(fsm, event->current_char) && event->current_char != '\r')
+    {
+        fsm_state_transition(fsm, &tokeniser_state_csv_unquoted_field);
+    }
+}
+
+static void tokeniser_state_csv_quoted_field_quote_transition(fsm_event_handlers_st * const event_handlers)
+{
+    default_event_handlers_set(event_handlers);
+
+    event_handlers->nul = tokeniser_state_csv_quoted_field_quote_nul_handler;
+    event_handlers->delimiter = tokeniser_state_csv_quoted_field_quote_delimiter_handler;
+    event_handlers->double_quote = tokeniser_state_csv_quoted_field_quote_quote_handler;
+    event_handlers->regular_char = tokeniser_state_csv_quoted_field_quote_regular_char_handler;
+}
+
+static bool variable_name_start_char(char const ch)
+{
+    return isalpha((unsigned char)ch) || ch == '_';
+}
+
+static bool variable_name_char(char const ch)
+{
+    return isalnum((unsigned char)ch) || ch == '_';
+}
+
+static char const * variable_lookup(tokeniser_st * const tokeniser)
+{
+    /* Look the collected name up, through a small direct mapped 
+     * cache as the same few names tend to be used over and over. 
+     */
+    uint64_t const hash = hash_bytes(tokeniser->variable_name, tokeniser->variable_name_length);
+    variable_cache_entry_st * const entry = &tokeniser->variable_cache[hash & (VARIABLE_CACHE_SIZE - 1)];
+
+    if (!entry->valid
+        || entry->hash != hash
+        || entry->name_length != tokeniser->variable_name_length
+        || memcmp(entry->name, tokeniser->variable_name, tokeniser->variable_name_length) != 0)
+    {
+        entry->valid = true;
+        entry->hash = hash;
+        entry->name_length = tokeniser->variable_name_length;
+        memcpy(entry->name, tokeniser->variable_name, tokeniser->variable_name_length + 1);
+        entry->value = tokeniser->variable_lookup(tokeniser->variable_name, tokeniser->variable_lookup_arg);
+    }
+
+    return entry->value;
+}
+
+static void variable_expand(fsm_class * const fsm)
+{
+    /* The reference is complete. Add the variable's value to the 
+     * token in its place. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    char const * value;
+    size_t length;
+    size_t index;
+
+    tokeniser->variable_state = variable_none;
+    if (tokeniser->current_token_discarded && tokeniser->current_token_has_text)
+    {
+        goto done;
+    }
+
+    /* Even a discarded token is looked up until it has some text, 
+     * to know whether it is dropped rather than counted. 
+     */
+    tokeniser->variable_name[tokeniser->variable_name_length] = '\0';
+    value = variable_lookup(tokeniser);
+    if (value == NULL || value[0] == '\0')
+    {
+        goto done;
+    }
+
+    tokeniser->current_token_has_text = true;
+    if (tokeniser->current_token_discarded)
+    {
+        goto done;
+    }
+
+    length = strlen(value);
+    if (tokeniser->limits.max_token_bytes == 0 && length != 0)
+    {
+        if (!current_token_append_run(tokeniser, value, length))
+        {
+            tokeniser_abandon_line(fsm, tokeniser_result_error);
+            goto done;
+        }
+        tokeniser->last_append_offset = tokeniser->char_count;
+        goto done;
+    }
+    for (index = 0; index < length; index++)
+    {
+        if (!token_char_append(fsm, value[index]))
+        {
+            break;
+        }
+    }
+
+done:
+    return;
+}
+
+static bool variable_literal(fsm_class * const fsm)
+{
+    /* What looked like the start of a reference isn't one, so keep 
+     * the characters collected as they are. Returns false if the 
+     * line has been abandoned. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    bool carry_on;
+    size_t index;
+
+    carry_on = token_char_append(fsm, '$');
+    if (carry_on && tokeniser->variable_state == variable_braced_name)
+    {
+        carry_on = token_char_append(fsm, '{');
+    }
+    for (index = 0; carry_on && index < tokeniser->variable_name_length; index++)
+    {
+        carry_on = token_char_append(fsm, tokeniser->variable_name[index]);
+    }
+    tokeniser->variable_state = variable_none;
+
+    return carry_on;
+}
+
+static bool variable_start(fsm_class * const fsm)
+{
+    /* A '$' where variables are expanded starts a reference, and 
+     * outside a token it starts a regular token too. Returns false 
+     * if the '$' is to be handled as an ordinary character. 
+     */
+    tokeniser_st * const tokeniser = FSM_TO_TOKENISER(fsm);
+    fsm_state_config const * const state = (Fsm_current_state(fsm))->config;
+    bool started;
+
+    if (state == &tokeniser_state_no_token)
+    {
+        current_token_init(tokeniser);
+        if (!token_begin(fsm))
+        {
+            /* The line has been abandoned, and the '$' with it. */
+            started = true;
+            goto done;
+        }
+        fsm_state_transition(fsm, &tokeniser_state_regular_token);
+    }
+    else if (state != &tokeniser_state_regular_token
+             && state != &tokeniser_state_double_quoted_token
+             && state != &tokeniser_state_double_quoted_regular_token)
+    {
+        started = false;
+        goto done;
+    }
+
+    tokeniser->variable_state = variable_dollar;
+    tokeniser->variable_name_length = 0;
+    started = true;
+
+done:
+    return started;
+}
+
+static bool variable_restart(fsm_class * const fsm, char const next_char)
+{
+    /* The character that ended a reference, or showed it wasn't 
+     * one, may start another, as in $A$B. Returns true if it did. 
+     */
+    return next_char == '$' && variable_start(fsm);
+}
+
+bool tokeniser_variable_feed(tokeniser_st * const tokeniser, char const next_char)
+{
+    /* Called with each character before it is dispatched when 
+     * variables are being expanded, to collect the names of 
+     * references. The character that ends a $NAME reference is 
+     * then dispatched as usual once the value has been added. 
+     * Returns: true if the character has been dealt with, so isn't 
+     * to be dispatched. 
+     */
+    fsm_class * const fsm = TOKENISER_TO_FSM(tokeniser);
+    bool taken;
+
+    switch (tokeniser->variable_state)
+    {
+        case variable_none:
+            taken = (next_char == '$' && variable_start(fsm));
+            break;
+
+        case variable_dollar:
+            if (next_char == '{')
+            {
+                tokeniser->variable_state = variable_braced_name;
+                taken = true;
+            }
+            else if (variable_name_start_char(next_char))
+            {
+                tokeniser->variable_state = variable_name;
+                tokeniser->variable_name[0] = next_char;
+                tokeniser->variable_name_length = 1;
+                taken = true;
+            }
+            else
+            {
+                variable_literal(fsm);
+                taken = variable_restart(fsm, next_char);
+            }
+            break;
+
+        case variable_name:
+            if (!variable_name_char(next_char))
+            {
+                variable_expand(fsm);
+                taken = variable_restart(fsm, next_char);
+            }
+            else if (tokeniser->variable_name_length == TOKENISER_VARIABLE_NAME_MAX)
+            {
+                variable_literal(fsm);
+                taken = variable_restart(fsm, next_char);
+            }
+            else
+            {
+                tokeniser->variable_name[tokeniser->variable_name_length] = next_char;
+                tokeniser->variable_name_length++;
+                taken = true;
+            }
+            break;
+
+        case variable_braced_name:
+            if (next_char == '}' && tokeniser->variable_name_length != 0)
+            {
+                variable_expand(fsm);
+                taken = true;
+            }
+            else if (tokeniser->variable_name_length < TOKENISER_VARIABLE_NAME_MAX
+                     && (tokeniser->variable_name_length == 0 ? variable_name_start_char(next_char) : variable_name_char(next_char)))
+            {
+                tokeniser->variable_name[tokeniser->variable_name_length] = next_char;
+                tokeniser->variable_name_length++;
+                taken = true;
+            }
+            else
+            {
+                variable_literal(fsm);
+                taken = variable_restart(fsm, next_char);
+            }
+            break;
+
+        default:
+            taken = false;
+            break;
+    }
+
+    return taken;
+}
+
+static size_t stop_run_length(char const * const chars, size_t const length, char const stop_char)
+{
+    /* Returns: The number of characters before the first stop_char, 
+     * '\n' or NUL. 
+     */
+    size_t index = 0;
+
+#if defined(__SSE2__)
+    __m128i const stops = _mm_set1_epi8(stop_char);
+    __m128i const newlines = _mm_set1_epi8('\n');
+
+    for (; index + 16 <= length; index += 16)
+    {
+        __m128i const block = _mm_loadu_si128((__m128i const *)(chars + index));
+        __m128i const matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, stops), _mm_cmpeq_epi8(block, newlines)),
+                                             _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+        unsigned int const mask = (unsigned int)_mm_movemask_epi8(matches);
+
+        if (mask != 0)
+        {
+            index += (size_t)__builtin_ctz(mask);
+            goto done;
+        }
+    }
+#endif
+
+    for (; index < length; index++)
+    {
+        if (chars[index] == stop_char || chars[index] == '\n' || chars[index] == '\0')
+        {
+            break;
+        }
+    }
+
+#if defined(__SSE2__)
+done:
+#endif
+    return index;
+}
+
+static bool char_is_space(char const ch)
+{
+    /* The characters isspace() accepts in the C locale. */
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+static size_t regular_run_length(char const * const chars, size_t const length, char const stop_char)
+{
+    /* Returns: The number of characters before the first space, 
+     * quote, NUL or stop_char. 
+     */
+    size_t index = 0;
+
+#if defined(__SSE2__)
+    for (; index + 16 <= length; index += 16)
+    {
+        __m128i const block = _mm_loadu_si128((__m128i const *)(chars + index));
+        __m128i const controls = _mm_sub_epi8(block, _mm_set1_epi8('\t')); /* '\t' to '\r' become 0 to 4. */
+        __m128i const is_control_space = _mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8('\r' - '\t')), controls);
+        __m128i const quotes = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\"')));
+        __m128i const others = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_setzero_si128())),
+                                            _mm_cmpeq_epi8(block, _mm_set1_epi8(stop_char)));
+        unsigned int const mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(is_control_space, quotes), others));
+
+        if (mask != 0)
+        {
+            index += (size_t)__builtin_ctz(mask);
+            goto done;
+        }
+    }
+#endif
+
+    for (; index < length; index++)
+    {
+        char const ch = chars[index];
+
+        if (char_is_space(ch) || ch == '\'' || ch == '\"' || ch == '\0' || ch == stop_char)
+        {
+            break;
+        }
+    }
+
+#if defined(__SSE2__)
+done:
+#endif
+    return index;
+}
+
+static size_t space_run_length(char const * const chars, size_t const length)
+{
+    /* Returns: The number of spaces, other than '\n', at the start of 
+     * chars. 
+     */
+    size_t index;
+
+    for (index = 0; index < length && chars[index] != '\n' && char_is_space(chars[index]); index++)
+    {
+    }
+
+    return index;
+}
+
+size_t tokeniser_run_feed(tokeniser_st * const tokeniser, char const * const chars, size_t const length)
+{
+    /* Within a token, every character up to the next one that could 
+     * end it, or end a quoted section of it, is simply added to the 
+     * token. Between tokens, spaces are simply skipped. Find the run 
+     * of them at once and add them together, as feeding them one at 
+     * a time would. The run isn't taken when something needs to see 
+     * each character. 
+     * Returns: The number of characters fed, which may be 0. 
+     */
+    fsm_class * const fsm = TOKENISER_TO_FSM(tokeniser);
+    fsm_state_config const * const state = (Fsm_current_state(fsm))->config;
+    size_t run = 0;
+    bool appending = true;
+
+    if (tokeniser->flight_recorder != NULL
+        || tokeniser->limits.max_token_bytes != 0
+        || tokeniser->limits.max_line_bytes != 0)
+    {
+        goto done;
+    }
+    if (tokeniser->line_csv_delimiter != '\0')
+    {
+        if (state == &tokeniser_state_csv_unquoted_field)
+        {
+            run = stop_run_length(chars, length, tokeniser->line_csv_delimiter);
+        }
+        else if (state == &tokeniser_state_csv_quoted_field)
+        {
+            run = stop_run_length(chars, length, '\"');
+        }
+    }
+    else if (tokeniser->variable_lookup == NULL)
+    {
+        if (state == &tokeniser_state_regular_token)
+        {
+            /* An '=' may split the token, so is fed on its own. */
+            run = regular_run_length(chars, length, tokeniser->key_values ? '=' : '\0');
+        }
+        else if (state == &tokeniser_state_single_quoted_token || state == &tokeniser_state_single_quoted_regular_token)
+        {
+            run = stop_run_length(chars, length, '\'');
+        }
+        else if (state == &tokeniser_state_double_quoted_token || state == &tokeniser_state_double_quoted_regular_token)
+        {
+            run = stop_run_length(chars, length, '\"');
+        }
+        else if (state == &tokeniser_state_no_token)
+        {
+            run = space_run_length(chars, length);
+            appending = false;
+        }
+    }
+    if (run == 0)
+    {
+        goto done;
+    }
+
+    if (appending && !tokeniser->current_token_discarded)
+    {
+        if (!current_token_append_run(tokeniser, chars, run))
+        {
+            /* Let the characters be fed one at a time, which reports 
+             * the error. 
+             */
+            run = 0;
+            goto done;
+        }
+        tokeniser->last_append_offset = tokeniser->char_count + run - 1;
+    }
+    tokeniser->previous_char = chars[run - 1];
+    tokeniser->char_count += run;
+
+done:
+    return run;
+}
+
+unsigned int tokeniser_state_id_get(fsm_state_config const * const state)
+{
+    return (state != NULL) ? state->id : tokeniser_state_id_count;
+}
+
+char const * tokeniser_state_name_get(unsigned int const id)
+{
+    char const * name;
+
+    if (id >= tokeniser_state_id_count)
+    {
+        name = "unknown";
+    }
+    else
+    {
+        name = tokeniser_states[id]->name;
+    }
+
+    return name;
+}
+
 void tokeniser_dispatch(tokeniser_st * const tokeniser, tokeniser_event_st const * const tokeniser_event)
 {
     fsm_class * const fsm = TOKENISER_TO_FSM(tokeniser);
     fsm_event const * const event_fsm = TOKENISER_EVENT_TO_FSM_EVENT(tokeniser_event);
 
-    STATE_PRINTF("%s code %d %c\n", __FUNCTION__, tokeniser_event->code, tokeniser_event->current_char);
+    if (tokeniser->flight_recorder != NULL)
+    {
+        flight_recorder_record(tokeniser->flight_recorder,
+                               tokeniser_state_id_get((Fsm_current_state(fsm))->config),
+                               tokeniser_event->code,
+                               tokeniser->char_count,
+                               tokeniser_event->current_char);
+    }
 
     switch (tokeniser_event->code)
     {
@@ -529,6 +1549,45 @@ void tokeniser_dispatch(tokeniser_st * const tokeniser, tokeniser_event_st const
         case event_regular_char:
             Fsm_dispatch(fsm, regular_char, event_fsm);
             break;
+        case event_delimiter:
+            Fsm_dispatch(fsm, delimiter, event_fsm);
+            break;
+    }
+}
+
+void tokeniser_line_limit_exceeded(tokeniser_st * const tokeniser)
+{
+    /* The line is too long. When truncating, end the line here as 
+     * if a NUL had been received. 
+     */
+    fsm_class * const fsm = TOKENISER_TO_FSM(tokeniser);
+    tokeniser_event_st event;
+
+    if (tokeniser_limit_exceeded(fsm))
+    {
+        event.code = event_nul;
+        event.current_char = '\0';
+        tokeniser_dispatch(tokeniser, &event);
+    }
+}
+
+void tokeniser_projection_update(tokeniser_st * const tokeniser)
+{
+    /* Called after each character when projecting. End the line 
+     * early once none of the rest of it is wanted, and pass on the 
+     * deferred last token when the line ends. 
+     */
+    fsm_class * const fsm = TOKENISER_TO_FSM(tokeniser);
+    bool const nothing_wanted = (tokeniser->projection_count == 0 && !tokeniser->projection_last);
+
+    if (tokeniser->result == tokeniser_result_continue && (tokeniser->projection_done || nothing_wanted))
+    {
+        tokeniser_abandon_line(fsm, tokeniser_result_ok);
+    }
+    else if (tokeniser->last_token_pending
+             && (tokeniser->result == tokeniser_result_ok || tokeniser->result == tokeniser_result_incomplete_token))
+    {
+        last_token_deliver(tokeniser);
     }
 }
 
@@ -541,5 +1600,6 @@ void tokeniser_init_fsm(tokeniser_st * const tokeniser)
     fsm_state_transition(fsm, &tokeniser_state_init);
 
     event.code = event_init;
+    event.current_char = '\0';
     tokeniser_dispatch(tokeniser, &event);
 }
@@ -2,8 +2,15 @@
 #define __TOKENISER_STATES_H__
 
 #include "tokeniser_private.h"
+#include "flight_recorder.h"
 
 void tokeniser_dispatch(tokeniser_st * const tokeniser, tokeniser_event_st const * const tokeniser_event);
 void tokeniser_init_fsm(tokeniser_st * const tokeniser); 
+void tokeniser_line_limit_exceeded(tokeniser_st * const tokeniser);
+void tokeniser_projection_update(tokeniser_st * const tokeniser);
+bool tokeniser_variable_feed(tokeniser_st * const tokeniser, char const next_char);
+size_t tokeniser_run_feed(tokeniser_st * const tokeniser, char const * const chars, size_t const length);
+unsigned int tokeniser_state_id_get(fsm_state_config const * const state);
+char const * tokeniser_state_name_get(unsigned int const id);
 
 #endif /* __TOKENISER_STATES_H__ */
@@ -0,0 +1,574 @@
+#include "tokeniser_structural.h"
+#include "tokeniser_table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <wmmintrin.h>
+#define HAVE_CLMUL /* Carry-less multiply can be used if the CPU has it. */
+#endif
+
+#define BLOCK_SIZE 64
+#define ALL_BITS (~(uint64_t)0)
+#define TOKENS_INITIAL_SIZE 64
+#define TEXT_INITIAL_SIZE 256
+
+#define TOKEN_STARTS_WITH_QUOTE 0x01 /* A quoted token. Its own quotes are stripped from its ends. */
+#define TOKEN_HAS_INNER_QUOTES 0x02 /* A regular token with quotes to be stripped from within it. */
+
+typedef enum open_quote_t
+{
+    open_quote_none,
+    open_quote_single,
+    open_quote_double
+} open_quote_t;
+
+typedef enum token_state_t
+{
+    token_state_none, /* Between tokens. */
+    token_state_quoted, /* In a quoted token. */
+    token_state_regular, /* In a regular token, possibly inside quotes. */
+    token_state_after_quoted /* Just after the closing quote of a quoted token. */
+} token_state_t;
+
+typedef struct structural_token_st
+{
+    size_t start_index;
+    size_t end_index;
+    char quote_char;
+    uint8_t flags;
+} structural_token_st;
+
+struct tokeniser_structural_st
+{
+    uint8_t char_classes[256]; /* The table_class_t of each character. */
+    bool c_locale_spaces; /* The spaces are those of the C locale, so whole blocks can be classified with SIMD. */
+    bool clmul; /* The CPU has carry-less multiply, for prefix_xor(). */
+    char const * buffer;
+    structural_token_st * tokens;
+    size_t token_count;
+    size_t token_array_size;
+    char * text; /* The token most recently materialised. */
+    size_t text_size;
+};
+
+typedef struct block_masks_st
+{
+    uint64_t space;
+    uint64_t single_quote;
+    uint64_t double_quote;
+    uint64_t nul;
+} block_masks_st;
+
+/* What stage one carries from one block to the next. Each
+ * previous_ mask holds a single bit, for the last character of
+ * the previous block, in bit 0.
+ */
+typedef struct scan_st
+{
+    open_quote_t open_quote;
+    uint64_t previous_space; /* A space outside quotes. */
+    uint64_t previous_inside; /* Inside quotes. */
+    uint64_t previous_close; /* A closing quote. */
+    token_state_t token_state;
+} scan_st;
+
+static inline unsigned int lowest_bit_index(uint64_t const mask)
+{
+    return (unsigned int)__builtin_ctzll(mask);
+}
+
+#if defined(HAVE_CLMUL)
+__attribute__((target("pclmul,sse2"))) static uint64_t prefix_xor_clmul(uint64_t const mask)
+{
+    /* Multiplying by all ones without carries XORs each bit into
+     * every bit above it.
+     */
+    __m128i const product = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)mask), _mm_set1_epi8((char)0xFF), 0);
+
+    return (uint64_t)_mm_cvtsi128_si64(product);
+}
+#endif
+
+static inline uint64_t prefix_xor(uint64_t const mask, bool const clmul)
+{
+    /* Each bit becomes the XOR of itself and every bit below it,
+     * so runs between pairs of quotes are set. The carry-less
+     * multiply is chosen at run time, so the build needn't target
+     * a CPU that has it.
+     */
+    uint64_t result = mask;
+
+#if defined(HAVE_CLMUL)
+    if (clmul)
+    {
+        result = prefix_xor_clmul(mask);
+    }
+    else
+#else
+    (void)clmul;
+#endif
+    {
+        result ^= result << 1;
+        result ^= result << 2;
+        result ^= result << 4;
+        result ^= result << 8;
+        result ^= result << 16;
+        result ^= result << 32;
+    }
+
+    return result;
+}
+
+#if defined(__SSE2__)
+static inline void block_masks_16_get(char const * const block, unsigned int const shift, block_masks_st * const masks)
+{
+    __m128i const chars = _mm_loadu_si128((__m128i const *)block);
+    __m128i const controls = _mm_sub_epi8(chars, _mm_set1_epi8('\t')); /* '\t' to '\r' become 0 to 4. */
+    __m128i const is_control_space = _mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8('\r' - '\t')), controls);
+    __m128i const is_space = _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')), is_control_space);
+
+    masks->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_space) << shift;
+    masks->single_quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\''))) << shift;
+    masks->double_quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\"'))) << shift;
+    masks->nul |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_setzero_si128())) << shift;
+}
+#endif
+
+static void block_masks_get(tokeniser_structural_st const * const structural,
+                            char const * const block,
+                            size_t const block_length,
+                            block_masks_st * const masks)
+{
+    uint64_t space = 0;
+    uint64_t single_quote = 0;
+    uint64_t double_quote = 0;
+    uint64_t nul = 0;
+    size_t index;
+
+#if defined(__SSE2__)
+    if (structural->c_locale_spaces)
+    {
+        char padded_block[BLOCK_SIZE];
+        char const * whole_block = block;
+
+        if (block_length < BLOCK_SIZE)
+        {
+            /* Pad the last block with spaces, which are ignored past
+             * the end of the record.
+             */
+            memcpy(padded_block, block, block_length);
+            memset(padded_block + block_length, ' ', BLOCK_SIZE - block_length);
+            whole_block = padded_block;
+        }
+        memset(masks, 0, sizeof *masks);
+        block_masks_16_get(whole_block, 0, masks);
+        block_masks_16_get(whole_block + 16, 16, masks);
+        block_masks_16_get(whole_block + 32, 32, masks);
+        block_masks_16_get(whole_block + 48, 48, masks);
+        goto done;
+    }
+#endif
+
+    for (index = 0; index < block_length; index++)
+    {
+        uint8_t const char_class = structural->char_classes[(unsigned char)block[index]];
+
+        space |= (uint64_t)(char_class == table_class_space) << index;
+        single_quote |= (uint64_t)(char_class == table_class_single_quote) << index;
+        double_quote |= (uint64_t)(char_class == table_class_double_quote) << index;
+        nul |= (uint64_t)(char_class == table_class_nul) << index;
+    }
+
+    masks->space = space;
+    masks->single_quote = single_quote;
+    masks->double_quote = double_quote;
+    masks->nul = nul;
+
+#if defined(__SSE2__)
+done:
+#endif
+    return;
+}
+
+static uint64_t inside_quotes_walk(uint64_t const single_quotes, uint64_t const double_quotes, open_quote_t * const open_quote)
+{
+    /* With both kinds of quote in the block, a quote of one kind
+     * may be inside a quote of the other, so visit each quote in
+     * turn.
+     */
+    uint64_t quotes = single_quotes | double_quotes;
+    uint64_t inside = 0;
+    unsigned int open_bit = 0;
+    open_quote_t state = *open_quote;
+
+    while (quotes != 0)
+    {
+        unsigned int const bit = lowest_bit_index(quotes);
+        open_quote_t const quote = ((single_quotes >> bit) & 1) ? open_quote_single : open_quote_double;
+
+        quotes &= quotes - 1;
+        if (state == open_quote_none)
+        {
+            state = quote;
+            open_bit = bit;
+        }
+        else if (state == quote)
+        {
+            inside |= (((uint64_t)1 << bit) - 1) & ~(((uint64_t)1 << open_bit) - 1);
+            state = open_quote_none;
+        }
+    }
+    if (state != open_quote_none)
+    {
+        inside |= ALL_BITS << open_bit;
+    }
+
+    *open_quote = state;
+
+    return inside;
+}
+
+static uint64_t inside_quotes_get(uint64_t const single_quotes, uint64_t const double_quotes, bool const clmul, open_quote_t * const open_quote)
+{
+    /* Returns a mask of the characters inside quotes, including
+     * opening quotes but not closing ones.
+     */
+    uint64_t inside;
+
+    if ((single_quotes | double_quotes) == 0)
+    {
+        inside = (*open_quote != open_quote_none) ? ALL_BITS : 0;
+    }
+    else if (double_quotes == 0 && *open_quote != open_quote_double)
+    {
+        inside = prefix_xor(single_quotes, clmul) ^ ((*open_quote == open_quote_single) ? ALL_BITS : 0);
+        *open_quote = (inside >> 63) ? open_quote_single : open_quote_none;
+    }
+    else if (single_quotes == 0 && *open_quote != open_quote_single)
+    {
+        inside = prefix_xor(double_quotes, clmul) ^ ((*open_quote == open_quote_double) ? ALL_BITS : 0);
+        *open_quote = (inside >> 63) ? open_quote_double : open_quote_none;
+    }
+    else
+    {
+        inside = inside_quotes_walk(single_quotes, double_quotes, open_quote);
+    }
+
+    return inside;
+}
+
+static structural_token_st * token_add(tokeniser_structural_st * const structural, size_t const start_index, uint8_t const flags)
+{
+    structural_token_st * token = NULL;
+
+    if (structural->token_count == structural->token_array_size)
+    {
+        size_t const new_size = (structural->token_array_size == 0) ? TOKENS_INITIAL_SIZE : structural->token_array_size * 2;
+        structural_token_st * const new_tokens = realloc(structural->tokens, new_size * sizeof *new_tokens);
+
+        if (new_tokens == NULL)
+        {
+            goto done;
+        }
+        structural->tokens = new_tokens;
+        structural->token_array_size = new_size;
+    }
+
+    token = &structural->tokens[structural->token_count];
+    structural->token_count++;
+    token->start_index = start_index;
+    token->end_index = start_index;
+    token->quote_char = '\0';
+    token->flags = flags;
+
+done:
+    return token;
+}
+
+static void token_end(tokeniser_structural_st * const structural, size_t const end_index, char const quote_char)
+{
+    structural_token_st * const token = &structural->tokens[structural->token_count - 1];
+
+    token->end_index = end_index;
+    token->quote_char = quote_char;
+}
+
+static bool block_scan(tokeniser_structural_st * const structural,
+                       scan_st * const scan,
+                       size_t const block_start,
+                       uint64_t const valid,
+                       block_masks_st const * const masks)
+{
+    /* Find the token boundaries in a block from its masks. Only the
+     * characters where something happens are visited.
+     */
+    uint64_t const inside = inside_quotes_get(masks->single_quote, masks->double_quote, structural->clmul, &scan->open_quote);
+    uint64_t const inside_before = (inside << 1) | scan->previous_inside;
+    uint64_t const openers = inside & ~inside_before & valid;
+    uint64_t const closers = ~inside & inside_before & valid;
+    uint64_t const space = masks->space & ~inside & valid;
+    uint64_t const space_before = (space << 1) | scan->previous_space;
+    uint64_t const word_starts = ~space & space_before & valid;
+    uint64_t const word_ends = space & ~space_before;
+    uint64_t const after_closers = ((closers << 1) | scan->previous_close) & ~space & ~openers & valid;
+    uint64_t events = word_starts | word_ends | openers | closers | after_closers;
+    bool ok = true;
+
+    while (events != 0)
+    {
+        unsigned int const bit = lowest_bit_index(events);
+        uint64_t const mask = (uint64_t)1 << bit;
+        size_t const index = block_start + bit;
+
+        events &= events - 1;
+
+        if ((word_ends & mask) != 0)
+        {
+            if (scan->token_state == token_state_regular)
+            {
+                token_end(structural, index, '\0');
+            }
+            scan->token_state = token_state_none;
+        }
+        else if ((openers & mask) != 0)
+        {
+            if (scan->token_state == token_state_regular)
+            {
+                structural->tokens[structural->token_count - 1].flags |= TOKEN_HAS_INNER_QUOTES;
+            }
+            else
+            {
+                ok = token_add(structural, index, TOKEN_STARTS_WITH_QUOTE) != NULL;
+                scan->token_state = token_state_quoted;
+            }
+        }
+        else if ((closers & mask) != 0)
+        {
+            if (scan->token_state == token_state_quoted)
+            {
+                token_end(structural, index + 1, structural->buffer[index]);
+                scan->token_state = token_state_after_quoted;
+            }
+        }
+        else if ((word_starts & mask) != 0 || scan->token_state == token_state_after_quoted)
+        {
+            /* A regular token, either at the start of a word or straight
+             * after a quoted token.
+             */
+            ok = token_add(structural, index, 0) != NULL;
+            scan->token_state = token_state_regular;
+        }
+
+        if (!ok)
+        {
+            goto done;
+        }
+    }
+
+    scan->previous_space = (space >> 63) & 1;
+    scan->previous_inside = (inside >> 63) & 1;
+    scan->previous_close = (closers >> 63) & 1;
+
+done:
+    return ok;
+}
+
+static tokeniser_result_t record_end(tokeniser_structural_st * const structural, scan_st const * const scan, size_t const end_index)
+{
+    /* The end of the record acts as a NUL. */
+    tokeniser_result_t result;
+
+    switch (scan->token_state)
+    {
+        case token_state_quoted:
+            token_end(structural, end_index, '\0');
+            result = tokeniser_result_incomplete_token;
+            break;
+        case token_state_regular:
+            token_end(structural, end_index, '\0');
+            result = (scan->open_quote != open_quote_none) ? tokeniser_result_incomplete_token : tokeniser_result_ok;
+            break;
+        default:
+            result = tokeniser_result_ok;
+            break;
+    }
+
+    return result;
+}
+
+tokeniser_structural_st * tokeniser_structural_alloc(void)
+{
+    tokeniser_structural_st * const structural = calloc(1, sizeof *structural);
+    unsigned int ch;
+
+    if (structural == NULL)
+    {
+        goto done;
+    }
+
+#if defined(HAVE_CLMUL)
+    structural->clmul = __builtin_cpu_supports("pclmul");
+#endif
+    structural->c_locale_spaces = true;
+    for (ch = 0; ch < sizeof structural->char_classes; ch++)
+    {
+        bool const c_locale_space = ch == ' ' || (ch >= '\t' && ch <= '\r');
+
+        structural->char_classes[ch] = (uint8_t)tokeniser_table_class_get((char)ch);
+        if ((structural->char_classes[ch] == table_class_space) != c_locale_space)
+        {
+            structural->c_locale_spaces = false;
+        }
+    }
+
+done:
+    return structural;
+}
+
+void tokeniser_structural_free(tokeniser_structural_st * const structural)
+{
+    if (structural == NULL)
+    {
+        goto done;
+    }
+
+    free(structural->tokens);
+    free(structural->text);
+    free(structural);
+
+done:
+    return;
+}
+
+tokeniser_result_t tokeniser_structural_index(tokeniser_structural_st * const structural,
+                                              char const * const buffer,
+                                              size_t const length)
+{
+    scan_st scan = { open_quote_none, 1, 0, 0, token_state_none };
+    tokeniser_result_t result;
+    size_t end_index = length;
+    size_t block_start;
+
+    structural->buffer = buffer;
+    structural->token_count = 0;
+
+    for (block_start = 0; block_start < end_index; block_start += BLOCK_SIZE)
+    {
+        size_t const block_length = (end_index - block_start < BLOCK_SIZE) ? end_index - block_start : BLOCK_SIZE;
+        uint64_t valid = (block_length == BLOCK_SIZE) ? ALL_BITS : ((uint64_t)1 << block_length) - 1;
+        block_masks_st masks;
+
+        block_masks_get(structural, buffer + block_start, block_length, &masks);
+        if (masks.nul != 0)
+        {
+            /* The record ends at the first NUL. */
+            unsigned int const nul_bit = lowest_bit_index(masks.nul);
+
+            end_index = block_start + nul_bit;
+            valid &= ((uint64_t)1 << nul_bit) - 1;
+            masks.space &= valid;
+            masks.single_quote &= valid;
+            masks.double_quote &= valid;
+        }
+
+        if (!block_scan(structural, &scan, block_start, valid, &masks))
+        {
+            result = tokeniser_result_error;
+            goto done;
+        }
+    }
+
+    result = record_end(structural, &scan, end_index);
+
+done:
+    return result;
+}
+
+size_t tokeniser_structural_token_count(tokeniser_structural_st const * const structural)
+{
+    return structural->token_count;
+}
+
+bool tokeniser_structural_token_span(tokeniser_structural_st const * const structural,
+                                     size_t const token,
+                                     size_t * const start_index,
+                                     size_t * const end_index)
+{
+    bool found;
+
+    if (token >= structural->token_count)
+    {
+        found = false;
+        goto done;
+    }
+
+    *start_index = structural->tokens[token].start_index;
+    *end_index = structural->tokens[token].end_index;
+    found = true;
+
+done:
+    return found;
+}
+
+char tokeniser_structural_token_quote_char(tokeniser_structural_st const * const structural, size_t const token)
+{
+    return (token < structural->token_count) ? structural->tokens[token].quote_char : '\0';
+}
+
+char const * tokeniser_structural_token_get(tokeniser_structural_st * const structural, size_t const token)
+{
+    structural_token_st const * token_info;
+    char const * text = NULL;
+    size_t from;
+    size_t to;
+
+    if (token >= structural->token_count)
+    {
+        goto done;
+    }
+    token_info = &structural->tokens[token];
+
+    from = token_info->start_index;
+    to = token_info->end_index;
+    if ((token_info->flags & TOKEN_STARTS_WITH_QUOTE) != 0)
+    {
+        from++;
+        if (token_info->quote_char != '\0')
+        {
+            to--;
+        }
+    }
+
+    if (to - from + 1 > structural->text_size)
+    {
+        size_t const new_size = (to - from + 1 > TEXT_INITIAL_SIZE) ? to - from + 1 : TEXT_INITIAL_SIZE;
+        char * const new_text = realloc(structural->text, new_size);
+
+        if (new_text == NULL)
+        {
+            goto done;
+        }
+        structural->text = new_text;
+        structural->text_size = new_size;
+    }
+
+    if ((token_info->flags & TOKEN_HAS_INNER_QUOTES) != 0)
+    {
+        tokeniser_table_quotes_strip(structural->buffer + from, to - from, structural->text);
+    }
+    else
+    {
+        memcpy(structural->text, structural->buffer + from, to - from);
+        structural->text[to - from] = '\0';
+    }
+    text = structural->text;
+
+done:
+    return text;
+}
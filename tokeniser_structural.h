@@ -0,0 +1,62 @@
+#ifndef __TOKENISER_STRUCTURAL_H__
+#define __TOKENISER_STRUCTURAL_H__
+
+#include "tokeniser.h"
+
+#include <stddef.h>
+
+/* A two stage tokeniser for a single record held in memory.
+ * Stage one scans the record 64 bytes at a time, building bit
+ * masks of the spaces, quotes and NULs in each block, and from
+ * them finds where every token starts and ends. Stage two
+ * copies out the text of a token, with its quotes stripped, only
+ * when it is asked for.
+ * The tokens, their offsets and quote characters, and the result
+ * are the same as feeding the record to tokeniser_feed()
+ * followed by a '\0'.
+ */
+typedef struct tokeniser_structural_st tokeniser_structural_st;
+
+tokeniser_structural_st * tokeniser_structural_alloc(void);
+
+void tokeniser_structural_free(tokeniser_structural_st * const structural);
+
+/*
+ * Stage one: find the tokens in a record. The record must stay
+ * unchanged until the tokens have been finished with.
+ * @buffer: The record. It needn't be NUL terminated. If it holds
+ * a NUL, the record ends there.
+ * @length: The number of characters in the record.
+ * Return value: tokeniser_result_ok, tokeniser_result_incomplete_token,
+ * or tokeniser_result_error if out of memory.
+ */
+tokeniser_result_t tokeniser_structural_index(tokeniser_structural_st * const structural,
+                                              char const * const buffer,
+                                              size_t const length);
+
+size_t tokeniser_structural_token_count(tokeniser_structural_st const * const structural);
+
+/*
+ * Get the start and end offsets of a token, as passed to
+ * new_token_cb.
+ * Returns: false if token is out of range.
+ */
+bool tokeniser_structural_token_span(tokeniser_structural_st const * const structural,
+                                     size_t const token,
+                                     size_t * const start_index,
+                                     size_t * const end_index);
+
+/*
+ * Returns: The quote character passed to new_token_cb for the
+ * token ('\0' if it wasn't quoted).
+ */
+char tokeniser_structural_token_quote_char(tokeniser_structural_st const * const structural, size_t const token);
+
+/*
+ * Stage two: get the text of a token.
+ * Returns: The NUL terminated token, which is valid until the
+ * next call, or NULL if token is out of range or out of memory.
+ */
+char const * tokeniser_structural_token_get(tokeniser_structural_st * const structural, size_t const token);
+
+#endif /* __TOKENISER_STRUCTURAL_H__ */
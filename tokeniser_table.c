@@ -0,0 +1,38 @@
+#include "tokeniser_table.h"
+
+#define ENTRY(state, action) { table_state_##state, table_action_##action }
+
+table_entry_st const tokeniser_table[table_state_count][table_class_count] =
+{
+    /*                                         nul                                    space                                           single quote                                    double quote                                    regular char */
+    [table_state_no_token] =                 { ENTRY(done, end_line),              ENTRY(no_token, none),                          ENTRY(single_quoted_token, start_quoted),       ENTRY(double_quoted_token, start_quoted),       ENTRY(regular_token, start) },
+    [table_state_regular_token] =            { ENTRY(done, end_line_token),        ENTRY(no_token, end),                           ENTRY(single_quoted_regular_token, none),       ENTRY(double_quoted_regular_token, none),       ENTRY(regular_token, append) },
+    [table_state_single_quoted_token] =      { ENTRY(done, incomplete),            ENTRY(single_quoted_token, append),             ENTRY(no_token, end_quoted),                    ENTRY(single_quoted_token, append),             ENTRY(single_quoted_token, append) },
+    [table_state_double_quoted_token] =      { ENTRY(done, incomplete),            ENTRY(double_quoted_token, append),             ENTRY(double_quoted_token, append),             ENTRY(no_token, end_quoted),                    ENTRY(double_quoted_token, append) },
+    [table_state_single_quoted_regular_token] = { ENTRY(done, incomplete),         ENTRY(single_quoted_regular_token, append),     ENTRY(regular_token, none),                     ENTRY(single_quoted_regular_token, append),     ENTRY(single_quoted_regular_token, append) },
+    [table_state_double_quoted_regular_token] = { ENTRY(done, incomplete),         ENTRY(double_quoted_regular_token, append),     ENTRY(double_quoted_regular_token, append),     ENTRY(regular_token, none),                     ENTRY(double_quoted_regular_token, append) },
+    [table_state_done] =                     { ENTRY(done, none),                  ENTRY(done, none),                              ENTRY(done, none),                              ENTRY(done, none),                              ENTRY(done, none) }
+};
+
+size_t tokeniser_table_quotes_strip(char const * const token, size_t const length, char * const text)
+{
+    char open_quote = '\0';
+    size_t text_length = 0;
+    size_t index;
+
+    for (index = 0; index < length; index++)
+    {
+        char const ch = token[index];
+
+        if ((ch == '\'' || ch == '\"') && (open_quote == '\0' || open_quote == ch))
+        {
+            open_quote = (open_quote == '\0') ? ch : '\0';
+            continue;
+        }
+        text[text_length] = ch;
+        text_length++;
+    }
+    text[text_length] = '\0';
+
+    return text_length;
+}
@@ -0,0 +1,103 @@
+#ifndef __TOKENISER_TABLE_H__
+#define __TOKENISER_TABLE_H__
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A compact, table driven form of the tokeniser FSM in
+ * tokeniser_states.c. It has no per-character dispatch through
+ * handler pointers and keeps no token state of its own, so it
+ * suits the engines that scan large buffers themselves. The two
+ * must be kept in step: for the same input they must find the
+ * same tokens, at the same offsets, with the same result.
+ */
+
+typedef enum table_state_t
+{
+    table_state_no_token,
+    table_state_regular_token,
+    table_state_single_quoted_token,
+    table_state_double_quoted_token,
+    table_state_single_quoted_regular_token,
+    table_state_double_quoted_regular_token,
+    table_state_done,
+    table_state_count
+} table_state_t;
+
+typedef enum table_class_t
+{
+    table_class_nul,
+    table_class_space,
+    table_class_single_quote,
+    table_class_double_quote,
+    table_class_regular_char,
+    table_class_count
+} table_class_t;
+
+typedef enum table_action_t
+{
+    table_action_none, /* The character isn't part of any token. */
+    table_action_start, /* Start a token with this character. */
+    table_action_start_quoted, /* Start a quoted token. The quote isn't part of it. */
+    table_action_append, /* Add the character to the current token. */
+    table_action_end, /* The token ends before this character. */
+    table_action_end_quoted, /* The token ends after this character, which is its closing quote. */
+    table_action_end_line, /* The line is complete (tokeniser_result_ok). */
+    table_action_end_line_token, /* The token ends before this character, and so does the line. */
+    table_action_incomplete /* The line ends inside a quote (tokeniser_result_incomplete_token). */
+} table_action_t;
+
+typedef struct table_entry_st
+{
+    uint8_t next_state; /* table_state_t */
+    uint8_t action; /* table_action_t */
+} table_entry_st;
+
+extern table_entry_st const tokeniser_table[table_state_count][table_class_count];
+
+static inline table_class_t tokeniser_table_class_get(char const ch)
+{
+    table_class_t char_class;
+
+    /* Matches tokeniser_event_from_char_get(). */
+    if (ch == '\0')
+    {
+        char_class = table_class_nul;
+    }
+    else if (isspace((int)ch))
+    {
+        char_class = table_class_space;
+    }
+    else if (ch == '\'')
+    {
+        char_class = table_class_single_quote;
+    }
+    else if (ch == '\"')
+    {
+        char_class = table_class_double_quote;
+    }
+    else
+    {
+        char_class = table_class_regular_char;
+    }
+
+    return char_class;
+}
+
+/* True for the states in which a token is being built. */
+static inline int tokeniser_table_state_in_token(table_state_t const state)
+{
+    return state != table_state_no_token && state != table_state_done;
+}
+
+/*
+ * Copy the text of a regular token that has quotes within it,
+ * stripping the quotes as the quoted regular token states do.
+ * @text: Where to copy the text. There must be room for length
+ * characters plus a NUL.
+ * Returns: The length of the stripped text.
+ */
+size_t tokeniser_table_quotes_strip(char const * const token, size_t const length, char * const text);
+
+#endif /* __TOKENISER_TABLE_H__ */
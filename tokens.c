@@ -4,10 +4,15 @@
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 typedef struct token_st token_st;
 struct token_st
 {
     char * token;
+    size_t size; /* The allocated size of token, kept for reuse once the tokens are cleared. */
 };
 
 struct tokens_st
@@ -16,13 +21,16 @@ struct tokens_st
     char const * current_token;
     size_t count;
     size_t token_array_size;
-    token_st * token_array;
+    token_st * token_array; /* Used when the tokens aren't interned. */
+    token_dictionary_st * dictionary; /* Non-NULL when the tokens are interned. */
+    uint32_t * token_ids; /* Used when the tokens are interned. */
 };
 
+#define TOKENS_INITIAL_ARRAY_SIZE 8
+
 static bool tokens_ensure_space_for_new_token(tokens_st * const tokens)
 {
     bool has_space;
-    token_st * new_token_array;
     size_t new_token_array_size;
 
     if (tokens->count < tokens->token_array_size)
@@ -30,17 +38,32 @@ static bool tokens_ensure_space_for_new_token(tokens_st * const tokens)
         has_space = true;
         goto done;
     }
-    /* Make space for another token. */
-    new_token_array_size = tokens->token_array_size + 1;
-    new_token_array = calloc(new_token_array_size, sizeof *new_token_array);
-    if (new_token_array == NULL)
+    /* Double the space so adding a token is amortised constant time. */
+    new_token_array_size = (tokens->token_array_size == 0) ? TOKENS_INITIAL_ARRAY_SIZE : tokens->token_array_size * 2;
+    if (tokens->dictionary != NULL)
     {
-        has_space = false;
-        goto done;
+        uint32_t * const new_token_ids = realloc(tokens->token_ids, new_token_array_size * sizeof *new_token_ids);
+
+        if (new_token_ids == NULL)
+        {
+            has_space = false;
+            goto done;
+        }
+        tokens->token_ids = new_token_ids;
+    }
+    else
+    {
+        token_st * const new_token_array = calloc(new_token_array_size, sizeof *new_token_array);
+
+        if (new_token_array == NULL)
+        {
+            has_space = false;
+            goto done;
+        }
+        memcpy(new_token_array, tokens->token_array, tokens->token_array_size * sizeof *new_token_array);
+        free(tokens->token_array);
+        tokens->token_array = new_token_array;
     }
-    memcpy(new_token_array, tokens->token_array, tokens->token_array_size * sizeof *new_token_array);
-    free(tokens->token_array);
-    tokens->token_array = new_token_array;
     tokens->token_array_size = new_token_array_size;
     has_space = true;
 
@@ -55,6 +78,27 @@ tokens_st * tokens_alloc(void)
     return tokens;
 }
 
+tokens_st * tokens_alloc_interned(token_dictionary_st * const dictionary)
+{
+    tokens_st * tokens;
+
+    if (dictionary == NULL)
+    {
+        tokens = NULL;
+        goto done;
+    }
+
+    tokens = tokens_alloc();
+    if (tokens == NULL)
+    {
+        goto done;
+    }
+    tokens->dictionary = dictionary;
+
+done:
+    return tokens;
+}
+
 void tokens_free(tokens_st * const tokens)
 {
     if (tokens != NULL)
@@ -63,12 +107,13 @@ void tokens_free(tokens_st * const tokens)
         {
             size_t index;
 
-            for (index = 0; index < tokens->count; index++)
+            for (index = 0; index < tokens->token_array_size; index++)
             {
                 free(tokens->token_array[index].token);
             }
             free(tokens->token_array);
         }
+        free(tokens->token_ids);
         free(tokens);
     }
 }
@@ -83,11 +128,35 @@ bool tokens_add_token(tokens_st * const tokens, char const * const token)
         goto done;
     }
 
-    tokens->token_array[tokens->count].token = strdup(token);
-    if (tokens->token_array[tokens->count].token == NULL)
+    if (tokens->dictionary != NULL)
     {
-        token_added = false;
-        goto done;
+        uint32_t const id = token_dictionary_intern(tokens->dictionary, token);
+
+        if (id == TOKEN_ID_INVALID)
+        {
+            token_added = false;
+            goto done;
+        }
+        tokens->token_ids[tokens->count] = id;
+    }
+    else
+    {
+        token_st * const slot = &tokens->token_array[tokens->count];
+        size_t const size = strlen(token) + 1;
+
+        if (slot->size < size)
+        {
+            char * const new_token = realloc(slot->token, size);
+
+            if (new_token == NULL)
+            {
+                token_added = false;
+                goto done;
+            }
+            slot->token = new_token;
+            slot->size = size;
+        }
+        memcpy(slot->token, token, size);
     }
 
     tokens->count++;
@@ -97,6 +166,17 @@ done:
     return token_added;
 }
 
+void tokens_clear(tokens_st * const tokens)
+{
+    /* The token array, and the space for each token, are kept for 
+     * the next tokens added. 
+     */
+    if (tokens != NULL)
+    {
+        tokens->count = 0;
+    }
+}
+
 size_t tokens_count(tokens_st const * const tokens)
 {
     size_t count;
@@ -128,10 +208,281 @@ char const * tokens_get_token(tokens_st const * const tokens, size_t const index
         goto done;
     }
 
-    token = tokens->token_array[index].token;
+    if (tokens->dictionary != NULL)
+    {
+        token = token_dictionary_get(tokens->dictionary, tokens->token_ids[index]);
+    }
+    else
+    {
+        token = tokens->token_array[index].token;
+    }
 
 done:
     return token;
 }
 
+uint32_t tokens_get_token_id(tokens_st const * const tokens, size_t const index)
+{
+    uint32_t id;
+
+    if (tokens == NULL || tokens->dictionary == NULL)
+    {
+        id = TOKEN_ID_INVALID;
+        goto done;
+    }
+    if (index >= tokens->count)
+    {
+        id = TOKEN_ID_INVALID;
+        goto done;
+    }
+
+    id = tokens->token_ids[index];
+
+done:
+    return id;
+}
+
+size_t tokens_memory_used(tokens_st const * const tokens)
+{
+    size_t memory_used;
+    size_t index;
+
+    if (tokens == NULL)
+    {
+        memory_used = 0;
+        goto done;
+    }
+
+    memory_used = sizeof *tokens;
+    if (tokens->dictionary != NULL)
+    {
+        memory_used += tokens->token_array_size * sizeof *tokens->token_ids;
+        goto done;
+    }
+
+    memory_used += tokens->token_array_size * sizeof *tokens->token_array;
+    for (index = 0; index < tokens->token_array_size; index++)
+    {
+        memory_used += tokens->token_array[index].size;
+    }
+
+done:
+    return memory_used;
+}
+
+
+typedef struct token_chars_st
+{
+    bool space;
+    bool single_quote;
+    bool double_quote;
+} token_chars_st;
+
+static bool char_is_space(char const ch)
+{
+    /* The same characters the tokeniser splits tokens on. */
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+static void token_chars_scan(char const * const token, size_t const length, token_chars_st * const chars)
+{
+    /* Find which of the characters that have to be quoted are in 
+     * token. 
+     */
+    size_t index = 0;
+
+    chars->space = false;
+    chars->single_quote = false;
+    chars->double_quote = false;
+
+#if defined(__SSE2__)
+    if (length >= 16)
+    {
+        __m128i spaces = _mm_setzero_si128();
+        __m128i single_quotes = _mm_setzero_si128();
+        __m128i double_quotes = _mm_setzero_si128();
+
+        for (; index + 16 <= length; index += 16)
+        {
+            __m128i const block = _mm_loadu_si128((__m128i const *)(token + index));
+            __m128i const controls = _mm_sub_epi8(block, _mm_set1_epi8('\t')); /* '\t' to '\r' become 0 to 4. */
+            __m128i const is_control_space = _mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8('\r' - '\t')), controls);
+
+            spaces = _mm_or_si128(spaces, _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), is_control_space));
+            single_quotes = _mm_or_si128(single_quotes, _mm_cmpeq_epi8(block, _mm_set1_epi8('\'')));
+            double_quotes = _mm_or_si128(double_quotes, _mm_cmpeq_epi8(block, _mm_set1_epi8('\"')));
+        }
+        chars->space = _mm_movemask_epi8(spaces) != 0;
+        chars->single_quote = _mm_movemask_epi8(single_quotes) != 0;
+        chars->double_quote = _mm_movemask_epi8(double_quotes) != 0;
+    }
+#endif
+    for (; index < length; index++)
+    {
+        char const ch = token[index];
+
+        chars->space |= char_is_space(ch);
+        chars->single_quote |= (ch == '\'');
+        chars->double_quote |= (ch == '\"');
+    }
+}
+
+static size_t quoted_copy(char * const line, char const quote, char const * const chars, size_t const length)
+{
+    /* Returns the number of chars written, or that would be written 
+     * if line is NULL. 
+     */
+    if (line != NULL)
+    {
+        line[0] = quote;
+        memcpy(line + 1, chars, length);
+        line[length + 1] = quote;
+    }
+
+    return length + 2;
+}
+
+static size_t token_quote(char const * const token, char * const line)
+{
+    /* Write token so the tokeniser reads it back unchanged, quoting 
+     * as little as possible. If line is NULL nothing is written. 
+     * Returns the number of chars written, or SIZE_MAX if the token 
+     * can't be written. 
+     */
+    size_t const length = strlen(token);
+    token_chars_st chars;
+    size_t written;
+    size_t index;
+
+    if (length == 0)
+    {
+        written = quoted_copy(line, '\"', token, 0);
+        goto done;
+    }
+
+    token_chars_scan(token, length, &chars);
+    if (!chars.space && !chars.single_quote && !chars.double_quote)
+    {
+        if (line != NULL)
+        {
+            memcpy(line, token, length);
+        }
+        written = length;
+        goto done;
+    }
+    if (!chars.single_quote)
+    {
+        written = quoted_copy(line, '\'', token, length);
+        goto done;
+    }
+    if (!chars.double_quote)
+    {
+        written = quoted_copy(line, '\"', token, length);
+        goto done;
+    }
 
+    /* Both quotes are in the token, so it has to be written in 
+     * pieces, each quoted with the quote it doesn't contain. A token 
+     * that starts with a quote ends at the matching quote, so the 
+     * first piece must be an unquoted character. Only a token that 
+     * wasn't read from a line, e.g. one from a variable, can fail 
+     * this. 
+     */
+    if (char_is_space(token[0]) || token[0] == '\'' || token[0] == '\"')
+    {
+        written = SIZE_MAX;
+        goto done;
+    }
+
+    written = 0;
+    index = 0;
+    while (index < length)
+    {
+        size_t end = index;
+        char quote;
+
+        while (end < length && !char_is_space(token[end]) && token[end] != '\'' && token[end] != '\"')
+        {
+            end++;
+        }
+        if (end > index)
+        {
+            if (line != NULL)
+            {
+                memcpy(line + written, token + index, end - index);
+            }
+            written += end - index;
+            index = end;
+            continue;
+        }
+
+        /* Quote with whichever quote comes second, so the piece 
+         * reaches as far as it can. 
+         */
+        while (end < length && token[end] != '\'' && token[end] != '\"')
+        {
+            end++;
+        }
+        quote = (end < length && token[end] == '\'') ? '\"' : '\'';
+        while (end < length && token[end] != quote)
+        {
+            end++;
+        }
+        written += quoted_copy(line != NULL ? line + written : NULL, quote, token + index, end - index);
+        index = end;
+    }
+
+done:
+    return written;
+}
+
+char * tokens_join_quoted(tokens_st const * const tokens)
+{
+    char * line = NULL;
+    size_t line_length;
+    size_t index;
+    size_t offset;
+
+    if (tokens == NULL)
+    {
+        goto done;
+    }
+
+    /* Size the line first so it's allocated just once. */
+    line_length = 0;
+    for (index = 0; index < tokens->count; index++)
+    {
+        size_t const written = token_quote(tokens_get_token(tokens, index), NULL);
+
+        if (written == SIZE_MAX)
+        {
+            goto done;
+        }
+        line_length += written + 1; /* Followed by a space or the NUL terminator. */
+    }
+    if (line_length == 0)
+    {
+        line_length = 1;
+    }
+
+    line = malloc(line_length);
+    if (line == NULL)
+    {
+        goto done;
+    }
+
+    offset = 0;
+    for (index = 0; index < tokens->count; index++)
+    {
+        if (index > 0)
+        {
+            line[offset] = ' ';
+            offset++;
+        }
+        offset += token_quote(tokens_get_token(tokens, index), line + offset);
+    }
+    line[offset] = '\0';
+
+done:
+    return line;
+}
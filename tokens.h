@@ -7,16 +7,43 @@
  * Nisbet <nisbet@ihug.co.nz>, April 2016.
  */
 
+#include "token_dictionary.h"
+
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct tokens_st tokens_st;
 
 tokens_st * tokens_alloc(void);
+/* Allocate a token list that stores ids from dictionary rather
+ * than its own copy of each token. The dictionary may be shared
+ * by many token lists, and must outlive all of them.
+ */
+tokens_st * tokens_alloc_interned(token_dictionary_st * const dictionary);
 void tokens_free(tokens_st * const tokens);
 bool tokens_add_token(tokens_st * const tokens, char const * const token);
+/* Remove all the tokens, keeping the memory that held them so the
+ * list can be refilled without allocating.
+ */
+void tokens_clear(tokens_st * const tokens);
 size_t tokens_count(tokens_st const * const tokens);
 char const * tokens_get_token(tokens_st const * const tokens, size_t const index);
+/* Returns TOKEN_ID_INVALID if the tokens aren't interned. */
+uint32_t tokens_get_token_id(tokens_st const * const tokens, size_t const index);
+/* Returns the number of bytes allocated to hold the tokens,
+ * excluding any shared dictionary.
+ */
+size_t tokens_memory_used(tokens_st const * const tokens);
+/* Join the tokens into a line, separated by single spaces, that 
+ * the tokeniser splits back into the same tokens. Each token is 
+ * quoted only if it has to be, with whichever quote it doesn't 
+ * contain, and empty tokens are written as "". The caller frees 
+ * the line. Returns NULL if out of memory, or if a token starts 
+ * with a space or quote and contains both quotes, which no line 
+ * can produce. 
+ */
+char * tokens_join_quoted(tokens_st const * const tokens);
 
 
 #endif /* __TOKENS_H__ */